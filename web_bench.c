@@ -0,0 +1,344 @@
+#define _DEFAULT_SOURCE // Must match web_server.c, which is compiled as part of this file
+/*
+  web_bench: microbenchmarks for web_server's parsing and mapping helpers
+
+  Compiles web_server.c into itself (its main renamed away), so the static helpers are benchmarked exactly as
+  the server builds them, with the same flags. Each case runs for a fixed time and reports nanoseconds per
+  operation and heap allocations per operation (calls to malloc, calloc, realloc, strdup and realpath(.., NULL)
+  made by web_server.c). Inputs cover the common case and adversarial ones: long percent-encoded paths, deep
+  directory trees, traversal attempts and header-heavy requests.
+
+  Build:  cc -std=c11 -Wall -Wextra -O2 -pthread -o web_bench web_bench.c
+          (web_server.c must be next to it; build both with the same flags when comparing changes)
+
+  Usage:
+    web_bench [-t <ms_per_case>] [-j] [<filter>]
+      -t   Measuring time per case in milliseconds (default 300)
+      -j   Print one JSON object per case instead of a table
+      filter  Only run cases whose name contains this string
+*/
+
+#include <stdlib.h> // Declare the allocators before web_server.c's calls to them are redirected below
+#include <string.h> // Declare strdup likewise
+
+static unsigned long long bench_allocs; // Allocations made by web_server.c code since the counter was reset
+
+static void *bench_malloc(size_t n)     // Defines a counting malloc
+{                                       // Start of bench_malloc function body
+  bench_allocs++;                       // Count the allocation
+  return malloc(n);                     // and make it
+} // End of bench_malloc function body
+
+static void *bench_calloc(size_t n, size_t sz) // Defines a counting calloc
+{                                              // Start of bench_calloc function body
+  bench_allocs++;                              // Count the allocation
+  return calloc(n, sz);                        // and make it
+} // End of bench_calloc function body
+
+static void *bench_realloc(void *p, size_t n) // Defines a counting realloc
+{                                             // Start of bench_realloc function body
+  bench_allocs++;                             // Count the (re)allocation
+  return realloc(p, n);                       // and make it
+} // End of bench_realloc function body
+
+static char *bench_strdup(const char *s) // Defines a counting strdup
+{                                        // Start of bench_strdup function body
+  bench_allocs++;                        // Count the allocation
+  return strdup(s);                      // and make it
+} // End of bench_strdup function body
+
+static char *bench_realpath(const char *p, char *resolved) // Defines a counting realpath
+{                                                          // Start of bench_realpath function body
+  if (!resolved)                                           // realpath(p, NULL) returns a malloc'ed buffer
+    bench_allocs++;                                        // which is an allocation
+  return realpath(p, resolved);                            // Resolve the path
+} // End of bench_realpath function body
+
+#define malloc(n) bench_malloc(n)             // Route web_server.c's allocations
+#define calloc(n, sz) bench_calloc(n, sz)     // through the counting
+#define realloc(p, n) bench_realloc(p, n)     // wrappers above
+#define strdup(s) bench_strdup(s)             // (the bench's own code
+#define realpath(p, r) bench_realpath(p, r)   // comes after the #undefs)
+#define main web_server_main                  // Keep the server's entry point out of the way
+#undef _DEFAULT_SOURCE                        // (already in effect; web_server.c defines it again)
+#include "web_server.c"                       // The code under test
+#undef main                                   // Restore the names
+#undef malloc                                 // for the
+#undef calloc                                 // benchmark
+#undef realloc                                // code
+#undef strdup                                 // that
+#undef realpath                               // follows
+
+#define BENCH_MAX_DEPTH 32 // Depth of the deep directory tree in the scratch docroot
+
+typedef struct           // Defines one benchmark case
+{                        // Start of bench_case_t structure definition
+  const char *name;      // Case name (filterable)
+  void (*run)(int arg);  // One operation
+  int arg;               // Input selector passed to run
+} bench_case_t;          // End of bench_case_t structure definition
+
+static server_config_t bench_cfg;           // Configuration whose docroot is the scratch tree
+static char bench_root[PATH_MAX];           // Scratch docroot
+static char long_encoded[RECV_BUF_SIZE];    // Long percent-encoded path (every byte encoded)
+static char mixed_path[RECV_BUF_SIZE];      // Long path mixing plain, encoded and '+' characters
+static char deep_path[PATH_MAX];            // URL of a file at the bottom of the deep tree
+static char escape_plain[4096];             // Directory-listing-sized name without special characters
+static char escape_heavy[4096];             // The same size, every character needing an entity
+static char header_heavy[RECV_BUF_SIZE];    // A request filling the header buffer with many headers
+static int sock_pair[2] = {-1, -1};         // Loopback socket pair for read_http_request
+static volatile size_t bench_sink;          // Consumes results so the compiler cannot drop the work
+
+static const char small_request[] =        // A typical browser request
+  "GET /images/logo.png HTTP/1.1\r\n"
+  "Host: localhost:8080\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+  "Accept: image/avif,image/webp,image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5\r\n"
+  "Accept-Language: en-US,en;q=0.5\r\n"
+  "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+  "Referer: http://localhost:8080/index.html\r\n"
+  "If-None-Match: \"5e1a-19f2c3a40d8\"\r\n"
+  "If-Modified-Since: Sat, 17 Oct 2026 10:00:00 GMT\r\n"
+  "Connection: keep-alive\r\n\r\n";
+
+/* Nanoseconds on the monotonic clock */
+static long long bench_now(void)                                   // Defines a function to read the monotonic clock
+{                                                                  // Start of bench_now function body
+  struct timespec ts;                                              // Declare a timespec structure
+  clock_gettime(CLOCK_MONOTONIC, &ts);                             // Read the clock
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;         // Convert it to nanoseconds
+} // End of bench_now function body
+
+/* url_decode on a fresh copy of the selected input (the copy is part of the cost, as in map_url_to_fs) */
+static void run_url_decode(int arg)                                                         // Defines the url_decode case
+{                                                                                           // Start of run_url_decode function body
+  const char *in = arg == 0 ? "/images/photo%20of%20the%20day.jpg" : arg == 1 ? mixed_path : long_encoded; // Pick the input
+  char buf[RECV_BUF_SIZE];                                                                  // Declare a working buffer
+  strcpy(buf, in);                                                                          // url_decode works in place
+  bench_sink += (size_t)url_decode(buf) + (unsigned char)buf[0];                            // Decode it
+} // End of run_url_decode function body
+
+/* html_escape of a directory entry name */
+static void run_html_escape(int arg)                                                      // Defines the html_escape case
+{                                                                                         // Start of run_html_escape function body
+  const char *in = arg == 0 ? "holiday-photos-2026.jpg" : arg == 1 ? escape_plain : escape_heavy; // Pick the input
+  char *out = html_escape(in);                                                            // Escape it
+  bench_sink += out ? (unsigned char)out[0] : 0;                                          // Use the result
+  free(out);                                                                              // Release it
+} // End of run_html_escape function body
+
+/* guess_mime_type for a common, a late-matching and an unknown extension */
+static void run_mime(int arg)                                                                        // Defines the guess_mime_type case
+{                                                                                                    // Start of run_mime function body
+  const char *in = arg == 0 ? "/var/www/index.html" : arg == 1 ? "/var/www/video/intro.MP4" : "/var/www/archive.tar.zst"; // Pick the input
+  char mime[MAX_MIME_LEN];                                                                           // Declare the output
+  guess_mime_type(in, mime);                                                                         // Classify it
+  bench_sink += (unsigned char)mime[0];                                                              // Use the result
+} // End of run_mime function body
+
+/* strtrim of a header value with surrounding whitespace */
+static void run_strtrim(int arg)                                                       // Defines the strtrim case
+{                                                                                      // Start of run_strtrim function body
+  char buf[SMALL_BUF];                                                                 // Declare a working buffer
+  if (arg == 0)                                                                        // Typical header value
+    strcpy(buf, " gzip, deflate, br");                                                 // with one leading space
+  else                                                                                 // Adversarial value
+  {                                                                                    // Start of else block
+    memset(buf, ' ', sizeof(buf) - 2);                                                 // almost entirely whitespace
+    buf[sizeof(buf) / 2] = 'x';                                                        // around one character
+    buf[sizeof(buf) - 2] = '\0';                                                       // Terminate it
+  } // End of else block
+  bench_sink += (unsigned char)*strtrim(buf);                                          // Trim it
+} // End of run_strtrim function body
+
+/* map_url_to_fs on an existing file, the deep tree, a long encoded miss and a traversal attempt */
+static void run_map(int arg)                                                                       // Defines the map_url_to_fs case
+{                                                                                                  // Start of run_map function body
+  const char *in = arg == 0 ? "/index.html" : arg == 1 ? deep_path : arg == 2 ? long_encoded : "/../../../../etc/passwd"; // Pick the input
+  char out[PATH_MAX];                                                                              // Declare the output
+  bench_sink += (size_t)(map_url_to_fs(&bench_cfg, in, out, sizeof(out)) + 4);                     // Map it
+} // End of run_map function body
+
+/* read_http_request of a typical and a header-heavy request over a socket pair (includes the recv) */
+static void run_read_request(int arg)                                                  // Defines the read_http_request case
+{                                                                                      // Start of run_read_request function body
+  const char *req = arg == 0 ? small_request : header_heavy;                           // Pick the request
+  char method[16], path[PATH_MAX], version[16];                                        // Declare the outputs (sized as in handle_client)
+  request_headers_t hdrs;                                                              // Declare the captured headers
+  if (write_all(sock_pair[0], req, strlen(req)) != 0)                                  // Send the request
+    exit(1);                                                                           // (cannot fail on a healthy socket pair)
+  bench_sink += (size_t)(read_http_request(sock_pair[1], method, sizeof(method), path, sizeof(path), version, sizeof(version), &hdrs) + 1); // Parse it
+} // End of run_read_request function body
+
+/* Create a file, including any missing parent directories. Returns 0 on success */
+static int bench_touch(const char *path, const char *content)              // Defines a function to create a scratch file
+{                                                                          // Start of bench_touch function body
+  FILE *f = fopen(path, "w");                                              // Create the file
+  if (!f)                                                                  // If that fails
+    return -1;                                                             // report it
+  fputs(content, f);                                                       // Write its content
+  fclose(f);                                                               // Close it
+  return 0;                                                                // Return 0 to indicate success
+} // End of bench_touch function body
+
+/* Build the scratch docroot and the generated inputs. Returns 0 on success */
+static int bench_setup(void)                                                                        // Defines a function to prepare the inputs
+{                                                                                                   // Start of bench_setup function body
+  const char *tmp = getenv("TMPDIR");                                                               // Honor TMPDIR
+  if ((size_t)snprintf(bench_root, sizeof(bench_root), "%s/web_bench.XXXXXX", tmp && *tmp ? tmp : "/tmp") >= sizeof(bench_root)) // Scratch docroot template
+    return errno = ENAMETOOLONG, -1;                                                                // (TMPDIR too long)
+  if (!mkdtemp(bench_root))                                                                         // Create it
+    return -1;                                                                                      // or fail
+  char path[PATH_MAX];                                                                              // Declare a path buffer
+  if ((size_t)snprintf(path, sizeof(path), "%s/index.html", bench_root) >= sizeof(path))            // A top-level file
+    return errno = ENAMETOOLONG, -1;                                                                // (its path must fit)
+  if (bench_touch(path, "<html></html>\n") != 0)                                                    // Create it
+    return -1;                                                                                      // or fail
+  size_t len = (size_t)snprintf(path, sizeof(path), "%s", bench_root);                              // The deep tree, one level at a time
+  size_t ulen = 0;                                                                                  // Length of its URL
+  for (int d = 0; d < BENCH_MAX_DEPTH; d++)                                                         // Each level
+  {                                                                                                 // Start of for loop body
+    len += (size_t)snprintf(path + len, sizeof(path) - len, "/level %02d & more", d);               // gets a name that needs encoding
+    ulen += (size_t)snprintf(deep_path + ulen, sizeof(deep_path) - ulen, "/level%%20%02d%%20%%26%%20more", d); // in the URL
+    if (len >= sizeof(path) || ulen >= sizeof(deep_path))                                           // If the tree no longer fits
+      return errno = ENAMETOOLONG, -1;                                                              // fail rather than truncate
+    if (mkdir(path, 0755) != 0)                                                                     // Create the level
+      return -1;                                                                                    // or fail
+  } // End of for loop body
+  if ((size_t)snprintf(path + len, sizeof(path) - len, "/leaf.txt") >= sizeof(path) - len ||       // The file at the bottom
+      (size_t)snprintf(deep_path + ulen, sizeof(deep_path) - ulen, "/leaf.txt") >= sizeof(deep_path) - ulen) // and its URL
+    return errno = ENAMETOOLONG, -1;                                                                // must fit too
+  if (bench_touch(path, "leaf\n") != 0)                                                             // Create it
+    return -1;                                                                                      // or fail
+  snprintf(bench_cfg.root, sizeof(bench_cfg.root), "%s", bench_root);                               // Point the configuration
+  if (canonicalize_path(bench_root, bench_cfg.root_real, sizeof(bench_cfg.root_real)) != 0)         // at the scratch docroot
+    return -1;                                                                                      // or fail
+
+  size_t n = 0;                                                                                     // Long fully encoded path
+  long_encoded[n++] = '/';                                                                          // starting with a slash
+  while (n + 3 < 3000)                                                                              // about 1000 encoded bytes (fits PATH_MAX)
+    n += (size_t)snprintf(long_encoded + n, sizeof(long_encoded) - n, "%%%02X", 'a' + (int)(n % 26)); // of letters
+  n = 0;                                                                                            // Long mixed path
+  while (n + 8 < 3000)                                                                              // about the same length
+    n += (size_t)snprintf(mixed_path + n, sizeof(mixed_path) - n, "/dir+%s", n % 3 ? "x%2Fy" : "abc"); // of plain, '+' and encoded parts
+  for (size_t i = 0; i < sizeof(escape_plain) - 1; i++)                                             // Long names:
+  {                                                                                                 // Start of for loop body
+    escape_plain[i] = (char)('a' + i % 26);                                                         // one with nothing to escape
+    escape_heavy[i] = "&<>\""[i % 4];                                                               // one with nothing else
+  } // End of for loop body
+  n = (size_t)snprintf(header_heavy, sizeof(header_heavy), "GET /index.html HTTP/1.1\r\nHost: localhost\r\n"); // Header-heavy request
+  for (int i = 0; n + 200 < sizeof(header_heavy); i++)                                              // fills the receive buffer
+    n += (size_t)snprintf(header_heavy + n, sizeof(header_heavy) - n, "X-Custom-Header-%03d: %s\r\n", i, // with headers the parser
+                          "some-moderately-long-value-that-is-not-interesting-to-the-server"); // must skip
+  snprintf(header_heavy + n, sizeof(header_heavy) - n, "User-Agent: bench\r\n\r\n");                // (one it keeps, last)
+  return socketpair(AF_UNIX, SOCK_STREAM, 0, sock_pair);                                            // Loopback for read_http_request
+} // End of bench_setup function body
+
+/* Remove the scratch docroot */
+static void bench_cleanup(void)                                                          // Defines a function to remove the scratch files
+{                                                                                        // Start of bench_cleanup function body
+  char path[PATH_MAX];                                                                   // Declare a path buffer
+  size_t len = (size_t)snprintf(path, sizeof(path), "%s", bench_root);                   // Rebuild the deep path
+  int levels = 0;                                                                        // Levels that fit (setup made no others)
+  for (; levels < BENCH_MAX_DEPTH && len < sizeof(path); levels++)                       // level by level
+  {                                                                                      // Start of for loop body
+    size_t n = (size_t)snprintf(path + len, sizeof(path) - len, "/level %02d & more", levels); // to the bottom
+    if (n >= sizeof(path) - len)                                                         // If this level does not fit
+      break;                                                                             // it was never created
+    len += n;                                                                            // Step down
+  } // End of for loop body
+  path[len] = '\0';                                                                      // (drop a partial level name)
+  if ((size_t)snprintf(path + len, sizeof(path) - len, "/leaf.txt") < sizeof(path) - len) // Remove the leaf
+    unlink(path);                                                                        // file
+  path[len] = '\0';                                                                      // Back to the deepest level
+  for (int d = levels - 1; d > 0; d--)                                                   // then each level
+  {                                                                                      // Start of for loop body
+    rmdir(path);                                                                         // from the bottom
+    *strrchr(path, '/') = '\0';                                                          // up
+  } // End of for loop body
+  rmdir(path);                                                                           // The last level
+  if ((size_t)snprintf(path, sizeof(path), "%s/index.html", bench_root) < sizeof(path))  // The top-level file
+    unlink(path);                                                                        // goes (setup refused paths that do not fit)
+  rmdir(bench_root);                                                                     // and so does the docroot
+} // End of bench_cleanup function body
+
+static const bench_case_t bench_cases[] = {  // Every case, grouped by helper
+  {"url_decode/short", run_url_decode, 0},
+  {"url_decode/long_mixed", run_url_decode, 1},
+  {"url_decode/long_all_encoded", run_url_decode, 2},
+  {"html_escape/short", run_html_escape, 0},
+  {"html_escape/4k_plain", run_html_escape, 1},
+  {"html_escape/4k_all_special", run_html_escape, 2},
+  {"guess_mime_type/html", run_mime, 0},
+  {"guess_mime_type/mp4_late", run_mime, 1},
+  {"guess_mime_type/unknown", run_mime, 2},
+  {"strtrim/header_value", run_strtrim, 0},
+  {"strtrim/mostly_space", run_strtrim, 1},
+  {"map_url_to_fs/top_file", run_map, 0},
+  {"map_url_to_fs/deep_tree", run_map, 1},
+  {"map_url_to_fs/long_encoded_miss", run_map, 2},
+  {"map_url_to_fs/traversal", run_map, 3},
+  {"read_http_request/browser", run_read_request, 0},
+  {"read_http_request/header_heavy", run_read_request, 1},
+};
+
+int main(int argc, char **argv)                                                              // The main entry point of the program
+{                                                                                            // Start of main function body
+  long long budget_ms = 300;                                                                 // Measuring time per case
+  int json = 0;                                                                              // Output format
+  const char *filter = NULL;                                                                 // Case filter
+  for (int i = 1; i < argc; i++)                                                             // Parse the command line
+  {                                                                                          // Start of for loop body
+    if (!strcmp(argv[i], "-t") && i + 1 < argc)                                              // Time per case
+      budget_ms = atoll(argv[++i]);                                                          // set it
+    else if (!strcmp(argv[i], "-j"))                                                         // JSON output
+      json = 1;                                                                              // enable it
+    else if (argv[i][0] != '-' && !filter)                                                   // Case filter
+      filter = argv[i];                                                                      // set it
+    else                                                                                     // Anything else
+    {                                                                                        // Start of else block
+      fprintf(stderr, "Usage: %s [-t ms_per_case] [-j] [filter]\n", argv[0]);                // print usage
+      return 1;                                                                              // Exit with an error code
+    } // End of else block
+  } // End of for loop body
+  if (budget_ms <= 0 || bench_setup() != 0)                                                  // Prepare the inputs
+  {                                                                                          // Start of if block
+    fprintf(stderr, "web_bench: setup failed: %s\n", strerror(errno));                       // print an error
+    bench_cleanup();                                                                         // remove what was created
+    return 1;                                                                                // Exit with an error code
+  } // End of if block
+  if (!json)                                                                                 // Table heading
+    printf("%-34s %12s %12s %12s\n", "case", "ns/op", "allocs/op", "ops");
+
+  for (size_t c = 0; c < sizeof(bench_cases) / sizeof(bench_cases[0]); c++)                  // Run each case
+  {                                                                                          // Start of for loop body
+    const bench_case_t *bc = &bench_cases[c];                                                // Get the case
+    if (filter && !strstr(bc->name, filter))                                                 // Skip it if filtered out
+      continue;                                                                              // (next case)
+    for (int i = 0; i < 100; i++)                                                            // Warm caches and branch predictors
+      bc->run(bc->arg);                                                                      // before measuring
+    unsigned long long ops = 0, batch = 16;                                                  // Operations so far and per clock read
+    long long deadline = budget_ms * 1000000LL, elapsed = 0;                                 // Measuring window
+    bench_allocs = 0;                                                                        // Count allocations from here
+    long long t0 = bench_now();                                                              // Start the clock
+    while (elapsed < deadline)                                                               // Until the window is used up
+    {                                                                                        // Start of while loop body
+      for (unsigned long long i = 0; i < batch; i++)                                         // run a batch
+        bc->run(bc->arg);                                                                    // of operations
+      ops += batch;                                                                          // Count them
+      elapsed = bench_now() - t0;                                                            // Check the clock
+      if (elapsed < deadline / 100 && batch < (1ULL << 20))                                  // Grow the batch while it is short
+        batch *= 2;                                                                          // so clock reads stay negligible
+    } // End of while loop body
+    double ns = (double)elapsed / (double)ops;                                               // Time per operation
+    double allocs = (double)bench_allocs / (double)ops;                                      // Allocations per operation
+    if (json)                                                                                // One JSON object per case
+      printf("{\"case\":\"%s\",\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f,\"ops\":%llu}\n", bc->name, ns, allocs, ops);
+    else                                                                                     // or a table row
+      printf("%-34s %12.1f %12.3f %12llu\n", bc->name, ns, allocs, ops);
+  } // End of for loop body
+  close(sock_pair[0]);  // Close the socket pair
+  close(sock_pair[1]);  // (both ends)
+  bench_cleanup();      // Remove the scratch docroot
+  return 0;             // Return 0 to indicate success
+} // End of main function body
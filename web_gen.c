@@ -0,0 +1,343 @@
+#define _DEFAULT_SOURCE // Expose non-standard functions like clock_gettime
+/*
+  web_gen: synthetic docroot generator for scaling tests (companion to web_server.c)
+
+  Builds a directory tree of a given depth and fan-out holding any number of files (millions are fine: files
+  are created in directory order and each directory is made once), with sizes drawn from a log-normal or a
+  Zipf-like (Pareto) distribution. A fraction of the file and directory names can be made "tricky": spaces,
+  percent signs, '+', '#', '?', HTML metacharacters, quotes, UTF-8 and very long names, which exercise
+  url_decode, map_url_to_fs and the escaping in send_dir_listing. The generator is deterministic for a seed.
+
+  Optionally writes a URL list of every file, percent-encoded, with Zipf popularity weights, in the
+  "<weight> <path>" format web_load -f reads.
+
+  Build:  cc -std=c11 -Wall -Wextra -O2 -o web_gen web_gen.c -lm
+
+  Usage:
+    web_gen -o <dir> [-n files] [-D depth] [-F fanout] [-s lognormal|zipf|fixed] [-m median] [-S sigma]
+            [-a alpha] [-M max] [-x fraction] [-z] [-r seed] [-u url_file] [-p popularity]
+      -o   Docroot to create (must not exist or be empty)
+      -n   Number of files (default 1000)
+      -D   Directory depth below the docroot (default 2; 0 puts every file in one directory)
+      -F   Subdirectories per directory (default 10)
+      -s   Size distribution (default lognormal)
+      -m   Median size in bytes for lognormal, minimum size for zipf, the size for fixed (default 4096)
+      -S   Sigma of the lognormal distribution (default 1.5)
+      -a   Tail exponent of the zipf distribution (default 1.2; smaller means heavier tail)
+      -M   Largest file size in bytes (default 64 MiB)
+      -x   Fraction of names that are tricky (default 0.05)
+      -z   Create sparse files (sizes without writing data; fast for huge trees)
+      -r   Random seed (default 1)
+      -u   Write a URL list for web_load -f to this file
+      -p   Zipf exponent of the URL popularity weights (default 1.0)
+*/
+
+#include <sys/types.h> // Provides basic system data types
+#include <sys/stat.h>  // Provides mkdir
+#include <fcntl.h>     // Provides open flags
+#include <unistd.h>    // Provides write, ftruncate and close
+#include <dirent.h>    // Provides opendir for the empty-docroot check
+#include <errno.h>     // Provides errno
+#include <stdint.h>    // Provides fixed-width integer types
+#include <stdio.h>     // Provides printf
+#include <stdlib.h>    // Provides strtoull and malloc
+#include <string.h>    // Provides string functions
+#include <math.h>      // Provides exp, log and pow
+#include <time.h>      // Provides clock_gettime
+
+#define GEN_PATH_MAX 4096 // Longest generated path
+#define MAX_DEPTH 32      // Deepest supported tree
+#define WRITE_CHUNK 65536 // Bytes written per write() call
+
+static uint64_t rng_state = 1; // Random state (splitmix64)
+
+/* Next 64 random bits */
+static uint64_t rng_next(void)                               // Defines the random number generator
+{                                                            // Start of rng_next function body
+  uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);         // splitmix64: advance the state
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;               // then mix it
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;               // thoroughly
+  return z ^ (z >> 31);                                      // Return the mixed value
+} // End of rng_next function body
+
+/* Uniform in (0, 1) */
+static double rng_unit(void)                                        // Defines a function for uniform doubles
+{                                                                   // Start of rng_unit function body
+  return ((double)(rng_next() >> 11) + 0.5) / 9007199254740992.0;   // 53 random bits, never 0 or 1
+} // End of rng_unit function body
+
+typedef struct        // Defines the generator settings
+{                     // Start of gen_opts_t structure definition
+  const char *out;    // Docroot to create
+  uint64_t files;     // Number of files
+  int depth, fanout;  // Tree shape
+  int dist;           // 0 = lognormal, 1 = zipf, 2 = fixed
+  double median;      // Median (lognormal), minimum (zipf) or size (fixed)
+  double sigma;       // Lognormal sigma
+  double alpha;       // Zipf tail exponent
+  double max;         // Largest size
+  double tricky;      // Fraction of tricky names
+  int sparse;         // Create sparse files
+  const char *urls;   // URL list output
+  double popularity;  // Zipf exponent of the URL weights
+} gen_opts_t;         // End of gen_opts_t structure definition
+
+/* Draw a file size */
+static uint64_t draw_size(const gen_opts_t *o)                                 // Defines a function to draw a file size
+{                                                                              // Start of draw_size function body
+  double size;                                                                 // Declare the drawn size
+  if (o->dist == 2)                                                            // Fixed
+    size = o->median;                                                          // is always the same
+  else if (o->dist == 1)                                                       // Zipf-like: Pareto with minimum median
+    size = o->median * pow(rng_unit(), -1.0 / o->alpha);                       // (inverse transform of the tail)
+  else                                                                         // Log-normal around the median
+  {                                                                            // Start of else block
+    double z = sqrt(-2.0 * log(rng_unit())) * cos(2.0 * M_PI * rng_unit());   // Standard normal (Box-Muller)
+    size = o->median * exp(o->sigma * z);                                      // scaled and exponentiated
+  } // End of else block
+  return size > o->max ? (uint64_t)o->max : (uint64_t)size;                    // Cap at the maximum
+} // End of draw_size function body
+
+/* Write a name for entry n into out: plain most of the time, tricky for the configured fraction */
+static void make_name(const gen_opts_t *o, char *out, size_t out_sz, const char *prefix, uint64_t n, const char *ext) // Defines a function to name an entry
+{                                                                                                                   // Start of make_name function body
+  static const char *const tricky[] = {                                                      // Templates that need care somewhere
+    "%s %llu with spaces%s",          // spaces ('+' and %20 in URLs)
+    "%s%%25%llu%%2F%s",               // literal percent signs that look like encodings
+    "%s+%llu+plus%s",                 // '+' which url_decode turns into a space
+    "%s#%llu?query%s",                // '#' and '?' that must be encoded to reach the file
+    "%s<%llu>&amp;\"'%s",             // HTML metacharacters for the directory listing
+    "%s-\xc3\xbcnic\xc3\xb8" "de-%llu-\xe6\x97\xa5\xe6\x9c\xac%s", // UTF-8
+    "%s;%llu=semi,comma%s",           // sub-delimiters
+  };
+  size_t ntricky = sizeof(tricky) / sizeof(tricky[0]);                                       // Number of templates
+  if (o->tricky > 0 && rng_unit() < o->tricky)                                               // Tricky name?
+  {                                                                                          // Start of if block
+    uint64_t pick = rng_next() % (ntricky + 1);                                              // One more choice than templates:
+    if (pick == ntricky)                                                                     // the last is a very long name
+    {                                                                                        // Start of if block
+      int len = snprintf(out, out_sz, "%s%llu-", prefix, (unsigned long long)n);             // Unique start
+      for (; len < 200 && (size_t)len + 1 < out_sz; len++)                                   // padded to 200 bytes
+        out[len] = (char)('a' + len % 26);                                                   // with letters
+      snprintf(out + len, out_sz - (size_t)len, "%s", ext);                                  // then the extension
+      return;                                                                                // Done
+    } // End of if block
+    snprintf(out, out_sz, tricky[pick], prefix, (unsigned long long)n, ext);                 // Fill the template
+    return;                                                                                  // Done
+  } // End of if block
+  snprintf(out, out_sz, "%s%07llu%s", prefix, (unsigned long long)n, ext);                   // Plain name
+} // End of make_name function body
+
+/* Append s to out percent-encoded (everything but unreserved characters and '/') */
+static void url_encode_append(char *out, size_t out_sz, const char *s)                      // Defines a function to percent-encode a path
+{                                                                                           // Start of url_encode_append function body
+  size_t n = strlen(out);                                                                   // Append after the existing text
+  for (; *s && n + 4 < out_sz; s++)                                                         // Each byte
+  {                                                                                         // Start of for loop body
+    unsigned char c = (unsigned char)*s;                                                    // as unsigned
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||      // Unreserved
+        c == '-' || c == '_' || c == '.' || c == '~' || c == '/')                           // characters
+      out[n++] = (char)c;                                                                   // are copied
+    else                                                                                    // Everything else
+      n += (size_t)snprintf(out + n, out_sz - n, "%%%02X", c);                              // is encoded
+  } // End of for loop body
+  out[n] = '\0'; // Terminate
+} // End of url_encode_append function body
+
+/* Create a file of the given size. Returns 0 on success */
+static int create_file(const char *path, uint64_t size, int sparse)                          // Defines a function to create one file
+{                                                                                            // Start of create_file function body
+  static char chunk[WRITE_CHUNK];                                                            // Content pattern (text, so gzip has work to do)
+  if (!chunk[0])                                                                             // Fill it once
+    for (size_t i = 0; i < sizeof(chunk); i++)                                               // with lines of
+      chunk[i] = i % 64 == 63 ? '\n' : (char)('a' + (i * 7 + i / 64) % 26);                  // shifting letters
+  int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);                                    // Create the file
+  if (fd < 0)                                                                                // If that fails
+    return -1;                                                                               // report it
+  int rc = 0;                                                                                // Initialize the result
+  if (sparse)                                                                                // Sparse files
+    rc = ftruncate(fd, (off_t)size);                                                         // only get a size
+  else                                                                                       // Others get content
+    for (uint64_t left = size; left > 0 && rc == 0;)                                         // chunk by chunk
+    {                                                                                        // Start of for loop body
+      ssize_t n = write(fd, chunk, left < WRITE_CHUNK ? (size_t)left : WRITE_CHUNK);         // Write the next chunk
+      if (n <= 0)                                                                            // If the write fails
+        rc = -1;                                                                             // stop
+      else                                                                                   // Otherwise
+        left -= (uint64_t)n;                                                                 // count it
+    } // End of for loop body
+  if (close(fd) != 0)                                                                        // Close the file
+    rc = -1;                                                                                 // (errors surface here on some filesystems)
+  return rc;                                                                                 // Return the result
+} // End of create_file function body
+
+/* Make sure the docroot exists and is empty. Returns 0 on success */
+static int prepare_root(const char *dir)                                   // Defines a function to prepare the docroot
+{                                                                          // Start of prepare_root function body
+  if (mkdir(dir, 0755) == 0)                                               // A new directory
+    return 0;                                                              // is fine
+  if (errno != EEXIST)                                                     // If it cannot be created
+    return -1;                                                             // report it
+  DIR *d = opendir(dir);                                                   // An existing one
+  if (!d)                                                                  // must be readable
+    return -1;                                                             // (report it otherwise)
+  struct dirent *e;                                                        // and empty
+  int empty = 1;                                                           // so nothing is overwritten
+  while ((e = readdir(d)) != NULL)                                         // Check every entry
+    if (strcmp(e->d_name, ".") && strcmp(e->d_name, ".."))                 // besides . and ..
+      empty = 0;                                                           // (any other means not empty)
+  closedir(d);                                                             // Close it
+  if (!empty)                                                              // Refuse a non-empty directory
+    errno = ENOTEMPTY;                                                     // with a clear reason
+  return empty ? 0 : -1;                                                   // Return the result
+} // End of prepare_root function body
+
+static double now_sec(void)                                 // Defines a function to read the monotonic clock
+{                                                           // Start of now_sec function body
+  struct timespec ts;                                       // Declare a timespec structure
+  clock_gettime(CLOCK_MONOTONIC, &ts);                      // Read the clock
+  return (double)ts.tv_sec + ts.tv_nsec / 1e9;              // Convert it to seconds
+} // End of now_sec function body
+
+static void print_usage(const char *prog)                                                            // Defines a function to print usage
+{                                                                                                    // Start of print_usage function body
+  fprintf(stderr, "Usage: %s -o <dir> [-n files] [-D depth] [-F fanout] [-s lognormal|zipf|fixed] [-m median]\n"
+                  "       [-S sigma] [-a alpha] [-M max] [-x fraction] [-z] [-r seed] [-u url_file] [-p popularity]\n", prog);
+} // End of print_usage function body
+
+int main(int argc, char **argv)                                                                     // The main entry point of the program
+{                                                                                                   // Start of main function body
+  gen_opts_t o = {NULL, 1000, 2, 10, 0, 4096, 1.5, 1.2, 64.0 * 1024 * 1024, 0.05, 0, NULL, 1.0};   // Defaults
+  for (int i = 1; i < argc; i++)                                                                    // Parse the command line
+  {                                                                                                 // Start of for loop body
+    const char *a = argv[i];                                                                        // The option
+    if (!strcmp(a, "-z"))                                                                           // Sparse files
+    {                                                                                               // Start of if block
+      o.sparse = 1;                                                                                 // enable them
+      continue;                                                                                     // Next option
+    } // End of if block
+    if (i + 1 >= argc)                                                                              // Every other option takes a value
+    {                                                                                               // Start of if block
+      print_usage(argv[0]);                                                                         // print usage
+      return 1;                                                                                     // Exit with an error code
+    } // End of if block
+    const char *v = argv[++i];                                                                      // The value
+    if (!strcmp(a, "-o")) o.out = v;                                                                // Docroot
+    else if (!strcmp(a, "-n")) o.files = strtoull(v, NULL, 10);                                     // File count
+    else if (!strcmp(a, "-D")) o.depth = atoi(v);                                                   // Depth
+    else if (!strcmp(a, "-F")) o.fanout = atoi(v);                                                  // Fan-out
+    else if (!strcmp(a, "-m")) o.median = atof(v);                                                  // Median / minimum size
+    else if (!strcmp(a, "-S")) o.sigma = atof(v);                                                   // Lognormal sigma
+    else if (!strcmp(a, "-a")) o.alpha = atof(v);                                                   // Zipf exponent
+    else if (!strcmp(a, "-M")) o.max = atof(v);                                                     // Maximum size
+    else if (!strcmp(a, "-x")) o.tricky = atof(v);                                                  // Tricky fraction
+    else if (!strcmp(a, "-r")) rng_state = strtoull(v, NULL, 10);                                   // Seed
+    else if (!strcmp(a, "-u")) o.urls = v;                                                          // URL list
+    else if (!strcmp(a, "-p")) o.popularity = atof(v);                                              // Popularity exponent
+    else if (!strcmp(a, "-s"))                                                                      // Distribution
+      o.dist = !strcmp(v, "zipf") ? 1 : !strcmp(v, "fixed") ? 2 : !strcmp(v, "lognormal") ? 0 : -1; // by name
+    else                                                                                            // Unknown option
+      o.dist = -1;                                                                                  // is an error
+    if (o.dist < 0)                                                                                 // Reject bad input
+    {                                                                                               // Start of if block
+      print_usage(argv[0]);                                                                         // print usage
+      return 1;                                                                                     // Exit with an error code
+    } // End of if block
+  } // End of for loop body
+  if (!o.out || o.depth < 0 || o.depth > MAX_DEPTH || o.fanout < 1 || o.median < 0 || o.alpha <= 0 || o.max < 0) // Validate
+  {                                                                                                 // Start of if block
+    print_usage(argv[0]);                                                                           // print usage
+    return 1;                                                                                       // Exit with an error code
+  } // End of if block
+  if (prepare_root(o.out) != 0)                                                                     // Create the docroot
+  {                                                                                                 // Start of if block
+    fprintf(stderr, "web_gen: %s: %s\n", o.out, strerror(errno));                                   // print an error
+    return 1;                                                                                       // Exit with an error code
+  } // End of if block
+  FILE *uf = NULL;                                                                                  // URL list
+  if (o.urls && !(uf = fopen(o.urls, "w")))                                                         // Open it if wanted
+  {                                                                                                 // Start of if block
+    fprintf(stderr, "web_gen: %s: %s\n", o.urls, strerror(errno));                                  // print an error
+    return 1;                                                                                       // Exit with an error code
+  } // End of if block
+
+  // Leaf directories: fanout^depth of them, but never more than there are files (empty ones are not created)
+  uint64_t leaves = 1;                                                                              // Count the leaves
+  for (int d = 0; d < o.depth && leaves < o.files; d++)                                             // level by level
+    leaves *= (uint64_t)o.fanout;                                                                   // multiplying out
+  if (leaves > o.files && o.files > 0)                                                              // Cap at the file count
+    leaves = o.files;                                                                               // (one file per leaf at most)
+  static const char *const exts[] = {".html", ".css", ".js", ".jpg", ".png", ".txt", ".json", ".bin"}; // Extension mix
+  char dir_names[MAX_DEPTH][256];                                                                   // Name of each level of the current leaf
+  uint64_t prev_digit[MAX_DEPTH];                                                                   // Digits of the previous leaf (to skip existing levels)
+  char path[GEN_PATH_MAX], url[GEN_PATH_MAX * 3];                                                   // Declare path buffers
+  uint64_t file_no = 0, dirs = 0, bytes = 0;                                                        // Totals
+  double t0 = now_sec();                                                                            // Start the clock
+  for (int d = 0; d < MAX_DEPTH; d++)                                                               // No level exists yet
+    prev_digit[d] = UINT64_MAX;                                                                     // (forces every mkdir for the first leaf)
+
+  for (uint64_t leaf = 0; leaf < leaves; leaf++)                                                    // Each leaf directory
+  {                                                                                                 // Start of for loop body
+    uint64_t digits[MAX_DEPTH], rest = leaf;                                                        // Its path as base-fanout digits
+    for (int d = o.depth - 1; d >= 0; d--)                                                          // (most significant first)
+    {                                                                                               // Start of for loop body
+      digits[d] = rest % (uint64_t)o.fanout;                                                        // Digit of this level
+      rest /= (uint64_t)o.fanout;                                                                   // Move up
+    } // End of for loop body
+    size_t len = (size_t)snprintf(path, sizeof(path), "%s", o.out);                                 // Build the directory path
+    int changed = 0;                                                                                // Set once a level differs from the previous leaf
+    for (int d = 0; d < o.depth; d++)                                                               // Level by level
+    {                                                                                               // Start of for loop body
+      if (changed || digits[d] != prev_digit[d])                                                    // A new directory
+      {                                                                                             // Start of if block
+        changed = 1;                                                                                // (and so is everything below it)
+        make_name(&o, dir_names[d], sizeof(dir_names[d]), "d", digits[d], "");                      // gets a name
+        prev_digit[d] = digits[d];                                                                  // Remember it
+      } // End of if block
+      len += (size_t)snprintf(path + len, sizeof(path) - len, "/%s", dir_names[d]);                 // Append the level
+      if (changed)                                                                                  // Create it once
+      {                                                                                             // Start of if block
+        if (mkdir(path, 0755) != 0 && errno != EEXIST)                                              // Make the directory
+        {                                                                                           // Start of if block
+          fprintf(stderr, "web_gen: mkdir %s: %s\n", path, strerror(errno));                        // or report why not
+          return 1;                                                                                 // Exit with an error code
+        } // End of if block
+        dirs++;                                                                                     // Count it
+      } // End of if block
+    } // End of for loop body
+    uint64_t count = o.files / leaves + (leaf < o.files % leaves);                                  // Files in this leaf
+    for (uint64_t k = 0; k < count; k++, file_no++)                                                 // Each file
+    {                                                                                               // Start of for loop body
+      char name[256];                                                                               // Declare the file name
+      make_name(&o, name, sizeof(name), "f", file_no, exts[rng_next() % 8]);                        // Name it
+      snprintf(path + len, sizeof(path) - len, "/%s", name);                                        // Full path
+      uint64_t size = draw_size(&o);                                                                // Size it
+      if (create_file(path, size, o.sparse) != 0)                                                   // Create it
+      {                                                                                             // Start of if block
+        fprintf(stderr, "web_gen: %s: %s\n", path, strerror(errno));                                // or report why not
+        return 1;                                                                                   // Exit with an error code
+      } // End of if block
+      bytes += size;                                                                                // Count the bytes
+      if (uf)                                                                                       // List its URL
+      {                                                                                             // Start of if block
+        url[0] = '\0';                                                                              // relative to the docroot,
+        url_encode_append(url, sizeof(url), path + strlen(o.out));                                  // percent-encoded
+        uint64_t rank = (file_no * 0x9E3779B97F4A7C15ULL) % o.files + 1;                            // Popularity rank (scrambled order)
+        fprintf(uf, "%.6g %s\n", 1.0 / pow((double)rank, o.popularity), url);                       // with its Zipf weight
+      } // End of if block
+    } // End of for loop body
+    path[len] = '\0';                                                                               // Back to the directory
+    if (leaf % 1000 == 999 && isatty(STDERR_FILENO))                                                // Show progress on big runs
+      fprintf(stderr, "\r%llu files, %llu dirs", (unsigned long long)file_no, (unsigned long long)dirs);
+  } // End of for loop body
+  if (uf && fclose(uf) != 0)                                                                        // Close the URL list
+  {                                                                                                 // Start of if block
+    fprintf(stderr, "web_gen: %s: %s\n", o.urls, strerror(errno));                                  // reporting a failed write
+    return 1;                                                                                       // Exit with an error code
+  } // End of if block
+  if (isatty(STDERR_FILENO) && leaves >= 1000)                                                      // End the progress line
+    fprintf(stderr, "\n");                                                                          // if one was shown
+  printf("%llu files (%llu bytes%s) in %llu directories under %s in %.1f s\n", (unsigned long long)file_no,
+         (unsigned long long)bytes, o.sparse ? ", sparse" : "", (unsigned long long)dirs, o.out, now_sec() - t0);
+  return 0; // Return 0 to indicate success
+} // End of main function body
@@ -0,0 +1,855 @@
+#define _DEFAULT_SOURCE // Expose non-standard functions like strcasecmp and clock_gettime
+/*
+  web_load: open-loop HTTP load generator (companion to web_server.c)
+
+  Sends requests at a constant rate regardless of how fast the server answers (open loop), so a stalling
+  server cannot slow the load down and hide its own latency. Latency is measured from each request's
+  *intended* send time (start + i / rate), which corrects for coordinated omission: a request that had to
+  wait for a free connection is charged for that wait. The plain service time (from the actual send) is
+  reported alongside for comparison.
+
+  Replay mode (-r) re-issues a request trace recorded by web_server (replay_trace=) instead: each request is
+  sent with its original method, target and key headers at its original offset from the start of the trace,
+  divided by the speed factor (-s 2 replays an hour in 30 minutes; -s 0 sends as fast as the connections allow,
+  which is a closed loop, so only the service time is meaningful there).
+
+  Works against any HTTP/1.x server that sends Content-Length or closes the connection (web_server and
+  http_server.py both do), over fresh connections per request or keep-alive connections when the server
+  allows them (a server that closes after each response simply gets reconnected).
+
+  Build:  cc -std=c11 -Wall -Wextra -O2 -pthread -o web_load web_load.c
+
+  Usage:
+    web_load -R <rate> [-d <seconds>] [-c <conns>] [-t <threads>] [-k] [-T <timeout_ms>] [-j]
+             [-H <host>] [-p <port>] [-u <path>[=<weight>]]... [-f <url_file>]
+    web_load -r <trace> [-s <speed>] [-d <seconds>] [-c <conns>] [-t <threads>] [-k] [-T <timeout_ms>] [-j]
+             [-H <host>] [-p <port>]
+      -R   Target request rate (requests per second, across all threads)
+      -r   Replay a web_server replay_trace file instead of generating requests
+      -s   Replay speed factor (default 1 = original timing, 0 = as fast as possible)
+      -d   Test duration in seconds (default 10; replays default to the whole trace)
+      -c   Maximum concurrent connections (default 64, split across threads)
+      -t   Worker threads (default 2)
+      -k   Ask for keep-alive and reuse connections the server leaves open
+      -T   Per-request timeout in milliseconds (default 10000)
+      -j   Print the summary as one JSON object (for scripts) instead of text
+      -H   Server host (default 127.0.0.1)
+      -p   Server port (default 8080)
+      -u   URL path with an optional relative weight; repeatable (default "/")
+      -f   File of "<weight> <path>" lines (# starts a comment)
+*/
+
+#include <sys/types.h>   // Provides basic system data types
+#include <sys/socket.h>  // Provides socket functions
+#include <sys/epoll.h>   // Provides epoll for multiplexing connections
+#include <netinet/in.h>  // Provides internet address structures
+#include <netinet/tcp.h> // Provides TCP_NODELAY
+#include <netdb.h>       // Provides getaddrinfo
+#include <pthread.h>     // Provides POSIX threads
+#include <unistd.h>      // Provides close
+#include <fcntl.h>       // Provides fcntl for non-blocking sockets
+#include <errno.h>       // Provides errno
+#include <stdint.h>      // Provides fixed-width integer types
+#include <stdio.h>       // Provides printf
+#include <stdlib.h>      // Provides malloc and atoi
+#include <string.h>      // Provides string functions
+#include <strings.h>     // Provides strncasecmp
+#include <time.h>        // Provides clock_gettime
+
+#define MAX_PATH_LEN 1024     // Maximum length of one URL path
+#define REQ_BUF 8192          // Size of a formatted request (replayed requests carry their recorded headers)
+#define RESP_HEAD_MAX 8192    // Response headers larger than this are an error
+#define HIST_BUCKETS 256      // Latency histogram buckets (log-linear, microseconds, up to ~10^18 us)
+#define BACKLOG_MAX 1000000   // Most requests that may wait for a free connection per thread
+
+#define ST_FREE 0       // Connection slot: no socket
+#define ST_IDLE 1       // Connection slot: open keep-alive connection without a request
+#define ST_CONNECTING 2 // Connection slot: connect() in progress
+#define ST_SENDING 3    // Connection slot: writing the request
+#define ST_READING 4    // Connection slot: reading the response
+
+typedef struct          // Defines one URL of the mix
+{                       // Start of url_t structure definition
+  char *path;           // Request target
+  double weight;        // Relative weight
+  double cum;           // Cumulative share of the total weight (for picking)
+} url_t;                // End of url_t structure definition
+
+typedef struct             // Defines a latency histogram (HDR-style log-linear buckets)
+{                          // Start of hist_t structure definition
+  uint64_t b[HIST_BUCKETS]; // Sample counts
+  uint64_t n;              // Number of samples
+  double sum;              // Sum of the samples (microseconds)
+  uint64_t max;            // Largest sample (microseconds)
+} hist_t;                  // End of hist_t structure definition
+
+/* Replay trace layout: must match replay_file_header_t / replay_record_t in web_server.c */
+#define REPLAY_MAGIC "WSREPLAY" // File magic (8 bytes, no terminator)
+#define REPLAY_VERSION 1        // Record layout version this tool understands
+
+typedef struct            // Defines the header at the start of a replay trace file
+{                         // Start of replay_file_header_t structure definition
+  char magic[8];          // REPLAY_MAGIC
+  uint32_t version;       // REPLAY_VERSION
+  uint32_t record_size;   // Size of the fixed part of each record
+} replay_file_header_t;   // End of replay_file_header_t structure definition
+
+typedef struct            // Defines the fixed part of one replay record, followed by the variable fields in order:
+{                         // method, path, version, Accept-Encoding, If-None-Match, If-Modified-Since, Referer, User-Agent
+  uint16_t length;        // Total record length in bytes, including this header
+  uint16_t path_len;      // Length of the request target
+  uint8_t method_len;     // Length of the method
+  uint8_t version_len;    // Length of the HTTP version
+  uint8_t ae_len;         // Length of the Accept-Encoding value (0 = absent)
+  uint8_t inm_len;        // Length of the If-None-Match value
+  uint64_t time_us;       // Arrival time of the request head (Unix microseconds)
+  uint8_t ims_len;        // Length of the If-Modified-Since value
+  uint8_t referer_len;    // Length of the Referer value
+  uint8_t ua_len;         // Length of the User-Agent value
+  uint8_t reserved[5];    // Padding, always zero
+} replay_record_t;        // End of replay_record_t structure definition
+
+typedef struct            // Defines one loaded trace entry
+{                         // Start of replay_entry_t structure definition
+  uint64_t time_us;       // Arrival time
+  const char *rec;        // The record (fixed part, then the fields)
+} replay_entry_t;         // End of replay_entry_t structure definition
+
+typedef struct            // Defines a request waiting for a free connection
+{                         // Start of pending_t structure definition
+  int64_t due;            // When it should have been sent
+  int64_t item;           // Trace entry to send (-1 = pick from the URL mix)
+} pending_t;              // End of pending_t structure definition
+
+typedef struct            // Defines one connection slot
+{                         // Start of conn_t structure definition
+  int fd;                 // Socket (-1 when free)
+  int state;              // ST_FREE .. ST_READING
+  int url;                // URL index of the request in flight
+  int64_t intended_ns;    // When the request in flight should have been sent
+  int64_t sent_ns;        // When it was actually sent
+  size_t req_len, req_off; // Request length and bytes written
+  char req[REQ_BUF];      // Formatted request
+  char head[RESP_HEAD_MAX]; // Response headers received so far
+  size_t head_len;        // Bytes in head
+  int head_done;          // 1 once the blank line was seen
+  int status;             // Response status code
+  int server_close;       // Server said Connection: close (or spoke HTTP/1.0 without keep-alive)
+  int64_t body_left;      // Body bytes still expected (-1 = read until close)
+  uint64_t bytes;         // Response bytes received
+} conn_t;                 // End of conn_t structure definition
+
+typedef struct                 // Defines one worker thread's state and results
+{                              // Start of worker_t structure definition
+  int id;                      // Thread number
+  double rate;                 // This thread's share of the request rate
+  int nconns;                  // This thread's share of the connections
+  uint64_t rng;                // Random state for the URL mix
+  hist_t corrected;            // Latency from the intended send time
+  hist_t service;              // Latency from the actual send time
+  uint64_t done, errors, timeouts, connect_errors; // Outcome counts
+  uint64_t status[6];          // Responses by class: [1]=1xx .. [5]=5xx, [0]=other
+  uint64_t bytes;              // Response bytes received
+  uint64_t max_backlog;        // Deepest queue of requests waiting for a connection
+} worker_t;                    // End of worker_t structure definition
+
+static url_t *urls;                    // The URL mix (grown as URLs are added)
+static int nurls, urls_cap;            // Number of URLs and allocated entries
+static struct addrinfo *server_addr;   // Resolved server address
+static char host_header[300];          // Host header value
+static int keep_alive;                 // Reuse connections (-k)
+static int64_t timeout_ns = 10000000000LL; // Per-request timeout
+static int64_t start_ns, end_ns;       // Schedule window (monotonic)
+static replay_entry_t *replay;         // Trace entries in time order (NULL unless -r)
+static uint64_t nreplay;               // Number of trace entries
+static uint32_t replay_rec_size;       // Fixed record size declared by the trace file
+static double replay_speed = 1;        // Replay speed factor (0 = as fast as possible)
+static int nthreads_total;             // Worker threads (trace entries are dealt out round-robin)
+
+/* Monotonic clock in nanoseconds */
+static int64_t now_ns(void)                                   // Defines a function to read the monotonic clock
+{                                                             // Start of now_ns function body
+  struct timespec ts;                                         // Declare a timespec structure
+  clock_gettime(CLOCK_MONOTONIC, &ts);                        // Read the clock
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;      // Convert it to nanoseconds
+} // End of now_ns function body
+
+/* Histogram bucket of a value: exact below 16, then 8 linear sub-buckets per power of two (<= 12.5% error) */
+static int hist_bucket(uint64_t v)                               // Defines a function to pick a histogram bucket
+{                                                                // Start of hist_bucket function body
+  if (v < 16)                                                    // Small values
+    return (int)v;                                               // have a bucket each
+  int msb = 63 - __builtin_clzll(v);                             // Position of the highest set bit
+  int shift = msb - 3;                                           // Keep the top 4 bits
+  int b = (shift + 1) * 8 + (int)((v >> shift) & 7);             // Group, then sub-bucket
+  return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;                // Clamp
+} // End of hist_bucket function body
+
+/* Largest value falling into bucket b */
+static uint64_t hist_upper(int b)                                // Defines a function to get a bucket's upper bound
+{                                                                // Start of hist_upper function body
+  if (b < 16)                                                    // Exact buckets
+    return (uint64_t)b;                                          // hold one value
+  int shift = b / 8 - 1;                                         // Group
+  return ((uint64_t)(8 + b % 8 + 1) << shift) - 1;               // One below the next bucket
+} // End of hist_upper function body
+
+static void hist_add(hist_t *h, uint64_t us)  // Defines a function to record a sample
+{                                             // Start of hist_add function body
+  h->b[hist_bucket(us)]++;                    // Count it in its bucket
+  h->n++;                                     // Count the sample
+  h->sum += (double)us;                       // Add to the sum
+  if (us > h->max)                            // Track the maximum
+    h->max = us;                              // exactly
+} // End of hist_add function body
+
+static void hist_merge(hist_t *dst, const hist_t *src) // Defines a function to merge histograms
+{                                                      // Start of hist_merge function body
+  for (int i = 0; i < HIST_BUCKETS; i++)               // Add the buckets
+    dst->b[i] += src->b[i];                            // one by one
+  dst->n += src->n;                                    // the counts
+  dst->sum += src->sum;                                // the sums
+  if (src->max > dst->max)                             // and keep the larger maximum
+    dst->max = src->max;                               // of the two
+} // End of hist_merge function body
+
+/* Value at quantile q (bucket upper bound, capped at the exact maximum) */
+static uint64_t hist_quantile(const hist_t *h, double q)                // Defines a function to read a quantile
+{                                                                       // Start of hist_quantile function body
+  uint64_t rank = (uint64_t)(q * (double)h->n + 0.5), seen = 0;         // Rank of the wanted sample
+  if (rank == 0)                                                        // At least the first sample
+    rank = 1;                                                           // is wanted
+  for (int i = 0; i < HIST_BUCKETS; i++)                                // Walk the buckets
+  {                                                                     // Start of for loop body
+    seen += h->b[i];                                                    // Count the samples so far
+    if (seen >= rank)                                                   // If the wanted sample is here
+      return hist_upper(i) < h->max ? hist_upper(i) : h->max;           // report the bucket bound
+  } // End of for loop body
+  return h->max; // Empty histogram or rounding at the top
+} // End of hist_quantile function body
+
+/* Pick a URL index according to the weights */
+static int pick_url(worker_t *w)                                  // Defines a function to choose a URL
+{                                                                 // Start of pick_url function body
+  w->rng ^= w->rng << 13;                                         // xorshift64
+  w->rng ^= w->rng >> 7;                                          // (fast and good enough
+  w->rng ^= w->rng << 17;                                         // for a request mix)
+  double r = (double)(w->rng >> 11) / 9007199254740992.0;         // Uniform in [0, 1)
+  int lo = 0, hi = nurls - 1;                                     // Binary search for the first URL
+  while (lo < hi)                                                 // whose cumulative share exceeds r
+  {                                                               // Start of while loop body
+    int mid = lo + (hi - lo) / 2;                                 // (generated mixes can hold millions)
+    if (r < urls[mid].cum)                                        // If it is at or before mid
+      hi = mid;                                                   // search the lower half
+    else                                                          // Otherwise
+      lo = mid + 1;                                               // the upper half
+  } // End of while loop body
+  return lo;                                                      // The last URL takes any rounding remainder
+} // End of pick_url function body
+
+/* Close a connection slot's socket and mark it free */
+static void conn_close(int ep, conn_t *c)          // Defines a function to close a connection
+{                                                  // Start of conn_close function body
+  if (c->fd >= 0)                                  // If a socket is open
+  {                                                // Start of if block
+    epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);     // stop watching it
+    close(c->fd);                                  // and close it
+  } // End of if block
+  c->fd = -1;           // No socket
+  c->state = ST_FREE;   // The slot is free
+} // End of conn_close function body
+
+/* Format a recorded request: its own method, target, version and key headers, our Host and Connection */
+static size_t format_replay(char *out, size_t out_sz, const char *rec)                              // Defines a function to rebuild a recorded request
+{                                                                                                   // Start of format_replay function body
+  replay_record_t h;                                                                                // Declare the fixed part
+  memcpy(&h, rec, sizeof(h));                                                                       // (copied: records are unaligned)
+  const char *f = rec + replay_rec_size;                                                            // The variable fields
+  const char *method = f, *path = method + h.method_len, *version = path + h.path_len;              // Request line
+  const char *ae = version + h.version_len, *inm = ae + h.ae_len, *ims = inm + h.inm_len;           // Conditional and encoding headers
+  const char *ref = ims + h.ims_len, *ua = ref + h.referer_len;                                     // Referer and User-Agent
+  int n = snprintf(out, out_sz, "%.*s %.*s %.*s\r\nHost: %s\r\n", h.method_len, method, h.path_len, path,
+                   h.version_len ? (int)h.version_len : 8, h.version_len ? version : "HTTP/1.0", host_header);
+  if (h.ae_len)                                                                                     // Each recorded header
+    n += snprintf(out + n, out_sz - (size_t)n, "Accept-Encoding: %.*s\r\n", h.ae_len, ae);         // is sent again
+  if (h.inm_len)                                                                                    // (the snprintf calls cannot overflow:
+    n += snprintf(out + n, out_sz - (size_t)n, "If-None-Match: %.*s\r\n", h.inm_len, inm);         // a record's fields total well under REQ_BUF)
+  if (h.ims_len)                                                                                    // If-Modified-Since, when recorded
+    n += snprintf(out + n, out_sz - (size_t)n, "If-Modified-Since: %.*s\r\n", h.ims_len, ims);
+  if (h.referer_len)                                                                                // Referer, when recorded
+    n += snprintf(out + n, out_sz - (size_t)n, "Referer: %.*s\r\n", h.referer_len, ref);
+  n += snprintf(out + n, out_sz - (size_t)n, "User-Agent: %.*s\r\nConnection: %s\r\n\r\n",
+                h.ua_len ? (int)h.ua_len : 8, h.ua_len ? ua : "web_load", keep_alive ? "keep-alive" : "close");
+  return (size_t)n;                                                                                 // Report the length
+} // End of format_replay function body
+
+/* Start a request on a slot: connect if needed, then queue the request bytes. Returns 0 on success */
+static int conn_start(int ep, worker_t *w, conn_t *c, const pending_t *p)                          // Defines a function to start a request
+{                                                                                                 // Start of conn_start function body
+  c->intended_ns = p->due;                                                                        // Remember when it was due
+  if (p->item >= 0)                                                                               // A trace entry
+    c->req_len = format_replay(c->req, sizeof(c->req), replay[p->item].rec);                      // is rebuilt from its record
+  else                                                                                            // Otherwise pick from the mix
+  {                                                                                               // Start of else block
+    c->url = pick_url(w);                                                                         // Choose the URL
+    c->req_len = (size_t)snprintf(c->req, sizeof(c->req),                                         // Format the request
+                                  "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: web_load\r\nConnection: %s\r\n\r\n",
+                                  urls[c->url].path, host_header, keep_alive ? "keep-alive" : "close");
+  } // End of else block
+  if (c->req_len >= sizeof(c->req))                                                               // Clamp an oversized path
+    c->req_len = sizeof(c->req) - 1;                                                              // (the server will reject it)
+  c->req_off = 0;                                                                                 // Nothing written yet
+  c->head_len = 0;                                                                                // No response yet
+  c->head_done = 0;                                                                               // Headers still to come
+  c->status = 0;                                                                                  // Unknown status
+  c->server_close = 0;                                                                            // Assume the server keeps it open
+  c->body_left = -1;                                                                              // Body length unknown
+  c->bytes = 0;                                                                                   // Nothing received
+  struct epoll_event ev = {0};                                                                    // Declare an epoll registration
+  ev.data.ptr = c;                                                                                // pointing back at the slot
+  if (c->state == ST_IDLE)                                                                        // Reuse an open connection
+  {                                                                                               // Start of if block
+    c->state = ST_SENDING;                                                                        // go straight to sending
+    c->sent_ns = now_ns();                                                                        // The service time starts now
+    ev.events = EPOLLOUT;                                                                         // Wait until writable
+    return epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);                                              // (usually immediately)
+  } // End of if block
+  c->fd = socket(server_addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK, server_addr->ai_protocol);  // New non-blocking socket
+  if (c->fd < 0)                                                                                  // If that fails
+    return -1;                                                                                    // report it
+  int one = 1;                                                                                    // Requests are small single writes:
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));                                 // do not let Nagle delay them
+  c->sent_ns = now_ns();                                                                          // The service time includes connecting
+  if (connect(c->fd, server_addr->ai_addr, server_addr->ai_addrlen) != 0 && errno != EINPROGRESS) // Start connecting
+  {                                                                                               // Start of if block
+    close(c->fd);                                                                                 // Give up on this socket
+    c->fd = -1;                                                                                   // The slot has none
+    return -1;                                                                                    // report it
+  } // End of if block
+  c->state = ST_CONNECTING;                                                                       // Wait for the connection
+  ev.events = EPOLLOUT;                                                                           // (writable = connected)
+  return epoll_ctl(ep, EPOLL_CTL_ADD, c->fd, &ev);                                                // Watch the socket
+} // End of conn_start function body
+
+/* Parse the response head once complete: status, Content-Length, Connection. Returns 0 on success */
+static int parse_head(conn_t *c)                                                        // Defines a function to parse response headers
+{                                                                                       // Start of parse_head function body
+  int minor = 0;                                                                        // HTTP minor version
+  if (sscanf(c->head, "HTTP/1.%d %d", &minor, &c->status) != 2)                         // Status line
+    return -1;                                                                          // is required
+  c->server_close = minor == 0;                                                         // HTTP/1.0 closes unless told otherwise
+  for (char *line = strstr(c->head, "\r\n"); line; line = strstr(line, "\r\n"))         // Walk the header lines
+  {                                                                                     // Start of for loop body
+    line += 2;                                                                          // Skip the line break
+    if (!strncasecmp(line, "Content-Length:", 15))                                      // Body length
+      c->body_left = strtoll(line + 15, NULL, 10);                                      // (the body is counted, not kept)
+    else if (!strncasecmp(line, "Connection:", 11))                                     // Connection handling
+      c->server_close = strstr(line, "close") != NULL && strstr(line, "close") < strstr(line, "\r\n"); // close wins
+  } // End of for loop body
+  if (c->status == 204 || c->status == 304 || (c->status >= 100 && c->status < 200))    // Responses without a body
+    c->body_left = 0;                                                                   // end at the blank line
+  return 0;                                                                             // Return 0 to indicate success
+} // End of parse_head function body
+
+/* Record a finished (or failed) request and recycle its slot */
+static void conn_finish(int ep, worker_t *w, conn_t *c, int ok)                       // Defines a function to complete a request
+{                                                                                     // Start of conn_finish function body
+  int64_t t = now_ns();                                                               // Completion time
+  if (ok)                                                                             // A response arrived
+  {                                                                                   // Start of if block
+    hist_add(&w->corrected, (uint64_t)((t - c->intended_ns) / 1000));                 // Latency the user would see
+    hist_add(&w->service, (uint64_t)((t - c->sent_ns) / 1000));                       // Latency of the request itself
+    w->done++;                                                                        // Count it
+    w->status[c->status >= 100 && c->status < 600 ? c->status / 100 : 0]++;           // by class
+    w->bytes += c->bytes;                                                             // and its bytes
+  } // End of if block
+  else                                                                                // A failure
+    w->errors++;                                                                      // is counted separately
+  if (ok && keep_alive && !c->server_close && c->body_left == 0)                      // If the connection can be reused
+  {                                                                                   // Start of if block
+    struct epoll_event ev = {0};                                                      // Stop polling it
+    ev.data.ptr = c;                                                                  // until the next request
+    epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);                                         // (no events)
+    c->state = ST_IDLE;                                                               // Keep it open
+  } // End of if block
+  else                                                                                // Otherwise
+    conn_close(ep, c);                                                                // close it
+} // End of conn_finish function body
+
+/* Handle readiness on a connection */
+static void conn_event(int ep, worker_t *w, conn_t *c, uint32_t events)                 // Defines a function to drive a connection
+{                                                                                       // Start of conn_event function body
+  if (c->state == ST_CONNECTING)                                                        // Connection attempt finished
+  {                                                                                     // Start of if block
+    int err = 0;                                                                        // Declare the connect result
+    socklen_t len = sizeof(err);                                                        // Its size
+    getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);                                // Ask how it went
+    if (err)                                                                            // If it failed
+    {                                                                                   // Start of if block
+      w->connect_errors++;                                                              // count it
+      conn_finish(ep, w, c, 0);                                                         // and fail the request
+      return;                                                                           // Done
+    } // End of if block
+    c->state = ST_SENDING;                                                              // Connected: send the request
+  } // End of if block
+  if (c->state == ST_SENDING)                                                           // Writing the request
+  {                                                                                     // Start of if block
+    ssize_t n = send(c->fd, c->req + c->req_off, c->req_len - c->req_off, MSG_NOSIGNAL); // Write what we can
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))                                   // Not writable after all
+      return;                                                                           // wait for the next event
+    if (n <= 0)                                                                         // If the write fails
+    {                                                                                   // Start of if block
+      conn_finish(ep, w, c, 0);                                                         // fail the request
+      return;                                                                           // Done
+    } // End of if block
+    c->req_off += (size_t)n;                                                            // Count the bytes
+    if (c->req_off < c->req_len)                                                        // If more remain
+      return;                                                                           // wait until writable again
+    struct epoll_event ev = {0};                                                        // Switch to reading
+    ev.events = EPOLLIN | EPOLLRDHUP;                                                   // the response
+    ev.data.ptr = c;                                                                    // for this slot
+    epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);                                           // Update the registration
+    c->state = ST_READING;                                                              // Now reading
+    return;                                                                             // Wait for data
+  } // End of if block
+  if (c->state != ST_READING || !(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) // Only reads remain
+    return;                                                                             // Nothing to do
+  char buf[65536];                                                                      // Declare a receive buffer
+  for (;;)                                                                              // Drain the socket
+  {                                                                                     // Start of for loop body
+    ssize_t n = recv(c->fd, buf, sizeof(buf), 0);                                       // Read what is there
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))                                   // Nothing more for now
+      return;                                                                           // wait for the next event
+    if (n <= 0)                                                                         // End of stream or error
+    {                                                                                   // Start of if block
+      c->server_close = 1;                                                              // The connection is gone
+      conn_finish(ep, w, c, n == 0 && c->head_done && c->body_left < 0);                // Complete only if the body ran to close
+      return;                                                                           // Done
+    } // End of if block
+    c->bytes += (uint64_t)n;                                                            // Count the bytes
+    size_t used = 0;                                                                    // Bytes of buf consumed by the head
+    if (!c->head_done)                                                                  // Still collecting headers
+    {                                                                                   // Start of if block
+      size_t prev = c->head_len;                                                        // Head bytes from earlier reads
+      size_t take = (size_t)n < sizeof(c->head) - 1 - c->head_len ? (size_t)n : sizeof(c->head) - 1 - c->head_len; // What fits
+      memcpy(c->head + c->head_len, buf, take);                                         // Append
+      c->head_len += take;                                                              // Count
+      c->head[c->head_len] = '\0';                                                      // Terminate
+      char *end = strstr(c->head, "\r\n\r\n");                                          // Look for the blank line
+      if (!end)                                                                         // Not there yet
+      {                                                                                 // Start of if block
+        if (c->head_len < sizeof(c->head) - 1)                                          // Room for more
+          continue;                                                                     // keep reading
+        conn_finish(ep, w, c, 0);                                                       // Oversized headers fail the request
+        return;                                                                         // Done
+      } // End of if block
+      size_t head_bytes = (size_t)(end + 4 - c->head);                                  // Length of the head
+      end[2] = '\0';                                                                    // Cut after the last header line
+      c->head_done = 1;                                                                 // Headers are complete
+      if (parse_head(c) != 0)                                                           // If they make no sense
+      {                                                                                 // Start of if block
+        conn_finish(ep, w, c, 0);                                                       // fail the request
+        return;                                                                         // Done
+      } // End of if block
+      used = head_bytes - prev;                                                         // Bytes of this read that were head
+    } // End of if block
+    if (c->body_left >= 0)                                                              // Known body length
+    {                                                                                   // Start of if block
+      c->body_left -= (int64_t)((size_t)n - used);                                      // Count the body bytes
+      if (c->body_left <= 0)                                                            // If the body is complete
+      {                                                                                 // Start of if block
+        c->body_left = 0;                                                               // (ignore anything extra)
+        conn_finish(ep, w, c, 1);                                                       // the request succeeded
+        return;                                                                         // Done
+      } // End of if block
+    } // End of if block
+  } // End of for loop body
+} // End of conn_event function body
+
+/* Intended send time of this thread's n-th request, with the trace entry to send in *item (-1 for the URL mix).
+   Returns INT64_MAX once a replayed trace has no more entries for this thread */
+static int64_t next_due(const worker_t *w, uint64_t n, int64_t *item)                             // Defines a function to schedule requests
+{                                                                                                 // Start of next_due function body
+  if (!replay)                                                                                    // Constant rate:
+  {                                                                                               // Start of if block
+    double period = 1e9 / w->rate;                                                                // Nanoseconds between requests
+    *item = -1;                                                                                   // from the URL mix,
+    return start_ns + (int64_t)(period * w->id / (w->id + 1.0)) + (int64_t)(period * (double)n);  // staggered between threads
+  } // End of if block
+  uint64_t k = (uint64_t)w->id + n * (uint64_t)nthreads_total;                                    // Trace entries are dealt round-robin
+  if (k >= nreplay)                                                                               // Past the end of the trace
+    return INT64_MAX;                                                                             // nothing more is due
+  *item = (int64_t)k;                                                                             // Send this entry
+  if (replay_speed <= 0)                                                                          // As fast as possible:
+    return start_ns;                                                                              // always due (the caller stamps the real time)
+  return start_ns + (int64_t)((double)(replay[k].time_us - replay[0].time_us) * 1000.0 / replay_speed); // at its scaled offset
+} // End of next_due function body
+
+/* Worker thread: schedules this thread's share of the requests and drives its connections */
+static void *worker_thread(void *arg)                                                          // Defines the entry point of a worker thread
+{                                                                                              // Start of worker_thread function body
+  worker_t *w = (worker_t *)arg;                                                               // This thread's state
+  int ep = epoll_create1(0);                                                                   // Create the epoll instance
+  conn_t *conns = (conn_t *)calloc((size_t)w->nconns, sizeof(conn_t));                         // Connection slots
+  pending_t *backlog = (pending_t *)malloc(BACKLOG_MAX * sizeof(pending_t));                   // Requests waiting for a slot
+  size_t bl_head = 0, bl_len = 0;                                                              // Backlog ring
+  struct epoll_event evs[256];                                                                 // Declare an event buffer
+  if (ep < 0 || !conns || !backlog)                                                            // If setup fails
+    return NULL;                                                                               // give up (the summary shows no requests)
+  for (int i = 0; i < w->nconns; i++)                                                          // Every slot
+    conns[i].fd = -1;                                                                          // starts without a socket
+  uint64_t issued = 0;                                                                         // Requests scheduled so far
+  int asap = replay && replay_speed <= 0;                                                      // Closed-loop replay
+
+  for (;;)                                                                                     // Event loop
+  {                                                                                            // Start of for loop body
+    int64_t t = now_ns();                                                                      // Current time
+    int64_t due, item;                                                                         // Next intended send time and trace entry
+    int idle = 0;                                                                              // Connections without a request
+    for (int i = 0; asap && i < w->nconns; i++)                                                // (only needed as fast as possible,
+      idle += conns[i].state <= ST_IDLE;                                                       // where nothing queues beyond them)
+    while ((due = next_due(w, issued, &item)) <= t && due < end_ns && (!asap || bl_len < (size_t)idle)) // Requests that are due
+    {                                                                                          // Start of while loop body
+      if (bl_len < BACKLOG_MAX)                                                                // queue them (with their intended time)
+        backlog[(bl_head + bl_len++) % BACKLOG_MAX] = (pending_t){asap ? t : due, item};       // to be started when a slot is free
+      else                                                                                     // A backlog this deep means the run is hopeless
+        w->errors++;                                                                           // count the request as failed
+      issued++;                                                                                // One more scheduled
+    } // End of while loop body
+    if (bl_len > w->max_backlog)                                                               // Track how deep the queue got
+      w->max_backlog = bl_len;                                                                 // (coordinated omission made visible)
+    int busy = 0;                                                                              // Slots with a request in flight
+    for (int i = 0; i < w->nconns; i++)                                                        // Visit every slot
+    {                                                                                          // Start of for loop body
+      conn_t *c = &conns[i];                                                                   // Get the slot
+      if ((c->state == ST_FREE || c->state == ST_IDLE) && bl_len > 0)                          // A free slot and waiting work
+      {                                                                                        // Start of if block
+        pending_t *p = &backlog[bl_head];                                                      // Oldest waiting request
+        bl_head = (bl_head + 1) % BACKLOG_MAX;                                                 // Take it
+        bl_len--;                                                                              // off the queue
+        if (conn_start(ep, w, c, p) != 0)                                                      // Start it
+        {                                                                                      // Start of if block
+          w->connect_errors++;                                                                 // count a failed start
+          conn_finish(ep, w, c, 0);                                                            // and fail the request
+        } // End of if block
+      } // End of if block
+      if (c->state >= ST_CONNECTING)                                                           // A request in flight
+      {                                                                                        // Start of if block
+        busy++;                                                                                // keeps the loop going
+        if (t - c->intended_ns > timeout_ns)                                                   // If it has taken too long
+        {                                                                                      // Start of if block
+          w->timeouts++;                                                                       // count a timeout
+          conn_finish(ep, w, c, 0);                                                            // and fail it
+        } // End of if block
+      } // End of if block
+    } // End of for loop body
+    if (due >= end_ns && bl_len == 0 && busy == 0)                                             // Schedule done and nothing in flight
+      break;                                                                                   // The run is over
+    int64_t wait_ns = asap ? 10000000 : due < end_ns ? due - now_ns() : 1000000;               // Sleep until the next request is due
+                                                                                               // (as fast as possible: until a response)
+    int wait_ms = wait_ns <= 0 ? 0 : (int)(wait_ns / 1000000);                                 // (epoll has millisecond resolution;
+    int n = epoll_wait(ep, evs, 256, wait_ms);                                                 // the sub-ms remainder is caught next loop)
+    for (int i = 0; i < n; i++)                                                                // Handle each ready connection
+      conn_event(ep, w, (conn_t *)evs[i].data.ptr, evs[i].events);                             // according to its state
+  } // End of for loop body
+  for (int i = 0; i < w->nconns; i++)                                                          // Close leftover keep-alive connections
+    conn_close(ep, &conns[i]);                                                                 // one by one
+  close(ep);                                                                                   // Close the epoll instance
+  free(conns);                                                                                 // Free the slots
+  free(backlog);                                                                               // and the backlog
+  return NULL;                                                                                 // Return NULL as the thread result
+} // End of worker_thread function body
+
+/* Add a URL to the mix */
+static int add_url(const char *path, double weight)                      // Defines a function to add a URL
+{                                                                        // Start of add_url function body
+  if (weight <= 0 || path[0] != '/')                                    // Validate it
+    return -1;                                                           // reject bad entries
+  if (nurls == urls_cap)                                                 // Grow the table when full
+  {                                                                      // Start of if block
+    int cap = urls_cap ? urls_cap * 2 : 64;                              // doubling its size
+    url_t *grown = (url_t *)realloc(urls, (size_t)cap * sizeof(url_t));  // Reallocate it
+    if (!grown)                                                          // If that fails
+      return -1;                                                         // reject the entry
+    urls = grown;                                                        // Use the larger table
+    urls_cap = cap;                                                      // and remember its size
+  } // End of if block
+  if (!(urls[nurls].path = strdup(path)))                                // Copy the path
+    return -1;                                                           // (or fail)
+  urls[nurls++].weight = weight;                                         // and its weight
+  return 0;                                                              // Return 0 to indicate success
+} // End of add_url function body
+
+/* Load "<weight> <path>" lines from a file */
+static int load_url_file(const char *file)                               // Defines a function to read a URL mix file
+{                                                                        // Start of load_url_file function body
+  FILE *f = fopen(file, "r");                                            // Open the file
+  char line[MAX_PATH_LEN + 64], path[MAX_PATH_LEN];                      // Declare buffers for a line and its path
+  double weight;                                                         // Declare the weight
+  if (!f)                                                                // If it cannot be opened
+    return -1;                                                           // report it
+  while (fgets(line, sizeof(line), f))                                   // Read each line
+  {                                                                      // Start of while loop body
+    if (line[0] == '#' || sscanf(line, "%lf %1023s", &weight, path) != 2) // Skip comments and blank lines
+      continue;                                                          // (and anything malformed)
+    if (add_url(path, weight) != 0)                                      // Add the URL
+      fprintf(stderr, "Ignoring URL entry: %s", line);                   // or say why not
+  } // End of while loop body
+  fclose(f);  // Close the file
+  return 0;   // Return 0 to indicate success
+} // End of load_url_file function body
+
+/* Load a replay trace into memory and sort its records by arrival time. Returns 0 on success */
+static int load_replay(const char *file)                                                          // Defines a function to read a replay trace
+{                                                                                                 // Start of load_replay function body
+  FILE *f = fopen(file, "rb");                                                                    // Open the trace
+  if (!f)                                                                                         // If it cannot be opened
+    return -1;                                                                                    // report it
+  size_t cap = 1 << 20, len = 0;                                                                  // The whole file is kept in memory
+  char *data = (char *)malloc(cap);                                                               // (records point into it)
+  size_t n;                                                                                       // Bytes per read
+  while (data && (n = fread(data + len, 1, cap - len, f)) > 0)                                    // Read it all
+    if ((len += n) == cap)                                                                        // growing the buffer
+      data = (char *)realloc(data, cap *= 2);                                                     // as needed
+  fclose(f);                                                                                      // Close the file
+  replay_file_header_t fh;                                                                        // Declare the file header
+  if (!data || len < sizeof(fh))                                                                  // It must at least hold a header
+    return -1;                                                                                    // (report it otherwise)
+  memcpy(&fh, data, sizeof(fh));                                                                  // Check the header
+  if (memcmp(fh.magic, REPLAY_MAGIC, 8) != 0 || fh.version != REPLAY_VERSION || fh.record_size < sizeof(replay_record_t))
+  {                                                                                               // Start of if block
+    fprintf(stderr, "%s: not a replay trace this tool understands\n", file);                     // Say what is wrong
+    return -1;                                                                                    // and fail
+  } // End of if block
+  replay_rec_size = fh.record_size;                                                               // Fixed part of each record
+  size_t cap_e = 1024;                                                                            // Index of the records
+  replay = (replay_entry_t *)malloc(cap_e * sizeof(replay_entry_t));                              // (grown as needed)
+  for (size_t off = sizeof(fh); replay && off + sizeof(replay_record_t) <= len;)                  // Walk the records
+  {                                                                                               // Start of for loop body
+    replay_record_t h;                                                                            // Declare the fixed part
+    memcpy(&h, data + off, sizeof(h));                                                            // Copy it out
+    size_t fields = (size_t)h.method_len + h.path_len + h.version_len + h.ae_len + h.inm_len + h.ims_len + h.referer_len + h.ua_len;
+    if (h.length < replay_rec_size + fields || off + h.length > len)                              // Inconsistent or cut off
+    {                                                                                             // Start of if block
+      fprintf(stderr, "%s: damaged record at offset %zu, ignoring the rest\n", file, off);        // (a trace still being written
+      break;                                                                                      // may end mid-record)
+    } // End of if block
+    if (nreplay == cap_e)                                                                         // Grow the index
+      replay = (replay_entry_t *)realloc(replay, (cap_e *= 2) * sizeof(replay_entry_t));          // when full
+    if (replay)                                                                                   // Add the entry
+      replay[nreplay++] = (replay_entry_t){h.time_us, data + off};                                // for this record
+    off += h.length;                                                                              // Next record
+  } // End of for loop body
+  if (!replay || nreplay == 0)                                                                    // Nothing to replay
+    return -1;                                                                                    // is a failure
+  for (uint64_t i = 1; i < nreplay; i++)                                                          // Sort by arrival time: insertion sort,
+  {                                                                                               // since threads interleave records only
+    replay_entry_t e = replay[i];                                                                 // a few milliseconds out of order
+    uint64_t j = i;                                                                               // (nearly sorted input, near-linear time)
+    for (; j > 0 && replay[j - 1].time_us > e.time_us; j--)                                       // Shift later entries
+      replay[j] = replay[j - 1];                                                                  // up one place
+    replay[j] = e;                                                                                // and insert
+  } // End of for loop body
+  return 0; // Return 0 to indicate success
+} // End of load_replay function body
+
+static void print_usage(const char *prog)                                                         // Defines a function to print usage
+{                                                                                                 // Start of print_usage function body
+  fprintf(stderr, "Usage: %s -R <rate> [-d secs] [-c conns] [-t threads] [-k] [-T timeout_ms] [-j]\n"
+                  "       [-H host] [-p port] [-u path[=weight]]... [-f url_file]\n"
+                  "       %s -r <trace> [-s speed] [-d secs] [-c conns] [-t threads] [-k] [-T timeout_ms] [-j]\n"
+                  "       [-H host] [-p port]\n", prog, prog);
+} // End of print_usage function body
+
+int main(int argc, char **argv)                                                                    // The main entry point of the program
+{                                                                                                  // Start of main function body
+  double rate = 0, duration = 0;                                                                   // Rate and duration (0 = default)
+  const char *trace = NULL;                                                                        // Replay trace
+  int nconns = 64, nthreads = 2, json = 0;                                                         // Connections, threads, output format
+  const char *host = "127.0.0.1", *port = "8080";                                                  // Server
+  for (int i = 1; i < argc; i++)                                                                   // Parse the command line
+  {                                                                                                // Start of for loop body
+    const char *a = argv[i], *v = i + 1 < argc ? argv[i + 1] : NULL;                               // Option and its value
+    if (!strcmp(a, "-k"))                                                                          // Keep-alive
+      keep_alive = 1;                                                                              // enable it
+    else if (!strcmp(a, "-j"))                                                                     // JSON summary
+      json = 1;                                                                                    // enable it
+    else if (!v)                                                                                   // Every other option takes a value
+    {                                                                                              // Start of else if block
+      print_usage(argv[0]);                                                                        // print usage
+      return 1;                                                                                    // Exit with an error code
+    } // End of else if block
+    else if (!strcmp(a, "-R"))                                                                     // Rate
+      rate = atof(argv[++i]);                                                                      // set it
+    else if (!strcmp(a, "-r"))                                                                     // Replay trace
+      trace = argv[++i];                                                                           // set it
+    else if (!strcmp(a, "-s"))                                                                     // Replay speed
+      replay_speed = atof(argv[++i]);                                                              // set it
+    else if (!strcmp(a, "-d"))                                                                     // Duration
+      duration = atof(argv[++i]);                                                                  // set it
+    else if (!strcmp(a, "-c"))                                                                     // Connections
+      nconns = atoi(argv[++i]);                                                                    // set them
+    else if (!strcmp(a, "-t"))                                                                     // Threads
+      nthreads = atoi(argv[++i]);                                                                  // set them
+    else if (!strcmp(a, "-T"))                                                                     // Timeout
+      timeout_ns = (int64_t)atoll(argv[++i]) * 1000000LL;                                          // set it
+    else if (!strcmp(a, "-H"))                                                                     // Host
+      host = argv[++i];                                                                            // set it
+    else if (!strcmp(a, "-p"))                                                                     // Port
+      port = argv[++i];                                                                            // set it
+    else if (!strcmp(a, "-u"))                                                                     // URL with optional weight
+    {                                                                                              // Start of else if block
+      char path[MAX_PATH_LEN];                                                                     // Declare a buffer for the path
+      snprintf(path, sizeof(path), "%s", argv[++i]);                                               // Copy it
+      char *eq = strrchr(path, '=');                                                               // Look for the weight
+      double weight = 1;                                                                           // Default weight
+      if (eq && !strchr(eq, '/') && atof(eq + 1) > 0)                                              // A trailing "=number"
+      {                                                                                            // Start of if block
+        weight = atof(eq + 1);                                                                     // is the weight
+        *eq = '\0';                                                                                // not part of the path
+      } // End of if block
+      if (add_url(path, weight) != 0)                                                              // Add the URL
+      {                                                                                            // Start of if block
+        fprintf(stderr, "Invalid URL: %s\n", argv[i]);                                             // or complain
+        return 1;                                                                                  // Exit with an error code
+      } // End of if block
+    } // End of else if block
+    else if (!strcmp(a, "-f"))                                                                     // URL file
+    {                                                                                              // Start of else if block
+      if (load_url_file(argv[++i]) != 0)                                                           // Load it
+      {                                                                                            // Start of if block
+        fprintf(stderr, "Cannot read URL file %s\n", argv[i]);                                     // or complain
+        return 1;                                                                                  // Exit with an error code
+      } // End of if block
+    } // End of else if block
+    else                                                                                           // Unknown option
+    {                                                                                              // Start of else block
+      print_usage(argv[0]);                                                                        // print usage
+      return 1;                                                                                    // Exit with an error code
+    } // End of else block
+  } // End of for loop body
+  if ((rate <= 0 && !trace) || duration < 0 || replay_speed < 0 || nthreads < 1 || nconns < nthreads) // Validate the options
+  {                                                                                                // Start of if block
+    print_usage(argv[0]);                                                                          // print usage
+    return 1;                                                                                      // Exit with an error code
+  } // End of if block
+  if (trace && load_replay(trace) != 0)                                                            // Load the trace
+  {                                                                                                // Start of if block
+    fprintf(stderr, "Cannot load replay trace %s\n", trace);                                      // or complain
+    return 1;                                                                                      // Exit with an error code
+  } // End of if block
+  nthreads_total = nthreads;                                                                       // Needed to deal out trace entries
+  if (nurls == 0)                                                                                  // Default URL mix
+    add_url("/", 1);                                                                               // is the root
+  double total = 0;                                                                                // Build the cumulative shares
+  for (int i = 0; i < nurls; i++)                                                                  // Sum the weights
+    total += urls[i].weight;                                                                       // of all URLs
+  for (int i = 0; i < nurls; i++)                                                                  // Then the running share
+    urls[i].cum = (i ? urls[i - 1].cum : 0) + urls[i].weight / total;                              // of each URL
+
+  struct addrinfo hints;                                                                           // Declare resolver hints
+  memset(&hints, 0, sizeof(hints));                                                                // Zero them
+  hints.ai_family = AF_UNSPEC;                                                                     // IPv4 or IPv6
+  hints.ai_socktype = SOCK_STREAM;                                                                 // TCP
+  int gai = getaddrinfo(host, port, &hints, &server_addr);                                         // Resolve the server once
+  if (gai != 0)                                                                                    // If resolution fails
+  {                                                                                                // Start of if block
+    fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(gai));                                       // print an error
+    return 1;                                                                                      // Exit with an error code
+  } // End of if block
+  snprintf(host_header, sizeof(host_header), "%s:%s", host, port);                                 // Host header value
+
+  worker_t *ws = (worker_t *)calloc((size_t)nthreads, sizeof(worker_t));                           // Per-thread state
+  pthread_t *tids = (pthread_t *)calloc((size_t)nthreads, sizeof(pthread_t));                      // Thread IDs
+  if (!ws || !tids)                                                                                // If allocation fails
+    return 1;                                                                                      // Exit with an error code
+  start_ns = now_ns() + 100000000LL;                                                               // Start shortly, once every thread is up
+  end_ns = duration > 0 ? start_ns + (int64_t)(duration * 1e9) :                                  // Stop scheduling after the duration,
+           trace ? INT64_MAX : start_ns + 10000000000LL;                                           // at the end of the trace, or after 10 s
+  for (int i = 0; i < nthreads; i++)                                                               // Start the workers
+  {                                                                                                // Start of for loop body
+    ws[i].id = i;                                                                                  // Thread number
+    ws[i].rate = rate / nthreads;                                                                  // Equal share of the rate
+    ws[i].nconns = nconns / nthreads + (i < nconns % nthreads);                                    // and of the connections
+    ws[i].rng = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);                                         // Distinct, reproducible URL sequence
+    if (pthread_create(&tids[i], NULL, worker_thread, &ws[i]) != 0)                                // Start the thread
+    {                                                                                              // Start of if block
+      fprintf(stderr, "Failed to start worker thread\n");                                          // print an error
+      return 1;                                                                                    // Exit with an error code
+    } // End of if block
+  } // End of for loop body
+
+  worker_t sum;                                                                                    // Merge the results
+  memset(&sum, 0, sizeof(sum));                                                                    // starting from zero
+  for (int i = 0; i < nthreads; i++)                                                               // Wait for each thread
+  {                                                                                                // Start of for loop body
+    pthread_join(tids[i], NULL);                                                                   // to finish
+    hist_merge(&sum.corrected, &ws[i].corrected);                                                  // and add its histograms
+    hist_merge(&sum.service, &ws[i].service);                                                      // (both of them)
+    sum.done += ws[i].done;                                                                        // and its counts
+    sum.errors += ws[i].errors;                                                                    // (failures)
+    sum.timeouts += ws[i].timeouts;                                                                // (timeouts)
+    sum.connect_errors += ws[i].connect_errors;                                                    // (connect failures)
+    sum.bytes += ws[i].bytes;                                                                      // (bytes)
+    if (ws[i].max_backlog > sum.max_backlog)                                                       // (deepest backlog)
+      sum.max_backlog = ws[i].max_backlog;                                                         // of any thread
+    for (int k = 0; k < 6; k++)                                                                    // (status classes)
+      sum.status[k] += ws[i].status[k];                                                            // one by one
+  } // End of for loop body
+  double elapsed = (double)(now_ns() - start_ns) / 1e9;                                            // Wall time of the run
+  const hist_t *h = &sum.corrected, *sv = &sum.service;                                            // Shorthands
+  static const double qs[] = {0.5, 0.75, 0.9, 0.99, 0.999, 0.9999};                                // Reported quantiles
+  static const char *const qn[] = {"p50", "p75", "p90", "p99", "p999", "p9999"};                   // and their names
+
+  if (json)                                                                                        // One JSON object for scripts
+  {                                                                                                // Start of if block
+    printf("{\"target_rate\":%.1f,\"duration_s\":%.3f,\"requests\":%llu,\"errors\":%llu,\"timeouts\":%llu,"
+           "\"connect_errors\":%llu,\"throughput_rps\":%.1f,\"bytes_per_sec\":%.0f,\"max_backlog\":%llu,"
+           "\"status\":{\"1xx\":%llu,\"2xx\":%llu,\"3xx\":%llu,\"4xx\":%llu,\"5xx\":%llu,\"other\":%llu}",
+           rate, elapsed, (unsigned long long)sum.done, (unsigned long long)sum.errors,
+           (unsigned long long)sum.timeouts, (unsigned long long)sum.connect_errors, sum.done / elapsed,
+           sum.bytes / elapsed, (unsigned long long)sum.max_backlog,
+           (unsigned long long)sum.status[1], (unsigned long long)sum.status[2], (unsigned long long)sum.status[3],
+           (unsigned long long)sum.status[4], (unsigned long long)sum.status[5], (unsigned long long)sum.status[0]);
+    for (int pass = 0; pass < 2; pass++)                                                           // Corrected, then service latency
+    {                                                                                              // Start of for loop body
+      const hist_t *x = pass ? sv : h;                                                             // Pick the histogram
+      printf(",\"%s\":{\"mean\":%.1f,\"max\":%llu", pass ? "service_us" : "latency_us",
+             x->n ? x->sum / (double)x->n : 0.0, (unsigned long long)x->max);
+      for (int i = 0; i < 6; i++)                                                                  // Each quantile
+        printf(",\"%s\":%llu", qn[i], (unsigned long long)hist_quantile(x, qs[i]));
+      printf("}");                                                                                 // Close the object
+    } // End of for loop body
+    printf("}\n");                                                                                 // Close the summary
+  } // End of if block
+  else                                                                                             // Human-readable summary
+  {                                                                                                // Start of else block
+    if (trace)                                                                                     // Replaying:
+    {                                                                                              // Start of if block
+      char speed[32] = "full speed";                                                               // Describe the pace
+      if (replay_speed > 0)                                                                        // (a multiple of the original,
+        snprintf(speed, sizeof(speed), "%.3gx speed", replay_speed);                               // or as fast as possible)
+      printf("replay of %llu requests from %s at %s, %d connections, %d threads, %s\n", (unsigned long long)nreplay,
+             trace, speed, nconns, nthreads, keep_alive ? "keep-alive" : "connection per request");
+    } // End of if block
+    else                                                                                           // Constant rate
+      printf("target %.1f req/s for %.1f s, %d connections, %d threads, %s\n", rate, duration ? duration : 10, nconns,
+             nthreads, keep_alive ? "keep-alive" : "connection per request");
+    printf("completed %llu requests in %.2f s: %.1f req/s, %.2f MiB/s\n", (unsigned long long)sum.done, elapsed,
+           sum.done / elapsed, sum.bytes / elapsed / 1048576.0);
+    printf("errors %llu (timeouts %llu, connect %llu), deepest backlog %llu\n", (unsigned long long)sum.errors,
+           (unsigned long long)sum.timeouts, (unsigned long long)sum.connect_errors, (unsigned long long)sum.max_backlog);
+    printf("status 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, other %llu\n", (unsigned long long)sum.status[2],
+           (unsigned long long)sum.status[3], (unsigned long long)sum.status[4], (unsigned long long)sum.status[5],
+           (unsigned long long)(sum.status[0] + sum.status[1]));
+    printf("%-8s %14s %14s\n", "", "latency(us)", "service(us)");                                  // Column headings
+    printf("%-8s %14.1f %14.1f\n", "mean", h->n ? h->sum / (double)h->n : 0.0, sv->n ? sv->sum / (double)sv->n : 0.0);
+    for (int i = 0; i < 6; i++)                                                                    // Each quantile
+      printf("%-8s %14llu %14llu\n", qn[i], (unsigned long long)hist_quantile(h, qs[i]),
+             (unsigned long long)hist_quantile(sv, qs[i]));
+    printf("%-8s %14llu %14llu\n", "max", (unsigned long long)h->max, (unsigned long long)sv->max);
+    printf("(latency is measured from each request's scheduled send time, correcting for coordinated omission)\n");
+  } // End of else block
+  freeaddrinfo(server_addr); // Free the resolved address
+  return sum.done ? 0 : 1;   // Fail if nothing completed
+} // End of main function body
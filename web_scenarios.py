@@ -0,0 +1,303 @@
+"""Scenario benchmark suite for web_server, with stored baselines and regression gating.
+
+Builds web_server, web_load and web_gen, generates docroots (with web_gen), starts the server on each and drives a fixed set of
+scenarios through web_load at constant rates (open loop, latency corrected for coordinated omission):
+
+  tiny_flood    many small files at a high request rate
+  large_jpeg    streaming multi-megabyte JPEGs
+  autoindex     directory listings of a directory with tens of thousands of entries
+  scan_404      a vulnerability-scanner style flood of missing paths
+  slow_trickle  small files while idle clients trickle their request headers a byte at a time
+  page_load     keep-alive browser page loads of www/index.html and the assets it references
+
+Usage:
+  python3 web_scenarios.py --record            run and store the results as the new baseline
+  python3 web_scenarios.py                     run and compare against the baseline (exit 1 on regression)
+  python3 web_scenarios.py --only tiny_flood,scan_404 --tolerance 0.15 --duration 5
+
+The baseline is machine-specific: record it on the machine that gates, from a known-good build.
+"""
+
+import argparse
+import json
+import os
+import random
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CFLAGS = ["-std=c11", "-Wall", "-Wextra", "-O2", "-pthread"]
+
+# Metrics compared against the baseline: name -> (JSON path in web_load's summary, True if higher is worse)
+GATED_METRICS = {
+    "p50_us": (("latency_us", "p50"), True),
+    "p99_us": (("latency_us", "p99"), True),
+    "throughput_rps": (("throughput_rps",), False),
+}
+
+# Latencies this small are noise on a loaded machine; differences below this floor are never regressions
+LATENCY_FLOOR_US = 500
+
+
+def build(out_dir, cc):
+    """Compile web_server, web_load and web_gen into out_dir; returns their paths."""
+    bins = {}
+    for name in ("web_server", "web_load", "web_gen"):
+        path = os.path.join(out_dir, name)
+        subprocess.run([cc] + CFLAGS + ["-o", path, os.path.join(HERE, name + ".c"), "-lm"], check=True)
+        bins[name] = path
+    return bins
+
+
+def generate(bins, root, url_file, *args):
+    """Run web_gen into root with the given options; returns the URLs it listed."""
+    os.makedirs(os.path.dirname(root), exist_ok=True)
+    subprocess.run([bins["web_gen"], "-o", root, "-u", url_file, "-r", "460"] + list(args),
+                   check=True, stdout=subprocess.DEVNULL)
+    with open(url_file) as f:
+        return [line.split()[1] for line in f]
+
+
+def make_docroots(bins, base, rng):
+    """Generate one docroot holding every scenario's content; returns the URL lists the scenarios use."""
+    root = os.path.join(base, "docroot")
+    urls = {}
+
+    # Tiny files: 2000 files around 512 B (capped at 2 KiB) across 20 directories, a few with tricky names
+    urls["tiny"] = ["/tiny" + u for u in generate(bins, os.path.join(root, "tiny"), os.path.join(base, "tiny.gen"),
+                                                   "-n", "2000", "-D", "1", "-F", "20", "-m", "512", "-S", "0.8",
+                                                   "-M", "2048", "-x", "0.02")]
+
+    # Large JPEGs: four files of 4 - 16 MiB (random bytes behind a JPEG header; the server only sees the name)
+    urls["jpeg"] = []
+    for i, mib in enumerate((4, 8, 12, 16)):
+        rel = "photos/large-%d.jpg" % i
+        path = os.path.join(root, rel)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, "wb") as f:
+            f.write(b"\xff\xd8\xff\xe0" + rng.randbytes(mib * 1024 * 1024 - 4))
+        urls["jpeg"].append("/" + rel)
+
+    # Huge directory: 20000 sparse entries, half of them with names that need escaping in the listing
+    generate(bins, os.path.join(root, "huge"), os.path.join(base, "huge.gen"), "-n", "20000", "-D", "0", "-x", "0.5", "-z")
+    urls["autoindex"] = ["/huge/"]
+
+    # Scanner flood: paths typical of vulnerability scanners, none of which exist
+    probes = ["wp-login.php", "admin/config.php", ".env", ".git/config", "phpmyadmin/index.php",
+              "cgi-bin/test.cgi", "server-status", "backup.zip", "actuator/health", "vendor/phpunit/eval.php"]
+    urls["scan"] = ["/%s/%s?id=%d" % ("x%03d" % (i % 500), probes[i % len(probes)], i) for i in range(5000)]
+
+    # Browser page: www/index.html and everything it references, copied into the docroot
+    shutil.copytree(os.path.join(HERE, "www"), os.path.join(root, "site"))
+    with open(os.path.join(HERE, "www", "index.html")) as f:
+        refs = re.findall(r'(?:href|src)="([^"#?:]+)"', f.read())
+    urls["page"] = ["/site/index.html"] + ["/site/" + r for r in refs]
+    return root, urls
+
+
+def write_url_file(path, urls, weights=None):
+    with open(path, "w") as f:
+        for i, u in enumerate(urls):
+            f.write("%g %s\n" % (weights[i] if weights else 1, u))
+    return path
+
+
+def wait_for_port(port, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=0.2).close()
+            return True
+        except OSError:
+            time.sleep(0.05)
+    return False
+
+
+def free_port():
+    s = socket.socket()
+    s.bind(("127.0.0.1", 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+class Trickler:
+    """Idle clients that keep connections open by sending their request one byte at a time."""
+
+    def __init__(self, port, clients, interval):
+        self.port = port
+        self.clients = clients
+        self.interval = interval
+        self.stop = threading.Event()
+        self.thread = threading.Thread(target=self.run, daemon=True)
+
+    def run(self):
+        request = b"GET /tiny/ HTTP/1.1\r\nHost: bench\r\nX-Padding: " + b"a" * 4000 + b"\r\n\r\n"
+        socks = []
+        for _ in range(self.clients):
+            try:
+                socks.append([socket.create_connection(("127.0.0.1", self.port), timeout=1), 0])
+            except OSError:
+                break
+        while not self.stop.is_set():
+            for entry in socks:
+                s, pos = entry
+                try:
+                    s.send(request[pos % len(request):pos % len(request) + 1])
+                    entry[1] = pos + 1
+                except OSError:
+                    pass
+            self.stop.wait(self.interval)
+        for s, _ in socks:
+            s.close()
+
+    def __enter__(self):
+        self.thread.start()
+        return self
+
+    def __exit__(self, *exc):
+        self.stop.set()
+        self.thread.join()
+
+
+def scenarios(urls, work, scale):
+    """Scenario name -> (web_load arguments, trickling clients). Rates are multiplied by scale."""
+    def rate(r):
+        return ["-R", str(max(1, int(r * scale)))]
+    return {
+        "tiny_flood": (rate(2000) + ["-c", "128", "-f", write_url_file(os.path.join(work, "tiny.urls"), urls["tiny"])], 0),
+        "large_jpeg": (rate(20) + ["-c", "32", "-f", write_url_file(os.path.join(work, "jpeg.urls"), urls["jpeg"])], 0),
+        "autoindex": (rate(5) + ["-c", "32", "-f", write_url_file(os.path.join(work, "autoindex.urls"), urls["autoindex"])], 0),
+        "scan_404": (rate(2000) + ["-c", "128", "-f", write_url_file(os.path.join(work, "scan.urls"), urls["scan"])], 0),
+        "slow_trickle": (rate(1000) + ["-c", "64", "-f", os.path.join(work, "tiny.urls")], 200),
+        # A page load is the HTML plus each asset once; the large image is fetched by one visitor in ten
+        "page_load": (rate(1500) + ["-c", "64", "-k", "-f", write_url_file(
+            os.path.join(work, "page.urls"), urls["page"],
+            [10 if "large" not in u else 1 for u in urls["page"]])], 0),
+    }
+
+
+def run_scenario(bins, root, port, args, tricklers, duration):
+    """Start a fresh server, optionally surround it with trickling clients, run web_load and return its summary."""
+    server = subprocess.Popen([bins["web_server"], "-r", root, "-p", str(port)],
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        if not wait_for_port(port):
+            raise RuntimeError("web_server did not start on port %d" % port)
+        cmd = [bins["web_load"], "-p", str(port), "-d", str(duration), "-t", "2", "-T", "5000", "-j"] + args
+        if tricklers:
+            with Trickler(port, tricklers, 0.1):
+                time.sleep(0.5)
+                out = subprocess.run(cmd, capture_output=True, text=True)
+        else:
+            out = subprocess.run(cmd, capture_output=True, text=True)
+        if not out.stdout.strip():
+            raise RuntimeError("web_load failed: %s" % out.stderr.strip())
+        return json.loads(out.stdout)
+    finally:
+        server.terminate()
+        server.wait()
+
+
+def pick(summary, path):
+    for key in path:
+        summary = summary[key]
+    return summary
+
+
+def compare(name, result, base, tolerance):
+    """Return a list of regression messages for one scenario."""
+    problems = []
+    for metric, (path, higher_is_worse) in GATED_METRICS.items():
+        now, then = pick(result, path), pick(base, path)
+        if higher_is_worse:
+            limit = max(then * (1 + tolerance), then + LATENCY_FLOOR_US)
+            bad = now > limit
+        else:
+            limit = then * (1 - tolerance)
+            bad = now < limit
+        if bad:
+            problems.append("%s: %s %.1f vs baseline %.1f (limit %.1f)" % (name, metric, now, then, limit))
+    if result["errors"] > base["errors"] + max(5, base["errors"] * tolerance):
+        problems.append("%s: errors %d vs baseline %d" % (name, result["errors"], base["errors"]))
+    return problems
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Scenario benchmarks for web_server with regression gating")
+    parser.add_argument("--baseline", default=os.path.join(HERE, "web_scenarios.baseline.json"),
+                        help="Baseline file (default: web_scenarios.baseline.json next to this script)")
+    parser.add_argument("--record", action="store_true", help="Store the results as the new baseline")
+    parser.add_argument("--tolerance", type=float, default=0.10, help="Allowed relative regression (default 0.10)")
+    parser.add_argument("--duration", type=float, default=10, help="Seconds per scenario (default 10)")
+    parser.add_argument("--scale", type=float, default=1.0, help="Multiply every scenario's request rate")
+    parser.add_argument("--only", default="", help="Comma-separated scenario names to run")
+    parser.add_argument("--cc", default=os.environ.get("CC", "cc"), help="C compiler (default $CC or cc)")
+    parser.add_argument("--keep", action="store_true", help="Keep the generated docroot and binaries")
+    opts = parser.parse_args()
+
+    work = tempfile.mkdtemp(prefix="web_scenarios.")
+    try:
+        bins = build(work, opts.cc)
+        root, urls = make_docroots(bins, work, random.Random(460))
+        suite = scenarios(urls, work, opts.scale)
+        wanted = [n for n in opts.only.split(",") if n] or list(suite)
+        unknown = [n for n in wanted if n not in suite]
+        if unknown:
+            parser.error("unknown scenario(s): %s" % ", ".join(unknown))
+
+        results = {}
+        print("%-14s %10s %10s %10s %10s %8s" % ("scenario", "req/s", "p50(us)", "p99(us)", "max(us)", "errors"))
+        for name in wanted:
+            args, tricklers = suite[name]
+            r = run_scenario(bins, root, free_port(), args, tricklers, opts.duration)
+            results[name] = r
+            print("%-14s %10.1f %10d %10d %10d %8d" % (name, r["throughput_rps"], r["latency_us"]["p50"],
+                                                       r["latency_us"]["p99"], r["latency_us"]["max"], r["errors"]))
+            sys.stdout.flush()
+
+        if opts.record:
+            stored = {}
+            if os.path.exists(opts.baseline):
+                with open(opts.baseline) as f:
+                    stored = json.load(f)
+            stored.setdefault("scenarios", {}).update(results)
+            stored["duration"] = opts.duration
+            stored["scale"] = opts.scale
+            with open(opts.baseline, "w") as f:
+                json.dump(stored, f, indent=2, sort_keys=True)
+            print("baseline written to %s" % opts.baseline)
+            return 0
+
+        if not os.path.exists(opts.baseline):
+            print("no baseline at %s; run with --record first" % opts.baseline)
+            return 2
+        with open(opts.baseline) as f:
+            baseline = json.load(f)
+        if baseline.get("duration") != opts.duration or baseline.get("scale") != opts.scale:
+            print("warning: baseline was recorded with duration=%s scale=%s" % (baseline.get("duration"), baseline.get("scale")))
+        problems = []
+        for name, r in results.items():
+            if name in baseline.get("scenarios", {}):
+                problems += compare(name, r, baseline["scenarios"][name], opts.tolerance)
+            else:
+                print("%s: no baseline, not gated" % name)
+        for p in problems:
+            print("REGRESSION " + p)
+        print("%d regression(s) beyond %.0f%% tolerance" % (len(problems), opts.tolerance * 100))
+        return 1 if problems else 0
+    finally:
+        if opts.keep:
+            print("kept %s" % work)
+        else:
+            shutil.rmtree(work, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
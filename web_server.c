@@ -13,6 +13,9 @@
   - Supports Linux/macOS (POSIX) and Windows via #ifdef _WIN32.
   - On Windows, compile and link with Ws2_32 (e.g., cl web_server.c /W4 /D_CRT_SECURE_NO_WARNINGS ws2_32.lib).
   - On POSIX, compile with: cc -std=c11 -Wall -Wextra -O2 -pthread -o web_server web_server.c
+    (add -lrt on glibc older than 2.17 for shm_open; the stats viewer is built the same way from web_stat.c
+    and the open-loop load generator from web_load.c; web_bench.c compiles this file into helper microbenchmarks;
+    web_gen.c builds synthetic docroots and needs -lm)
 
   Usage:
     web_server -r <root_dir> -p <port>
@@ -22,13 +25,70 @@
   Config file format (simple key=value, whitespace ignored, lines starting with # are comments):
     root=/path/to/www
     port=8080
+    etag=content        (optional; "inode" (default) derives ETags from inode/size/mtime)
+    cache=*.css 86400 immutable   (optional, repeatable; first matching rule wins)
+    cache=/images/ 3600           (pattern is a URL path prefix or *.ext; max-age 0 means no-cache)
+    gzip_cache=64       (optional; MiB of memory for background-built gzip variants, 0 = off)
+    gzip_workers=2      (optional; compressor threads)
+    gzip_min_hits=2     (optional; gzip-accepting requests before a variant is built)
+    access_log=/var/log/web_server.log   (optional; default is stdout)
+    log_format=combined (optional; combined (default), json or binary; all carry status, bytes, ttfb, duration, cache)
+    stats_path=/__stats (optional; URL of the built-in JSON metrics endpoint, empty = disabled)
+    admin_port=9100     (optional; serves Prometheus text metrics at /metrics and the profiler at
+                         /debug/profile?seconds=10&hz=99 on this port, 0 = off; bind it to a trusted network)
+    stats_shm=/web_server (optional; publishes live counters in this POSIX shared-memory segment for web_stat)
+    server_timing=on    (optional; Server-Timing header with recv/map/stat/open phase durations)
+    log_phases=on       (optional; per-phase durations in combined/json access log records)
+    slow_log=/var/log/web_server.slow   (optional; JSON records of slow requests with phases and TCP_INFO)
+    slow_ms=1000        (optional; threshold for slow_log, measured from the parsed request head)
+    replay_trace=/var/log/web_server.replay  (optional; binary record of every request for web_load -r)
+    shadow=10.0.0.7:8080 (optional; mirror a sample of GET requests to this host:port, responses discarded)
+    shadow_sample=0.05  (optional; fraction of GET requests mirrored, default 1)
+    max_connections=2000 (optional; open connections beyond which new ones are shed, 0 = unlimited)
+    max_inflight=256    (optional; requests being served at once beyond which new ones get a 503, 0 = unlimited)
+    overload=reject     (optional; "reject" answers excess connections with a 503, "pause" stops accepting)
+    retry_after=1       (optional; Retry-After seconds sent with overload 503s)
+    listen_backlog=128  (optional; kernel accept queue length of the listening socket)
+    adaptive_limit=on   (optional; adjust the in-flight limit from observed latency, up to max_inflight)
+    header_timeout=20   (optional; seconds allowed for the request head to arrive, 0 = unlimited)
+    send_timeout=60     (optional; seconds a response may go without send progress, 0 = unlimited)
+    rate_limit=20       (optional; requests per second allowed per client address, 0 = unlimited)
+    rate_burst=40       (optional; requests a client address may send at once before rate_limit applies)
+    max_conns_per_ip=16 (optional; concurrent connections per client address, 0 = unlimited)
+    pace_rate=4096      (optional; KiB/s cap for each large file transfer, 0 = unlimited)
+    pace_total=20480    (optional; KiB/s shared fairly by all large file transfers, 0 = unlimited)
+    pace_threshold=1024 (optional; KiB; file bodies up to this size are never paced)
 
   Supported features:
   - Methods: GET and HEAD
   - Basic URL decoding and path normalization to prevent directory traversal
   - MIME type by extension (basic map)
   - Directory listing (auto-index) if no index.html is present
-  - Simple logging to stdout
+  - Conditional GET: ETag/Last-Modified validators, 304 for If-None-Match/If-Modified-Since
+  - Optional content-hash ETags (etag=content) computed off the request path by a background hasher
+  - Cache-Control/Expires policies per path prefix or extension (cache= rules)
+  - Precompressed siblings (file.br, file.gz) served via Accept-Encoding negotiation
+  - File bodies sent with sendfile() (zero-copy)
+  - Optional background gzip cache for popular text files and directory listings (gzip_cache=)
+  - Access log (stdout or access_log=file) written by a background thread from per-thread lock-free rings
+  - Metrics endpoint (/__stats): request/status/method counts, bytes, connections, cache stats and
+    per-class latency histograms, kept in per-thread counters and aggregated only when read
+  - Optional admin port (admin_port=) exposing the same metrics in Prometheus text format, streamed per family
+  - Optional shared-memory stats segment (stats_shm=) guarded by seqlocks, read by the web_stat viewer
+  - Per-phase request tracing (recv, map, stat, open, hdr, send) via Server-Timing and the access log
+  - Slow request log (slow_log=) with the phase breakdown, file size and the connection's TCP_INFO
+  - USDT probes (accept, request__parsed, path__mapped, response__start, response__end) when <sys/sdt.h> exists
+  - Sampling profiler on the admin port (/debug/profile?seconds=N): SIGPROF stack samples as folded stacks
+  - Request recording (replay_trace=): arrival time, request line and key headers, replayable with web_load -r
+  - Traffic shadowing (shadow=): a sampled fraction of GETs re-sent to a second server by a background thread
+  - Admission control (max_connections=, max_inflight=): precomputed 503 + Retry-After or paused accepts under
+    overload, with the accept queue and request queue depths in the metrics
+  - Adaptive concurrency limit (adaptive_limit=on): gradient controller on time to first byte
+  - Header and send-progress timeouts kept in a hierarchical timer wheel; expired connections get a 408 or are
+    shut down, which unblocks their thread
+  - Per-client-address rate and connection limits in a sharded lock-free table, answered with a canned 429
+  - Optional pacing of large file bodies (pace_rate=, pace_total=): each gets a fair share of a global cap via
+    SO_MAX_PACING_RATE and a userspace clock, while small responses are sent unpaced
   - Connection: close after each response (HTTP/1.0 style)
 */
 
@@ -36,15 +96,22 @@
 #include <sys/socket.h>       // Provides socket-related functions and structures
 #include <sys/stat.h>         // Provides file status functions and structures
 #include <sys/sendfile.h>     // Provides sendfile function for efficient file transfer
+#include <sys/mman.h>         // Provides mmap for hashing whole files without copying
+#include <sys/ioctl.h>        // Provides ioctl for reading a socket's send queue
+#include <linux/sockios.h>    // Provides SIOCOUTQ (bytes the peer has not yet acknowledged)
 #include <netinet/in.h>       // Provides internet address family structures
+#include <netinet/tcp.h>      // Provides TCP_INFO for the slow request log
 #include <arpa/inet.h>        // Provides functions for manipulating IP addresses
 #include <netdb.h>            // Provides network database operations
 #include <dirent.h>           // Provides directory entry structures and functions
 #include <pthread.h>          // Provides POSIX thread functions for concurrency
 #include <unistd.h>           // Provides POSIX operating system API
 #include <fcntl.h>            // Provides file control options
+#include <poll.h>             // Provides poll for the shadow request sender and paced sends
 #include <signal.h>           // Provides signal handling functions
 #include <stdarg.h>           // Provides support for variable argument lists
+#include <execinfo.h>         // Provides backtrace for the sampling profiler
+#include <elf.h>              // Provides ELF types for symbolizing profiles
 typedef int sock_t;           // Defines a custom type for socket descriptors for cross-platform compatibility
 #define INVALID_SOCKET (-1)   // Defines a value for an invalid socket
 #define SOCKET_ERROR (-1)     // Defines a value for a socket error
@@ -56,6 +123,32 @@ typedef int sock_t;           // Defines a custom type for socket descriptors fo
 #include <time.h>   // Provides time and date functions
 #include <ctype.h>  // Provides character handling functions
 #include <errno.h>  // Provides access to error numbers
+#include <stdint.h> // Provides fixed-width integer types
+#include <limits.h> // Provides LLONG_MAX for timers without a deadline
+#include <stdatomic.h> // Provides lock-free atomic operations for per-thread rings and counters
+
+/* USDT (static tracepoint) probes for bpftrace/perf, provider "web_server":
+     accept(conn_id, fd)                             a connection was accepted (accept loop)
+     request__parsed(conn_id, method, path)          the request head was parsed
+     path__mapped(conn_id, fs_path, rc)              map_url_to_fs finished (rc 0 = ok, -2 = not found)
+     response__start(conn_id, status)                the first response byte is about to be sent
+     response__end(conn_id, status, bytes, dur_us)   the response is complete
+   With <sys/sdt.h> (systemtap-sdt-dev) each probe compiles to a single nop plus an ELF note, so it costs nothing
+   until a tracer attaches, e.g.: bpftrace -e 'usdt:./web_server:response__end { @[arg1] = hist(arg3); }'
+   Without the header (or with -DWS_NO_USDT) the probes compile to nothing */
+#if !defined(WS_NO_USDT) && defined(__has_include) // If the compiler can look for the header
+#if __has_include(<sys/sdt.h>)                     // and it is installed
+#include <sys/sdt.h>                               // use the real probe macros
+#define WS_PROBE2(name, a, b) DTRACE_PROBE2(web_server, name, a, b)
+#define WS_PROBE3(name, a, b, c) DTRACE_PROBE3(web_server, name, a, b, c)
+#define WS_PROBE4(name, a, b, c, d) DTRACE_PROBE4(web_server, name, a, b, c, d)
+#endif                                             // End of header check
+#endif                                             // End of USDT block
+#ifndef WS_PROBE2                                  // If the probes are unavailable
+#define WS_PROBE2(name, a, b) ((void)0)            // compile them to nothing
+#define WS_PROBE3(name, a, b, c) ((void)0)         // (the arguments are not evaluated)
+#define WS_PROBE4(name, a, b, c, d) ((void)0)      // End of no-op probes
+#endif                                             // End of fallback block
 
 #ifndef PATH_MAX      // If PATH_MAX is not defined
 #define PATH_MAX 4096 // define it to a common value to ensure buffer sizes are adequate for file paths
@@ -66,6 +159,76 @@ typedef int sock_t;           // Defines a custom type for socket descriptors fo
 #define SMALL_BUF 256       // Defines a small buffer size for short strings
 #define BIG_BUF 8192        // Defines a large buffer size for formatted strings
 #define MAX_MIME_LEN 64     // Defines the maximum length of a MIME type string
+#define MAX_ETAG_LEN 64     // Defines the maximum length of an ETag value (including quotes)
+
+#define FILE_CACHE_SLOTS 4096 // Defines the number of slots in the file info cache (direct-mapped by path hash)
+#define FILE_CACHE_LOCKS 64   // Defines the number of lock stripes guarding the file info cache
+#define HASH_QUEUE_LEN 256    // Defines the capacity of the background hashing job queue
+
+#define ETAG_INODE 0   // ETags derived from inode, size and mtime (default)
+#define ETAG_CONTENT 1 // ETags derived from a hash of the file contents (identical across replicas)
+
+#define ENC_IDENTITY 0 // Response body sent as stored
+#define ENC_GZIP 1     // Response body served from the precompressed ".gz" sibling
+#define ENC_BR 2       // Response body served from the precompressed ".br" sibling
+#define SIBLING_TTL 2  // Seconds a cached sibling scan is trusted before re-checking the disk
+
+#define MAX_CACHE_RULES 32 // Defines the maximum number of cache= policy rules
+
+#define MAX_WORKER_SLOTS 1024      // Defines the number of per-thread worker slots (concurrent connections with their own log ring)
+#define LOG_RING_SIZE 8192         // Defines the size of each per-thread access log ring (power of two)
+#define LOG_LINE_MAX 2048          // Defines the maximum length of one access log record
+#define LOG_BATCH_SIZE (256 * 1024) // Defines the size of the log writer's batch buffer
+#define LOG_FLUSH_MS 20            // Defines how long the log writer sleeps when the rings are empty
+#define REPLAY_RING_SIZE 8192      // Defines the size of each per-thread replay trace ring (power of two)
+#define SHADOW_RING_SIZE 4096      // Defines the size of each per-thread shadow request ring (power of two)
+#define SHADOW_MAX_INFLIGHT 64     // Defines how many mirrored requests may be in flight at once
+#define SHADOW_TIMEOUT_MS 2000     // Defines how long a mirrored request may take before it is abandoned
+#define ADAPTIVE_INTERVAL_MS 100   // Defines how often the adaptive limiter re-evaluates the in-flight limit
+#define ADAPTIVE_MIN_SAMPLES 20    // Defines how many requests a window needs before the limit is changed
+#define ADAPTIVE_MIN_LIMIT 4       // Defines the smallest in-flight limit the adaptive limiter will set
+#define ADAPTIVE_INITIAL_LIMIT 32  // Defines the in-flight limit the adaptive limiter starts from
+#define ADAPTIVE_TOLERANCE 1.5     // Defines how far latency may rise above its baseline before the limit shrinks
+#define WHEEL_TICK_MS 10           // Defines the resolution of the connection timer wheel
+#define WHEEL_L0 256               // Defines the number of slots of the fine wheel level (one tick each)
+#define WHEEL_L1 64                // Defines the number of slots of the coarse wheel level (WHEEL_L0 ticks each)
+#define SEND_CHUNK (512 * 1024)    // Defines the most one blocking send may take, so send progress renews the deadline
+#define RATE_SHARDS 64             // Defines the number of shards of the per-address rate table
+#define RATE_SHARD_SLOTS 1024      // Defines the number of entries per shard (power of two)
+#define RATE_PROBE 16              // Defines how many entries an address may probe before it goes untracked
+#define RATE_IDLE_S 60             // Defines how long an address may stay quiet before its entry can be reused
+#define PACE_CHUNK_MS 100          // Defines how much send time a paced chunk covers before the share is recomputed
+#define PACE_MIN_CHUNK 65536       // Defines the smallest paced chunk in bytes
+#define PACE_MAX_WAIT_MS 500       // Defines the longest a paced chunk may take (below the smallest send_timeout)
+#define PACE_SLACK_MS 200          // Defines how much unused send time a paced transfer may catch up on in a burst
+
+#define LOG_FORMAT_COMBINED 0 // Apache combined log format plus ttfb_us, duration_us and cache fields
+#define LOG_FORMAT_JSON 1     // One JSON object per line
+#define LOG_FORMAT_BINARY 2   // Compact fixed-header binary records (see binary_log_record_t)
+
+#define STAT_METHODS 3         // Method counters: GET, HEAD, other
+#define STAT_CODES 9           // Status code counters (see stats_codes)
+#define STAT_CLASSES 5         // Response classes with a latency histogram: 1xx .. 5xx
+#define STAT_HIST_BUCKETS 192  // Latency histogram buckets (log-linear, up to about 67 s)
+#define ST_REQUESTS 0          // Counter index: requests served
+#define ST_CONNECTIONS 1       // Counter index: connections accepted
+#define ST_BYTES 2             // Counter index: bytes sent
+#define ST_GZ_HITS 3           // Counter index: responses served from the gzip cache
+#define ST_GZ_MISSES 4         // Counter index: gzip cache lookups without a variant
+#define ST_METHOD 5                                         // First method counter
+#define ST_STATUS (ST_METHOD + STAT_METHODS)                // First status code counter
+#define ST_LAT_SUM (ST_STATUS + STAT_CODES)                 // First latency sum (microseconds), one per class
+#define ST_HIST (ST_LAT_SUM + STAT_CLASSES)                 // First histogram bucket, STAT_HIST_BUCKETS per class
+#define ST_COUNTERS (ST_HIST + STAT_CLASSES * STAT_HIST_BUCKETS) // Total number of counters per thread
+
+// One caching policy rule from the config file, compiled into its response header line at load time
+typedef struct            // Defines a structure to hold a caching policy rule
+{                         // Start of cache_rule_t structure definition
+  char pattern[SMALL_BUF]; // URL path prefix ("/images/") or extension including the dot (".css")
+  int is_ext;             // 1 if pattern is an extension, 0 if it is a path prefix
+  long max_age;           // Freshness lifetime in seconds (0 = revalidate every time)
+  char header[SMALL_BUF]; // Precompiled "Cache-Control: ...\r\n" line
+} cache_rule_t;           // End of cache_rule_t structure definition
 
 // Server configuration container
 typedef struct              // Defines a structure to hold the server's configuration
@@ -73,16 +236,75 @@ typedef struct              // Defines a structure to hold the server's configur
   char root[PATH_MAX];      // The root directory as provided by the user
   char root_real[PATH_MAX]; // The canonical absolute path to the root, used for security checks
   int port;                 // The port number to listen on
+  int etag_mode;            // How ETags are derived: ETAG_INODE or ETAG_CONTENT
+  cache_rule_t cache_rules[MAX_CACHE_RULES]; // Caching policy rules in config file order
+  int n_cache_rules;        // Number of valid entries in cache_rules
+  int gzip_cache_mb;        // Memory budget of the background gzip cache in MiB (0 = disabled)
+  int gzip_workers;         // Number of compressor threads
+  int gzip_min_hits;        // Requests wanting gzip before a variant is built
+  char access_log[PATH_MAX]; // Access log file path (empty = stdout)
+  int log_format;           // LOG_FORMAT_COMBINED, LOG_FORMAT_JSON or LOG_FORMAT_BINARY
+  char stats_path[SMALL_BUF]; // Reserved URL path of the metrics endpoint (empty = disabled)
+  int admin_port;           // Port of the Prometheus admin listener (0 = disabled)
+  char stats_shm[SMALL_BUF]; // Name of the shared-memory stats segment (empty = disabled)
+  int server_timing;        // Send a Server-Timing header with the per-phase breakdown
+  int log_phases;           // Append the per-phase breakdown to access log records (text formats)
+  char slow_log[PATH_MAX];  // Slow request log file path (empty = disabled)
+  char replay_trace[PATH_MAX]; // Replay trace file path (empty = not recording)
+  char shadow[SMALL_BUF];   // Shadow target "host:port" (empty = no mirroring)
+  double shadow_sample;     // Fraction of GET requests mirrored to the shadow target
+  int max_connections;      // Open connections beyond which new ones are shed (0 = unlimited)
+  int max_inflight;         // Requests served at once beyond which new ones get a 503 (0 = unlimited)
+  int overload_pause;       // 1 = stop accepting at max_connections, 0 = answer the excess with a 503
+  int retry_after;          // Retry-After seconds of overload responses
+  int listen_backlog;       // Accept queue length passed to listen()
+  int adaptive_limit;       // Adjust the in-flight limit from observed latency
+  int header_timeout;       // Seconds allowed for the request head (0 = unlimited)
+  int send_timeout;         // Seconds a response may go without send progress (0 = unlimited)
+  int rate_limit;           // Requests per second allowed per client address (0 = unlimited)
+  int rate_burst;           // Burst size of the per-address token bucket
+  int max_conns_per_ip;     // Concurrent connections per client address (0 = unlimited)
+  int pace_rate;            // KiB/s cap for each large file transfer (0 = unlimited)
+  int pace_total;           // KiB/s shared by all large file transfers (0 = unlimited)
+  int pace_threshold;       // KiB; file bodies up to this size are never paced
+  int slow_ms;              // Duration from which a request counts as slow
 } server_config_t;          // End of server_config_t structure definition
 
+#define TIMER_HEADER 1 // Connection timer phase: waiting for the request head
+#define TIMER_SEND 2   // Connection timer phase: sending the response
+
+// A connection's deadline in the timer wheel (see timer_wheel_thread)
+typedef struct conn_timer                // Defines a structure for one connection timer
+{                                        // Start of conn_timer_t structure definition
+  struct conn_timer *prev, *next;        // Links in the wheel slot list (NULL while not in the wheel)
+  long long expires;                     // Tick the timer is filed under (only read/written under the wheel lock)
+  atomic_llong deadline;                 // Tick the connection actually expires at (may move later without the lock)
+  atomic_int phase;                      // TIMER_HEADER or TIMER_SEND
+  atomic_int queued;                     // Send queue length at the last progress (the client drains it by reading)
+  sock_t fd;                             // The connection's socket
+} conn_timer_t;                          // End of conn_timer_t structure definition
+
 typedef struct                  // Defines a structure to hold client context information
 {                               // Start of client_ctx_t structure definition
   sock_t client;                // The client's socket descriptor
   struct sockaddr_storage addr; // The client's address information
   socklen_t addrlen;            // The length of the client's address structure
   server_config_t *cfg;         // A pointer to the server's configuration
+  unsigned long long id;        // Connection number (for tracing probes)
+  conn_timer_t timer;           // Header / send-progress deadline
+  struct rate_entry *rate;      // Rate table entry holding this connection (NULL if none)
 } client_ctx_t;                 // End of client_ctx_t structure definition
 
+// Request headers the server acts on (everything else is ignored)
+typedef struct                       // Defines a structure to hold the interesting request header values
+{                                    // Start of request_headers_t structure definition
+  char if_none_match[SMALL_BUF];     // Raw If-None-Match value, empty string if the header is absent
+  char if_modified_since[SMALL_BUF]; // Raw If-Modified-Since value, empty string if the header is absent
+  char accept_encoding[SMALL_BUF];   // Raw Accept-Encoding value, empty string if the header is absent
+  char referer[SMALL_BUF];           // Referer value (for the access log), empty string if absent
+  char user_agent[SMALL_BUF];        // User-Agent value (for the access log), empty string if absent
+} request_headers_t;                 // End of request_headers_t structure definition
+
 /* Utility: trim leading/trailing whitespace from a mutable C string in-place */
 static char *strtrim(char *s)                     // Defines a function to trim whitespace from a string
 {                                                 // Start of strtrim function body
@@ -293,15 +515,387 @@ static int map_url_to_fs(const server_config_t *cfg, const char *request_path, c
   return 0; // Return 0 to indicate success
 } // End of map_url_to_fs function body
 
-/* Format current time in RFC 1123 format for HTTP Date header */
-static void http_date_now(char out[SMALL_BUF])                 // Defines a function to get the current time in HTTP date format
-{                                                              // Start of http_date_now function body
-  time_t t = time(NULL);                                       // Get the current time as a time_t value
+/* Format a time_t in RFC 1123 format (used for Date and Last-Modified headers) */
+static void http_date_fmt(time_t t, char out[SMALL_BUF])       // Defines a function to format a time in HTTP date format
+{                                                              // Start of http_date_fmt function body
   struct tm tmv;                                               // Declare a tm structure to hold the broken-down time
   gmtime_r(&t, &tmv);                                          // Convert the time_t value to a UTC time structure
   strftime(out, SMALL_BUF, "%a, %d %b %Y %H:%M:%S GMT", &tmv); // Format the time into the specified string format
+} // End of http_date_fmt function body
+
+/* Format current time in RFC 1123 format for HTTP Date header */
+static void http_date_now(char out[SMALL_BUF]) // Defines a function to get the current time in HTTP date format
+{                                              // Start of http_date_now function body
+  http_date_fmt(time(NULL), out);              // Format the current time
 } // End of http_date_now function body
 
+/* Parse an HTTP date as sent in If-Modified-Since, in any of the three formats RFC 9110 requires recipients
+   to accept: IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT"), RFC 850 ("Sunday, 06-Nov-94 08:49:37 GMT") and
+   asctime ("Sun Nov  6 08:49:37 1994"). Out-of-range fields are rejected rather than normalised by timegm()
+   Returns 0 on success and stores the UTC time in *out, -1 if the date is malformed */
+static int http_date_parse(const char *s, time_t *out)                                            // Defines a function to parse an HTTP date
+{                                                                                                 // Start of http_date_parse function body
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";                            // Month abbreviations in calendar order
+  char wday[10], mon[4];                                                                          // Buffers for the weekday and month names
+  int day, year, hh, mm, ss;                                                                      // Numeric date and time fields
+  if (sscanf(s, "%3[A-Za-z], %d %3s %d %d:%d:%d", wday, &day, mon, &year, &hh, &mm, &ss) == 7)    // IMF-fixdate
+    ;                                                                                             // has every field in place
+  else if (sscanf(s, "%9[A-Za-z], %d-%3[A-Za-z]-%d %d:%d:%d", wday, &day, mon, &year, &hh, &mm, &ss) == 7) // RFC 850
+  {                                                                                               // Start of else if block
+    if (year < 0 || year > 99)                                                                    // It carries a two-digit year
+      return -1;                                                                                  // and nothing else
+    struct tm nowtm;                                                                              // Declare a tm structure for the current date
+    time_t now = time(NULL);                                                                      // Current time
+    gmtime_r(&now, &nowtm);                                                                       // in UTC
+    int cur = nowtm.tm_year + 1900;                                                               // Current year
+    year += cur - cur % 100;                                                                      // Put the year in the current century
+    if (year > cur + 50)                                                                          // More than 50 years ahead means
+      year -= 100;                                                                                // the same two digits in the past century
+  } // End of else if block
+  else if (sscanf(s, "%3[A-Za-z] %3s %d %d:%d:%d %d", wday, mon, &day, &hh, &mm, &ss, &year) != 7) // asctime
+    return -1;                                                                                    // If no format fits, the date is malformed
+  const char *m = strstr(months, mon);                                                            // Look up the month name
+  if (!m || strlen(mon) != 3 || (m - months) % 3 != 0)                                            // If the month is unknown or matched across two names
+    return -1;                                                                                    // the date is malformed
+  if (day < 1 || day > 31 || hh < 0 || hh > 23 || mm < 0 || mm > 59 || ss < 0 || ss > 60 || year < 1900) // Check field ranges (60 is a leap second)
+    return -1;                                                                                    // the date is malformed
+  struct tm tmv;                                                                                  // Declare a tm structure for the broken-down time
+  memset(&tmv, 0, sizeof(tmv));                                                                   // Zero out the structure
+  tmv.tm_mday = day;                                                                              // Day of the month
+  tmv.tm_mon = (int)((m - months) / 3);                                                           // Month index (0-11)
+  tmv.tm_year = year - 1900;                                                                      // Years since 1900
+  tmv.tm_hour = hh;                                                                               // Hours
+  tmv.tm_min = mm;                                                                                // Minutes
+  tmv.tm_sec = ss < 60 ? ss : 59;                                                                 // Seconds (a leap second counts as :59)
+  time_t t = timegm(&tmv);                                                                        // Convert the UTC broken-down time to a time_t
+  if (t == (time_t)-1)                                                                            // If the conversion fails
+    return -1;                                                                                    // the date is out of range
+  if (tmv.tm_mday != day)                                                                         // If timegm() moved the day (e.g. 31 Apr or 29 Feb of a common year)
+    return -1;                                                                                    // the day does not exist in that month
+  *out = t;                                                                                       // Store the parsed time
+  return 0;                                                                                       // Return 0 to indicate success
+} // End of http_date_parse function body
+
+/* Build a strong ETag from file identity: inode, size and modification time (ns), quoted, in hex */
+static void make_etag(const struct stat *st, char out[MAX_ETAG_LEN])                                     // Defines a function to build an ETag from stat data
+{                                                                                                        // Start of make_etag function body
+  unsigned long long mtime_ns = (unsigned long long)st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec; // Modification time in nanoseconds
+  snprintf(out, MAX_ETAG_LEN, "\"%llx-%llx-%llx\"",                                                      // Format the ETag as "inode-size-mtime"
+           (unsigned long long)st->st_ino, (unsigned long long)st->st_size, mtime_ns);
+} // End of make_etag function body
+
+/* Check an If-None-Match header value against our ETag
+   The value is "*" or a comma-separated list of entity tags; weak comparison is used (W/ prefixes ignored)
+   Returns 1 if any listed tag matches, else 0 */
+static int etag_list_matches(const char *list, const char *etag) // Defines a function to match an ETag against an If-None-Match list
+{                                                                // Start of etag_list_matches function body
+  size_t elen = strlen(etag);                                    // Get the length of our ETag
+  const char *p = list;                                          // Create a pointer to walk the list
+  while (*p)                                                     // Loop over every entry of the list
+  {                                                              // Start of while loop body
+    while (*p == ' ' || *p == '\t' || *p == ',')                 // Skip separators and whitespace
+      p++;                                                       // Move to the next character
+    if (*p == '\0')                                              // If the list is exhausted
+      break;                                                     // stop looking
+    if (*p == '*')                                               // "*" matches any current representation
+      return 1;                                                  // so the resource matches
+    if (p[0] == 'W' && p[1] == '/')                              // If the tag is weak
+      p += 2;                                                    // compare only its opaque part
+    const char *start = p;                                       // Remember where this tag starts
+    if (*p == '"')                                               // If the tag is quoted (as it should be)
+    {                                                            // Start of if block
+      p = strchr(p + 1, '"');                                    // find the closing quote
+      p = p ? p + 1 : start + strlen(start);                     // and step past it (or to the end if unterminated)
+    } // End of if block
+    else                                                         // Otherwise
+    {                                                            // Start of else block
+      while (*p && *p != ',' && *p != ' ' && *p != '\t')         // consume an unquoted token
+        p++;                                                     // Move to the next character
+    } // End of else block
+    if ((size_t)(p - start) == elen && !memcmp(start, etag, elen)) // If this tag equals ours
+      return 1;                                                  // the resource matches
+  } // End of while loop body
+  return 0; // No listed tag matched
+} // End of etag_list_matches function body
+
+/* XXH64 (xxHash, 64-bit variant): a fast non-cryptographic hash used for content ETags and cache keys
+   Reads input as little-endian 64-bit lanes, as the reference implementation does on x86/ARM */
+#define XXH_P1 11400714785074694791ULL // First xxHash64 prime
+#define XXH_P2 14029467366897019727ULL // Second xxHash64 prime
+#define XXH_P3 1609587929392839161ULL  // Third xxHash64 prime
+#define XXH_P4 9650029242287828579ULL  // Fourth xxHash64 prime
+#define XXH_P5 2870177450012600261ULL  // Fifth xxHash64 prime
+
+static uint64_t xxh_rotl(uint64_t x, int r) // Defines a 64-bit rotate-left helper
+{                                           // Start of xxh_rotl function body
+  return (x << r) | (x >> (64 - r));        // Rotate the bits left by r positions
+} // End of xxh_rotl function body
+
+static uint64_t xxh_round(uint64_t acc, uint64_t lane) // Defines one xxHash accumulation round
+{                                                      // Start of xxh_round function body
+  acc += lane * XXH_P2;                                // Mix the input lane into the accumulator
+  acc = xxh_rotl(acc, 31);                             // Rotate the accumulator
+  return acc * XXH_P1;                                 // Multiply by the first prime
+} // End of xxh_round function body
+
+static uint64_t xxh_merge(uint64_t h, uint64_t acc) // Defines the accumulator merge step
+{                                                   // Start of xxh_merge function body
+  h ^= xxh_round(0, acc);                           // Fold a scrambled accumulator into the hash
+  return h * XXH_P1 + XXH_P4;                       // and mix
+} // End of xxh_merge function body
+
+static uint64_t xxh64(const void *data, size_t len, uint64_t seed) // Defines a function to compute XXH64 of a buffer
+{                                                                  // Start of xxh64 function body
+  const unsigned char *p = (const unsigned char *)data;            // Create a pointer to walk the input
+  const unsigned char *end = p + len;                              // Remember where the input ends
+  uint64_t h, lane;                                                // Declare the hash and a scratch lane
+  if (len >= 32)                                                   // If there is at least one full 32-byte stripe
+  {                                                                // Start of if block
+    uint64_t v1 = seed + XXH_P1 + XXH_P2, v2 = seed + XXH_P2;      // Initialize the first two accumulators
+    uint64_t v3 = seed, v4 = seed - XXH_P1;                        // Initialize the last two accumulators
+    do                                                             // Consume 32 bytes per iteration, one lane per accumulator
+    {                                                              // Start of do loop body
+      memcpy(&lane, p, 8);                                         // Load lane 1
+      v1 = xxh_round(v1, lane);                                    // and mix it
+      memcpy(&lane, p + 8, 8);                                     // Load lane 2
+      v2 = xxh_round(v2, lane);                                    // and mix it
+      memcpy(&lane, p + 16, 8);                                    // Load lane 3
+      v3 = xxh_round(v3, lane);                                    // and mix it
+      memcpy(&lane, p + 24, 8);                                    // Load lane 4
+      v4 = xxh_round(v4, lane);                                    // and mix it
+      p += 32;                                                     // Advance to the next stripe
+    } while (p + 32 <= end);                                       // Stop when less than a full stripe remains
+    h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18); // Converge the accumulators
+    h = xxh_merge(h, v1);                                          // Merge accumulator 1
+    h = xxh_merge(h, v2);                                          // Merge accumulator 2
+    h = xxh_merge(h, v3);                                          // Merge accumulator 3
+    h = xxh_merge(h, v4);                                          // Merge accumulator 4
+  } // End of if block
+  else                // For short inputs
+    h = seed + XXH_P5; // start from the seed directly
+  h += (uint64_t)len; // Mix in the total length
+  while (p + 8 <= end) // Consume remaining 8-byte lanes
+  {                    // Start of while loop body
+    memcpy(&lane, p, 8);                             // Load the lane
+    h ^= xxh_round(0, lane);                         // Mix it in
+    h = xxh_rotl(h, 27) * XXH_P1 + XXH_P4;           // and scramble
+    p += 8;                                          // Advance past the lane
+  } // End of while loop body
+  if (p + 4 <= end) // Consume a remaining 4-byte word
+  {                 // Start of if block
+    uint32_t w;                                      // Declare the 32-bit word
+    memcpy(&w, p, 4);                                // Load it
+    h ^= (uint64_t)w * XXH_P1;                       // Mix it in
+    h = xxh_rotl(h, 23) * XXH_P2 + XXH_P3;           // and scramble
+    p += 4;                                          // Advance past the word
+  } // End of if block
+  while (p < end) // Consume the last few bytes one at a time
+  {               // Start of while loop body
+    h ^= (uint64_t)(*p) * XXH_P5;                    // Mix the byte in
+    h = xxh_rotl(h, 11) * XXH_P1;                    // and scramble
+    p++;                                             // Advance past the byte
+  } // End of while loop body
+  h ^= h >> 33; // Final avalanche: spread every input bit over the whole hash
+  h *= XXH_P2;  // Multiply by the second prime
+  h ^= h >> 29; // Shift-xor again
+  h *= XXH_P3;  // Multiply by the third prime
+  h ^= h >> 32; // Final shift-xor
+  return h;     // Return the hash
+} // End of xxh64 function body
+
+/* File info cache: per-file stat identity plus derived data (content digest, precompressed siblings), shared by all threads
+   Direct-mapped by a hash of the filesystem path; a slot is only trusted when its dev/inode/size/mtime
+   match a fresh stat(), so a changed file (or a path hash collision) simply invalidates the slot */
+#define DIGEST_NONE 0    // No digest is known for this slot
+#define DIGEST_PENDING 1 // A hashing job is queued or running
+#define DIGEST_READY 2   // The digest matches the recorded stat identity
+
+typedef struct          // Defines a structure for one file info cache slot
+{                       // Start of file_info_t structure definition
+  uint64_t key;         // Hash of the filesystem path that owns this slot (0 = empty)
+  dev_t dev;            // Device of the cached file
+  ino_t ino;            // Inode of the cached file
+  off_t size;           // Size of the cached file
+  long long mtime_ns;   // Modification time of the cached file in nanoseconds
+  uint64_t digest;      // XXH64 of the file contents, valid when digest_state == DIGEST_READY
+  int digest_state;     // DIGEST_NONE, DIGEST_PENDING or DIGEST_READY
+  int sib_mask;         // Which precompressed siblings (ENC_GZIP/ENC_BR) exist next to the file
+  time_t sib_checked;   // When sib_mask was last refreshed from disk (0 = never)
+} file_info_t;          // End of file_info_t structure definition
+
+static file_info_t file_cache[FILE_CACHE_SLOTS];               // The cache slots
+static pthread_mutex_t file_cache_locks[FILE_CACHE_LOCKS];     // Lock stripes; slot i is guarded by lock i % FILE_CACHE_LOCKS
+
+// Background hashing job queue (paths waiting to be hashed); a ring buffer guarded by a mutex/condvar pair
+static struct                       // Defines the hashing service state
+{                                   // Start of hash service structure definition
+  pthread_mutex_t lock;             // Guards the ring buffer
+  pthread_cond_t ready;             // Signaled when a job is queued
+  char *jobs[HASH_QUEUE_LEN];       // Queued paths (heap copies owned by the queue)
+  size_t head, count;               // Index of the oldest job and the number of queued jobs
+} hash_service = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, {0}, 0, 0}; // Statically initialized hashing service
+
+static long long stat_mtime_ns(const struct stat *st)                                 // Defines a helper to get a stat's mtime in nanoseconds
+{                                                                                     // Start of stat_mtime_ns function body
+  return (long long)st->st_mtim.tv_sec * 1000000000LL + (long long)st->st_mtim.tv_nsec; // Combine seconds and nanoseconds
+} // End of stat_mtime_ns function body
+
+/* Return 1 if a cache slot describes exactly the file identified by 'st' */
+static int file_info_matches(const file_info_t *fi, uint64_t key, const struct stat *st) // Defines a function to validate a cache slot
+{                                                                                        // Start of file_info_matches function body
+  return fi->key == key && fi->dev == st->st_dev && fi->ino == st->st_ino &&             // Same path and same inode
+         fi->size == st->st_size && fi->mtime_ns == stat_mtime_ns(st);                   // and unchanged size and mtime
+} // End of file_info_matches function body
+
+/* Locate the slot and lock stripe for a path. Returns the path's cache key */
+static uint64_t file_cache_slot(const char *path, file_info_t **fi, pthread_mutex_t **lk) // Defines a function to find a path's cache slot
+{                                                                                        // Start of file_cache_slot function body
+  uint64_t key = xxh64(path, strlen(path), 0);                                           // Compute the cache key for the path
+  *fi = &file_cache[key % FILE_CACHE_SLOTS];                                             // Find the slot for the path
+  *lk = &file_cache_locks[(key % FILE_CACHE_SLOTS) % FILE_CACHE_LOCKS];                  // Find the slot's lock stripe
+  return key;                                                                            // Return the key
+} // End of file_cache_slot function body
+
+/* Make a slot describe the file identified by 'st', discarding any derived data if it did not already
+   Must be called with the slot's lock held */
+static void file_cache_claim(file_info_t *fi, uint64_t key, const struct stat *st) // Defines a function to (re)claim a cache slot
+{                                                                                  // Start of file_cache_claim function body
+  if (file_info_matches(fi, key, st))                                              // If the slot already describes this exact file
+    return;                                                                        // its derived data is still valid
+  fi->key = key;                                                                   // Claim the slot for this path
+  fi->dev = st->st_dev;                                                            // Record the device
+  fi->ino = st->st_ino;                                                            // Record the inode
+  fi->size = st->st_size;                                                          // Record the size
+  fi->mtime_ns = stat_mtime_ns(st);                                                // Record the modification time
+  fi->digest_state = DIGEST_NONE;                                                  // Forget any previous digest
+  fi->sib_checked = 0;                                                             // and any previous sibling scan
+} // End of file_cache_claim function body
+
+/* Initialize the file info cache lock stripes (called once from main) */
+static void file_cache_init(void)                    // Defines a function to initialize the file info cache
+{                                                    // Start of file_cache_init function body
+  for (int i = 0; i < FILE_CACHE_LOCKS; i++)         // Loop over every lock stripe
+    pthread_mutex_init(&file_cache_locks[i], NULL);  // and initialize it
+} // End of file_cache_init function body
+
+/* Queue a path for background hashing. Returns 0 if queued, -1 if the queue is full */
+static int hash_service_enqueue(const char *path)               // Defines a function to queue a hashing job
+{                                                               // Start of hash_service_enqueue function body
+  char *copy = strdup(path);                                    // Copy the path; the queue owns the copy
+  if (!copy)                                                    // If allocation fails
+    return -1;                                                  // report the job as dropped
+  pthread_mutex_lock(&hash_service.lock);                       // Lock the queue
+  if (hash_service.count == HASH_QUEUE_LEN)                     // If the queue is full
+  {                                                             // Start of if block
+    pthread_mutex_unlock(&hash_service.lock);                   // unlock it
+    free(copy);                                                 // discard the copy
+    return -1;                                                  // and report the job as dropped
+  } // End of if block
+  hash_service.jobs[(hash_service.head + hash_service.count) % HASH_QUEUE_LEN] = copy; // Append the job at the tail
+  hash_service.count++;                                         // Count the new job
+  pthread_cond_signal(&hash_service.ready);                     // Wake the hashing thread
+  pthread_mutex_unlock(&hash_service.lock);                     // Unlock the queue
+  return 0;                                                     // Return 0 to indicate success
+} // End of hash_service_enqueue function body
+
+/* Hash one file and publish the digest if the file did not change while it was being read */
+static void hash_service_run_job(const char *path)                          // Defines a function to hash one queued file
+{                                                                           // Start of hash_service_run_job function body
+  file_info_t *fi;                                                          // Declare a pointer to the path's cache slot
+  pthread_mutex_t *lk;                                                      // Declare a pointer to the slot's lock stripe
+  uint64_t key = file_cache_slot(path, &fi, &lk);                           // Find the slot for the path
+  struct stat before, after;                                                // Declare stat structures taken around the read
+  uint64_t digest = 0;                                                      // Initialize the digest
+  int ok = 0;                                                               // Initialize a flag indicating a usable digest
+  int fd = open(path, O_RDONLY);                                            // Open the file for reading
+  if (fd >= 0 && fstat(fd, &before) == 0 && S_ISREG(before.st_mode))        // If it opened and is a regular file
+  {                                                                         // Start of if block
+    if (before.st_size == 0)                                                // An empty file cannot be mapped
+    {                                                                       // Start of if block
+      digest = xxh64("", 0, 0);                                             // so hash the empty input
+      ok = 1;                                                               // and mark the digest usable
+    } // End of if block
+    else                                                                    // Otherwise
+    {                                                                       // Start of else block
+      void *m = mmap(NULL, (size_t)before.st_size, PROT_READ, MAP_PRIVATE, fd, 0); // map the whole file
+      if (m != MAP_FAILED)                                                  // If mapping succeeds
+      {                                                                     // Start of if block
+        digest = xxh64(m, (size_t)before.st_size, 0);                       // hash the contents
+        munmap(m, (size_t)before.st_size);                                  // Unmap the file
+        ok = 1;                                                             // Mark the digest usable
+      } // End of if block
+    } // End of else block
+    if (ok && (fstat(fd, &after) != 0 || after.st_size != before.st_size || stat_mtime_ns(&after) != stat_mtime_ns(&before))) // If the file changed while we read it
+      ok = 0;                                                               // the digest cannot be trusted
+  } // End of if block
+  if (fd >= 0)  // If the file was opened
+    close(fd);  // close it
+
+  pthread_mutex_lock(lk);                                 // Lock the slot
+  if (fi->digest_state == DIGEST_PENDING && fi->key == key) // If the slot is still waiting for this path
+  {                                                       // Start of if block
+    if (ok && file_info_matches(fi, key, &before))        // If the digest belongs to the identity recorded in the slot
+    {                                                     // Start of if block
+      fi->digest = digest;                                // publish the digest
+      fi->digest_state = DIGEST_READY;                    // and mark it ready
+    } // End of if block
+    else                                                  // Otherwise (file changed or vanished)
+      fi->digest_state = DIGEST_NONE;                     // let the next request queue a fresh job
+  } // End of if block
+  pthread_mutex_unlock(lk); // Unlock the slot
+} // End of hash_service_run_job function body
+
+/* Background hashing thread: waits for queued paths and hashes them one at a time */
+static void *hash_service_thread(void *arg)                           // Defines the entry point of the hashing thread
+{                                                                     // Start of hash_service_thread function body
+  (void)arg;                                                          // The thread takes no argument
+  for (;;)                                                            // Loop forever
+  {                                                                   // Start of for loop body
+    pthread_mutex_lock(&hash_service.lock);                           // Lock the queue
+    while (hash_service.count == 0)                                   // While there is nothing to do
+      pthread_cond_wait(&hash_service.ready, &hash_service.lock);     // sleep until a job arrives
+    char *path = hash_service.jobs[hash_service.head];                // Take the oldest job
+    hash_service.head = (hash_service.head + 1) % HASH_QUEUE_LEN;     // Advance the head
+    hash_service.count--;                                             // Count the job as taken
+    pthread_mutex_unlock(&hash_service.lock);                         // Unlock the queue before doing the slow work
+    hash_service_run_job(path);                                       // Hash the file
+    free(path);                                                       // Free the job's path
+  } // End of for loop body
+  return NULL; // Never reached
+} // End of hash_service_thread function body
+
+/* Produce a content-hash ETag for 'path' if its digest is cached and current
+   Never hashes on the calling thread: on a miss the slot is (re)claimed for the new stat identity
+   and a background job is queued. Returns 1 if out was filled, 0 if no digest is available yet */
+static int content_etag(const char *path, const struct stat *st, char out[MAX_ETAG_LEN]) // Defines a function to look up a content-hash ETag
+{                                                                                       // Start of content_etag function body
+  file_info_t *fi;                                                                      // Declare a pointer to the path's cache slot
+  pthread_mutex_t *lk;                                                                  // Declare a pointer to the slot's lock stripe
+  uint64_t key = file_cache_slot(path, &fi, &lk);                                       // Find the slot for the path
+  int have = 0, queue = 0;                                                              // Flags: digest available, job needed
+  pthread_mutex_lock(lk);                                                               // Lock the slot
+  file_cache_claim(fi, key, st);                                                        // Make sure the slot describes this exact file
+  if (fi->digest_state == DIGEST_READY)                                                 // If its digest is ready
+  {                                                                                     // Start of if block
+    snprintf(out, MAX_ETAG_LEN, "\"%016llx\"", (unsigned long long)fi->digest);         // format the ETag from it
+    have = 1;                                                                           // and report success
+  } // End of if block
+  else if (fi->digest_state == DIGEST_NONE)                                             // If no job is outstanding
+    queue = 1;                                                                          // request one
+  if (queue)                                                                            // If a job is needed
+    fi->digest_state = DIGEST_PENDING;                                                  // mark it outstanding before queueing
+  pthread_mutex_unlock(lk);                                                             // Unlock the slot
+
+  if (queue && hash_service_enqueue(path) != 0) // If the job could not be queued
+  {                                             // Start of if block
+    pthread_mutex_lock(lk);                     // relock the slot
+    if (fi->key == key && fi->digest_state == DIGEST_PENDING) // If the slot still belongs to this path
+      fi->digest_state = DIGEST_NONE;           // allow a later request to retry
+    pthread_mutex_unlock(lk);                   // Unlock the slot
+  } // End of if block
+  return have; // Report whether the ETag was produced
+} // End of content_etag function body
+
 /* Guess MIME type based on file extension. Falls back to application/octet-stream */
 static void guess_mime_type(const char *path, char out[MAX_MIME_LEN]) // Defines a function to guess the MIME type from a file extension
 {                                                                     // Start of guess_mime_type function body
@@ -341,21 +935,833 @@ static void guess_mime_type(const char *path, char out[MAX_MIME_LEN]) // Defines
     strcpy(out, "application/octet-stream");                    // default to a generic binary stream type
 } // End of guess_mime_type function body
 
-/* Send all bytes in buffer reliably over a blocking socket. Returns 0 on success, -1 on error */
+/* Report which precompressed siblings (path.gz, path.br) exist, as a mask of ENC_GZIP/ENC_BR
+   The answer is kept in the file info cache for SIBLING_TTL seconds (or until the file itself changes),
+   so the common case costs no extra stat() calls */
+static int precompressed_siblings(const char *path, const struct stat *st) // Defines a function to look up precompressed siblings
+{                                                                         // Start of precompressed_siblings function body
+  file_info_t *fi;                                                        // Declare a pointer to the path's cache slot
+  pthread_mutex_t *lk;                                                    // Declare a pointer to the slot's lock stripe
+  uint64_t key = file_cache_slot(path, &fi, &lk);                         // Find the slot for the path
+  time_t now = time(NULL);                                                // Get the current time
+  pthread_mutex_lock(lk);                                                 // Lock the slot
+  file_cache_claim(fi, key, st);                                          // Make sure the slot describes this exact file
+  if (fi->sib_checked != 0 && now - fi->sib_checked < SIBLING_TTL)        // If the cached scan is fresh
+  {                                                                       // Start of if block
+    int mask = fi->sib_mask;                                              // take its answer
+    pthread_mutex_unlock(lk);                                             // Unlock the slot
+    return mask;                                                          // and return it
+  } // End of if block
+  pthread_mutex_unlock(lk); // Unlock the slot before touching the disk
+
+  int mask = 0;                                               // Initialize the sibling mask
+  char sib[PATH_MAX];                                         // Declare a buffer for the sibling path
+  struct stat sst;                                            // Declare a stat structure for the sibling
+  snprintf(sib, sizeof(sib), "%s.br", path);                  // Build the Brotli sibling path
+  if (stat(sib, &sst) == 0 && S_ISREG(sst.st_mode) && stat_mtime_ns(&sst) >= stat_mtime_ns(st)) // If it exists and is not older than the original
+    mask |= ENC_BR;                                           // record it
+  snprintf(sib, sizeof(sib), "%s.gz", path);                  // Build the gzip sibling path
+  if (stat(sib, &sst) == 0 && S_ISREG(sst.st_mode) && stat_mtime_ns(&sst) >= stat_mtime_ns(st)) // If it exists and is not older than the original
+    mask |= ENC_GZIP;                                         // record it
+
+  pthread_mutex_lock(lk);                  // Relock the slot
+  if (file_info_matches(fi, key, st))      // If it still describes this file
+  {                                        // Start of if block
+    fi->sib_mask = mask;                   // store the scan result
+    fi->sib_checked = now;                 // and when it was taken
+  } // End of if block
+  pthread_mutex_unlock(lk); // Unlock the slot
+  return mask;              // Return the mask
+} // End of precompressed_siblings function body
+
+/* Forget a cached sibling scan (used when a sibling turned out to be missing or stale) */
+static void precompressed_siblings_invalidate(const char *path) // Defines a function to drop a cached sibling scan
+{                                                               // Start of precompressed_siblings_invalidate function body
+  file_info_t *fi;                                              // Declare a pointer to the path's cache slot
+  pthread_mutex_t *lk;                                          // Declare a pointer to the slot's lock stripe
+  uint64_t key = file_cache_slot(path, &fi, &lk);               // Find the slot for the path
+  pthread_mutex_lock(lk);                                       // Lock the slot
+  if (fi->key == key)                                           // If the slot belongs to this path
+    fi->sib_checked = 0;                                        // force a fresh scan next time
+  pthread_mutex_unlock(lk);                                     // Unlock the slot
+} // End of precompressed_siblings_invalidate function body
+
+/* Check whether an Accept-Encoding value admits a content coding (e.g. "gzip")
+   Honors q-values ("gzip;q=0" refuses gzip) and the "*" wildcard. Returns 1 if acceptable, else 0 */
+static int accepts_encoding(const char *ae, const char *coding) // Defines a function to evaluate Accept-Encoding
+{                                                               // Start of accepts_encoding function body
+  size_t clen = strlen(coding);                                 // Get the length of the coding name
+  int star = 0;                                                 // Initialize the wildcard verdict (0 = no wildcard seen)
+  const char *p = ae;                                           // Create a pointer to walk the list
+  while (*p)                                                    // Loop over every list element
+  {                                                             // Start of while loop body
+    while (*p == ' ' || *p == '\t' || *p == ',')                // Skip separators and whitespace
+      p++;                                                      // Move to the next character
+    const char *tok = p;                                        // Remember where the coding name starts
+    while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') // Find the end of the coding name
+      p++;                                                      // Move to the next character
+    size_t tlen = (size_t)(p - tok);                            // Get the length of the coding name
+    double q = 1.0;                                             // The default quality is 1
+    while (*p && *p != ',')                                     // Scan the element's parameters
+    {                                                           // Start of while loop body
+      if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=')          // If this is the quality parameter
+        q = atof(p + 2);                                        // read its value
+      p++;                                                      // Move to the next character
+    } // End of while loop body
+    if (tlen == clen && !strncasecmp(tok, coding, clen))        // If this element names the coding
+      return q > 0;                                             // its quality decides
+    if (tlen == 1 && *tok == '*')                               // If this element is the wildcard
+      star = q > 0 ? 1 : -1;                                    // remember its verdict
+  } // End of while loop body
+  return star > 0; // Unlisted codings are acceptable only through a positive wildcard
+} // End of accepts_encoding function body
+
+/* gzip encoder (RFC 1951 deflate in RFC 1952 framing) used by the background compression cache
+   LZ77 over a 32 KiB window with hash chains, emitted as one block of fixed Huffman codes.
+   Fixed codes compress text slightly worse than zlib's dynamic trees but need no code-length
+   tables, which keeps the encoder small enough to live in this file */
+static uint32_t crc32_table[256]; // CRC-32 lookup table (filled by gzip_init)
+
+static void gzip_init(void)                                     // Defines a function to build the CRC-32 table
+{                                                               // Start of gzip_init function body
+  for (uint32_t n = 0; n < 256; n++)                            // Loop over every byte value
+  {                                                             // Start of for loop body
+    uint32_t c = n;                                             // Start from the byte value
+    for (int k = 0; k < 8; k++)                                 // Process each bit
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;            // using the reflected IEEE polynomial
+    crc32_table[n] = c;                                         // Store the table entry
+  } // End of for loop body
+} // End of gzip_init function body
+
+typedef struct        // Defines a structure for writing a little-endian bit stream
+{                     // Start of bitwriter_t structure definition
+  unsigned char *out; // Output buffer (sized by the caller for the worst case)
+  size_t len, cap;    // Bytes written and buffer capacity
+  uint64_t bits;      // Pending bits, least significant first
+  int nbits;          // Number of pending bits
+} bitwriter_t;        // End of bitwriter_t structure definition
+
+static void bw_put(bitwriter_t *bw, uint32_t v, int n) // Defines a function to append n bits (LSB first)
+{                                                      // Start of bw_put function body
+  bw->bits |= (uint64_t)v << bw->nbits;                // Queue the bits after the pending ones
+  bw->nbits += n;                                      // Count them
+  while (bw->nbits >= 8 && bw->len < bw->cap)          // Flush whole bytes
+  {                                                    // Start of while loop body
+    bw->out[bw->len++] = (unsigned char)bw->bits;      // Write the lowest byte
+    bw->bits >>= 8;                                    // Drop it from the queue
+    bw->nbits -= 8;                                    // and from the count
+  } // End of while loop body
+} // End of bw_put function body
+
+static void bw_put_code(bitwriter_t *bw, uint32_t code, int n) // Defines a function to append a Huffman code
+{                                                              // Start of bw_put_code function body
+  uint32_t rev = 0;                                            // Huffman codes are defined MSB first,
+  for (int i = 0; i < n; i++)                                  // so reverse the code's bits
+    rev |= ((code >> i) & 1u) << (n - 1 - i);                  // one at a time
+  bw_put(bw, rev, n);                                          // before appending them
+} // End of bw_put_code function body
+
+static void deflate_literal(bitwriter_t *bw, int sym) // Defines a function to emit a literal/length symbol with the fixed code
+{                                                     // Start of deflate_literal function body
+  if (sym < 144)                                      // Symbols 0-143 use 8-bit codes
+    bw_put_code(bw, 0x30u + (uint32_t)sym, 8);        // starting at 00110000
+  else if (sym < 256)                                 // Symbols 144-255 use 9-bit codes
+    bw_put_code(bw, 0x190u + (uint32_t)(sym - 144), 9); // starting at 110010000
+  else if (sym < 280)                                 // Symbols 256-279 use 7-bit codes
+    bw_put_code(bw, (uint32_t)(sym - 256), 7);        // starting at 0000000
+  else                                                // Symbols 280-287 use 8-bit codes
+    bw_put_code(bw, 0xC0u + (uint32_t)(sym - 280), 8); // starting at 11000000
+} // End of deflate_literal function body
+
+static void deflate_match(bitwriter_t *bw, int len, int dist) // Defines a function to emit a length/distance pair
+{                                                             // Start of deflate_match function body
+  static const int len_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                   35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258}; // Base lengths of codes 257-285
+  static const int len_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};                 // Extra bits of codes 257-285
+  static const int dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                    513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577}; // Base distances of codes 0-29
+  static const int dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+                                     8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};                         // Extra bits of codes 0-29
+  int lc = 28;                                                 // Find the length code, searching from the top
+  while (len_base[lc] > len)                                   // until its base fits
+    lc--;                                                      // Try the next lower code
+  deflate_literal(bw, 257 + lc);                               // Emit the length symbol
+  bw_put(bw, (uint32_t)(len - len_base[lc]), len_extra[lc]);   // and its extra bits
+  int dc = 29;                                                 // Find the distance code the same way
+  while (dist_base[dc] > dist)                                 // until its base fits
+    dc--;                                                      // Try the next lower code
+  bw_put_code(bw, (uint32_t)dc, 5);                            // Emit the 5-bit distance code
+  bw_put(bw, (uint32_t)(dist - dist_base[dc]), dist_extra[dc]); // and its extra bits
+} // End of deflate_match function body
+
+/* Compress 'len' bytes into a newly allocated gzip member. Returns the buffer (length in *out_len) or NULL on failure */
+static unsigned char *gzip_compress(const unsigned char *in, size_t len, size_t *out_len) // Defines a function to gzip a buffer
+{                                                                                        // Start of gzip_compress function body
+  enum { WBITS = 15, WSIZE = 1 << WBITS, WMASK = WSIZE - 1, HBITS = 15, MAX_CHAIN = 64, MAX_MATCH = 258 }; // LZ77 parameters
+  bitwriter_t bw = {0};                                                                  // Initialize the bit writer
+  bw.cap = 10 + len + len / 8 + 64 + 8;                                                  // Worst case: header, 9 bits per byte, slack, trailer
+  bw.out = (unsigned char *)malloc(bw.cap);                                              // Allocate the output buffer
+  int32_t *head = (int32_t *)malloc(sizeof(int32_t) << HBITS);                           // Most recent position for each 3-byte hash
+  int32_t *prev = (int32_t *)malloc(sizeof(int32_t) * WSIZE);                            // Previous position with the same hash, per window slot
+  if (!bw.out || !head || !prev || len > INT32_MAX)                                      // If allocation fails or the input is too large
+  {                                                                                      // Start of if block
+    free(bw.out);                                                                        // free everything
+    free(head);                                                                          // that was allocated
+    free(prev);                                                                          // so far
+    return NULL;                                                                         // and report failure
+  } // End of if block
+  for (int i = 0; i < (1 << HBITS); i++) // Mark every hash bucket empty
+    head[i] = -1;                        // -1 means "no earlier position"
+
+  static const unsigned char hdr[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3}; // gzip header: magic, deflate, no flags, no mtime, Unix
+  memcpy(bw.out, hdr, sizeof(hdr));                                         // Write the header
+  bw.len = sizeof(hdr);                                                     // and account for it
+  bw_put(&bw, 1, 1);                                                        // BFINAL: this is the only block
+  bw_put(&bw, 1, 2);                                                        // BTYPE 01: fixed Huffman codes
+
+  size_t i = 0;                                                             // Current input position
+  while (i < len)                                                           // Loop over the input
+  {                                                                         // Start of while loop body
+    int best_len = 0, best_dist = 0;                                        // Longest match found so far
+    if (i + 3 <= len)                                                       // If a 3-byte hash can be formed here
+    {                                                                       // Start of if block
+      uint32_t h = ((uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2]) * 2654435761u >> (32 - HBITS); // Hash the next 3 bytes
+      int32_t cand = head[h];                                               // Start from the most recent position with this hash
+      int chain = MAX_CHAIN;                                                // Bound the search effort
+      int max = (int)(len - i < MAX_MATCH ? len - i : MAX_MATCH);           // Longest match allowed here
+      while (cand >= 0 && i - (size_t)cand <= WSIZE && chain-- > 0)         // Walk candidates inside the window
+      {                                                                     // Start of while loop body
+        int l = 0;                                                          // Measure the match length
+        while (l < max && in[(size_t)cand + l] == in[i + l])                // byte by byte
+          l++;                                                              // Extend the match
+        if (l > best_len)                                                   // If this is the longest so far
+        {                                                                   // Start of if block
+          best_len = l;                                                     // remember its length
+          best_dist = (int)(i - (size_t)cand);                              // and distance
+          if (l == max)                                                     // If it cannot get longer
+            break;                                                          // stop searching
+        } // End of if block
+        int32_t next = prev[cand & WMASK];                                  // Follow the chain
+        if (next >= cand)                                                   // If the slot was reused by a newer position
+          break;                                                            // the chain has ended
+        cand = next;                                                        // Move to the older candidate
+      } // End of while loop body
+      prev[i & WMASK] = head[h];                                            // Link this position into its hash chain
+      head[h] = (int32_t)i;                                                 // and make it the most recent
+    } // End of if block
+    if (best_len >= 3)                                                      // If a useful match was found
+    {                                                                       // Start of if block
+      deflate_match(&bw, best_len, best_dist);                              // emit it
+      for (size_t j = i + 1; j < i + (size_t)best_len && j + 3 <= len; j++) // Index the positions inside the match too
+      {                                                                     // Start of for loop body
+        uint32_t h = ((uint32_t)in[j] << 16 | (uint32_t)in[j + 1] << 8 | in[j + 2]) * 2654435761u >> (32 - HBITS); // Hash the 3 bytes at j
+        prev[j & WMASK] = head[h];                                          // Link the position into its chain
+        head[h] = (int32_t)j;                                               // and make it the most recent
+      } // End of for loop body
+      i += (size_t)best_len; // Skip the matched bytes
+    } // End of if block
+    else                                   // Otherwise
+    {                                      // Start of else block
+      deflate_literal(&bw, in[i]);         // emit the byte as a literal
+      i++;                                 // Move to the next byte
+    } // End of else block
+  } // End of while loop body
+  deflate_literal(&bw, 256); // End-of-block symbol
+  if (bw.nbits > 0)          // If a partial byte is pending
+    bw_put(&bw, 0, 8 - bw.nbits); // pad it to a byte boundary
+  free(head);                // The LZ77 tables are no longer needed
+  free(prev);                // Free the chain table too
+
+  uint32_t crc = 0xFFFFFFFFu;                          // Compute the CRC-32 of the uncompressed data
+  for (size_t k = 0; k < len; k++)                     // over every input byte
+    crc = crc32_table[(crc ^ in[k]) & 0xFF] ^ (crc >> 8); // using the lookup table
+  crc ^= 0xFFFFFFFFu;                                  // Finalize the CRC
+  uint32_t isize = (uint32_t)len;                      // The trailer stores the input size modulo 2^32
+  for (int k = 0; k < 4; k++)                          // Write the trailer, little-endian
+    bw.out[bw.len++] = (unsigned char)(crc >> (8 * k)); // CRC-32 first
+  for (int k = 0; k < 4; k++)                          // then
+    bw.out[bw.len++] = (unsigned char)(isize >> (8 * k)); // the input size
+  *out_len = bw.len;                                   // Report the compressed length
+  return bw.out;                                       // Return the gzip member
+} // End of gzip_compress function body
+
+/* Background compression cache: gzip variants of frequently requested text responses, built off the request path
+   Entries are keyed like the file info cache (path hash + dev/inode/size/mtime). A request that finds no variant
+   is served uncompressed and counts a hit; once an entry reaches gzip_min_hits it is queued for the compressor
+   pool, and later requests are served the compressed bytes from memory. Bytes are bounded by gzip_cache (MiB)
+   with LRU eviction; the number of tracked entries is bounded too */
+#define GZ_TABLE_SIZE 4096           // Hash buckets in the compression cache
+#define GZ_MAX_ENTRIES 8192          // Maximum tracked entries (counting, pending or ready)
+#define GZ_QUEUE_LEN 256             // Capacity of the compression job queue
+#define GZ_MIN_SIZE 256              // Smaller bodies are not worth compressing
+#define GZ_MAX_SIZE (16 * 1024 * 1024) // Larger files are left to precompression (*.gz siblings)
+
+#define GZ_COUNTING 0 // Counting hits, no variant yet
+#define GZ_PENDING 1  // A compression job is queued or running
+#define GZ_READY 2    // blob holds the gzip variant
+#define GZ_USELESS 3  // Compression did not shrink the body; serve identity without retrying
+
+typedef struct    // Defines a reference-counted compressed body
+{                 // Start of gz_blob_t structure definition
+  int refs;       // Owners: the cache entry plus any request currently sending it (guarded by the cache lock)
+  size_t len;     // Length of the gzip data
+  unsigned char data[]; // The gzip member
+} gz_blob_t;      // End of gz_blob_t structure definition
+
+typedef struct gz_entry              // Defines one compression cache entry
+{                                    // Start of gz_entry structure definition
+  uint64_t key;                      // Path (and, for listings, URL) hash
+  dev_t dev;                         // Identity: device
+  ino_t ino;                         // Identity: inode
+  off_t size;                        // Identity: size
+  long long mtime_ns;                // Identity: modification time
+  unsigned hits;                     // Requests that wanted gzip while no variant existed
+  int state;                         // GZ_COUNTING, GZ_PENDING, GZ_READY or GZ_USELESS
+  gz_blob_t *blob;                   // The compressed body when state == GZ_READY
+  struct gz_entry *next;             // Next entry in the same bucket
+  struct gz_entry *lru_prev, *lru_next; // Neighbors in the LRU list (head = most recently used)
+} gz_entry_t;                        // End of gz_entry structure definition
+
+typedef struct         // Defines a compression job
+{                      // Start of gz_job_t structure definition
+  uint64_t key;        // Cache key of the entry to fill
+  struct stat st;      // Identity the variant must match
+  char *path;          // File to compress (NULL for buffer jobs)
+  unsigned char *buf;  // Body to compress (directory listings); owned by the job
+  size_t len;          // Length of buf
+} gz_job_t;            // End of gz_job_t structure definition
+
+static struct                              // Defines the compression cache state
+{                                          // Start of compression cache structure definition
+  pthread_mutex_t lock;                    // Guards the table, the LRU list, blob refcounts and the job queue
+  pthread_cond_t ready;                    // Signaled when a job is queued
+  gz_entry_t *buckets[GZ_TABLE_SIZE];      // Hash buckets
+  gz_entry_t *lru_head, *lru_tail;         // LRU list ends
+  size_t entries, bytes;                   // Tracked entries and bytes held in blobs
+  size_t budget;                           // Maximum bytes held in blobs (0 = cache disabled)
+  unsigned min_hits;                       // Hits before a variant is built
+  gz_job_t jobs[GZ_QUEUE_LEN];             // Job ring buffer
+  size_t head, count;                      // Oldest job and number of queued jobs
+} gz_cache = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, {0}, NULL, NULL, 0, 0, 0, 0, {{0}}, 0, 0}; // Statically initialized, disabled
+
+/* Return 1 if a MIME type is worth compressing (text formats), else 0 */
+static int mime_is_compressible(const char *mime)                           // Defines a function to classify MIME types
+{                                                                           // Start of mime_is_compressible function body
+  return !strncmp(mime, "text/", 5) || !strncmp(mime, "application/javascript", 22) || // Text, scripts,
+         !strncmp(mime, "application/json", 16) || !strncmp(mime, "image/svg+xml", 13); // JSON and SVG compress well
+} // End of mime_is_compressible function body
+
+static void gz_blob_release(gz_blob_t *b) // Defines a function to drop a blob reference
+{                                         // Start of gz_blob_release function body
+  if (!b)                                 // If there is no blob
+    return;                               // there is nothing to do
+  pthread_mutex_lock(&gz_cache.lock);     // Lock the cache (it guards refcounts)
+  int last = --b->refs == 0;              // Drop the reference
+  pthread_mutex_unlock(&gz_cache.lock);   // Unlock the cache
+  if (last)                               // If that was the last owner
+    free(b);                              // free the blob
+} // End of gz_blob_release function body
+
+static void gz_lru_unlink(gz_entry_t *e) // Defines a function to remove an entry from the LRU list (lock held)
+{                                        // Start of gz_lru_unlink function body
+  if (e->lru_prev)                       // If the entry has a predecessor
+    e->lru_prev->lru_next = e->lru_next; // bypass it forwards
+  else                                   // Otherwise it is the head
+    gz_cache.lru_head = e->lru_next;     // so move the head
+  if (e->lru_next)                       // If the entry has a successor
+    e->lru_next->lru_prev = e->lru_prev; // bypass it backwards
+  else                                   // Otherwise it is the tail
+    gz_cache.lru_tail = e->lru_prev;     // so move the tail
+  e->lru_prev = e->lru_next = NULL;      // Detach the entry
+} // End of gz_lru_unlink function body
+
+static void gz_lru_push_front(gz_entry_t *e) // Defines a function to make an entry the most recently used (lock held)
+{                                            // Start of gz_lru_push_front function body
+  e->lru_prev = NULL;                        // Nothing comes before the head
+  e->lru_next = gz_cache.lru_head;           // The old head follows
+  if (gz_cache.lru_head)                     // If the list was not empty
+    gz_cache.lru_head->lru_prev = e;         // link the old head back
+  else                                       // Otherwise
+    gz_cache.lru_tail = e;                   // the entry is also the tail
+  gz_cache.lru_head = e;                     // The entry is the new head
+} // End of gz_lru_push_front function body
+
+static void gz_drop_blob(gz_entry_t *e) // Defines a function to release an entry's variant (lock held)
+{                                       // Start of gz_drop_blob function body
+  if (!e->blob)                         // If the entry has no variant
+    return;                             // there is nothing to do
+  gz_cache.bytes -= e->blob->len;       // Stop accounting for its bytes
+  if (--e->blob->refs == 0)             // Drop the cache's reference; if no request is sending it
+    free(e->blob);                      // free it now
+  e->blob = NULL;                       // The entry no longer has a variant
+} // End of gz_drop_blob function body
+
+static void gz_evict(gz_entry_t *e) // Defines a function to remove an entry from the cache entirely (lock held)
+{                                   // Start of gz_evict function body
+  gz_entry_t **pp = &gz_cache.buckets[e->key % GZ_TABLE_SIZE]; // Find the entry's bucket
+  while (*pp && *pp != e)           // Walk the bucket chain
+    pp = &(*pp)->next;              // to the link pointing at the entry
+  if (*pp)                          // If found
+    *pp = e->next;                  // unlink it
+  gz_lru_unlink(e);                 // Remove it from the LRU list
+  gz_drop_blob(e);                  // Release its variant
+  gz_cache.entries--;               // Count it gone
+  free(e);                          // Free the entry
+} // End of gz_evict function body
+
+/* Find or create the entry for (key, identity), resetting it if the file changed. Lock held. May return NULL on OOM */
+static gz_entry_t *gz_entry_get(uint64_t key, const struct stat *st) // Defines a function to look up a cache entry
+{                                                                    // Start of gz_entry_get function body
+  gz_entry_t *e = gz_cache.buckets[key % GZ_TABLE_SIZE];             // Start at the key's bucket
+  while (e && e->key != key)                                         // Walk the chain
+    e = e->next;                                                     // until the key matches
+  if (!e)                                                            // If the key is not tracked yet
+  {                                                                  // Start of if block
+    while (gz_cache.entries >= GZ_MAX_ENTRIES && gz_cache.lru_tail)  // Make room by evicting
+      gz_evict(gz_cache.lru_tail);                                   // the least recently used entries
+    e = (gz_entry_t *)calloc(1, sizeof(*e));                         // Allocate a new entry
+    if (!e)                                                          // If allocation fails
+      return NULL;                                                   // report it
+    e->key = key;                                                    // Record the key
+    e->next = gz_cache.buckets[key % GZ_TABLE_SIZE];                 // Prepend the entry to its bucket
+    gz_cache.buckets[key % GZ_TABLE_SIZE] = e;                       // and make it the bucket head
+    gz_cache.entries++;                                              // Count it
+    gz_lru_push_front(e);                                            // It is the most recently used entry
+    e->ino = (ino_t)-1;                                              // Force the identity reset below
+  } // End of if block
+  else                     // The entry already exists
+  {                        // Start of else block
+    gz_lru_unlink(e);      // so move it
+    gz_lru_push_front(e);  // to the front of the LRU list
+  } // End of else block
+  if (e->dev != st->st_dev || e->ino != st->st_ino || e->size != st->st_size || e->mtime_ns != stat_mtime_ns(st)) // If the file changed
+  {                                                                  // Start of if block
+    gz_drop_blob(e);                                                 // its old variant is useless
+    e->dev = st->st_dev;                                             // Record the new identity
+    e->ino = st->st_ino;                                             // inode
+    e->size = st->st_size;                                           // size
+    e->mtime_ns = stat_mtime_ns(st);                                 // and modification time
+    e->hits = 0;                                                     // Start counting again
+    e->state = GZ_COUNTING;                                          // with no variant
+  } // End of if block
+  return e; // Return the entry
+} // End of gz_entry_get function body
+
+/* Queue a compression job (takes ownership of job->path / job->buf). Lock held. Returns 0 if queued */
+static int gz_enqueue_locked(gz_job_t *job)                          // Defines a function to queue a compression job
+{                                                                    // Start of gz_enqueue_locked function body
+  if (gz_cache.count == GZ_QUEUE_LEN)                                // If the queue is full
+    return -1;                                                       // refuse the job
+  gz_cache.jobs[(gz_cache.head + gz_cache.count) % GZ_QUEUE_LEN] = *job; // Append it at the tail
+  gz_cache.count++;                                                  // Count it
+  pthread_cond_signal(&gz_cache.ready);                              // Wake a compressor thread
+  return 0;                                                          // Return 0 to indicate success
+} // End of gz_enqueue_locked function body
+
+/* Request-path lookup. Returns a referenced blob if a gzip variant of (key, st) is ready (release it with
+   gz_blob_release), else NULL after counting a hit. When the hit makes the entry due for compression,
+   *due is set to 1 and the entry is marked pending: the caller must then call gz_cache_submit exactly once.
+   Pass due == NULL to only peek for a ready variant without counting a hit */
+static gz_blob_t *gz_cache_lookup(uint64_t key, const struct stat *st, int *due) // Defines a function to look up a gzip variant
+{                                                                                // Start of gz_cache_lookup function body
+  gz_blob_t *b = NULL;                                                           // Initialize the result
+  if (due)                                                                       // If the caller counts hits
+    *due = 0;                                                                    // no job is due by default
+  pthread_mutex_lock(&gz_cache.lock);                                            // Lock the cache
+  gz_entry_t *e = gz_entry_get(key, st);                                         // Find the entry for this identity
+  if (e && e->state == GZ_READY)                                                 // If a variant is ready
+  {                                                                              // Start of if block
+    b = e->blob;                                                                 // take it
+    b->refs++;                                                                   // with a reference for the caller
+  } // End of if block
+  else if (due && e && e->state == GZ_COUNTING && ++e->hits >= gz_cache.min_hits) // If the entry just became popular enough
+  {                                                                              // Start of else if block
+    e->state = GZ_PENDING;                                                       // mark it pending
+    *due = 1;                                                                    // and ask the caller for a job
+  } // End of else if block
+  pthread_mutex_unlock(&gz_cache.lock); // Unlock the cache
+  return b;                             // Return the variant (or NULL)
+} // End of gz_cache_lookup function body
+
+/* Submit the job promised by gz_cache_lookup: either a file path (copied) or a body buffer (ownership taken) */
+static void gz_cache_submit(uint64_t key, const struct stat *st, const char *path, unsigned char *buf, size_t len) // Defines a function to submit a compression job
+{                                                                                                                // Start of gz_cache_submit function body
+  gz_job_t job;                                                         // Declare the job
+  memset(&job, 0, sizeof(job));                                         // Zero it
+  job.key = key;                                                        // Record the cache key
+  job.st = *st;                                                         // and the identity to match
+  job.path = path ? strdup(path) : NULL;                                // Copy the file path, if any
+  job.buf = buf;                                                        // Take the body buffer, if any
+  job.len = len;                                                        // and its length
+  pthread_mutex_lock(&gz_cache.lock);                                   // Lock the cache
+  int queued = (path ? job.path != NULL : buf != NULL) && gz_enqueue_locked(&job) == 0; // Try to queue the job
+  if (!queued)                                                          // If the job could not be queued
+  {                                                                     // Start of if block
+    gz_entry_t *e = gz_cache.buckets[key % GZ_TABLE_SIZE];              // find the entry
+    while (e && e->key != key)                                          // by walking its bucket
+      e = e->next;                                                      // chain
+    if (e && e->state == GZ_PENDING)                                    // If it is still waiting
+    {                                                                   // Start of if block
+      e->state = GZ_COUNTING;                                           // let a later request retry
+      e->hits = 0;                                                      // after another round of hits
+    } // End of if block
+  } // End of if block
+  pthread_mutex_unlock(&gz_cache.lock); // Unlock the cache
+  if (!queued)                          // If the job was dropped
+  {                                     // Start of if block
+    free(job.path);                     // free its path
+    free(buf);                          // and its buffer
+  } // End of if block
+} // End of gz_cache_submit function body
+
+/* Compress one job and publish the result if the entry still wants it */
+static void gz_run_job(gz_job_t *job)                                                 // Defines a function to run a compression job
+{                                                                                     // Start of gz_run_job function body
+  unsigned char *src = job->buf;                                                      // The body to compress (buffer jobs)
+  size_t len = job->len;                                                              // and its length
+  void *map = NULL;                                                                   // Mapping of the file (file jobs)
+  int fd = -1;                                                                        // Descriptor of the file (file jobs)
+  struct stat fst;                                                                    // Identity of the file actually read
+  if (job->path)                                                                      // If this is a file job
+  {                                                                                   // Start of if block
+    fd = open(job->path, O_RDONLY);                                                   // open the file
+    if (fd < 0 || fstat(fd, &fst) != 0 || fst.st_dev != job->st.st_dev || fst.st_ino != job->st.st_ino || // If it cannot be opened,
+        fst.st_size != job->st.st_size || stat_mtime_ns(&fst) != stat_mtime_ns(&job->st) || fst.st_size == 0) // or is not the file that was requested
+      len = 0;                                                                        // there is nothing to compress
+    else                                                                              // Otherwise
+    {                                                                                 // Start of else block
+      len = (size_t)fst.st_size;                                                      // compress the whole file
+      map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);                           // mapped into memory
+      src = map == MAP_FAILED ? NULL : (unsigned char *)map;                          // (if the mapping worked)
+    } // End of else block
+  } // End of if block
+
+  size_t zlen = 0;                                                   // Compressed length
+  unsigned char *z = (src && len) ? gzip_compress(src, len, &zlen) : NULL; // Compress the body
+  if (map && map != MAP_FAILED)                                      // If the file was mapped
+    munmap(map, len);                                                // unmap it
+  if (fd >= 0)                                                       // If the file was opened
+    close(fd);                                                       // close it
+  gz_blob_t *b = NULL;                                               // The blob to publish
+  if (z && zlen < len)                                               // If compression helped
+  {                                                                  // Start of if block
+    b = (gz_blob_t *)malloc(sizeof(gz_blob_t) + zlen);               // allocate a blob
+    if (b)                                                           // If allocation worked
+    {                                                                // Start of if block
+      b->refs = 1;                                                   // the cache entry will own it
+      b->len = zlen;                                                 // Record its length
+      memcpy(b->data, z, zlen);                                      // and copy the gzip data in
+    } // End of if block
+  } // End of if block
+  free(z); // The compressor's buffer is no longer needed
+
+  pthread_mutex_lock(&gz_cache.lock);                               // Lock the cache
+  gz_entry_t *e = gz_cache.buckets[job->key % GZ_TABLE_SIZE];       // Find the entry
+  while (e && e->key != job->key)                                   // by walking its bucket
+    e = e->next;                                                    // chain
+  if (e && e->state == GZ_PENDING && e->dev == job->st.st_dev && e->ino == job->st.st_ino && e->size == job->st.st_size && e->mtime_ns == stat_mtime_ns(&job->st)) // If it still waits for this identity
+  {                                                                 // Start of if block
+    if (b)                                                          // If a variant was built
+    {                                                               // Start of if block
+      e->blob = b;                                                  // publish it
+      e->state = GZ_READY;                                          // mark it ready
+      gz_cache.bytes += b->len;                                     // and account for its bytes
+      b = NULL;                                                     // The entry owns the blob now
+      while (gz_cache.bytes > gz_cache.budget && gz_cache.lru_tail) // While over budget
+      {                                                             // Start of while loop body
+        gz_entry_t *victim = gz_cache.lru_tail;                     // take the least recently used entry
+        while (victim && !victim->blob)                             // that actually holds bytes
+          victim = victim->lru_prev;                                // (entries without a variant cost nothing)
+        if (!victim)                                                // If none holds bytes
+          break;                                                    // stop
+        gz_evict(victim);                                           // Evict it
+      } // End of while loop body
+    } // End of if block
+    else                        // If compression failed or did not help
+      e->state = len ? GZ_USELESS : GZ_COUNTING; // remember that (or retry later if the file could not be read)
+  } // End of if block
+  pthread_mutex_unlock(&gz_cache.lock); // Unlock the cache
+  free(b);                              // Free an unpublished blob
+  free(job->path);                      // Free the job's path
+  free(job->buf);                       // and its buffer
+} // End of gz_run_job function body
+
+/* Compressor pool thread: takes jobs from the queue and compresses them */
+static void *gz_worker_thread(void *arg)                     // Defines the entry point of a compressor thread
+{                                                            // Start of gz_worker_thread function body
+  (void)arg;                                                 // The thread takes no argument
+  for (;;)                                                   // Loop forever
+  {                                                          // Start of for loop body
+    pthread_mutex_lock(&gz_cache.lock);                      // Lock the cache
+    while (gz_cache.count == 0)                              // While there is nothing to do
+      pthread_cond_wait(&gz_cache.ready, &gz_cache.lock);    // sleep until a job arrives
+    gz_job_t job = gz_cache.jobs[gz_cache.head];             // Take the oldest job
+    gz_cache.head = (gz_cache.head + 1) % GZ_QUEUE_LEN;      // Advance the head
+    gz_cache.count--;                                        // Count the job as taken
+    pthread_mutex_unlock(&gz_cache.lock);                    // Unlock before doing the slow work
+    gz_run_job(&job);                                        // Compress
+  } // End of for loop body
+  return NULL; // Never reached
+} // End of gz_worker_thread function body
+
+/* Find the first caching policy rule that applies to a served file, or NULL if none does
+   Rules match against the path relative to the document root, so index.html served for "/" matches "/index.html" */
+static const cache_rule_t *cache_rule_lookup(const server_config_t *cfg, const char *fs_path) // Defines a function to select a caching policy
+{                                                                                           // Start of cache_rule_lookup function body
+  size_t rlen = strlen(cfg->root_real);                                                     // Get the length of the canonical root
+  if (rlen > 0 && cfg->root_real[rlen - 1] == '/')                                          // If the root ends with a slash (root is "/")
+    rlen--;                                                                                 // keep that slash as part of the relative path
+  const char *rel = fs_path + rlen;                                                         // The URL-style path of the file, starting with '/'
+  const char *ext = strrchr(rel, '.');                                                      // Find the file's extension
+  if (ext && strchr(ext, '/'))                                                              // If the last dot belongs to a directory name
+    ext = NULL;                                                                             // the file has no extension
+  for (int i = 0; i < cfg->n_cache_rules; i++)                                              // Check the rules in config file order
+  {                                                                                         // Start of for loop body
+    const cache_rule_t *r = &cfg->cache_rules[i];                                           // Get the current rule
+    if (r->is_ext ? (ext && !strcasecmp(ext, r->pattern))                                   // An extension rule matches the file's extension
+                  : !strncmp(rel, r->pattern, strlen(r->pattern)))                          // a prefix rule matches the start of the path
+      return r;                                                                             // The first match wins
+  } // End of for loop body
+  return NULL; // No rule applies
+} // End of cache_rule_lookup function body
+
+/* Per-request accounting for the access log, kept per thread (one connection, one request per thread)
+   The send helpers below count bytes and note the first byte; responders record status and cache outcome */
+#define CACHE_NONE 0 // The compression cache was not consulted
+#define CACHE_HIT 1  // The body came from the compression cache
+#define CACHE_MISS 2 // The compression cache was consulted but had no variant
+
+#define PH_RECV 0  // Trace phase: waiting for and parsing the request head (read_http_request)
+#define PH_MAP 1   // Trace phase: URL to filesystem mapping (map_url_to_fs)
+#define PH_STAT 2  // Trace phase: stat, sibling lookup, validators and negotiation
+#define PH_OPEN 3  // Trace phase: opening the body (or reading a directory for a listing)
+#define PH_HDR 4   // Trace phase: building and sending the response headers
+#define PH_SEND 5  // Trace phase: sending the body
+#define PH_COUNT 6 // Number of trace phases
+
+typedef struct                     // Defines a structure for one request's log record
+{                                  // Start of request_log_t structure definition
+  int active;                      // 1 once a request has been parsed on this thread
+  long long start_ns;              // Monotonic time the request head was fully received
+  long long first_byte_ns;         // Monotonic time the first response byte was sent (0 = none yet)
+  long long end_ns;                // Monotonic time the response was complete
+  time_t wall;                     // Wall-clock time the request was received
+  long long bytes;                 // Bytes sent (status line, headers and body)
+  int status;                      // HTTP status code sent (0 = no response)
+  int cache;                       // CACHE_NONE, CACHE_HIT or CACHE_MISS
+  char method[16];                 // Request method
+  char path[PATH_MAX];             // Request target as received
+  char version[16];                // Request HTTP version
+  char referer[SMALL_BUF];         // Referer header value (empty if absent)
+  char user_agent[SMALL_BUF];      // User-Agent header value (empty if absent)
+  long long file_size;             // Size of the file behind the response (0 for listings and errors)
+  unsigned long long conn_id;      // Connection number (for tracing probes)
+  int admitted;                    // 1 while the request holds an in-flight admission
+  long long trace_last;            // Monotonic time of the last phase boundary
+  long long phase_ns[PH_COUNT];    // Time spent in each trace phase
+} request_log_t;                   // End of request_log_t structure definition
+
+static _Thread_local request_log_t req_log; // The calling thread's current request record
+static const char *const phase_names[PH_COUNT] = {"recv", "map", "stat", "open", "hdr", "send"}; // Trace phase names
+static int trace_header;                    // Send a Server-Timing header (server_timing=on)
+static int trace_log;                       // Add the phase breakdown to access log records (log_phases=on)
+
+/* Monotonic clock in nanoseconds, for durations */
+static long long mono_ns(void)                                  // Defines a function to read the monotonic clock
+{                                                               // Start of mono_ns function body
+  struct timespec ts;                                           // Declare a timespec structure
+  clock_gettime(CLOCK_MONOTONIC, &ts);                          // Read the monotonic clock
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;      // Convert it to nanoseconds
+} // End of mono_ns function body
+
+static atomic_llong wheel_now;                 // Current timer wheel tick (advanced by the wheel thread)
+static long long send_timeout_ticks;           // Send-progress allowance in ticks (0 = unlimited)
+static _Thread_local conn_timer_t *current_timer; // The calling thread's connection timer (NULL if none)
+
+/* Account for bytes that just went out on the wire (any progress renews the send deadline) */
+static void req_log_sent(size_t n)                              // Defines a function to count sent bytes
+{                                                               // Start of req_log_sent function body
+  if (current_timer && send_timeout_ticks)                      // Progress pushes the deadline out
+  {                                                             // Start of if block
+    int q = 0;                                                  // Bytes still queued for the client
+    atomic_store_explicit(&current_timer->deadline,             // without touching the wheel (it re-files
+                          atomic_load_explicit(&wheel_now, memory_order_relaxed) + send_timeout_ticks, // the timer lazily)
+                          memory_order_relaxed);
+    if (ioctl(current_timer->fd, SIOCOUTQ, &q) == 0)            // Note the send queue, so the wheel can tell
+      atomic_store_explicit(&current_timer->queued, q, memory_order_relaxed); // whether the client drains it later
+  } // End of if block
+  if (req_log.first_byte_ns == 0)                               // If this is the first byte of the response
+  {                                                             // Start of if block
+    WS_PROBE2(response__start, req_log.conn_id, req_log.status); // fire the response-start probe
+    req_log.first_byte_ns = mono_ns();                          // note the time to first byte
+  } // End of if block
+  req_log.bytes += (long long)n;                                // Count the bytes
+} // End of req_log_sent function body
+
+/* Close the current trace phase: the time since the previous boundary is charged to 'phase' */
+static void trace_mark(int phase)                               // Defines a function to record a phase boundary
+{                                                               // Start of trace_mark function body
+  long long now = mono_ns();                                    // Read the clock (a vDSO call, no system call)
+  req_log.phase_ns[phase] += now - req_log.trace_last;          // Charge the elapsed time to the phase
+  req_log.trace_last = now;                                     // The next phase starts here
+} // End of trace_mark function body
+
+/* Format the Server-Timing header line for the phases completed so far (empty when server_timing is off)
+   Only phases up to the header build can be reported: the body has not been sent yet when headers go out */
+static const char *server_timing(char out[SMALL_BUF])                                               // Defines a function to format Server-Timing
+{                                                                                                   // Start of server_timing function body
+  out[0] = '\0';                                                                                    // Start with no header
+  if (!trace_header)                                                                                // If the header is disabled
+    return out;                                                                                     // send nothing
+  const request_log_t *r = &req_log;                                                                // Get the thread's request record
+  long long total = 0;                                                                              // Sum of the reported phases
+  size_t len = (size_t)snprintf(out, SMALL_BUF, "Server-Timing: ");                                 // Header name
+  for (int p = PH_RECV; p < PH_HDR; p++)                                                            // Phases before the header build
+  {                                                                                                 // Start of for loop body
+    total += r->phase_ns[p];                                                                        // Add to the total
+    len += (size_t)snprintf(out + len, SMALL_BUF - len, "%s;dur=%.3f, ", phase_names[p], r->phase_ns[p] / 1e6); // Milliseconds
+  } // End of for loop body
+  snprintf(out + len, SMALL_BUF - len, "total;dur=%.3f\r\n", total / 1e6);                          // Finish with the total
+  return out;                                                                                       // Return the output for convenience
+} // End of server_timing function body
+
+/* Send all bytes in buffer reliably over a blocking socket, at most SEND_CHUNK per call so send_timeout
+   measures progress rather than the whole transfer. Returns 0 on success, -1 on error */
 static int send_all(sock_t s, const void *buf, size_t len) // Defines a function to send all data in a buffer over a socket
 {                                                          // Start of send_all function body
   const char *p = (const char *)buf;                       // Create a pointer to the start of the buffer
   while (len > 0)                                          // Loop until all bytes have been sent
   {                                                        // Start of while loop body
-    ssize_t n = send(s, p, len, 0);                        // Send data from the buffer over the socket
+    ssize_t n = send(s, p, len < SEND_CHUNK ? len : SEND_CHUNK, 0); // Send the next chunk of the buffer over the socket
+    if (n < 0 && errno == EINTR)                           // If interrupted by a signal (e.g. the profiler's)
+      continue;                                            // try again
     if (n <= 0)                                            // If send returns an error or 0
       return -1;                                           // return an error
+    req_log_sent((size_t)n);                               // Account for the bytes in the access log record
     p += n;                                                // Move the buffer pointer forward by the number of bytes sent
     len -= (size_t)n;                                      // Decrease the remaining length by the number of bytes sent
   } // End of while loop body
   return 0; // Return 0 to indicate success
 } // End of send_all function body
 
+/* Send 'len' bytes of an open file over a blocking socket with sendfile(), without copying through user space
+   Each call is capped at SEND_CHUNK so every chunk that leaves renews the send_timeout deadline
+   Returns 0 on success, -1 on error (including the file shrinking underneath us) */
+static int sendfile_all(sock_t s, int fd, off_t len) // Defines a function to send a whole file over a socket
+{                                                    // Start of sendfile_all function body
+  off_t off = 0;                                     // Start at the beginning of the file
+  while (off < len)                                  // Loop until the whole file has been sent
+  {                                                  // Start of while loop body
+    off_t chunk = len - off < SEND_CHUNK ? len - off : SEND_CHUNK; // The rest of the file, one chunk at a time
+    ssize_t n = sendfile(s, fd, &off, (size_t)chunk); // Send the chunk; advances off
+    if (n < 0 && errno == EINTR)                     // If interrupted by a signal
+      continue;                                      // try again
+    if (n <= 0)                                      // If sendfile fails or the file ended early
+      return -1;                                     // return an error
+    req_log_sent((size_t)n);                         // Account for the bytes in the access log record
+  } // End of while loop body
+  return 0; // Return 0 to indicate success
+} // End of sendfile_all function body
+
+/* Bandwidth pacing (pace_rate=, pace_total=, pace_threshold=)
+   File bodies above pace_threshold are paced; smaller ones never wait, so short responses keep their latency on
+   a link that downloads would otherwise fill. A paced transfer runs at its fair share: pace_total split evenly
+   between the paced transfers in progress, capped at pace_rate. The share is recomputed every chunk (about
+   PACE_CHUNK_MS of sending), so transfers speed up as others finish. The kernel gets the share through
+   SO_MAX_PACING_RATE, which spreads the packets on the wire; the thread also advances a virtual clock by each
+   chunk and waits while ahead of it, which holds the rate where the kernel does not pace. The wait is a poll()
+   on the socket, so a timeout shutdown() or a client hangup ends it at once; no chunk takes longer than
+   PACE_MAX_WAIT_MS, which keeps send progress inside send_timeout; and nothing waits after the last chunk */
+static long long pace_rate, pace_total, pace_threshold;                 // Bytes/s, bytes/s and bytes (0 = off)
+static atomic_int pace_active;                                          // Paced transfers in progress
+static atomic_ullong pace_transfers, pace_bytes, pace_delay_us;         // Totals: transfers, bytes and time slept
+
+/* Set up pacing from the configuration */
+static void pace_init(const server_config_t *cfg)                       // Defines a function to set up pacing
+{                                                                       // Start of pace_init function body
+  pace_rate = cfg->pace_rate > 0 ? cfg->pace_rate * 1024LL : 0;         // Per-transfer cap
+  pace_total = cfg->pace_total > 0 ? cfg->pace_total * 1024LL : 0;      // Global cap
+  pace_threshold = cfg->pace_threshold > 0 ? cfg->pace_threshold * 1024LL : 0; // Size above which bodies are paced
+} // End of pace_init function body
+
+/* Whether a body of 'len' bytes is paced */
+static int pace_wanted(off_t len)                                       // Defines a function to decide on pacing
+{                                                                       // Start of pace_wanted function body
+  return (pace_rate || pace_total) && len > pace_threshold;             // Only large bodies, and only if a cap is set
+} // End of pace_wanted function body
+
+/* Current rate of one paced transfer in bytes/s */
+static long long pace_share(void)                                       // Defines a function to compute the fair share
+{                                                                       // Start of pace_share function body
+  long long share = pace_rate;                                          // Start from the per-transfer cap
+  if (pace_total)                                                       // If there is a global cap
+  {                                                                     // Start of if block
+    int n = atomic_load_explicit(&pace_active, memory_order_relaxed);   // split it between the paced transfers
+    long long fair = pace_total / (n > 1 ? n : 1);                      // in equal parts
+    if (!share || fair < share)                                         // If that is below the per-transfer cap
+      share = fair;                                                     // the fair share applies
+  } // End of if block
+  return share > 0 ? share : 1;                                         // (never zero)
+} // End of pace_share function body
+
+/* sendfile_all() at the paced rate. Returns 0 on success, -1 on error */
+static int sendfile_paced(sock_t s, int fd, off_t len)                                      // Defines a function to send a file at a paced rate
+{                                                                                           // Start of sendfile_paced function body
+  atomic_fetch_add_explicit(&pace_active, 1, memory_order_relaxed);                         // One more paced transfer
+  atomic_fetch_add_explicit(&pace_transfers, 1, memory_order_relaxed);                      // Count it in the total
+  long long clock = mono_ns();                                                              // Virtual time the bytes sent so far are due by
+  long long applied = 0;                                                                    // Rate last given to the kernel
+  off_t off = 0;                                                                            // Start at the beginning of the file
+  int rc = 0;                                                                               // Initialize the result
+  while (off < len)                                                                         // Loop until the whole file has been sent
+  {                                                                                         // Start of while loop body
+    long long share = pace_share();                                                         // This chunk's rate
+#ifdef SO_MAX_PACING_RATE                                                                   // If the kernel can pace the socket
+    if (share != applied)                                                                   // If it changed
+    {                                                                                       // Start of if block
+      unsigned int r = share < UINT_MAX ? (unsigned int)share : UINT_MAX - 1;               // (the option is bytes/s, ~0U = unlimited)
+      setsockopt(s, SOL_SOCKET, SO_MAX_PACING_RATE, &r, sizeof(r));                         // let the kernel spread the packets
+    } // End of if block
+#endif                                                                                      // End of SO_MAX_PACING_RATE block
+    applied = share;                                                                        // Remember the rate in effect
+    long long chunk = share * PACE_CHUNK_MS / 1000;                                         // Bytes for one chunk
+    long long most = share * PACE_MAX_WAIT_MS / 1000;                                      // Most a chunk may hold at this share
+    if (chunk < PACE_MIN_CHUNK)                                                             // Not so few bytes
+      chunk = most < PACE_MIN_CHUNK ? (most > 0 ? most : 1) : PACE_MIN_CHUNK;            // that syscalls dominate, unless the share is tiny
+    if (chunk > len - off)                                                                  // Not past the end
+      chunk = len - off;                                                                    // of the file
+    ssize_t n = sendfile(s, fd, &off, (size_t)chunk);                                       // Send the chunk; advances off
+    if (n < 0 && errno == EINTR)                                                            // If interrupted by a signal
+      continue;                                                                             // try again
+    if (n <= 0)                                                                             // If sendfile fails or the file ended early
+    {                                                                                       // Start of if block
+      rc = -1;                                                                              // report an error
+      break;                                                                                // and stop sending
+    } // End of if block
+    req_log_sent((size_t)n);                                                                // Account for the bytes in the access log record
+    atomic_fetch_add_explicit(&pace_bytes, (unsigned long long)n, memory_order_relaxed);    // and in the pacing totals
+    if (off >= len)                                                                         // After the last chunk
+      break;                                                                                // there is nothing to wait for
+    long long now = mono_ns();                                                              // Current time
+    if (clock < now - PACE_SLACK_MS * 1000000LL)                                            // If the network held us back
+      clock = now - PACE_SLACK_MS * 1000000LL;                                              // bank only a little of the lost time
+    clock += n * 1000000000LL / share;                                                      // The bytes are due by this time
+    long long waited = now;                                                                 // Start of the wait
+    while (now < clock)                                                                     // While we are ahead of it
+    {                                                                                       // Start of while loop body
+      struct pollfd pfd = {s, 0, 0};                                                        // Watch the socket for hangup and errors only
+      int ms = (int)((clock - now + 999999) / 1000000);                                     // Time left, rounded up to whole milliseconds
+      if (poll(&pfd, 1, ms) > 0)                                                            // If the socket was shut down or reset
+        break;                                                                              // stop waiting; the next sendfile fails
+      now = mono_ns();                                                                      // Otherwise (timeout or signal) check the time
+    } // End of while loop body
+    atomic_fetch_add_explicit(&pace_delay_us, (unsigned long long)((now - waited) / 1000), memory_order_relaxed); // Count the wait
+  } // End of while loop body
+  atomic_fetch_sub_explicit(&pace_active, 1, memory_order_relaxed);                         // The transfer is over
+  return rc;                                                                                // Return the result
+} // End of sendfile_paced function body
+
 /* Send a formatted string. Returns 0 on success, -1 on error */
 static int sendf(sock_t s, const char *fmt, ...)                           // Defines a function to send a formatted string over a socket
 {                                                                          // Start of sendf function body
@@ -382,12 +1788,16 @@ static void send_error(sock_t s, int status, const char *reason, const char *det
                       status, reason, status, reason, detail ? detail : "");
   if (blen < 0)                                           // If formatting fails
     blen = 0;                                             // set the length to 0
+  char timing[SMALL_BUF];                                  // Declare a buffer for the Server-Timing header
+  req_log.status = status;                                // Record the status for the access log
   sendf(s, "HTTP/1.0 %d %s\r\n", status, reason);         // Send the HTTP status line
   sendf(s, "Date: %s\r\n", date);                         // Send the Date header
   sendf(s, "Server: c-mini/1.0\r\n");                     // Send the Server header
   sendf(s, "Content-Type: text/html; charset=utf-8\r\n"); // Send the Content-Type header
   sendf(s, "Content-Length: %d\r\n", blen);               // Send the Content-Length header
+  sendf(s, "%s", server_timing(timing));                  // Send the Server-Timing header, if enabled
   sendf(s, "Connection: close\r\n\r\n");                  // Send the Connection header and the end of headers
+  trace_mark(PH_HDR);                                     // Close the header phase
   send_all(s, body, (size_t)blen);                        // Send the HTML body
 } // End of send_error function body
 
@@ -408,11 +1818,46 @@ static int reserve_html_buf(char **html, size_t *cap, size_t len, size_t need) /
   return 1; // Return 1 to indicate success
 } // End of reserve_html_buf function body
 
-/* Produce an HTML directory listing for 'dirpath' and send it. Returns 0 on success */
-static int send_dir_listing(sock_t s, const char *url_path, const char *dirpath) // Defines a function to send an HTML directory listing
-{                                                                                // Start of send_dir_listing function body
-  char date[SMALL_BUF];                                                          // Declare a buffer for the date string
-  http_date_now(date);                                                           // Get the current date in HTTP format
+/* Produce an HTML directory listing for 'dirpath' and send it. Returns 0 on success
+   With the gzip cache enabled, popular listings are compressed in the background and later
+   gzip-accepting requests are answered from memory without reading the directory at all */
+static int send_dir_listing(sock_t s, const char *url_path, const char *dirpath, const request_headers_t *req) // Defines a function to send an HTML directory listing
+{                                                                                                             // Start of send_dir_listing function body
+  char date[SMALL_BUF];                                                                                       // Declare a buffer for the date string
+  http_date_now(date);                                                                                        // Get the current date in HTTP format
+
+  // Compression cache: keyed by directory path + URL (the URL appears in the HTML) and the directory's identity
+  struct stat dst;                                                                                  // Declare a stat structure for the directory
+  int gz_due = 0;                                                                                   // Set when this request makes the listing due for compression
+  uint64_t gz_key = 0;                                                                              // The listing's cache key
+  int gz_ok = gz_cache.budget > 0 && stat(dirpath, &dst) == 0;                                      // The cache applies if enabled and the directory exists
+  if (gz_ok && req && accepts_encoding(req->accept_encoding, "gzip"))                               // If the client takes gzip
+  {                                                                                                 // Start of if block
+    gz_key = xxh64(url_path ? url_path : "/", strlen(url_path ? url_path : "/"), xxh64(dirpath, strlen(dirpath), 0)); // Hash directory and URL together
+    gz_blob_t *b = gz_cache_lookup(gz_key, &dst, NULL);                                             // Take a ready variant (the hit is counted once the listing is sent)
+    req_log.cache = b ? CACHE_HIT : CACHE_MISS;                                                     // Record the outcome for the access log
+    if (b)                                                                                          // If a variant is ready
+    {                                                                                               // Start of if block
+      char timing[SMALL_BUF];                                                                       // Declare a buffer for the Server-Timing header
+      trace_mark(PH_STAT);                                                                          // Close the lookup phase
+      req_log.status = 200;                                                                         // Record the status for the access log
+      sendf(s, "HTTP/1.0 200 OK\r\n"                                                                // Send the HTTP status line
+               "Date: %s\r\n"                                                                       // the Date header
+               "Server: c-mini/1.0\r\n"                                                             // the Server header
+               "Content-Type: text/html; charset=utf-8\r\n"                                         // the Content-Type header
+               "Content-Length: %zu\r\n"                                                            // the Content-Length header
+               "Content-Encoding: gzip\r\n"                                                         // the Content-Encoding header
+               "Vary: Accept-Encoding\r\n"                                                          // the Vary header
+               "%s"                                                                                 // the Server-Timing header, if enabled
+               "Connection: close\r\n\r\n",                                                          // and the Connection header and the end of headers
+            date, b->len, server_timing(timing));                                                   // in a single send
+      trace_mark(PH_HDR);                                                                           // Close the header phase
+      int rc = send_all(s, b->data, b->len);                                                        // Send the compressed listing from memory
+      trace_mark(PH_SEND);                                                                          // Close the send phase
+      gz_blob_release(b);                                                                           // Release the variant
+      return rc;                                                                                    // Return the result of the send operation
+    } // End of if block
+  } // End of if block
 
   // Build HTML into a dynamically growing buffer
   size_t cap = 8192, len = 0;                                     // Initialize capacity and length for the HTML buffer
@@ -541,82 +1986,225 @@ static int send_dir_listing(sock_t s, const char *url_path, const char *dirpath)
   } // End of footer block
 
   // Send response
+  char timing[SMALL_BUF];                                 // Declare a buffer for the Server-Timing header
+  trace_mark(PH_OPEN);                                    // Reading the directory counts as opening the body
+  req_log.status = 200;                                   // Record the status for the access log
   sendf(s, "HTTP/1.0 200 OK\r\n");                        // Send the HTTP status line
   sendf(s, "Date: %s\r\n", date);                         // Send the Date header
   sendf(s, "Server: c-mini/1.0\r\n");                     // Send the Server header
   sendf(s, "Content-Type: text/html; charset=utf-8\r\n"); // Send the Content-Type header
   sendf(s, "Content-Length: %zu\r\n", len);               // Send the Content-Length header
+  if (gz_ok)                                              // If a gzip variant may be served for this URL later
+    sendf(s, "Vary: Accept-Encoding\r\n");                // tell caches the representation varies
+  sendf(s, "%s", server_timing(timing));                  // Send the Server-Timing header, if enabled
   sendf(s, "Connection: close\r\n\r\n");                  // Send the Connection header and the end of headers
+  trace_mark(PH_HDR);                                     // Close the header phase
   int rc = send_all(s, html, len);                        // Send the HTML body
-  free(html);                                             // Free the HTML buffer
+  trace_mark(PH_SEND);                                    // Close the send phase
+  if (gz_key)                                             // If the client would have taken gzip
+    gz_blob_release(gz_cache_lookup(gz_key, &dst, &gz_due)); // count the miss (a variant that appeared meanwhile is not needed)
+  if (gz_due)                                             // If this listing just became popular
+    gz_cache_submit(gz_key, &dst, NULL, (unsigned char *)html, len); // hand the HTML to the compressor pool (which frees it)
+  else                                                    // Otherwise
+    free(html);                                           // Free the HTML buffer
   free(esc_title);                                        // Free the escaped title
   return rc;                                              // Return the result of the send operation
 } // End of send_dir_listing function body
 
-/* Attempt to serve a file (GET or HEAD). Streams file in chunks
+/* Decide whether a conditional request can be answered with 304 Not Modified
+   If-None-Match takes precedence; If-Modified-Since is only consulted when it is absent
+   Returns 1 if the client's cached copy is still valid, else 0 */
+static int request_not_modified(const request_headers_t *req, const char *etag, time_t mtime) // Defines a function to evaluate conditional request headers
+{                                                                                             // Start of request_not_modified function body
+  if (!req)                                                                                   // If no headers were parsed
+    return 0;                                                                                 // the request is unconditional
+  if (req->if_none_match[0])                                                                  // If the client sent If-None-Match
+    return etag_list_matches(req->if_none_match, etag);                                       // the ETag alone decides
+  time_t since;                                                                               // Declare a variable for the If-Modified-Since time
+  if (req->if_modified_since[0] && http_date_parse(req->if_modified_since, &since) == 0 &&    // If the client sent a valid If-Modified-Since
+      since <= time(NULL))                                                                    // that is not in the future (such a date is ignored)
+    return mtime <= since;                                                                    // the copy is valid unless the file changed afterwards
+  return 0;                                                                                   // Otherwise, send the full response
+} // End of request_not_modified function body
+
+/* Emit a bodiless 304 Not Modified response
+   'meta' is the prebuilt block of validator and caching header lines shared with the 200 response */
+static void send_not_modified(sock_t s, const char *date, const char *meta) // Defines a function to send a 304 response
+{                                                                           // Start of send_not_modified function body
+  char timing[SMALL_BUF];                                                   // Declare a buffer for the Server-Timing header
+  req_log.status = 304;                                                     // Record the status for the access log
+  sendf(s, "HTTP/1.0 304 Not Modified\r\n"                                 // Send the HTTP status line
+           "Date: %s\r\n"                                                  // the Date header
+           "Server: c-mini/1.0\r\n"                                        // the Server header
+           "%s%s"                                                           // the validators, caching and Server-Timing headers
+           "Connection: close\r\n\r\n",                                    // and the Connection header and the end of headers
+        date, meta, server_timing(timing));                                 // in a single send
+  trace_mark(PH_HDR);                                                       // Close the header phase
+} // End of send_not_modified function body
+
+/* Attempt to serve a file (GET or HEAD). The body goes out with sendfile() (zero-copy)
+   Answers conditional requests with 304 (without opening the file) when the validators match
+   Serves file.br / file.gz instead of the file itself when they exist and the client accepts the coding
    Returns 0 on success, -1 on error */
-static int send_file(sock_t s, const char *filepath, int is_head)             // Defines a function to send a file
-{                                                                             // Start of send_file function body
-  char date[SMALL_BUF];                                                       // Declare a buffer for the date string
-  http_date_now(date);                                                        // Get the current date in HTTP format
-  long long fsize = 0;                                                        // Initialize the file size to 0
-  int isdir = 0;                                                              // Initialize a flag to indicate if the path is a directory
-  if (path_stat_isdir(filepath, &isdir, &fsize) != 0 || isdir)                // Get the status of the file
-  {                                                                           // Start of if block
-    send_error(s, 404, "Not Found", "The requested resource was not found."); // If it's a directory or doesn't exist, send a 404 error
-    return -1;                                                                // Return an error
+static int send_file(sock_t s, const server_config_t *cfg, const char *filepath, int is_head, const request_headers_t *req) // Defines a function to send a file
+{                                                                                                                          // Start of send_file function body
+  time_t now = time(NULL);                                                                      // Get the current time once for Date and Expires
+  char date[SMALL_BUF];                                                                         // Declare a buffer for the date string
+  http_date_fmt(now, date);                                                                     // Format the current date in HTTP format
+  struct stat st;                                                                               // Declare a stat structure for the file's metadata
+  if (stat(filepath, &st) != 0 || S_ISDIR(st.st_mode))                                          // Get the status of the file
+  {                                                                                             // Start of if block
+    send_error(s, 404, "Not Found", "The requested resource was not found.");                   // If it's a directory or doesn't exist, send a 404 error
+    return -1;                                                                                  // Return an error
   } // End of if block
+  req_log.file_size = (long long)st.st_size;        // Record the file size for the slow log
+  int sibs = precompressed_siblings(filepath, &st); // Find out (from the cache, usually) which precompressed variants exist
+  int enc;                                          // Declare the chosen content coding
+  char mime[MAX_MIME_LEN];                          // Declare a buffer for the MIME type
+  guess_mime_type(filepath, mime);                  // The type is that of the original file, whatever the encoding
+  int gz_ok = gz_cache.budget > 0 && mime_is_compressible(mime) &&  // The background gzip cache may hold a variant
+              st.st_size >= GZ_MIN_SIZE && st.st_size <= GZ_MAX_SIZE; // of compressible files of a reasonable size
+  gz_blob_t *mem = NULL;                            // A gzip variant from the compression cache, if one is used
 
-  FILE *f = fopen(filepath, "rb");                                            // Open the file in binary read mode
-  if (!f)                                                                     // If opening fails
-  {                                                                           // Start of if block
-    send_error(s, 404, "Not Found", "The requested resource was not found."); // send a 404 error
-    return -1;                                                                // Return an error
-  } // End of if block
+negotiate:                                                              // Label for (re)selecting the representation
+  enc = ENC_IDENTITY;                                                   // Start with the file as stored
+  const char *ae = req ? req->accept_encoding : "";                     // Get the client's Accept-Encoding (may be empty)
+  if ((sibs & ENC_BR) && accepts_encoding(ae, "br"))                    // Prefer Brotli when available and accepted
+    enc = ENC_BR;                                                       // serve the .br sibling
+  else if ((sibs & ENC_GZIP) && accepts_encoding(ae, "gzip"))           // Otherwise try gzip
+    enc = ENC_GZIP;                                                     // serve the .gz sibling
+  else if (gz_ok && accepts_encoding(ae, "gzip"))                       // Otherwise ask the compression cache
+  {                                                                     // Start of else if block
+    int due;                                                            // Set when this request makes the file due for compression
+    uint64_t gz_key = xxh64(filepath, strlen(filepath), 0);             // The cache is keyed by path and identity
+    mem = gz_cache_lookup(gz_key, &st, &due);                           // Take a ready variant, or count a hit
+    req_log.cache = mem ? CACHE_HIT : CACHE_MISS;                       // Record the outcome for the access log
+    if (mem)                                                            // If a variant is ready
+      enc = ENC_GZIP;                                                   // serve it from memory
+    else if (due)                                                       // If the file just became popular
+      gz_cache_submit(gz_key, &st, filepath, NULL, 0);                  // have it compressed in the background; this request stays identity
+  } // End of else if block
 
-  char mime[MAX_MIME_LEN];         // Declare a buffer for the MIME type
-  guess_mime_type(filepath, mime); // Guess the MIME type from the file path
+  char etag[MAX_ETAG_LEN], lastmod[SMALL_BUF];                     // Declare buffers for the validators
+  if (cfg->etag_mode == ETAG_CONTENT)                              // If ETags must be identical across replicas
+  {                                                                // Start of if block
+    if (!content_etag(filepath, &st, etag))                        // use the cached content hash, if it is ready
+      etag[0] = '\0';                                              // otherwise send no ETag until the hasher catches up
+  } // End of if block
+  else                                                             // Otherwise
+    make_etag(&st, etag);                                          // derive the ETag from inode, size and mtime
+  if (etag[0] && enc != ENC_IDENTITY)                              // Each encoding is a distinct representation
+  {                                                                // Start of if block
+    size_t el = strlen(etag);                                      // so it needs a distinct strong ETag:
+    snprintf(etag + el - 1, MAX_ETAG_LEN - (el - 1), "-%s\"", enc == ENC_BR ? "br" : "gz"); // suffix the coding inside the quotes
+  } // End of if block
+  http_date_fmt(st.st_mtime, lastmod);                             // Format the modification time for Last-Modified
 
-  sendf(s, "HTTP/1.0 200 OK\r\n");             // Send the HTTP status line
-  sendf(s, "Date: %s\r\n", date);              // Send the Date header
-  sendf(s, "Server: c-mini/1.0\r\n");          // Send the Server header
-  sendf(s, "Content-Type: %s\r\n", mime);      // Send the Content-Type header
-  sendf(s, "Content-Length: %lld\r\n", fsize); // Send the Content-Length header
-  sendf(s, "Connection: close\r\n\r\n");       // Send the Connection header and the end of headers
+  // Validator and caching headers, shared by the 200 and 304 responses
+  const cache_rule_t *rule = cache_rule_lookup(cfg, filepath);     // Find the caching policy for this file
+  char meta[BIG_BUF / 2];                                          // Declare a buffer for the header block
+  size_t mlen = 0;                                                 // Initialize the block length
+  if (etag[0])                                                     // If an ETag is available
+    mlen += (size_t)snprintf(meta + mlen, sizeof(meta) - mlen, "ETag: %s\r\n", etag); // add the ETag header
+  mlen += (size_t)snprintf(meta + mlen, sizeof(meta) - mlen, "Last-Modified: %s\r\n", lastmod); // Add the Last-Modified header
+  if (rule)                                                        // If a caching policy applies
+  {                                                                // Start of if block
+    char expires[SMALL_BUF];                                       // declare a buffer for the Expires date
+    http_date_fmt(now + rule->max_age, expires);                   // Expires is Date plus the policy's max-age
+    mlen += (size_t)snprintf(meta + mlen, sizeof(meta) - mlen, "%sExpires: %s\r\n", rule->header, expires); // Add the precompiled Cache-Control line and Expires
+  } // End of if block
+  if (sibs || gz_ok)                                               // If the representation depends on Accept-Encoding
+    mlen += (size_t)snprintf(meta + mlen, sizeof(meta) - mlen, "Vary: Accept-Encoding\r\n"); // tell caches so
 
-  if (!is_head)                                     // If the request method is not HEAD
+  char timing[SMALL_BUF];                           // Declare a buffer for the Server-Timing header
+  trace_mark(PH_STAT);                              // Close the metadata phase
+  if (request_not_modified(req, etag, st.st_mtime)) // If the client's cached copy is still current
   {                                                 // Start of if block
-    char buf[SEND_BUF_SIZE];                        // declare a buffer for sending the file content
-    size_t n;                                       // Declare a variable to hold the number of bytes read
-    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) // Loop while there is data to read from the file
-    {                                               // Start of while loop body
-      if (send_all(s, buf, n) != 0)                 // Send the read data over the socket
-      {                                             // Start of if block
-        fclose(f);                                  // Close the file
-        return -1;                                  // Return an error if sending fails
-      } // End of if block
-    } // End of while loop body
+    send_not_modified(s, date, meta);               // answer with 304 and never touch the file contents
+    gz_blob_release(mem);                           // Release the unused variant, if any
+    return 0;                                       // Return 0 to indicate success
   } // End of if block
-  fclose(f); // Close the file
-  return 0;  // Return 0 to indicate success
+
+  if (mem)                                                // If the body comes from the compression cache
+  {                                                       // Start of if block
+    req_log.status = 200;                                 // Record the status for the access log
+    sendf(s, "HTTP/1.0 200 OK\r\n"                        // Send the HTTP status line
+             "Date: %s\r\n"                               // the Date header
+             "Server: c-mini/1.0\r\n"                     // the Server header
+             "Content-Type: %s\r\n"                       // the Content-Type header
+             "Content-Length: %zu\r\n"                    // the Content-Length header (of the compressed bytes)
+             "Content-Encoding: gzip\r\n"                 // the Content-Encoding header
+             "%s%s"                                        // the validators, caching and Server-Timing headers
+             "Connection: close\r\n\r\n",                  // and the Connection header and the end of headers
+          date, mime, mem->len, meta, server_timing(timing)); // in a single send
+    trace_mark(PH_HDR);                                    // Close the header phase
+    int rc = is_head ? 0 : send_all(s, mem->data, mem->len); // Send the compressed body straight from memory
+    trace_mark(PH_SEND);                                   // Close the send phase
+    gz_blob_release(mem);                                  // Release the variant
+    return rc;                                             // Return the result of the send operation
+  } // End of if block
+
+  char bodypath[PATH_MAX];                                                  // Declare a buffer for the path of the bytes to send
+  snprintf(bodypath, sizeof(bodypath), "%s%s", filepath,                    // The body is the file itself
+           enc == ENC_BR ? ".br" : enc == ENC_GZIP ? ".gz" : "");           // or its precompressed sibling
+  struct stat bst;                                                          // Declare a stat structure for the opened body file
+  int fd = open(bodypath, O_RDONLY);                                        // Open the body file for reading
+  if (fd < 0 || fstat(fd, &bst) != 0 || !S_ISREG(bst.st_mode))              // If it cannot be opened or is not a regular file
+  {                                                                         // Start of if block
+    if (fd >= 0)                                                            // If it was opened
+      close(fd);                                                            // close it
+    if (enc != ENC_IDENTITY)                                                // If a sibling vanished since it was cached
+    {                                                                       // Start of if block
+      precompressed_siblings_invalidate(filepath);                          // forget the stale scan
+      sibs &= ~enc;                                                         // drop the variant
+      goto negotiate;                                                       // and pick another representation
+    } // End of if block
+    send_error(s, 404, "Not Found", "The requested resource was not found."); // send a 404 error
+    return -1;                                                                // Return an error
+  } // End of if block
+
+  trace_mark(PH_OPEN);                // Close the open phase
+  req_log.status = 200;               // Record the status for the access log
+  sendf(s, "HTTP/1.0 200 OK\r\n"      // Send the HTTP status line
+           "Date: %s\r\n"             // the Date header
+           "Server: c-mini/1.0\r\n"   // the Server header
+           "Content-Type: %s\r\n"     // the Content-Type header
+           "Content-Length: %lld\r\n" // the Content-Length header (of the bytes actually sent)
+           "%s%s%s"                   // the Content-Encoding header, if any
+           "%s%s"                      // the validators, caching and Server-Timing headers
+           "Connection: close\r\n\r\n", // and the Connection header and the end of headers
+        date, mime, (long long)bst.st_size,                                  // in a single send
+        enc ? "Content-Encoding: " : "", enc == ENC_BR ? "br" : enc == ENC_GZIP ? "gzip" : "", enc ? "\r\n" : "",
+        meta, server_timing(timing));
+  trace_mark(PH_HDR);                           // Close the header phase
+
+  int rc = 0;                                   // Initialize the result
+  if (!is_head)                                 // If the request method is not HEAD
+    rc = pace_wanted(bst.st_size) ? sendfile_paced(s, fd, bst.st_size) // paced if it is a large body
+                                  : sendfile_all(s, fd, bst.st_size);   // else let the kernel copy the file straight to the socket
+  trace_mark(PH_SEND);                          // Close the send phase
+  close(fd);                                    // Close the file
+  return rc;                                    // Return the result of the send operation
 } // End of send_file function body
 
 /* Parse a single HTTP request from the client socket
    - Reads until CRLFCRLF or buffer full
    - Extracts method, path, version
-   - Ignores headers (except we could examine Host etc. for advanced features)
+   - Captures the conditional headers (If-None-Match, If-Modified-Since), Accept-Encoding, Referer and User-Agent into hdrs
    Returns 0 on success; -1 on error */
-static int read_http_request(sock_t s, char *method, size_t msz, char *path, size_t psz, char *version, size_t vsz) // Defines a function to read and parse an HTTP request
-{                                                                                                                   // Start of read_http_request function body
+static int read_http_request(sock_t s, char *method, size_t msz, char *path, size_t psz, char *version, size_t vsz, request_headers_t *hdrs) // Defines a function to read and parse an HTTP request
+{                                                                                                                                            // Start of read_http_request function body
   char buf[RECV_BUF_SIZE];                                                                                          // Declare a buffer to receive the request
   size_t used = 0;                                                                                                  // Initialize the number of bytes used in the buffer
 
-  // Simple blocking read with a soft timeout can be added; for simplicity we omit it
+  // Blocking reads; the connection's header deadline in the timer wheel bounds how long they can stall
   for (;;)                                                                                    // Loop indefinitely to read from the socket
   {                                                                                           // Start of for loop body
     if (used >= sizeof(buf))                                                                  // If the buffer is full
       break;                                                                                  // stop reading
     ssize_t n = recv(s, buf + used, sizeof(buf) - used, 0);                                   // Receive data from the socket
+    if (n < 0 && errno == EINTR)                                                              // If interrupted by a signal
+      continue;                                                                               // try again
     if (n <= 0)                                                                               // If recv returns an error or 0
       break;                                                                                  // stop reading
     used += (size_t)n;                                                                        // Increment the number of bytes used
@@ -661,24 +2249,2120 @@ parse:           // Label for the parsing section
   strncpy(version, sp2 + 1, vsz - 1); // Copy the version to the output buffer
   version[vsz - 1] = 0;               // Ensure it's null-terminated
 
+  // Header lines: Name: value, one per line, until the blank line
+  memset(hdrs, 0, sizeof(*hdrs));                 // Start with every header marked absent
+  char *line = line_end + 2;                      // The first header line follows the request line's CRLF
+  while (*line)                                   // Loop over the header lines
+  {                                               // Start of while loop body
+    char *eol = strstr(line, "\r\n");             // Find the end of this line
+    char *next = eol ? eol + 2 : line + strlen(line); // Remember where the next line starts (a truncated last line ends the loop)
+    if (eol == line)                              // If this is the blank line
+      break;                                      // the headers are done
+    if (eol)                                      // If the line is complete
+      *eol = '\0';                                // null-terminate it
+    char *dst = NULL;                             // Destination for a header we care about
+    size_t skip = 0;                              // Length of the header name (including the colon)
+    if (stristartswith(line, "If-None-Match:"))   // If this is If-None-Match
+    {                                             // Start of if block
+      dst = hdrs->if_none_match;                  // store into the If-None-Match field
+      skip = strlen("If-None-Match:");            // and skip past the name
+    } // End of if block
+    else if (stristartswith(line, "If-Modified-Since:")) // If this is If-Modified-Since
+    {                                                    // Start of else if block
+      dst = hdrs->if_modified_since;                     // store into the If-Modified-Since field
+      skip = strlen("If-Modified-Since:");               // and skip past the name
+    } // End of else if block
+    else if (stristartswith(line, "Accept-Encoding:"))   // If this is Accept-Encoding
+    {                                                    // Start of else if block
+      dst = hdrs->accept_encoding;                       // store into the Accept-Encoding field
+      skip = strlen("Accept-Encoding:");                 // and skip past the name
+    } // End of else if block
+    else if (stristartswith(line, "Referer:"))           // If this is Referer
+    {                                                    // Start of else if block
+      dst = hdrs->referer;                               // store into the Referer field
+      skip = strlen("Referer:");                         // and skip past the name
+    } // End of else if block
+    else if (stristartswith(line, "User-Agent:"))        // If this is User-Agent
+    {                                                    // Start of else if block
+      dst = hdrs->user_agent;                            // store into the User-Agent field
+      skip = strlen("User-Agent:");                      // and skip past the name
+    } // End of else if block
+    if (dst)                                      // If the header is one we keep
+    {                                             // Start of if block
+      strncpy(dst, strtrim(line + skip), SMALL_BUF - 1); // copy its trimmed value
+      dst[SMALL_BUF - 1] = 0;                     // Ensure it's null-terminated
+    } // End of if block
+    line = next; // Move to the next line
+  } // End of while loop body
+
   return 0; // Return 0 to indicate success
 } // End of read_http_request function body
 
+#define WORKER_IDLE 0    // Worker slot phase: no connection
+#define WORKER_READING 1 // Worker slot phase: waiting for / parsing the request head (queued)
+#define WORKER_SENDING 2 // Worker slot phase: producing the response
+
+/* Worker slots: per-thread state that other threads read without locks
+   Each client thread claims a free slot for its lifetime (client_thread) and releases it on exit, so at any
+   moment a slot has at most one owner. The owner is the only writer of its slot's producer-side fields */
+typedef struct                        // Defines a structure for one worker slot
+{                                     // Start of worker_slot_t structure definition
+  atomic_int in_use;                  // 1 while a client thread owns the slot
+  atomic_int phase;                   // What the owner is doing: WORKER_READING or WORKER_SENDING
+  _Alignas(64) atomic_size_t log_head; // Access log ring: bytes ever written (advanced by the owner only)
+  _Alignas(64) atomic_size_t log_tail; // Access log ring: bytes ever drained (advanced by the log writer only)
+  char log_ring[LOG_RING_SIZE];       // Access log ring storage (complete lines, '\n'-terminated)
+  _Alignas(64) atomic_size_t replay_head; // Replay trace ring: bytes ever written (advanced by the owner only)
+  _Alignas(64) atomic_size_t replay_tail; // Replay trace ring: bytes ever drained (advanced by the log writer only)
+  char replay_ring[REPLAY_RING_SIZE]; // Replay trace ring storage (complete replay_record_t records)
+  _Alignas(64) atomic_size_t shadow_head; // Shadow ring: bytes ever written (advanced by the owner only)
+  _Alignas(64) atomic_size_t shadow_tail; // Shadow ring: bytes ever drained (advanced by the shadow thread only)
+  char shadow_ring[SHADOW_RING_SIZE]; // Shadow ring storage (complete replay_record_t records)
+  _Alignas(64) atomic_ullong stats[ST_COUNTERS]; // Metrics counters (written by the owner only, summed by readers)
+} worker_slot_t;                      // End of worker_slot_t structure definition
+
+static worker_slot_t worker_slots[MAX_WORKER_SLOTS]; // The slot table
+static atomic_uint worker_slot_hint;                 // Where the next claim starts scanning (spreads claims out)
+static _Thread_local worker_slot_t *current_slot;    // The calling thread's slot (NULL if it has none)
+static atomic_ullong log_dropped;                    // Access log lines dropped because a ring was full or no slot was free
+static int access_log_fd = STDOUT_FILENO;            // Where the log writer sends access log lines
+static atomic_ullong replay_dropped;                 // Replay trace records dropped (full ring or no slot)
+static int replay_fd = -1;                           // Replay trace file (-1 = recording disabled)
+static double shadow_sample;                         // Fraction of GETs mirrored (0 = shadowing disabled)
+static atomic_ullong shadow_sent, shadow_failed, shadow_dropped; // Mirrored requests completed, failed, and never sent
+
+/* Claim a free worker slot for the calling thread. Returns the slot or NULL if all are taken */
+static worker_slot_t *worker_slot_claim(void)                                      // Defines a function to claim a worker slot
+{                                                                                  // Start of worker_slot_claim function body
+  unsigned start = atomic_fetch_add_explicit(&worker_slot_hint, 1, memory_order_relaxed); // Pick a starting point
+  for (unsigned i = 0; i < MAX_WORKER_SLOTS; i++)                                  // Scan every slot at most once
+  {                                                                                // Start of for loop body
+    worker_slot_t *ws = &worker_slots[(start + i) % MAX_WORKER_SLOTS];             // Get the candidate slot
+    int expected = 0;                                                              // It must be free
+    if (atomic_compare_exchange_strong_explicit(&ws->in_use, &expected, 1,         // Try to take it
+                                                memory_order_acquire, memory_order_relaxed))
+      return ws;                                                                   // It is ours
+  } // End of for loop body
+  return NULL; // Every slot is taken
+} // End of worker_slot_claim function body
+
+/* Release a worker slot claimed by worker_slot_claim */
+static void worker_slot_release(worker_slot_t *ws)                 // Defines a function to release a worker slot
+{                                                                  // Start of worker_slot_release function body
+  if (ws)                                                          // If the thread had a slot
+    atomic_store_explicit(&ws->in_use, 0, memory_order_release);   // hand it back (publishing everything written to it)
+} // End of worker_slot_release function body
+
+/* Format the client's numeric address (IPv4 or IPv6) into out */
+static void format_client_addr(const client_ctx_t *ctx, char *out, size_t out_sz)                     // Defines a function to format a client address
+{                                                                                                     // Start of format_client_addr function body
+  out[0] = '\0';                                                                                      // Start with an empty string
+  if (ctx->addr.ss_family == AF_INET)                                                                 // If the client is IPv4
+    inet_ntop(AF_INET, &((const struct sockaddr_in *)&ctx->addr)->sin_addr, out, (socklen_t)out_sz);  // format the IPv4 address
+  else if (ctx->addr.ss_family == AF_INET6)                                                           // If the client is IPv6
+    inet_ntop(AF_INET6, &((const struct sockaddr_in6 *)&ctx->addr)->sin6_addr, out, (socklen_t)out_sz); // format the IPv6 address
+} // End of format_client_addr function body
+
+/* Append one record to a single-producer ring (ring_size a power of two) owned by the calling thread.
+   Never blocks: returns -1 without writing anything if the record does not fit */
+static int ring_push(atomic_size_t *head_p, atomic_size_t *tail_p, char *ring, size_t ring_size, const void *rec, size_t len) // Defines a function to append to a ring
+{                                                                              // Start of ring_push function body
+  size_t head = atomic_load_explicit(head_p, memory_order_relaxed);            // Our own write position
+  size_t tail = atomic_load_explicit(tail_p, memory_order_acquire);            // The writer's read position
+  if (ring_size - (head - tail) < len)                                         // If the record does not fit
+    return -1;                                                                 // report it rather than wait for the writer
+  size_t pos = head & (ring_size - 1);                                         // Where the record starts in the ring
+  size_t first = len < ring_size - pos ? len : ring_size - pos;                // Bytes that fit before the wrap
+  memcpy(ring + pos, rec, first);                                              // Copy the first part
+  memcpy(ring, (const char *)rec + first, len - first);                        // and the wrapped remainder, if any
+  atomic_store_explicit(head_p, head + len, memory_order_release);             // Publish the complete record
+  return 0;                                                                    // Return 0 to indicate success
+} // End of ring_push function body
+
+/* Queue one access log record (text line or binary record) on the calling thread's ring. Never blocks:
+   if the thread has no slot or its ring is full, the record is dropped and counted */
+static void access_log_push(const void *rec, size_t len)                       // Defines a function to queue an access log record
+{                                                                              // Start of access_log_push function body
+  worker_slot_t *ws = current_slot;                                            // Get the calling thread's ring
+  if (!ws || ring_push(&ws->log_head, &ws->log_tail, ws->log_ring, LOG_RING_SIZE, rec, len) != 0) // Queue the record
+    atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);          // or count it as dropped
+} // End of access_log_push function body
+
+/* Copy 'in' into 'out' for use inside a quoted log field, escaping '"', '\' and control bytes
+   (\xHH for combined logs, \u00HH for JSON). Stops early rather than split an escape sequence */
+static char *log_escape(const char *in, char *out, size_t out_sz, int json) // Defines a function to escape a log field
+{                                                                           // Start of log_escape function body
+  size_t o = 0;                                                             // Output position
+  for (const unsigned char *p = (const unsigned char *)in; *p; p++)         // Loop over the input bytes
+  {                                                                         // Start of for loop body
+    char esc[8];                                                            // Declare a buffer for one escaped byte
+    int n;                                                                  // Length of the escaped form
+    if (*p == '"' || *p == '\\')                                            // Quotes and backslashes
+      n = snprintf(esc, sizeof(esc), "\\%c", *p);                           // get a backslash
+    else if (*p < 0x20 || *p == 0x7f)                                       // Control bytes
+      n = snprintf(esc, sizeof(esc), json ? "\\u%04x" : "\\x%02x", *p);     // get a hex escape
+    else                                                                    // Anything else
+    {                                                                       // Start of else block
+      esc[0] = (char)*p;                                                    // is copied as is
+      n = 1;                                                                // one byte long
+    } // End of else block
+    if (o + (size_t)n + 1 > out_sz)                                         // If the escaped byte does not fit
+      break;                                                                // stop (truncating the field)
+    memcpy(out + o, esc, (size_t)n);                                        // Append the escaped byte
+    o += (size_t)n;                                                         // Advance the output position
+  } // End of for loop body
+  out[o] = '\0'; // Null-terminate the output
+  return out;    // Return the output for convenience
+} // End of log_escape function body
+
+/* Binary access log record (log_format=binary), host byte order, followed by method then path bytes */
+typedef struct             // Defines the fixed header of a binary access log record
+{                          // Start of binary_log_record_t structure definition
+  uint16_t length;         // Total record length in bytes, including this header
+  uint8_t version;         // Record layout version (1)
+  uint8_t cache;           // CACHE_NONE, CACHE_HIT or CACHE_MISS
+  uint16_t status;         // HTTP status code
+  uint8_t family;          // Client address family: 4 or 6
+  uint8_t method_len;      // Length of the method that follows the header
+  uint64_t wall;           // Unix time the request was received (seconds)
+  uint64_t bytes;          // Bytes sent
+  uint32_t ttfb_us;        // Time to first byte in microseconds
+  uint32_t duration_us;    // Total duration in microseconds
+  uint8_t addr[16];        // Client address (IPv4 uses the first 4 bytes)
+  uint16_t path_len;       // Length of the path that follows the method
+  uint16_t reserved[3];    // Padding, always zero
+} binary_log_record_t;     // End of binary_log_record_t structure definition
+
+/* Emit the access log record for the request just served on this thread, in the configured format */
+static void access_log_request(const client_ctx_t *ctx)                                 // Defines a function to log a finished request
+{                                                                                       // Start of access_log_request function body
+  const request_log_t *r = &req_log;                                                    // Get the thread's request record
+  long long ttfb_us = r->first_byte_ns ? (r->first_byte_ns - r->start_ns) / 1000 : -1;  // Time to first byte (-1 if nothing was sent)
+  long long total_us = (r->end_ns - r->start_ns) / 1000;                                // Total duration
+  static const char *const cache_names[] = {"-", "hit", "miss"};                        // Names of the cache outcomes
+  const char *cache = cache_names[r->cache];                                            // Name of this request's outcome
+  char line[LOG_LINE_MAX];                                                              // Declare a buffer for the record
+  int n = 0;                                                                            // Length of the record
+
+  if (ctx->cfg->log_format == LOG_FORMAT_BINARY)                                        // Compact binary record
+  {                                                                                     // Start of if block
+    binary_log_record_t h;                                                              // Declare the record header
+    memset(&h, 0, sizeof(h));                                                           // Zero it (including padding and address)
+    size_t mlen = strlen(r->method);                                                    // Length of the method
+    size_t plen = strlen(r->path);                                                      // Length of the path
+    if (plen > sizeof(line) - sizeof(h) - mlen)                                         // If the path does not fit
+      plen = sizeof(line) - sizeof(h) - mlen;                                           // truncate it
+    h.length = (uint16_t)(sizeof(h) + mlen + plen);                                     // Total record length
+    h.version = 1;                                                                      // Record layout version
+    h.cache = (uint8_t)r->cache;                                                        // Cache outcome
+    h.status = (uint16_t)r->status;                                                     // Status code
+    h.method_len = (uint8_t)mlen;                                                       // Method length
+    h.wall = (uint64_t)r->wall;                                                         // Request time
+    h.bytes = (uint64_t)r->bytes;                                                       // Bytes sent
+    h.ttfb_us = ttfb_us < 0 ? UINT32_MAX : (uint32_t)ttfb_us;                           // Time to first byte
+    h.duration_us = (uint32_t)total_us;                                                 // Total duration
+    if (ctx->addr.ss_family == AF_INET)                                                 // If the client is IPv4
+    {                                                                                   // Start of if block
+      h.family = 4;                                                                     // record the family
+      memcpy(h.addr, &((const struct sockaddr_in *)&ctx->addr)->sin_addr, 4);           // and the 4-byte address
+    } // End of if block
+    else if (ctx->addr.ss_family == AF_INET6)                                           // If the client is IPv6
+    {                                                                                   // Start of else if block
+      h.family = 6;                                                                     // record the family
+      memcpy(h.addr, &((const struct sockaddr_in6 *)&ctx->addr)->sin6_addr, 16);        // and the 16-byte address
+    } // End of else if block
+    h.path_len = (uint16_t)plen;                                                        // Path length
+    memcpy(line, &h, sizeof(h));                                                        // Assemble the header
+    memcpy(line + sizeof(h), r->method, mlen);                                          // the method
+    memcpy(line + sizeof(h) + mlen, r->path, plen);                                     // and the path
+    access_log_push(line, h.length);                                                    // Queue the record
+    return;                                                                             // Done
+  } // End of if block
+
+  char addr[INET6_ADDRSTRLEN];                                                          // Declare a buffer for the client address
+  format_client_addr(ctx, addr, sizeof(addr));                                          // Format the client address
+  int json = ctx->cfg->log_format == LOG_FORMAT_JSON;                                   // Whether fields use JSON escaping
+  char path[LOG_LINE_MAX / 2], ref[SMALL_BUF], ua[SMALL_BUF];                           // Declare buffers for the escaped fields
+  log_escape(r->path, path, sizeof(path), json);                                        // Escape the path
+  log_escape(r->referer, ref, sizeof(ref), json);                                       // Escape the Referer
+  log_escape(r->user_agent, ua, sizeof(ua), json);                                      // Escape the User-Agent
+  char ts[64];                                                                          // Declare a buffer for the timestamp
+  struct tm tmv;                                                                        // Declare a tm structure for the broken-down time
+  char phases[SMALL_BUF];                                                               // Declare a buffer for the phase breakdown
+  size_t plen = 0;                                                                      // Length of the breakdown
+  phases[0] = '\0';                                                                     // Empty unless log_phases is on
+  for (int p = 0; trace_log && p < PH_COUNT; p++)                                       // One field per phase (microseconds)
+    plen += (size_t)snprintf(phases + plen, sizeof(phases) - plen, json ? "%s\"%s\":%lld" : "%s%s=%lld",
+                             !json ? " " : p == 0 ? ",\"phases_us\":{" : ",", phase_names[p], r->phase_ns[p] / 1000);
+  if (trace_log && json)                                                                // Close the JSON object
+    snprintf(phases + plen, sizeof(phases) - plen, "}");                                // of phases
+  if (json)                                                                             // JSON lines: one object per request
+  {                                                                                     // Start of if block
+    gmtime_r(&r->wall, &tmv);                                                           // Use UTC
+    strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", &tmv);                               // in ISO 8601 form
+    n = snprintf(line, sizeof(line),                                                    // Format the object
+                 "{\"ts\":\"%s\",\"addr\":\"%s\",\"method\":\"%s\",\"path\":\"%s\",\"version\":\"%s\","
+                 "\"status\":%d,\"bytes\":%lld,\"ttfb_us\":%lld,\"duration_us\":%lld,\"cache\":\"%s\","
+                 "\"referer\":\"%s\",\"user_agent\":\"%s\"%s}\n",
+                 ts, addr, r->method, path, r->version, r->status, r->bytes, ttfb_us, total_us, cache, ref, ua, phases);
+  } // End of if block
+  else                                                                                  // Combined log format plus timing fields
+  {                                                                                     // Start of else block
+    localtime_r(&r->wall, &tmv);                                                        // Use local time
+    strftime(ts, sizeof(ts), "%d/%b/%Y:%H:%M:%S %z", &tmv);                             // in the common log format style
+    n = snprintf(line, sizeof(line),                                                    // Format the line
+                 "%s - - [%s] \"%s %s %s\" %d %lld \"%s\" \"%s\" %lld %lld %s%s\n",
+                 addr, ts, r->method, path, r->version, r->status, r->bytes,
+                 ref[0] ? ref : "-", ua[0] ? ua : "-", ttfb_us, total_us, cache, phases);
+  } // End of else block
+  if (n < 0)                             // If formatting fails
+    return;                              // there is nothing to log
+  if ((size_t)n >= sizeof(line))         // If the line was truncated
+  {                                      // Start of if block
+    n = (int)sizeof(line) - 1;           // keep what fit
+    line[n - 1] = '\n';                  // and keep it newline-terminated
+  } // End of if block
+  access_log_push(line, (size_t)n); // Queue the line
+} // End of access_log_request function body
+
+/* Write a whole buffer to a file descriptor, retrying short writes. Returns 0 on success */
+static int write_all(int fd, const char *buf, size_t len)          // Defines a function to write a whole buffer
+{                                                                  // Start of write_all function body
+  while (len > 0)                                                  // Loop until everything is written
+  {                                                                // Start of while loop body
+    ssize_t n = write(fd, buf, len);                               // Write as much as possible
+    if (n < 0 && errno == EINTR)                                   // If interrupted by a signal
+      continue;                                                    // try again
+    if (n <= 0)                                                    // If the write fails
+      return -1;                                                   // return an error
+    buf += n;                                                      // Advance past the written bytes
+    len -= (size_t)n;                                              // and count them
+  } // End of while loop body
+  return 0; // Return 0 to indicate success
+} // End of write_all function body
+
+/* Slow request log (slow_log=, slow_ms=)
+   Requests whose duration reaches the threshold get a detailed JSON line with the phase breakdown, the body
+   size and the kernel's TCP_INFO for the connection (read before the socket is closed). A large rtt or cwnd
+   with retransmits points at the network; large stat/open/send phases on a healthy connection point at the
+   server. Slow requests are rare by definition, so each record is written directly with one append write() */
+static int slow_log_fd = -1;      // Slow log file (-1 = disabled)
+static long long slow_log_ns;     // Threshold in nanoseconds
+
+static void slow_log_request(const client_ctx_t *ctx)                                        // Defines a function to log a slow request
+{                                                                                            // Start of slow_log_request function body
+  const request_log_t *r = &req_log;                                                         // Get the thread's request record
+  long long total_ns = r->end_ns - r->start_ns;                                              // Duration of the request
+  if (slow_log_fd < 0 || total_ns < slow_log_ns)                                             // If disabled or fast enough
+    return;                                                                                  // there is nothing to record
+  char addr[INET6_ADDRSTRLEN], path[LOG_LINE_MAX / 2], ts[64];                               // Declare buffers for the fields
+  format_client_addr(ctx, addr, sizeof(addr));                                               // Format the client address
+  log_escape(r->path, path, sizeof(path), 1);                                                // Escape the path for JSON
+  struct tm tmv;                                                                             // Declare a tm structure
+  gmtime_r(&r->wall, &tmv);                                                                  // Use UTC
+  strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", &tmv);                                      // in ISO 8601 form
+
+  char line[LOG_LINE_MAX];                                                                   // Declare a buffer for the record
+  size_t len = (size_t)snprintf(line, sizeof(line),                                          // Request summary
+                                "{\"ts\":\"%s\",\"addr\":\"%s\",\"method\":\"%s\",\"path\":\"%s\",\"status\":%d,"
+                                "\"bytes\":%lld,\"file_size\":%lld,\"duration_us\":%lld,\"phases_us\":{",
+                                ts, addr, r->method, path, r->status, r->bytes, r->file_size, total_ns / 1000);
+  for (int p = 0; p < PH_COUNT && len < sizeof(line); p++)                                   // Phase breakdown
+    len += (size_t)snprintf(line + len, sizeof(line) - len, "%s\"%s\":%lld", p ? "," : "", phase_names[p], r->phase_ns[p] / 1000);
+  struct tcp_info ti;                                                                        // Declare a TCP_INFO structure
+  socklen_t tlen = sizeof(ti);                                                               // Its size
+  memset(&ti, 0, sizeof(ti));                                                                // Zero it (older kernels fill less)
+  if (len < sizeof(line) && getsockopt(ctx->client, IPPROTO_TCP, TCP_INFO, &ti, &tlen) == 0) // Ask the kernel about the connection
+    len += (size_t)snprintf(line + len, sizeof(line) - len,
+                            "},\"tcp\":{\"rtt_us\":%u,\"rttvar_us\":%u,\"snd_cwnd\":%u,\"snd_mss\":%u,\"pmtu\":%u,"
+                            "\"retransmits\":%u,\"total_retrans\":%u,\"lost\":%u,\"unacked\":%u}}\n",
+                            ti.tcpi_rtt, ti.tcpi_rttvar, ti.tcpi_snd_cwnd, ti.tcpi_snd_mss, ti.tcpi_pmtu,
+                            (unsigned)ti.tcpi_retransmits, ti.tcpi_total_retrans, ti.tcpi_lost, ti.tcpi_unacked);
+  else if (len < sizeof(line))                                                               // If TCP_INFO is unavailable
+    len += (size_t)snprintf(line + len, sizeof(line) - len, "},\"tcp\":null}\n");            // say so
+  if (len >= sizeof(line))                                                                   // If the record was truncated
+    return;                                                                                  // drop it rather than write broken JSON
+  write_all(slow_log_fd, line, len);                                                         // Append the record
+} // End of slow_log_request function body
+
+/* Replay trace (replay_trace=)
+   Every parsed request is recorded as a compact binary record - arrival time, request line and the headers that
+   change how it is served - for web_load -r to re-issue later with the original timing. Records go through a
+   per-thread ring drained by the access log writer, like the access log, so recording never blocks a request.
+   Records from different threads may be written slightly out of time order; the replayer sorts them.
+   The file starts with a replay_file_header_t (written once, when the file is empty); all fields are in host
+   byte order and the layouts are duplicated in web_load.c */
+#define REPLAY_MAGIC "WSREPLAY" // File magic (8 bytes, no terminator)
+#define REPLAY_VERSION 1        // Record layout version
+
+typedef struct            // Defines the header at the start of a replay trace file
+{                         // Start of replay_file_header_t structure definition
+  char magic[8];          // REPLAY_MAGIC
+  uint32_t version;       // REPLAY_VERSION
+  uint32_t record_size;   // sizeof(replay_record_t), so readers can skip fields they do not know
+} replay_file_header_t;   // End of replay_file_header_t structure definition
+
+typedef struct            // Defines the fixed part of one replay record, followed by the variable fields in order:
+{                         // method, path, version, Accept-Encoding, If-None-Match, If-Modified-Since, Referer, User-Agent
+  uint16_t length;        // Total record length in bytes, including this header
+  uint16_t path_len;      // Length of the request target
+  uint8_t method_len;     // Length of the method
+  uint8_t version_len;    // Length of the HTTP version
+  uint8_t ae_len;         // Length of the Accept-Encoding value (0 = absent)
+  uint8_t inm_len;        // Length of the If-None-Match value
+  uint64_t time_us;       // Arrival time of the request head (Unix microseconds)
+  uint8_t ims_len;        // Length of the If-Modified-Since value
+  uint8_t referer_len;    // Length of the Referer value
+  uint8_t ua_len;         // Length of the User-Agent value
+  uint8_t reserved[5];    // Padding, always zero
+} replay_record_t;        // End of replay_record_t structure definition
+
+/* Record the request just parsed on this thread in the replay trace and, for sampled GETs, queue the same
+   record for the shadow thread (no-op unless replay_trace= or shadow= is set). Sampling is by connection
+   number - exactly shadow_sample of the connections, spread evenly, with no shared state to contend on */
+static void replay_record_request(const request_headers_t *hdrs)                          // Defines a function to record a request for replay
+{                                                                                         // Start of replay_record_request function body
+  const request_log_t *r = &req_log;                                                      // The request line is already in the log record
+  int shadow = shadow_sample > 0 && !strcmp(r->method, "GET") &&                          // Mirror this one if it is a GET
+               (unsigned long long)((double)r->conn_id * shadow_sample) !=                // and the sample count steps up
+               (unsigned long long)((double)(r->conn_id - 1) * shadow_sample);            // at this connection
+  if (replay_fd < 0 && !shadow)                                                           // If neither wants it
+    return;                                                                               // there is nothing to do
+  const char *fields[] = {r->method, r->path, r->version, hdrs->accept_encoding,          // Variable fields
+                          hdrs->if_none_match, hdrs->if_modified_since, r->referer, r->user_agent}; // in record order
+  size_t lens[8];                                                                         // and their lengths
+  char rec[LOG_LINE_MAX * 2];                                                             // Declare a buffer for the record
+  size_t len = sizeof(replay_record_t);                                                   // Start after the fixed part
+  for (int i = 0; i < 8; i++)                                                             // Measure each field
+  {                                                                                       // Start of for loop body
+    lens[i] = strlen(fields[i]);                                                          // (header values fit a uint8_t: SMALL_BUF - 1)
+    if (i == 1 && lens[i] > LOG_LINE_MAX)                                                 // Very long targets
+      lens[i] = LOG_LINE_MAX;                                                             // are truncated
+    memcpy(rec + len, fields[i], lens[i]);                                                // Append the field
+    len += lens[i];                                                                       // Count it
+  } // End of for loop body
+  struct timespec ts;                                                                     // Declare a timespec structure
+  clock_gettime(CLOCK_REALTIME, &ts);                                                     // Arrival time (wall clock, so traces from
+  replay_record_t h;                                                                      // different runs line up with the logs)
+  memset(&h, 0, sizeof(h));                                                               // Zero the fixed part (including padding)
+  h.length = (uint16_t)len;                                                               // Total length
+  h.method_len = (uint8_t)lens[0];                                                        // Method length
+  h.path_len = (uint16_t)lens[1];                                                         // Request path length
+  h.version_len = (uint8_t)lens[2];                                                       // Protocol version length
+  h.ae_len = (uint8_t)lens[3];                                                            // Accept-Encoding length
+  h.inm_len = (uint8_t)lens[4];                                                           // If-None-Match length
+  h.ims_len = (uint8_t)lens[5];                                                           // If-Modified-Since length
+  h.referer_len = (uint8_t)lens[6];                                                       // Referer length
+  h.ua_len = (uint8_t)lens[7];                                                            // User-Agent length
+  h.time_us = (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;              // Arrival time in microseconds
+  memcpy(rec, &h, sizeof(h));                                                             // Put the fixed part in front
+  worker_slot_t *ws = current_slot;                                                       // Get the calling thread's rings
+  if (replay_fd >= 0 &&                                                                   // When recording,
+      (!ws || ring_push(&ws->replay_head, &ws->replay_tail, ws->replay_ring, REPLAY_RING_SIZE, rec, len) != 0)) // queue the record
+    atomic_fetch_add_explicit(&replay_dropped, 1, memory_order_relaxed);                  // or count it as dropped
+  if (shadow &&                                                                           // When mirroring,
+      (!ws || ring_push(&ws->shadow_head, &ws->shadow_tail, ws->shadow_ring, SHADOW_RING_SIZE, rec, len) != 0)) // hand it over
+    atomic_fetch_add_explicit(&shadow_dropped, 1, memory_order_relaxed);                  // or count it as dropped
+} // End of replay_record_request function body
+
+/* Move everything queued in one ring into the batch buffer, writing the batch to fd whenever it fills.
+   Returns the number of bytes left in the batch */
+static size_t ring_drain(atomic_size_t *head_p, atomic_size_t *tail_p, const char *ring, size_t ring_size, // Defines a function to drain a ring
+                         int fd, char *batch, size_t used)
+{                                                                                          // Start of ring_drain function body
+  size_t tail = atomic_load_explicit(tail_p, memory_order_relaxed);                        // Our own read position
+  size_t head = atomic_load_explicit(head_p, memory_order_acquire);                        // The owner's published write position
+  while (tail != head)                                                                     // While the ring has data
+  {                                                                                        // Start of while loop body
+    size_t pos = tail & (ring_size - 1);                                                   // Where the data starts in the ring
+    size_t chunk = head - tail;                                                            // Bytes available
+    if (chunk > ring_size - pos)                                                           // Stop at the wrap point
+      chunk = ring_size - pos;                                                             // (the rest comes next iteration)
+    if (chunk > LOG_BATCH_SIZE - used)                                                     // Stop at the end of the batch
+      chunk = LOG_BATCH_SIZE - used;                                                       // buffer
+    if (chunk == 0)                                                                        // If the batch is full
+    {                                                                                      // Start of if block
+      write_all(fd, batch, used);                                                          // write it out
+      used = 0;                                                                            // and start a new one
+      continue;                                                                            // Retry the copy
+    } // End of if block
+    memcpy(batch + used, ring + pos, chunk);                                               // Copy the data into the batch
+    used += chunk;                                                                         // Count it
+    tail += chunk;                                                                         // Advance past it
+  } // End of while loop body
+  atomic_store_explicit(tail_p, tail, memory_order_release);                               // Give the space back to the owner
+  return used;                                                                             // Report what is still batched
+} // End of ring_drain function body
+
+/* Background access log writer: drains every slot's ring into one batch buffer and writes it with a
+   single write() call, sleeping briefly whenever the rings are empty. The replay trace rings, when
+   recording is on, are drained the same way into their own batch */
+static void *access_log_thread(void *arg)                                                  // Defines the entry point of the log writer thread
+{                                                                                          // Start of access_log_thread function body
+  (void)arg;                                                                               // The thread takes no argument
+  char *batch = (char *)malloc(LOG_BATCH_SIZE);                                            // Allocate the batch buffer
+  char *replay_batch = replay_fd >= 0 ? (char *)malloc(LOG_BATCH_SIZE) : NULL;             // and one for the replay trace
+  unsigned long long reported = 0;                                                         // Drops already reported on stderr
+  time_t last_report = 0;                                                                  // When drops were last reported
+  if (!batch || (replay_fd >= 0 && !replay_batch))                                         // If allocation fails
+    return NULL;                                                                           // logging stops (lines will be counted as dropped)
+  for (;;)                                                                                 // Loop forever
+  {                                                                                        // Start of for loop body
+    size_t used = 0, replay_used = 0;                                                      // Bytes in the batches
+    for (int i = 0; i < MAX_WORKER_SLOTS; i++)                                             // Visit every slot
+    {                                                                                      // Start of for loop body
+      worker_slot_t *ws = &worker_slots[i];                                                // Get the slot
+      used = ring_drain(&ws->log_head, &ws->log_tail, ws->log_ring, LOG_RING_SIZE, access_log_fd, batch, used); // Collect its log lines
+      if (replay_batch)                                                                    // and, when recording,
+        replay_used = ring_drain(&ws->replay_head, &ws->replay_tail, ws->replay_ring, REPLAY_RING_SIZE, // its replay records
+                                 replay_fd, replay_batch, replay_used);
+    } // End of for loop body
+    if (used > 0)                                                                          // If anything was collected
+      write_all(access_log_fd, batch, used);                                               // write it with one system call
+    if (replay_used > 0)                                                                   // Likewise for the replay trace
+      write_all(replay_fd, replay_batch, replay_used);                                     // (whole records only)
+    used += replay_used;                                                                   // Either kind counts as activity
+
+    unsigned long long dropped = atomic_load_explicit(&log_dropped, memory_order_relaxed) + // Check the drop counters
+                                 atomic_load_explicit(&replay_dropped, memory_order_relaxed);
+    time_t now = time(NULL);                                                               // Get the current time
+    if (dropped != reported && now != last_report)                                         // If new drops happened (report at most once a second)
+    {                                                                                      // Start of if block
+      fprintf(stderr, "access log: %llu records dropped so far (%llu of them replay records)\n", dropped, // report the running total
+              (unsigned long long)atomic_load_explicit(&replay_dropped, memory_order_relaxed));
+      reported = dropped;                                                                  // Remember what was reported
+      last_report = now;                                                                   // and when
+    } // End of if block
+    if (used == 0)                                                                         // If the rings were empty
+    {                                                                                      // Start of if block
+      struct timespec ts = {0, LOG_FLUSH_MS * 1000000L};                                   // sleep for the flush interval
+      nanosleep(&ts, NULL);                                                                // before looking again
+    } // End of if block
+  } // End of for loop body
+  return NULL; // Never reached
+} // End of access_log_thread function body
+
+/* Connection timeouts (header_timeout=, send_timeout=)
+   Every connection's deadline sits in a two-level hashed timer wheel: WHEEL_L0 slots of one tick, then WHEEL_L1
+   slots of WHEEL_L0 ticks whose timers cascade down as the fine level comes round, so arming, disarming and
+   expiring a timer are all O(1). Pushing a deadline later - which send progress does on every chunk - is a
+   relaxed store: when the wheel reaches the old slot it sees the new deadline and re-files the timer. An
+   expired connection is shut down (after a best-effort 408 if its request head never arrived), which makes its
+   thread's blocked recv/send/sendfile return so the thread closes it and exits. Connections are one request
+   each, so the header deadline is also the idle limit */
+static struct                                   // The timer wheel
+{                                               // Start of timer wheel structure definition
+  pthread_mutex_t lock;                         // Guards the slot lists and 'expires' fields
+  conn_timer_t l0[WHEEL_L0];                    // Fine level: list heads, one per tick
+  conn_timer_t l1[WHEEL_L1];                    // Coarse level: list heads, one per WHEEL_L0 ticks
+  long long tick;                               // Last tick processed
+} wheel = {.lock = PTHREAD_MUTEX_INITIALIZER};  // End of timer wheel structure definition
+static long long header_timeout_ticks;          // Header allowance in ticks (0 = unlimited)
+static atomic_ullong timeouts_header, timeouts_send; // Connections closed by each deadline
+
+/* Current time in wheel ticks */
+static long long wheel_clock(void)                                                            // Defines a function to read the wheel clock
+{                                                                                            // Start of wheel_clock function body
+  return mono_ns() / (WHEEL_TICK_MS * 1000000LL);                                            // Ticks since an arbitrary origin
+} // End of wheel_clock function body
+
+/* File a timer in the slot for its deadline (wheel lock held) */
+static void wheel_insert(conn_timer_t *t, long long expires)                                  // Defines a function to file a timer
+{                                                                                            // Start of wheel_insert function body
+  long long delta = expires - wheel.tick;                                                    // Ticks to go
+  conn_timer_t *head;                                                                        // Slot list to join
+  if (delta < WHEEL_L0)                                                                      // Within one turn of the fine level
+    head = &wheel.l0[(expires > wheel.tick ? expires : wheel.tick + 1) % WHEEL_L0];           // (overdue timers fire next tick)
+  else if (delta < (long long)WHEEL_L0 * WHEEL_L1)                                           // Within one turn of the coarse level
+    head = &wheel.l1[(expires / WHEEL_L0) % WHEEL_L1];                                       // the slot cascades down in time
+  else                                                                                       // Further out: the farthest coarse slot,
+    head = &wheel.l1[(wheel.tick / WHEEL_L0 + WHEEL_L1) % WHEEL_L1];                         // re-filed when it cascades
+  t->expires = expires;                                                                      // Remember where it went
+  t->prev = head;                                                                            // Link it in
+  t->next = head->next;                                                                      // at the front
+  head->next->prev = t;                                                                      // The old first timer points back at it
+  head->next = t;                                                                            // and the slot head points at it
+} // End of wheel_insert function body
+
+/* Take a timer out of its slot (wheel lock held) */
+static void wheel_unlink(conn_timer_t *t)                                                     // Defines a function to unfile a timer
+{                                                                                            // Start of wheel_unlink function body
+  t->prev->next = t->next;                                                                   // Bridge the neighbours
+  t->next->prev = t->prev;                                                                   // in both directions
+  t->prev = t->next = NULL;                                                                  // No longer in the wheel
+} // End of wheel_unlink function body
+
+/* Start timing a new connection: it has header_timeout to deliver its request head */
+static void timer_arm(conn_timer_t *t, sock_t fd)                                             // Defines a function to arm a connection timer
+{                                                                                            // Start of timer_arm function body
+  t->fd = fd;                                                                                // The socket to shut down on expiry
+  t->prev = t->next = NULL;                                                                  // Not filed yet
+  current_timer = t;                                                                         // Send progress renews it
+  if (!header_timeout_ticks && !send_timeout_ticks)                                          // No timeouts configured
+    return;                                                                                  // (the wheel is not running)
+  atomic_store_explicit(&t->phase, TIMER_HEADER, memory_order_relaxed);                      // Waiting for the head
+  long long deadline = header_timeout_ticks ? wheel_clock() + header_timeout_ticks : LLONG_MAX; // Its deadline
+  atomic_store_explicit(&t->deadline, deadline, memory_order_relaxed);                       // Store the header deadline
+  if (!header_timeout_ticks)                                                                 // With no header timeout there is nothing to file until the send phase
+    return;                                                                                  // so leave it unfiled for now
+  pthread_mutex_lock(&wheel.lock);                                                           // Take the wheel lock to file it
+  wheel_insert(t, deadline);                                                                 // in the slot for its deadline
+  pthread_mutex_unlock(&wheel.lock);                                                         // Release the wheel lock
+} // End of timer_arm function body
+
+/* The request head is in: from now on the connection must keep making send progress */
+static void timer_sending(void)                                                               // Defines a function to switch to the send deadline
+{                                                                                            // Start of timer_sending function body
+  conn_timer_t *t = current_timer;                                                           // The calling thread's timer
+  if (!t || (!header_timeout_ticks && !send_timeout_ticks))                                  // If timeouts are off
+    return;                                                                                  // there is nothing to do
+  long long deadline = send_timeout_ticks ? wheel_clock() + send_timeout_ticks : LLONG_MAX;  // The new deadline
+  atomic_store_explicit(&t->phase, TIMER_SEND, memory_order_relaxed);                        // Now sending
+  atomic_store_explicit(&t->deadline, deadline, memory_order_relaxed);                       // Store the send deadline
+  pthread_mutex_lock(&wheel.lock);                                                           // Re-file it only if needed (a later deadline is picked up lazily)
+  if (!t->prev && deadline != LLONG_MAX)                                                     // If it was never filed (header_timeout off)
+    wheel_insert(t, deadline);                                                               // file it now
+  else if (t->prev && deadline < t->expires)                                                 // If the deadline moved earlier than its slot
+  {                                                                                          // Start of else if block
+    wheel_unlink(t);                                                                         // take it out of the old slot
+    wheel_insert(t, deadline);                                                               // and file it at the new deadline
+  } // End of else if block
+  pthread_mutex_unlock(&wheel.lock);                                                         // Release the wheel lock
+} // End of timer_sending function body
+
+/* Stop timing the calling thread's connection (before its socket is closed, so the fd cannot be reused under us) */
+static void timer_disarm(void)                                                                // Defines a function to disarm a connection timer
+{                                                                                            // Start of timer_disarm function body
+  conn_timer_t *t = current_timer;                                                           // The calling thread's timer
+  current_timer = NULL;                                                                      // It is going away
+  if (!t || (!header_timeout_ticks && !send_timeout_ticks))                                  // If timeouts are off
+    return;                                                                                  // there is nothing to do
+  pthread_mutex_lock(&wheel.lock);                                                           // Take it out of the wheel
+  if (t->prev)                                                                               // if it is still filed
+    wheel_unlink(t);                                                                         // unlink it
+  pthread_mutex_unlock(&wheel.lock);                                                         // Release the wheel lock
+} // End of timer_disarm function body
+
+/* Expire one timer whose slot came round: re-file it if its deadline moved, otherwise close the connection (wheel lock held) */
+static void wheel_expire(conn_timer_t *t)                                                     // Defines a function to expire a timer
+{                                                                                            // Start of wheel_expire function body
+  static const char timeout_response[] = "HTTP/1.0 408 Request Timeout\r\nServer: c-mini/1.0\r\n" // Canned 408
+                                         "Content-Length: 0\r\nConnection: close\r\n\r\n";
+  wheel_unlink(t);                                                                           // Take it out of the slot
+  long long deadline = atomic_load_explicit(&t->deadline, memory_order_relaxed);             // Its current deadline
+  if (deadline > wheel.tick)                                                                 // If progress pushed it out
+  {                                                                                          // Start of if block
+    if (deadline != LLONG_MAX)                                                               // (and it still has one)
+      wheel_insert(t, deadline);                                                             // file it again
+    return;                                                                                  // It lives on
+  } // End of if block
+  int q = 0;                                                                                 // Bytes still queued for the client
+  if (atomic_load_explicit(&t->phase, memory_order_relaxed) == TIMER_SEND &&                 // A sender blocked on a full buffer makes
+      ioctl(t->fd, SIOCOUTQ, &q) == 0 && q < atomic_load_explicit(&t->queued, memory_order_relaxed)) // progress while the client drains it
+  {                                                                                          // Start of if block
+    atomic_store_explicit(&t->queued, q, memory_order_relaxed);                              // so note the new queue length
+    atomic_store_explicit(&t->deadline, wheel.tick + send_timeout_ticks, memory_order_relaxed); // give it another send_timeout
+    wheel_insert(t, wheel.tick + send_timeout_ticks);                                        // and file it again
+    return;                                                                                  // It lives on
+  } // End of if block
+  if (atomic_load_explicit(&t->phase, memory_order_relaxed) == TIMER_HEADER)                 // If the head never arrived
+  {                                                                                          // Start of if block
+    send(t->fd, timeout_response, sizeof(timeout_response) - 1, MSG_DONTWAIT | MSG_NOSIGNAL); // tell the client (best effort)
+    atomic_fetch_add_explicit(&timeouts_header, 1, memory_order_relaxed);                    // and count it
+  } // End of if block
+  else                                                                                       // A stalled response
+    atomic_fetch_add_explicit(&timeouts_send, 1, memory_order_relaxed);                      // is counted
+  shutdown(t->fd, SHUT_RDWR);                                                                // Wake the thread: its blocked call fails
+} // End of wheel_expire function body
+
+/* Timer wheel thread: advances the wheel once per tick, cascading and expiring slots */
+static void *timer_wheel_thread(void *arg)                                                    // Defines the entry point of the timer wheel thread
+{                                                                                            // Start of timer_wheel_thread function body
+  (void)arg;                                                                                 // The thread takes no argument
+  for (;;)                                                                                   // Loop forever
+  {                                                                                          // Start of for loop body
+    struct timespec ts = {0, WHEEL_TICK_MS * 1000000L};                                      // Sleep one tick
+    nanosleep(&ts, NULL);                                                                    // Block until the next tick is due
+    long long now = wheel_clock();                                                           // Where the wheel should be
+    pthread_mutex_lock(&wheel.lock);                                                         // Advance it
+    while (wheel.tick < now)                                                                 // one tick at a time
+    {                                                                                        // Start of while loop body
+      long long t = ++wheel.tick;                                                            // The tick to process
+      if (t % WHEEL_L0 == 0)                                                                 // A new turn of the fine level:
+      {                                                                                      // Start of if block
+        conn_timer_t *head = &wheel.l1[(t / WHEEL_L0) % WHEEL_L1];                           // bring the coarse slot
+        while (head->next != head)                                                           // for this turn down
+        {                                                                                    // Start of while loop body
+          conn_timer_t *c = head->next;                                                      // (each timer lands in its
+          wheel_unlink(c);                                                                   // fine slot, or stays coarse
+          wheel_insert(c, c->expires);                                                       // if it is still far off)
+        } // End of while loop body
+      } // End of if block
+      conn_timer_t *head = &wheel.l0[t % WHEEL_L0];                                          // Then expire the fine slot
+      while (head->next != head)                                                             // Every timer in it
+        wheel_expire(head->next);                                                            // is due (or re-filed)
+    } // End of while loop body
+    atomic_store_explicit(&wheel_now, wheel.tick, memory_order_relaxed);                     // Publish the clock for send progress
+    pthread_mutex_unlock(&wheel.lock);                                                       // Release the wheel lock
+  } // End of for loop body
+  return NULL; // Never reached
+} // End of timer_wheel_thread function body
+
+/* Set up the wheel and start its thread. Returns 0 on success */
+static int timer_wheel_start(const server_config_t *cfg)                                      // Defines a function to start the timer wheel
+{                                                                                            // Start of timer_wheel_start function body
+  header_timeout_ticks = cfg->header_timeout > 0 ? cfg->header_timeout * (1000LL / WHEEL_TICK_MS) : 0; // Header allowance in ticks
+  send_timeout_ticks = cfg->send_timeout > 0 ? cfg->send_timeout * (1000LL / WHEEL_TICK_MS) : 0;       // Send progress allowance in ticks
+  if (!header_timeout_ticks && !send_timeout_ticks)                                          // Nothing to enforce
+    return 0;                                                                                // (no thread needed)
+  for (int i = 0; i < WHEEL_L0; i++)                                                         // Empty slot lists
+    wheel.l0[i].prev = wheel.l0[i].next = &wheel.l0[i];                                      // point at themselves
+  for (int i = 0; i < WHEEL_L1; i++)                                                         // Same for the coarse level
+    wheel.l1[i].prev = wheel.l1[i].next = &wheel.l1[i];                                      // (each empty head is its own neighbour)
+  wheel.tick = wheel_clock();                                                                // Start at the present
+  atomic_store_explicit(&wheel_now, wheel.tick, memory_order_relaxed);                       // Publish the starting clock
+  pthread_t wtid;                                                                            // Declare the thread ID
+  if (pthread_create(&wtid, NULL, timer_wheel_thread, NULL) != 0)                            // Start the wheel
+    return -1;                                                                               // Report that the thread could not start
+  pthread_detach(wtid); // Detach the thread; it runs for the life of the process
+  return 0;             // Return 0 to indicate success
+} // End of timer_wheel_start function body
+
+/* Admission control (max_connections=, max_inflight=, overload=, retry_after=, listen_backlog=)
+   Two limits keep a flood from taking the server down. The accept loop counts open connections and, past
+   max_connections, either answers a new connection with the canned 503 right there (no thread is started for
+   it) or stops accepting until one closes, leaving the excess in the kernel's accept queue (listen_backlog=).
+   A request whose head has been read takes an in-flight admission; past the limit it gets the same 503 instead
+   of being served. The response is built once at startup and has no Date header, which is allowed for 5xx */
+static atomic_int admit_conns;                  // Open connections (accepted and not yet closed)
+static atomic_int admit_inflight;               // Requests being served
+static atomic_int admit_limit;                  // In-flight request limit (0 = unlimited)
+static int admit_max_conns;                     // Open connection limit (0 = unlimited)
+static int admit_pause;                         // 1 = pause accepting at the connection limit instead of rejecting
+static atomic_ullong shed_conns, shed_requests; // Connections and requests turned away
+static char overload_response[SMALL_BUF];       // The precomputed 503 response
+static size_t overload_len;                     // and its length
+static sock_t listen_sock = INVALID_SOCKET;     // The listening socket (its accept queue is reported in the metrics)
+static int adaptive_max;                        // Upper bound of the adaptive limit (0 = limiter off)
+static atomic_ullong adaptive_sum_us, adaptive_count; // Time to first byte of the requests finished in this window
+static atomic_int adaptive_peak;                // Most requests in flight at once during this window
+static atomic_llong adaptive_rtt_us, adaptive_baseline_us; // Last window's latency and the long-term baseline (for metrics)
+
+/* Build the overload response and publish the limits */
+static void admission_init(const server_config_t *cfg)                                       // Defines a function to set up admission control
+{                                                                                            // Start of admission_init function body
+  static const char body[] = "Server overloaded, please retry.\n";                          // Body of the 503
+  overload_len = (size_t)snprintf(overload_response, sizeof(overload_response),              // Whole response, built once
+                                  "HTTP/1.0 503 Service Unavailable\r\nServer: c-mini/1.0\r\n"
+                                  "Content-Type: text/plain; charset=utf-8\r\nContent-Length: %zu\r\n"
+                                  "Retry-After: %d\r\nConnection: close\r\n\r\n%s",
+                                  sizeof(body) - 1, cfg->retry_after > 0 ? cfg->retry_after : 1, body);
+  admit_max_conns = cfg->max_connections > 0 ? cfg->max_connections : 0;                    // Connection limit
+  admit_pause = cfg->overload_pause;                                                         // and what happens past it
+  atomic_store_explicit(&admit_limit, cfg->max_inflight > 0 ? cfg->max_inflight : 0, memory_order_relaxed); // In-flight limit
+  if (cfg->adaptive_limit)                                                                   // The adaptive limiter
+  {                                                                                          // Start of if block
+    adaptive_max = cfg->max_inflight > 0 ? cfg->max_inflight : MAX_WORKER_SLOTS;             // stays below the static limit
+    atomic_store_explicit(&admit_limit, adaptive_max < ADAPTIVE_INITIAL_LIMIT ? adaptive_max : ADAPTIVE_INITIAL_LIMIT,
+                          memory_order_relaxed);                                             // and starts low
+  } // End of if block
+} // End of admission_init function body
+
+/* Take an in-flight admission for the request just parsed on this thread. Returns 1 if it may be served */
+static int admission_acquire(void)                                                            // Defines a function to admit a request
+{                                                                                            // Start of admission_acquire function body
+  int limit = atomic_load_explicit(&admit_limit, memory_order_relaxed);                      // Current limit
+  int n = atomic_fetch_add_explicit(&admit_inflight, 1, memory_order_relaxed);               // Claim a place
+  if (limit > 0 && n >= limit)                                                               // If there was none left
+  {                                                                                          // Start of if block
+    atomic_fetch_sub_explicit(&admit_inflight, 1, memory_order_relaxed);                     // give it back
+    atomic_fetch_add_explicit(&shed_requests, 1, memory_order_relaxed);                      // and count the request as shed
+    return 0;                                                                                // It must not be served
+  } // End of if block
+  if (adaptive_max && n + 1 > atomic_load_explicit(&adaptive_peak, memory_order_relaxed)) // Track the window's peak
+    atomic_store_explicit(&adaptive_peak, n + 1, memory_order_relaxed);                      // (a lost race only understates it)
+  req_log.admitted = 1; // Remember to give the place back
+  return 1;             // The request may be served
+} // End of admission_acquire function body
+
+/* Give back the calling thread's in-flight admission, if it holds one */
+static void admission_release(void)                                                           // Defines a function to end an admission
+{                                                                                            // Start of admission_release function body
+  if (!req_log.admitted)                                                                     // If the request was not admitted
+    return;                                                                                  // there is nothing to give back
+  atomic_fetch_sub_explicit(&admit_inflight, 1, memory_order_relaxed);                       // Free the place
+  req_log.admitted = 0;                                                                      // (only once)
+  if (adaptive_max && req_log.first_byte_ns)                                                 // Feed the adaptive limiter
+  {                                                                                          // Start of if block
+    atomic_fetch_add_explicit(&adaptive_sum_us, (unsigned long long)(req_log.first_byte_ns - req_log.start_ns) / 1000, memory_order_relaxed);
+    atomic_fetch_add_explicit(&adaptive_count, 1, memory_order_relaxed);                     // with this request's time to first byte
+  } // End of if block
+} // End of admission_release function body
+
+/* Adaptive concurrency limit (adaptive_limit=on)
+   A gradient controller in the style of TCP Vegas: every ADAPTIVE_INTERVAL_MS it compares the window's mean
+   time to first byte (which covers queueing for CPU and disk but not slow clients draining a body) with a
+   slowly moving baseline. While latency stays within ADAPTIVE_TOLERANCE of the baseline the limit grows by
+   about its square root per window; as latency climbs the gradient baseline/latency scales it down (by at most
+   half per window), so the server settles where it is busy but not yet queueing. The limit does not grow in
+   windows that never came close to using it, and stays between ADAPTIVE_MIN_LIMIT and max_inflight */
+static void *adaptive_thread(void *arg)                                                      // Defines the entry point of the limiter thread
+{                                                                                            // Start of adaptive_thread function body
+  (void)arg;                                                                                 // The thread takes no argument
+  double limit = (double)atomic_load_explicit(&admit_limit, memory_order_relaxed);           // Current limit (kept fractional)
+  double baseline = 0;                                                                       // Long-term latency (microseconds)
+  for (;;)                                                                                   // Loop forever
+  {                                                                                          // Start of for loop body
+    struct timespec ts = {0, ADAPTIVE_INTERVAL_MS * 1000000L};                               // Wait for the window to fill
+    nanosleep(&ts, NULL);                                                                    // for one control interval
+    unsigned long long n = atomic_load_explicit(&adaptive_count, memory_order_relaxed);      // Requests finished in the window
+    if (n < ADAPTIVE_MIN_SAMPLES)                                                            // Too few to judge
+      continue;                                                                              // (keep accumulating)
+    unsigned long long sum = atomic_exchange_explicit(&adaptive_sum_us, 0, memory_order_relaxed); // Take the window
+    n = atomic_exchange_explicit(&adaptive_count, 0, memory_order_relaxed);                  // (a request landing in between
+    int peak = atomic_exchange_explicit(&adaptive_peak, 0, memory_order_relaxed);            // skews one window slightly)
+    double rtt = n ? (double)sum / (double)n : 0;                                            // Mean time to first byte
+    if (rtt < 1)                                                                             // Sub-microsecond means
+      rtt = 1;                                                                               // (keep the ratio finite)
+    if (baseline == 0 || rtt < baseline)                                                     // Better than the baseline:
+      baseline = baseline == 0 ? rtt : 0.8 * baseline + 0.2 * rtt;                           // follow it down quickly
+    else                                                                                     // Worse:
+      baseline = 0.98 * baseline + 0.02 * rtt;                                               // drift up slowly (workloads change)
+    double gradient = ADAPTIVE_TOLERANCE * baseline / rtt;                                   // Below 1 once latency exceeds the tolerance
+    gradient = gradient < 0.5 ? 0.5 : gradient > 1 ? 1 : gradient;                          // Shrink by at most half, never grow by it
+    double headroom = 1;                                                                     // Growth allowance: about sqrt(limit)
+    while ((headroom + 1) * (headroom + 1) <= limit)                                         // (no libm needed for this)
+      headroom++;                                                                            // by whole steps
+    double target = limit * gradient + headroom;                                             // Gradient step
+    if (peak < limit / 2 && target > limit)                                                  // If the limit was not the constraint
+      target = limit;                                                                        // do not grow it
+    limit = 0.8 * limit + 0.2 * target;                                                      // Smooth the change
+    if (limit < ADAPTIVE_MIN_LIMIT)                                                          // If the limit fell below the floor
+      limit = ADAPTIVE_MIN_LIMIT;                                                            // raise it back to ADAPTIVE_MIN_LIMIT
+    if (limit > adaptive_max)                                                                // If it exceeds the configured ceiling
+      limit = adaptive_max;                                                                  // clamp it to max_inflight
+    atomic_store_explicit(&admit_limit, (int)limit, memory_order_relaxed);                   // Publish it
+    atomic_store_explicit(&adaptive_rtt_us, (long long)rtt, memory_order_relaxed);           // and what it was based on
+    atomic_store_explicit(&adaptive_baseline_us, (long long)baseline, memory_order_relaxed); // for the metrics
+  } // End of for loop body
+  return NULL; // Never reached
+} // End of adaptive_thread function body
+
+/* Answer a request that was not admitted (logged and counted like any other response) */
+static void send_overload(sock_t s)                                   // Defines a function to shed a request
+{                                                                     // Start of send_overload function body
+  req_log.status = 503;                                               // Record the status for the access log
+  send_all(s, overload_response, overload_len);                       // Send the canned response
+} // End of send_overload function body
+
+/* Turn a new connection away from the accept loop with a canned response: it is sent without blocking (it
+   fits an empty send buffer), and request bytes that already arrived are swallowed so close() ends with a FIN
+   rather than a RST that could destroy the response before the client reads it */
+static void reject_connection(sock_t s, const char *response, size_t len) // Defines a function to reject a connection
+{                                                                     // Start of reject_connection function body
+  char junk[1024];                                                    // Declare a buffer for the unread request
+  send(s, response, len, MSG_DONTWAIT | MSG_NOSIGNAL);                // Best-effort response
+  shutdown(s, SHUT_WR);                                               // End our side
+  recv(s, junk, sizeof(junk), MSG_DONTWAIT);                          // Swallow what the client sent so far
+  CLOSESOCK(s);                                                       // Close the socket
+} // End of reject_connection function body
+
+/* Shed a new connection at the connection limit with the overload 503 */
+static void shed_connection(sock_t s)                                 // Defines a function to shed a connection
+{                                                                     // Start of shed_connection function body
+  reject_connection(s, overload_response, overload_len);              // Send the 503 and close
+  atomic_fetch_add_explicit(&shed_conns, 1, memory_order_relaxed);    // Count it
+} // End of shed_connection function body
+
+/* Per-client rate limiting (rate_limit=, rate_burst=, max_conns_per_ip=)
+   One entry per client address in a fixed table of RATE_SHARDS x RATE_SHARD_SLOTS, found by a keyed 64-bit
+   hash of the address (IPv4-mapped IPv6 counts as IPv4; the key is random per process, so clients cannot aim
+   collisions). The hash picks the shard and a starting slot, and an address claims the first free or stale
+   slot within RATE_PROBE with a compare-and-swap on its tag, so lookups never lock. The request rate is a token
+   bucket kept as a GCRA "theoretical arrival time": one 64-bit value advanced by CAS per connection (each
+   connection carries one request). Entries quiet for RATE_IDLE_S with no open connection are reused by new
+   addresses, which keeps the table bounded; if every probed slot is busy the address goes untracked (allowed)
+   rather than blocking. Races between reuse and a late update only blur one client's counters.
+   Over either limit the accept loop answers with a canned 429 and no thread is started */
+typedef struct rate_entry       // Defines one client address entry
+{                               // Start of rate_entry_t structure definition
+  atomic_ullong tag;            // Address hash (0 = never used)
+  atomic_llong tat;             // GCRA theoretical arrival time (monotonic ns)
+  atomic_llong last_seen;       // Monotonic ns of the last connection (for reuse)
+  atomic_int conns;             // Open connections from the address
+} rate_entry_t;                 // End of rate_entry_t structure definition
+
+static rate_entry_t rate_table[RATE_SHARDS][RATE_SHARD_SLOTS]; // The table
+static unsigned long long rate_key;                            // Hash key (random per process)
+static long long rate_interval_ns, rate_burst_ns;              // Token interval and burst allowance (0 = no rate limit)
+static int rate_max_conns;                                     // Connection limit per address (0 = unlimited)
+static atomic_ullong rate_limited, rate_conn_limited, rate_untracked; // Rejections and addresses that found no slot
+static char rate_response[SMALL_BUF];                          // The precomputed 429 response
+static size_t rate_response_len;                               // and its length
+
+/* splitmix64 finalizer: spreads the address bits over the whole hash */
+static unsigned long long rate_mix(unsigned long long x)       // Defines a function to mix hash bits
+{                                                              // Start of rate_mix function body
+  x ^= x >> 30;                                                // xor-shift the high bits down
+  x *= 0xbf58476d1ce4e5b9ULL;                                  // multiply by the first splitmix64 constant
+  x ^= x >> 27;                                                // xor-shift again
+  x *= 0x94d049bb133111ebULL;                                  // multiply by the second splitmix64 constant
+  return x ^ (x >> 31);                                        // and a final xor-shift
+} // End of rate_mix function body
+
+/* Keyed hash of a client's address (never 0, which marks unused entries) */
+static unsigned long long rate_hash(const struct sockaddr_storage *ss)                       // Defines a function to hash a client address
+{                                                                                            // Start of rate_hash function body
+  unsigned long long a = 0, b = 0;                                                           // The address as two 64-bit halves
+  if (ss->ss_family == AF_INET)                                                              // IPv4
+    memcpy(&a, &((const struct sockaddr_in *)ss)->sin_addr, 4);                              // in the low half
+  else if (ss->ss_family == AF_INET6)                                                        // IPv6
+  {                                                                                          // Start of else if block
+    const struct in6_addr *in6 = &((const struct sockaddr_in6 *)ss)->sin6_addr;              // The address
+    if (IN6_IS_ADDR_V4MAPPED(in6))                                                           // IPv4-mapped
+      memcpy(&a, in6->s6_addr + 12, 4);                                                      // counts as the IPv4 address
+    else                                                                                     // A real IPv6 address
+    {                                                                                        // Start of else block
+      memcpy(&a, in6->s6_addr, 8);                                                           // The network half in a
+      memcpy(&b, in6->s6_addr + 8, 8);                                                       // and the interface half in b
+      b ^= 0x6666666666666666ULL;                                                            // (kept apart from IPv4 space)
+    } // End of else block
+  } // End of else if block
+  unsigned long long h = rate_mix(rate_mix(a ^ rate_key) ^ b);                               // Mix with the key
+  return h ? h : 1;                                                                          // 0 is reserved
+} // End of rate_hash function body
+
+/* Find or claim the entry for an address hash. Returns NULL if no probed slot is available */
+static rate_entry_t *rate_lookup(unsigned long long h, long long now)                        // Defines a function to find a rate entry
+{                                                                                            // Start of rate_lookup function body
+  rate_entry_t *shard = rate_table[(h >> 32) % RATE_SHARDS];                                 // High bits pick the shard
+  for (int i = 0; i < RATE_PROBE; i++)                                                       // Probe linearly from the low bits
+  {                                                                                          // Start of for loop body
+    rate_entry_t *e = &shard[(h + (unsigned)i) & (RATE_SHARD_SLOTS - 1)];                    // Candidate entry
+    unsigned long long tag = atomic_load_explicit(&e->tag, memory_order_acquire);            // Its owner
+    if (tag == h)                                                                            // Ours already
+      return e;                                                                              // so use it
+    int stale = tag && atomic_load_explicit(&e->conns, memory_order_relaxed) == 0 &&         // Someone else's, but idle
+                now - atomic_load_explicit(&e->last_seen, memory_order_relaxed) > RATE_IDLE_S * 1000000000LL;
+    if ((tag == 0 || stale) &&                                                               // A free or stale entry
+        atomic_compare_exchange_strong_explicit(&e->tag, &tag, h, memory_order_acq_rel, memory_order_acquire)) // that we win
+    {                                                                                        // Start of if block
+      atomic_store_explicit(&e->tat, 0, memory_order_relaxed);                               // starts with a full bucket
+      atomic_store_explicit(&e->conns, 0, memory_order_relaxed);                             // and no connections
+      atomic_store_explicit(&e->last_seen, now, memory_order_relaxed);                       // and counts as active now
+      return e;                                                                              // It is ours now
+    } // End of if block
+    if (tag == h)                                                                            // Lost the race to our own address
+      return e;                                                                              // (another thread claimed it for us)
+  } // End of for loop body
+  return NULL; // Every probed entry is in use
+} // End of rate_lookup function body
+
+/* Charge a new connection to its client address. Returns 0 if it may proceed (ctx->rate is set if a connection
+   slot was taken), 1 if it exceeds the request rate, 2 if it exceeds the connection limit */
+static int rate_admit(client_ctx_t *ctx)                                                     // Defines a function to rate-limit a connection
+{                                                                                            // Start of rate_admit function body
+  ctx->rate = NULL;                                                                          // Nothing taken yet
+  if (!rate_interval_ns && !rate_max_conns)                                                  // If rate limiting is off
+    return 0;                                                                                // everything proceeds
+  long long now = mono_ns();                                                                 // Current time
+  rate_entry_t *e = rate_lookup(rate_hash(&ctx->addr), now);                                 // The address's entry
+  if (!e)                                                                                    // No room to track it
+  {                                                                                          // Start of if block
+    atomic_fetch_add_explicit(&rate_untracked, 1, memory_order_relaxed);                     // count that
+    return 0;                                                                                // and let it through
+  } // End of if block
+  atomic_store_explicit(&e->last_seen, now, memory_order_relaxed);                           // The address is active
+  if (rate_interval_ns)                                                                      // Token bucket (GCRA)
+  {                                                                                          // Start of if block
+    long long tat = atomic_load_explicit(&e->tat, memory_order_relaxed);                     // Theoretical arrival time
+    long long next;                                                                          // After this request
+    do                                                                                       // Advance it by one interval
+    {                                                                                        // Start of do loop body
+      next = (tat > now ? tat : now) + rate_interval_ns;                                     // from now or from the backlog
+      if (next - now > rate_burst_ns)                                                        // More than the burst ahead:
+      {                                                                                      // Start of if block
+        atomic_fetch_add_explicit(&rate_limited, 1, memory_order_relaxed);                   // too fast
+        return 1;                                                                            // (the bucket is left as it was)
+      } // End of if block
+    } while (!atomic_compare_exchange_weak_explicit(&e->tat, &tat, next, memory_order_relaxed, memory_order_relaxed));
+  } // End of if block
+  if (rate_max_conns)                                                                        // Connection limit
+  {                                                                                          // Start of if block
+    if (atomic_fetch_add_explicit(&e->conns, 1, memory_order_relaxed) >= rate_max_conns)     // Take a connection
+    {                                                                                        // Start of if block
+      atomic_fetch_sub_explicit(&e->conns, 1, memory_order_relaxed);                         // (give it back if over)
+      atomic_fetch_add_explicit(&rate_conn_limited, 1, memory_order_relaxed);                // count the rejection
+      return 2;                                                                              // and report the connection limit
+    } // End of if block
+    ctx->rate = e;                                                                           // Released when the connection ends
+  } // End of if block
+  return 0; // The connection may proceed
+} // End of rate_admit function body
+
+/* Give back a connection's place in its address's connection count */
+static void rate_release(client_ctx_t *ctx)                                                  // Defines a function to release a rate entry
+{                                                                                            // Start of rate_release function body
+  if (ctx->rate)                                                                             // If the connection holds one
+    atomic_fetch_sub_explicit(&ctx->rate->conns, 1, memory_order_relaxed);                   // give it back
+  ctx->rate = NULL;                                                                          // (only once)
+} // End of rate_release function body
+
+/* Set up rate limiting from the configuration */
+static void rate_init(const server_config_t *cfg)                                            // Defines a function to set up rate limiting
+{                                                                                            // Start of rate_init function body
+  static const char body[] = "Too many requests from your address, please slow down.\n";     // Body of the 429
+  rate_response_len = (size_t)snprintf(rate_response, sizeof(rate_response),                 // Whole response, built once
+                                       "HTTP/1.0 429 Too Many Requests\r\nServer: c-mini/1.0\r\n"
+                                       "Content-Type: text/plain; charset=utf-8\r\nContent-Length: %zu\r\n"
+                                       "Retry-After: 1\r\nConnection: close\r\n\r\n%s", sizeof(body) - 1, body);
+  rate_interval_ns = cfg->rate_limit > 0 ? 1000000000LL / cfg->rate_limit : 0;              // One token per interval
+  rate_burst_ns = rate_interval_ns * (cfg->rate_burst > 0 ? cfg->rate_burst : 1);           // Up to the burst at once
+  rate_max_conns = cfg->max_conns_per_ip > 0 ? cfg->max_conns_per_ip : 0;                   // Connection limit
+  struct timespec ts;                                                                        // Seed the hash key
+  clock_gettime(CLOCK_REALTIME, &ts);                                                        // from the clock
+  rate_key = rate_mix((unsigned long long)ts.tv_nsec ^ ((unsigned long long)ts.tv_sec << 32) ^ (unsigned long long)getpid());
+} // End of rate_init function body
+
+/* Connections waiting for their request head: the server's own queue */
+static int admission_queued(void)                                                            // Defines a function to count queued connections
+{                                                                                            // Start of admission_queued function body
+  int queued = 0;                                                                            // Count them
+  for (int s = 0; s < MAX_WORKER_SLOTS; s++)                                                 // in every owned slot
+    queued += atomic_load_explicit(&worker_slots[s].in_use, memory_order_relaxed) &&         // that is still
+              atomic_load_explicit(&worker_slots[s].phase, memory_order_relaxed) == WORKER_READING; // reading its request
+  return queued; // Return the count
+} // End of admission_queued function body
+
+/* Connections waiting in the kernel's accept queue (Linux reports it in TCP_INFO of the listener). -1 if unknown */
+static int admission_accept_queue(void)                                                       // Defines a function to read the accept queue length
+{                                                                                            // Start of admission_accept_queue function body
+  struct tcp_info ti;                                                                        // Declare a TCP_INFO structure
+  socklen_t tlen = sizeof(ti);                                                               // Its size
+  memset(&ti, 0, sizeof(ti));                                                                // Zero it
+  if (listen_sock == INVALID_SOCKET || getsockopt(listen_sock, IPPROTO_TCP, TCP_INFO, &ti, &tlen) != 0) // Ask the kernel
+    return -1;                                                                               // (not listening yet)
+  return (int)ti.tcpi_unacked;                                                               // On a listener this is the accept queue
+} // End of admission_accept_queue function body
+
+/* Traffic shadowing (shadow=, shadow_sample=)
+   Sampled GETs are queued by the request threads as replay records in a per-thread ring (see
+   replay_record_request). One background thread drains the rings, re-sends each request to the shadow target
+   over its own non-blocking connection and reads the response only to throw it away. At most
+   SHADOW_MAX_INFLIGHT mirrors are outstanding; past that, or when a ring is full because the target is slow,
+   records are dropped and counted, so a struggling shadow never holds up the primary */
+typedef struct            // Defines one mirrored request in flight
+{                         // Start of shadow_conn_t structure definition
+  int fd;                 // Connection to the shadow target (-1 = unused)
+  int sending;            // 1 while the request is being written, 0 while the response is drained
+  size_t len, off;        // Request length and bytes already sent
+  long long deadline;     // Monotonic time after which the mirror is abandoned
+  char req[LOG_LINE_MAX * 3]; // The rebuilt request
+} shadow_conn_t;          // End of shadow_conn_t structure definition
+
+static struct sockaddr_storage shadow_addr; // Resolved shadow target
+static socklen_t shadow_addrlen;            // and its length
+static char shadow_host[SMALL_BUF];         // Host header sent with mirrored requests (the target's host:port)
+
+/* Rebuild a request from a replay record. Returns its length, or 0 if it does not fit */
+static size_t shadow_format(const char *rec, char *out, size_t out_sz)                          // Defines a function to rebuild a queued request
+{                                                                                             // Start of shadow_format function body
+  replay_record_t h;                                                                          // Declare the fixed part
+  memcpy(&h, rec, sizeof(h));                                                                 // (copied: records are unaligned in the batch)
+  const char *f[8];                                                                           // Start of each variable field
+  size_t lens[8] = {h.method_len, h.path_len, h.version_len, h.ae_len, h.inm_len, h.ims_len, h.referer_len, h.ua_len};
+  f[0] = rec + sizeof(h);                                                                     // The fields follow the fixed part
+  for (int i = 1; i < 8; i++)                                                                 // back to back
+    f[i] = f[i - 1] + lens[i - 1];                                                            // in record order
+  static const char *const names[8] = {NULL, NULL, NULL, "Accept-Encoding", "If-None-Match", "If-Modified-Since", "Referer", "User-Agent"};
+  int n = snprintf(out, out_sz, "%.*s %.*s HTTP/1.1\r\nHost: %s\r\n", (int)lens[0], f[0], (int)lens[1], f[1], shadow_host);
+  for (int i = 3; i < 8 && n > 0 && (size_t)n < out_sz; i++)                                  // The recorded headers
+    if (lens[i])                                                                              // that were present
+      n += snprintf(out + n, out_sz - (size_t)n, "%s: %.*s\r\n", names[i], (int)lens[i], f[i]); // are sent again
+  if (n > 0 && (size_t)n < out_sz)                                                            // Finish the head
+    n += snprintf(out + n, out_sz - (size_t)n, "Connection: close\r\n\r\n");               // (one request per connection)
+  return n > 0 && (size_t)n < out_sz ? (size_t)n : 0;                                         // Report the length, or that it was cut
+} // End of shadow_format function body
+
+/* Close a mirror connection, counting it as completed or failed */
+static void shadow_finish(shadow_conn_t *c, int ok)                                           // Defines a function to end a mirrored request
+{                                                                                             // Start of shadow_finish function body
+  close(c->fd);                                                                               // Close the connection
+  c->fd = -1;                                                                                 // and free the slot
+  atomic_fetch_add_explicit(ok ? &shadow_sent : &shadow_failed, 1, memory_order_relaxed);     // Count the outcome
+} // End of shadow_finish function body
+
+/* Background shadow sender: one poll() loop over all mirrored requests in flight */
+static void *shadow_thread(void *arg)                                                         // Defines the entry point of the shadow sender thread
+{                                                                                             // Start of shadow_thread function body
+  (void)arg;                                                                                  // The thread takes no argument
+  shadow_conn_t *conns = (shadow_conn_t *)malloc(SHADOW_MAX_INFLIGHT * sizeof(shadow_conn_t)); // Connection slots
+  char *batch = (char *)malloc(LOG_BATCH_SIZE);                                               // Records drained from the rings
+  if (!conns || !batch)                                                                       // If allocation fails
+    return NULL;                                                                              // mirroring stops (records are counted as dropped)
+  for (int i = 0; i < SHADOW_MAX_INFLIGHT; i++)                                               // Every slot
+    conns[i].fd = -1;                                                                         // starts unused
+  char sink[16384];                                                                           // Responses are read into here and forgotten
+  int start = 0;                                                                              // First ring to drain (rotates, so none starves)
+  for (;;)                                                                                    // Loop forever
+  {                                                                                           // Start of for loop body
+    size_t used = 0;                                                                          // Bytes drained this round
+    for (int k = 0; k < MAX_WORKER_SLOTS && used <= LOG_BATCH_SIZE - SHADOW_RING_SIZE; k++)   // Drain rings while a whole ring still fits
+    {                                                                                         // Start of for loop body
+      worker_slot_t *ws = &worker_slots[(start + k) % MAX_WORKER_SLOTS];                      // Get the slot
+      used = ring_drain(&ws->shadow_head, &ws->shadow_tail, ws->shadow_ring, SHADOW_RING_SIZE, -1, batch, used); // (never writes: it fits)
+    } // End of for loop body
+    start = (start + 1) % MAX_WORKER_SLOTS;                                                   // Begin elsewhere next round
+    long long now = mono_ns();                                                                // Current time
+    int free_slot = 0;                                                                        // Where to look for an unused slot
+    for (size_t off = 0; off + sizeof(replay_record_t) <= used;)                              // Start each drained request
+    {                                                                                         // Start of for loop body
+      replay_record_t h;                                                                      // Declare the fixed part
+      memcpy(&h, batch + off, sizeof(h));                                                     // to learn the record's length
+      while (free_slot < SHADOW_MAX_INFLIGHT && conns[free_slot].fd >= 0)                     // Find a free slot
+        free_slot++;                                                                          // past the slots in use
+      shadow_conn_t *c = free_slot < SHADOW_MAX_INFLIGHT ? &conns[free_slot] : NULL;          // (none: too many in flight)
+      if (!c || !(c->len = shadow_format(batch + off, c->req, sizeof(c->req))))              // If it cannot be sent
+        atomic_fetch_add_explicit(&shadow_dropped, 1, memory_order_relaxed);                  // drop it
+      else if ((c->fd = (int)socket(shadow_addr.ss_family, SOCK_STREAM, 0)) < 0)              // Open a connection
+        atomic_fetch_add_explicit(&shadow_failed, 1, memory_order_relaxed);                   // (or count a failure)
+      else                                                                                    // and start connecting
+      {                                                                                       // Start of else block
+        fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK);                         // without waiting
+        c->sending = 1;                                                                       // The request goes first
+        c->off = 0;                                                                           // from its start
+        c->deadline = now + SHADOW_TIMEOUT_MS * 1000000LL;                                    // within the time limit
+        if (connect(c->fd, (struct sockaddr *)&shadow_addr, shadow_addrlen) != 0 && errno != EINPROGRESS) // If it fails outright
+          shadow_finish(c, 0);                                                                // count it
+      } // End of else block
+      off += h.length;                                                                        // Next record
+    } // End of for loop body
+
+    struct pollfd pfd[SHADOW_MAX_INFLIGHT];                                                   // Declare the poll set
+    int map[SHADOW_MAX_INFLIGHT], npfd = 0;                                                   // and which slot each entry is
+    for (int i = 0; i < SHADOW_MAX_INFLIGHT; i++)                                             // Every request in flight
+    {                                                                                         // Start of for loop body
+      if (conns[i].fd < 0)                                                                    // Skip unused slots
+        continue;                                                                             // to the next one
+      if (now > conns[i].deadline)                                                            // If it has taken too long
+      {                                                                                       // Start of if block
+        shadow_finish(&conns[i], 0);                                                          // give up on it
+        continue;                                                                             // and move on
+      } // End of if block
+      pfd[npfd].fd = conns[i].fd;                                                             // Watch it
+      pfd[npfd].events = conns[i].sending ? POLLOUT : POLLIN;                                 // for its next step
+      pfd[npfd].revents = 0;                                                                  // Clear the result of the last poll
+      map[npfd++] = i;                                                                        // Remember which slot the entry polls
+    } // End of for loop body
+    int n = poll(pfd, (nfds_t)npfd, used ? 0 : LOG_FLUSH_MS);                                 // Wait a little (not at all if busy)
+    for (int j = 0; j < npfd && n > 0; j++)                                                   // Advance each ready connection
+    {                                                                                         // Start of for loop body
+      shadow_conn_t *c = &conns[map[j]];                                                      // Get its slot
+      if (!pfd[j].revents)                                                                    // Not ready
+        continue;                                                                             // so move on to the next one
+      if (c->sending)                                                                         // Writing the request
+      {                                                                                       // Start of if block
+        ssize_t w = send(c->fd, c->req + c->off, c->len - c->off, MSG_NOSIGNAL);              // Send what the socket takes
+        if (w < 0 && errno != EAGAIN && errno != EINTR)                                       // If the connection failed
+          shadow_finish(c, 0);                                                                // count it
+        else if (w > 0 && (c->off += (size_t)w) == c->len)                                    // Once it is all sent
+          c->sending = 0;                                                                     // wait for the response
+        continue;                                                                             // Next connection
+      } // End of if block
+      ssize_t r;                                                                              // Bytes read
+      while ((r = recv(c->fd, sink, sizeof(sink), 0)) > 0)                                    // Drain the response
+        ;                                                                                     // and discard it
+      if (r == 0)                                                                             // The target closed: the response is complete
+        shadow_finish(c, 1);                                                                  // count a success
+      else if (errno != EAGAIN && errno != EINTR)                                             // A real error
+        shadow_finish(c, 0);                                                                  // counts as a failure
+    } // End of for loop body
+  } // End of for loop body
+  return NULL; // Never reached
+} // End of shadow_thread function body
+
+/* Resolve the shadow target "host:port" ("[v6addr]:port" for IPv6 literals). Returns 0 on success */
+static int shadow_resolve(const char *target)                                                 // Defines a function to resolve the shadow target
+{                                                                                             // Start of shadow_resolve function body
+  char host[SMALL_BUF];                                                                       // Declare a buffer for the host part
+  snprintf(host, sizeof(host), "%s", target);                                                 // Copy the target
+  char *colon = strrchr(host, ':');                                                           // The port follows the last colon
+  if (!colon || colon == host || !colon[1])                                                   // Both parts are required
+    return -1;                                                                                // otherwise the address is malformed
+  *colon = '\0';                                                                             // Split them
+  char *h = host;                                                                             // Host part
+  if (h[0] == '[' && colon[-1] == ']')                                                        // Strip the brackets
+  {                                                                                           // Start of if block
+    h++;                                                                                      // of an IPv6 literal
+    colon[-1] = '\0';                                                                        // Cut off the closing bracket
+  } // End of if block
+  struct addrinfo hints, *res = NULL;                                                         // Declare address info structures
+  memset(&hints, 0, sizeof(hints));                                                           // Zero out the hints structure
+  hints.ai_family = AF_UNSPEC;                                                                // Allow IPv4 or IPv6
+  hints.ai_socktype = SOCK_STREAM;                                                            // Specify a TCP socket
+  if (getaddrinfo(h, colon + 1, &hints, &res) != 0 || !res)                                   // Look it up
+    return -1;                                                                                // If it fails, the shadow target is unusable
+  memcpy(&shadow_addr, res->ai_addr, res->ai_addrlen);                                        // Keep the first address
+  shadow_addrlen = (socklen_t)res->ai_addrlen;                                                // and its length
+  freeaddrinfo(res);                                                                          // Free the list
+  snprintf(shadow_host, sizeof(shadow_host), "%s", target);                                   // Mirrors name the target as their Host
+  return 0; // Return 0 to indicate success
+} // End of shadow_resolve function body
+
+/* Server metrics (served at stats_path, /__stats by default)
+   Every counter lives in the owning thread's worker slot and is bumped with a plain relaxed load/store pair
+   (the owner is the only writer), so recording a request costs a handful of uncontended cache-line writes.
+   Readers sum all slots on demand; a thread that found no free slot counts into 'stats_shared' with atomic adds.
+   Latency histograms are HDR-style: exact below 16us, then 8 linear sub-buckets per power of two (<= 12.5% error) */
+static int stats_method_index(const char *method)     // Defines a function to map a method to its counter
+{                                                     // Start of stats_method_index function body
+  if (!strcmp(method, "GET"))                         // GET
+    return 0;                                         // is counter 0
+  if (!strcmp(method, "HEAD"))                        // HEAD
+    return 1;                                         // is counter 1
+  return 2;                                           // Everything else shares counter 2
+} // End of stats_method_index function body
+
+static const char *const stats_method_names[STAT_METHODS] = {"GET", "HEAD", "other"}; // Names of the method counters
+static const int stats_codes[STAT_CODES] = {200, 304, 400, 403, 404, 405, 500, 503, 0};     // Status codes with their own counter (0 = any other)
+static atomic_ullong stats_shared[ST_COUNTERS];                                        // Counters of threads without a worker slot
+static atomic_int stats_unslotted;                                                     // Connections being served without a worker slot
+static time_t stats_started;                                                           // When the server started (for uptime)
+
+/* Map a latency in microseconds to its histogram bucket */
+static int stats_bucket(unsigned long long us)                   // Defines a function to pick a histogram bucket
+{                                                                // Start of stats_bucket function body
+  if (us < 16)                                                   // Small values
+    return (int)us;                                              // have a bucket each
+  int msb = 63 - __builtin_clzll(us);                            // Position of the highest set bit (>= 4)
+  int shift = msb - 3;                                           // Keep the top 4 bits
+  int b = (shift + 1) * 8 + (int)((us >> shift) & 7);            // Power-of-two group, then linear sub-bucket
+  return b < STAT_HIST_BUCKETS ? b : STAT_HIST_BUCKETS - 1;      // Clamp very slow requests into the last bucket
+} // End of stats_bucket function body
+
+/* Return the largest latency (microseconds) that falls into histogram bucket b */
+static unsigned long long stats_bucket_upper(int b)              // Defines a function to get a bucket's upper bound
+{                                                                // Start of stats_bucket_upper function body
+  if (b < 16)                                                    // Exact buckets
+    return (unsigned long long)b;                                // hold a single value
+  int shift = b / 8 - 1;                                         // Power-of-two group
+  return ((unsigned long long)(8 + b % 8 + 1) << shift) - 1;     // One below the next bucket's lower bound
+} // End of stats_bucket_upper function body
+
+/* Add v to counter i of the calling thread */
+static void stats_add(int i, unsigned long long v)                                                 // Defines a function to bump a counter
+{                                                                                                  // Start of stats_add function body
+  worker_slot_t *ws = current_slot;                                                                // Get the calling thread's slot
+  if (ws)                                                                                          // Sole writer: no atomic read-modify-write needed
+    atomic_store_explicit(&ws->stats[i], atomic_load_explicit(&ws->stats[i], memory_order_relaxed) + v, memory_order_relaxed);
+  else                                                                                             // Shared fallback counters
+    atomic_fetch_add_explicit(&stats_shared[i], v, memory_order_relaxed);                          // need a real atomic add
+} // End of stats_add function body
+
+/* Record the request described by req_log in the calling thread's counters */
+static void stats_record_request(void)                                       // Defines a function to count a finished request
+{                                                                            // Start of stats_record_request function body
+  const request_log_t *r = &req_log;                                         // Get the thread's request record
+  int c = 0;                                                                 // Find the status code's counter
+  while (stats_codes[c] && stats_codes[c] != r->status)                      // (the last entry catches everything else)
+    c++;                                                                     // Try the next code
+  int cls = r->status / 100 - 1;                                             // Response class: 0 = 1xx ... 4 = 5xx
+  if (cls < 0 || cls >= STAT_CLASSES)                                        // No response was sent (or a bogus code)
+    cls = STAT_CLASSES - 1;                                                  // counts as a server-side failure
+  unsigned long long us = (unsigned long long)(r->end_ns - r->start_ns) / 1000; // Total duration in microseconds
+  stats_add(ST_REQUESTS, 1);                                                 // Count the request
+  stats_add(ST_BYTES, (unsigned long long)r->bytes);                         // the bytes sent
+  stats_add(ST_METHOD + stats_method_index(r->method), 1);                   // the method
+  stats_add(ST_STATUS + c, 1);                                               // the status code
+  stats_add(ST_LAT_SUM + cls, us);                                           // the latency sum for the class
+  stats_add(ST_HIST + cls * STAT_HIST_BUCKETS + stats_bucket(us), 1);        // and the histogram bucket
+  if (r->cache == CACHE_HIT)                                                 // If the gzip cache answered
+    stats_add(ST_GZ_HITS, 1);                                                // count a hit
+  else if (r->cache == CACHE_MISS)                                           // If it was consulted in vain
+    stats_add(ST_GZ_MISSES, 1);                                              // count a miss
+} // End of stats_record_request function body
+
+/* Sum every thread's counters into snap. Returns the number of connections currently being served */
+static int stats_snapshot(unsigned long long snap[ST_COUNTERS])                                  // Defines a function to aggregate the counters
+{                                                                                                // Start of stats_snapshot function body
+  int active = atomic_load_explicit(&stats_unslotted, memory_order_relaxed);                     // Connections without a slot
+  for (int i = 0; i < ST_COUNTERS; i++)                                                          // Start from the shared counters
+    snap[i] = atomic_load_explicit(&stats_shared[i], memory_order_relaxed);                      // Copy each one
+  for (int s = 0; s < MAX_WORKER_SLOTS; s++)                                                     // Visit every slot
+  {                                                                                              // Start of for loop body
+    worker_slot_t *ws = &worker_slots[s];                                                        // Get the slot
+    active += atomic_load_explicit(&ws->in_use, memory_order_relaxed);                           // An owned slot is a live connection
+    for (int i = 0; i < ST_COUNTERS; i++)                                                        // Add its counters
+      snap[i] += atomic_load_explicit(&ws->stats[i], memory_order_relaxed);                      // (each read is untorn; the sum is approximate)
+  } // End of for loop body
+  return active; // Return the live connection count
+} // End of stats_snapshot function body
+
+/* Return the latency (microseconds) at quantile q of histogram h holding n samples */
+static unsigned long long stats_quantile(const unsigned long long *h, unsigned long long n, double q) // Defines a function to read a quantile
+{                                                                                                      // Start of stats_quantile function body
+  unsigned long long rank = (unsigned long long)(q * (double)n + 0.5), seen = 0;                       // Rank of the wanted sample
+  if (rank == 0)                                                                                       // At least the first sample
+    rank = 1;                                                                                          // is wanted
+  for (int b = 0; b < STAT_HIST_BUCKETS; b++)                                                          // Walk the buckets in order
+  {                                                                                                    // Start of for loop body
+    seen += h[b];                                                                                      // Count the samples so far
+    if (seen >= rank)                                                                                  // If the wanted sample is in this bucket
+      return stats_bucket_upper(b);                                                                    // report the bucket's upper bound
+  } // End of for loop body
+  return 0; // Empty histogram
+} // End of stats_quantile function body
+
+/* Append printf-formatted text to a growing buffer. Returns 1 on success */
+static int buf_printf(char **buf, size_t *cap, size_t *len, const char *fmt, ...) // Defines a function to append to a buffer
+{                                                                                 // Start of buf_printf function body
+  va_list ap;                                                                     // Declare a variable argument list
+  va_start(ap, fmt);                                                              // Initialize it
+  int n = vsnprintf(NULL, 0, fmt, ap);                                            // Measure the text
+  va_end(ap);                                                                     // End the variable argument list
+  if (n < 0 || !reserve_html_buf(buf, cap, *len, (size_t)n))                      // Make room for it
+    return 0;                                                                     // or fail
+  va_start(ap, fmt);                                                              // Restart the argument list
+  vsnprintf(*buf + *len, *cap - *len, fmt, ap);                                   // Format into place
+  va_end(ap);                                                                     // End the variable argument list
+  *len += (size_t)n;                                                              // Count the text
+  return 1;                                                                       // Return 1 to indicate success
+} // End of buf_printf function body
+
+/* Render the metrics as a JSON document. Returns a malloc'd buffer (length in *out_len) or NULL */
+static char *stats_render_json(size_t *out_len)                                                    // Defines a function to render the metrics
+{                                                                                                  // Start of stats_render_json function body
+  static _Thread_local unsigned long long snap[ST_COUNTERS];                                       // Snapshot (too big for a thread stack)
+  int active = stats_snapshot(snap);                                                               // Aggregate the counters
+  size_t cap = 4096, len = 0;                                                                      // Initial capacity and length
+  char *b = (char *)malloc(cap);                                                                   // Allocate the output buffer
+  if (!b)                                                                                          // If allocation fails
+    return NULL;                                                                                   // give up
+  int ok = 1;                                                                                      // Whether every append succeeded
+  ok &= buf_printf(&b, &cap, &len,
+                   "{\"uptime_s\":%lld,\"connections\":{\"active\":%d,\"total\":%llu},"
+                   "\"requests\":{\"total\":%llu,\"bytes_sent\":%llu,\"by_method\":{",
+                   (long long)(time(NULL) - stats_started), active, snap[ST_CONNECTIONS],
+                   snap[ST_REQUESTS], snap[ST_BYTES]);
+  for (int i = 0; i < STAT_METHODS; i++)                                                           // Method counters
+    ok &= buf_printf(&b, &cap, &len, "%s\"%s\":%llu", i ? "," : "", stats_method_names[i], snap[ST_METHOD + i]);
+  ok &= buf_printf(&b, &cap, &len, "},\"by_status\":{");                                           // Status counters
+  for (int i = 0; i < STAT_CODES; i++)                                                             // One per tracked code
+  {                                                                                                // Start of for loop body
+    if (stats_codes[i])                                                                            // A specific code
+      ok &= buf_printf(&b, &cap, &len, "%s\"%d\":%llu", i ? "," : "", stats_codes[i], snap[ST_STATUS + i]);
+    else                                                                                           // The catch-all
+      ok &= buf_printf(&b, &cap, &len, ",\"other\":%llu", snap[ST_STATUS + i]);
+  } // End of for loop body
+
+  pthread_mutex_lock(&gz_cache.lock);                                                              // Briefly read the compression cache totals
+  size_t gz_entries = gz_cache.entries, gz_bytes = gz_cache.bytes, gz_budget = gz_cache.budget;    // Copy them
+  pthread_mutex_unlock(&gz_cache.lock);                                                            // and let go
+  ok &= buf_printf(&b, &cap, &len,
+                   "}},\"gzip_cache\":{\"enabled\":%s,\"hits\":%llu,\"misses\":%llu,\"entries\":%zu,"
+                   "\"bytes\":%zu,\"budget\":%zu},\"access_log\":{\"dropped\":%llu},"
+                   "\"shadow\":{\"sent\":%llu,\"failed\":%llu,\"dropped\":%llu},"
+                   "\"admission\":{\"inflight\":%d,\"inflight_limit\":%d,\"queued\":%d,\"accept_queue\":%d,"
+                   "\"shed_connections\":%llu,\"shed_requests\":%llu,\"adaptive\":%s,\"rtt_us\":%lld,"
+                   "\"rtt_baseline_us\":%lld},\"timeouts\":{\"header\":%llu,\"send\":%llu},"
+                   "\"rate_limit\":{\"rate\":%llu,\"connections\":%llu,\"untracked\":%llu},"
+                   "\"pacing\":{\"active\":%d,\"transfers\":%llu,\"bytes\":%llu,\"delay_us\":%llu},\"latency_us\":{",
+                   gz_budget ? "true" : "false", snap[ST_GZ_HITS], snap[ST_GZ_MISSES], gz_entries, gz_bytes,
+                   gz_budget, (unsigned long long)atomic_load_explicit(&log_dropped, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&shadow_sent, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&shadow_failed, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&shadow_dropped, memory_order_relaxed),
+                   atomic_load_explicit(&admit_inflight, memory_order_relaxed),
+                   atomic_load_explicit(&admit_limit, memory_order_relaxed), admission_queued(), admission_accept_queue(),
+                   (unsigned long long)atomic_load_explicit(&shed_conns, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&shed_requests, memory_order_relaxed), adaptive_max ? "true" : "false",
+                   (long long)atomic_load_explicit(&adaptive_rtt_us, memory_order_relaxed),
+                   (long long)atomic_load_explicit(&adaptive_baseline_us, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&timeouts_header, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&timeouts_send, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&rate_limited, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&rate_conn_limited, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&rate_untracked, memory_order_relaxed),
+                   atomic_load_explicit(&pace_active, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&pace_transfers, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&pace_bytes, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&pace_delay_us, memory_order_relaxed));
+
+  for (int c = 0; c < STAT_CLASSES; c++)                                                           // One histogram per response class
+  {                                                                                                // Start of for loop body
+    const unsigned long long *h = &snap[ST_HIST + c * STAT_HIST_BUCKETS];                          // Get the histogram
+    unsigned long long n = 0;                                                                      // Count its samples
+    int last = -1;                                                                                 // and find the highest used bucket
+    for (int i = 0; i < STAT_HIST_BUCKETS; i++)                                                    // Walk the buckets
+    {                                                                                              // Start of for loop body
+      n += h[i];                                                                                   // Count the samples
+      if (h[i])                                                                                    // If the bucket is used
+        last = i;                                                                                  // remember it
+    } // End of for loop body
+    ok &= buf_printf(&b, &cap, &len,
+                     "%s\"%dxx\":{\"count\":%llu,\"sum\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,"
+                     "\"p999\":%llu,\"max\":%llu,\"buckets\":[",
+                     c ? "," : "", c + 1, n, snap[ST_LAT_SUM + c], stats_quantile(h, n, 0.5),
+                     stats_quantile(h, n, 0.9), stats_quantile(h, n, 0.99), stats_quantile(h, n, 0.999),
+                     last >= 0 ? stats_bucket_upper(last) : 0ULL);
+    int first = 1;                                                                                 // Whether the next pair is the first
+    for (int i = 0; i <= last; i++)                                                                // Emit the used buckets as [upper bound, count]
+    {                                                                                              // Start of for loop body
+      if (!h[i])                                                                                   // Skip empty buckets
+        continue;                                                                                  // to keep the document small
+      ok &= buf_printf(&b, &cap, &len, "%s[%llu,%llu]", first ? "" : ",", stats_bucket_upper(i), h[i]);
+      first = 0;                                                                                   // Later pairs need a separator
+    } // End of for loop body
+    ok &= buf_printf(&b, &cap, &len, "]}");                                                        // Close the class
+  } // End of for loop body
+  ok &= buf_printf(&b, &cap, &len, "}}\n");                                                        // Close the document
+  if (!ok)                                                                                         // If an append failed
+  {                                                                                                // Start of if block
+    free(b);                                                                                       // free the buffer
+    return NULL;                                                                                   // and give up
+  } // End of if block
+  *out_len = len; // Return the length
+  return b;       // Return the document
+} // End of stats_render_json function body
+
+/* Serve the metrics document. Returns 0 on success */
+static int send_stats(sock_t s, int is_head)                                            // Defines a function to send the metrics
+{                                                                                       // Start of send_stats function body
+  size_t len = 0;                                                                       // Length of the document
+  char *body = stats_render_json(&len);                                                 // Render it
+  if (!body)                                                                            // If rendering fails
+  {                                                                                     // Start of if block
+    send_error(s, 500, "Internal Server Error", "Out of memory.");                      // send a 500 error
+    return -1;                                                                          // Return an error
+  } // End of if block
+  char date[SMALL_BUF];                                                                 // Declare a buffer for the Date header
+  http_date_now(date);                                                                  // Get the current date
+  req_log.status = 200;                                                                 // Record the status for the access log
+  int rc = sendf(s,                                                                     // Send the headers
+                 "HTTP/1.0 200 OK\r\nDate: %s\r\nContent-Type: application/json\r\n"
+                 "Cache-Control: no-store\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                 date, len);
+  if (rc == 0 && !is_head)                                                              // For GET
+    rc = send_all(s, body, len);                                                        // send the document
+  free(body); // Free the document
+  return rc;  // Return the send status
+} // End of send_stats function body
+
+/* Sum counters [first, first + n) across every thread into out (no snapshot of the whole table is taken) */
+static void stats_sum_range(int first, int n, unsigned long long *out)               // Defines a function to aggregate a counter range
+{                                                                                    // Start of stats_sum_range function body
+  for (int i = 0; i < n; i++)                                                        // Start from the shared counters
+    out[i] = atomic_load_explicit(&stats_shared[first + i], memory_order_relaxed);   // Copy each one
+  for (int s = 0; s < MAX_WORKER_SLOTS; s++)                                         // Visit every slot
+    for (int i = 0; i < n; i++)                                                      // Add its counters in the range
+      out[i] += atomic_load_explicit(&worker_slots[s].stats[first + i], memory_order_relaxed); // (relaxed reads; approximate sum)
+} // End of stats_sum_range function body
+
+/* Streaming output for a metrics scrape: text is formatted into a fixed buffer that is sent whenever it fills */
+typedef struct          // Defines a structure for a streaming response writer
+{                       // Start of stream_writer_t structure definition
+  sock_t s;             // Socket to write to
+  size_t len;           // Bytes waiting in buf
+  int err;              // Set once a send fails (later output is discarded)
+  char buf[SEND_BUF_SIZE]; // Output buffer
+} stream_writer_t;      // End of stream_writer_t structure definition
+
+/* Send whatever is buffered */
+static void stream_flush(stream_writer_t *w)            // Defines a function to flush a stream writer
+{                                                       // Start of stream_flush function body
+  if (!w->err && w->len && send_all(w->s, w->buf, w->len) != 0) // Send the buffered text
+    w->err = 1;                                         // remembering a failure
+  w->len = 0;                                           // The buffer is empty again
+} // End of stream_flush function body
+
+/* Append printf-formatted text (at most BIG_BUF bytes per call), flushing first if it might not fit */
+static void stream_printf(stream_writer_t *w, const char *fmt, ...) // Defines a function to write formatted text to a stream
+{                                                                   // Start of stream_printf function body
+  if (sizeof(w->buf) - w->len < BIG_BUF)                            // If the worst case would not fit
+    stream_flush(w);                                                // send what is buffered first
+  va_list ap;                                                       // Declare a variable argument list
+  va_start(ap, fmt);                                                // Initialize it
+  int n = vsnprintf(w->buf + w->len, BIG_BUF, fmt, ap);             // Format into the buffer
+  va_end(ap);                                                       // End the variable argument list
+  if (n > 0)                                                        // If something was written
+    w->len += (size_t)n < BIG_BUF ? (size_t)n : BIG_BUF - 1;        // count it (clamped if truncated)
+} // End of stream_printf function body
+
+/* Write one single-sample metric family */
+static void prom_scalar(stream_writer_t *w, const char *name, const char *type, const char *help, unsigned long long v) // Defines a function to write a simple metric
+{                                                                                                                      // Start of prom_scalar function body
+  stream_printf(w, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, v);                         // HELP, TYPE and the sample
+} // End of prom_scalar function body
+
+/* Stream the metrics in the Prometheus text exposition format (version 0.0.4)
+   Each family is aggregated just before it is written, so memory use stays constant and nothing is locked
+   apart from a brief read of the compression cache totals. Latency histograms are exported with one bucket
+   per power of two (the HDR sub-buckets are folded together), which keeps the le= label set fixed */
+static void prom_render(stream_writer_t *w)                                                                    // Defines a function to write the Prometheus metrics
+{                                                                                                              // Start of prom_render function body
+  unsigned long long v[STAT_HIST_BUCKETS];                                                                     // Scratch space for one family
+  int active = atomic_load_explicit(&stats_unslotted, memory_order_relaxed);                                   // Connections without a slot
+  for (int s = 0; s < MAX_WORKER_SLOTS; s++)                                                                   // plus every owned slot
+    active += atomic_load_explicit(&worker_slots[s].in_use, memory_order_relaxed);                             // are the live connections
+
+  prom_scalar(w, "webserver_uptime_seconds", "gauge", "Seconds since the server started.", (unsigned long long)(time(NULL) - stats_started));
+  prom_scalar(w, "webserver_connections_active", "gauge", "Connections currently being served.", (unsigned long long)active);
+  stats_sum_range(ST_REQUESTS, ST_METHOD, v);                                                                  // Requests, connections, bytes, gzip hits/misses
+  prom_scalar(w, "webserver_connections_total", "counter", "Connections accepted.", v[ST_CONNECTIONS]);
+  prom_scalar(w, "webserver_sent_bytes_total", "counter", "Bytes sent to clients, headers included.", v[ST_BYTES]);
+  prom_scalar(w, "webserver_gzip_cache_hits_total", "counter", "Responses served from the gzip cache.", v[ST_GZ_HITS]);
+  prom_scalar(w, "webserver_gzip_cache_misses_total", "counter", "gzip cache lookups that found no variant.", v[ST_GZ_MISSES]);
+
+  stats_sum_range(ST_METHOD, STAT_METHODS, v);                                                                 // Requests by method
+  stream_printf(w, "# HELP webserver_requests_total Requests served, by method.\n# TYPE webserver_requests_total counter\n");
+  for (int i = 0; i < STAT_METHODS; i++)                                                                       // One sample per method
+    stream_printf(w, "webserver_requests_total{method=\"%s\"} %llu\n", stats_method_names[i], v[i]);
+  stats_sum_range(ST_STATUS, STAT_CODES, v);                                                                   // Responses by status code
+  stream_printf(w, "# HELP webserver_responses_total Responses sent, by status code.\n# TYPE webserver_responses_total counter\n");
+  for (int i = 0; i < STAT_CODES; i++)                                                                         // One sample per tracked code
+  {                                                                                                            // Start of for loop body
+    if (stats_codes[i])                                                                                        // A specific code
+      stream_printf(w, "webserver_responses_total{code=\"%d\"} %llu\n", stats_codes[i], v[i]);
+    else                                                                                                       // The catch-all
+      stream_printf(w, "webserver_responses_total{code=\"other\"} %llu\n", v[i]);
+  } // End of for loop body
+
+  pthread_mutex_lock(&gz_cache.lock);                                                                          // Briefly read the compression cache totals
+  size_t gz_entries = gz_cache.entries, gz_bytes = gz_cache.bytes, gz_budget = gz_cache.budget;                // Copy them
+  pthread_mutex_unlock(&gz_cache.lock);                                                                        // and let go
+  prom_scalar(w, "webserver_gzip_cache_entries", "gauge", "Entries tracked by the gzip cache.", gz_entries);
+  prom_scalar(w, "webserver_gzip_cache_bytes", "gauge", "Bytes held by gzip cache variants.", gz_bytes);
+  prom_scalar(w, "webserver_gzip_cache_budget_bytes", "gauge", "Memory budget of the gzip cache (0 = disabled).", gz_budget);
+  prom_scalar(w, "webserver_access_log_dropped_total", "counter", "Access log records dropped because a ring was full.",
+              (unsigned long long)atomic_load_explicit(&log_dropped, memory_order_relaxed));
+  prom_scalar(w, "webserver_shadow_sent_total", "counter", "Mirrored requests the shadow target answered.",
+              (unsigned long long)atomic_load_explicit(&shadow_sent, memory_order_relaxed));
+  prom_scalar(w, "webserver_shadow_failed_total", "counter", "Mirrored requests that failed or timed out.",
+              (unsigned long long)atomic_load_explicit(&shadow_failed, memory_order_relaxed));
+  prom_scalar(w, "webserver_shadow_dropped_total", "counter", "Sampled requests not mirrored because the sender was saturated.",
+              (unsigned long long)atomic_load_explicit(&shadow_dropped, memory_order_relaxed));
+  int accept_queue = admission_accept_queue();                                                                 // Kernel accept queue
+  prom_scalar(w, "webserver_requests_inflight", "gauge", "Requests admitted and being served.",
+              (unsigned long long)atomic_load_explicit(&admit_inflight, memory_order_relaxed));
+  prom_scalar(w, "webserver_inflight_limit", "gauge", "Current in-flight request limit (0 = unlimited).",
+              (unsigned long long)atomic_load_explicit(&admit_limit, memory_order_relaxed));
+  prom_scalar(w, "webserver_connections_queued", "gauge", "Connections waiting for their request head.", (unsigned long long)admission_queued());
+  prom_scalar(w, "webserver_accept_queue", "gauge", "Connections waiting in the kernel accept queue.",
+              (unsigned long long)(accept_queue > 0 ? accept_queue : 0));
+  prom_scalar(w, "webserver_shed_connections_total", "counter", "Connections turned away at the connection limit.",
+              (unsigned long long)atomic_load_explicit(&shed_conns, memory_order_relaxed));
+  prom_scalar(w, "webserver_shed_requests_total", "counter", "Requests answered with 503 at the in-flight limit.",
+              (unsigned long long)atomic_load_explicit(&shed_requests, memory_order_relaxed));
+  stream_printf(w, "# HELP webserver_timeouts_total Connections closed by a deadline, by phase.\n"
+                   "# TYPE webserver_timeouts_total counter\n");
+  stream_printf(w, "webserver_timeouts_total{phase=\"header\"} %llu\n",
+                (unsigned long long)atomic_load_explicit(&timeouts_header, memory_order_relaxed));
+  stream_printf(w, "webserver_timeouts_total{phase=\"send\"} %llu\n",
+                (unsigned long long)atomic_load_explicit(&timeouts_send, memory_order_relaxed));
+  stream_printf(w, "# HELP webserver_rate_limited_total Connections answered with 429, by exceeded limit.\n"
+                   "# TYPE webserver_rate_limited_total counter\n");
+  stream_printf(w, "webserver_rate_limited_total{limit=\"rate\"} %llu\n",
+                (unsigned long long)atomic_load_explicit(&rate_limited, memory_order_relaxed));
+  stream_printf(w, "webserver_rate_limited_total{limit=\"connections\"} %llu\n",
+                (unsigned long long)atomic_load_explicit(&rate_conn_limited, memory_order_relaxed));
+  prom_scalar(w, "webserver_rate_untracked_total", "counter", "Connections from addresses that found no rate table entry.",
+              (unsigned long long)atomic_load_explicit(&rate_untracked, memory_order_relaxed));
+  prom_scalar(w, "webserver_paced_transfers_active", "gauge", "File transfers being paced.",
+              (unsigned long long)atomic_load_explicit(&pace_active, memory_order_relaxed));
+  prom_scalar(w, "webserver_paced_transfers_total", "counter", "File transfers sent paced.",
+              (unsigned long long)atomic_load_explicit(&pace_transfers, memory_order_relaxed));
+  prom_scalar(w, "webserver_paced_bytes_total", "counter", "Body bytes sent by paced transfers.",
+              (unsigned long long)atomic_load_explicit(&pace_bytes, memory_order_relaxed));
+  stream_printf(w, "# HELP webserver_pacing_delay_seconds_total Time paced transfers spent waiting for their share.\n"
+                   "# TYPE webserver_pacing_delay_seconds_total counter\n"
+                   "webserver_pacing_delay_seconds_total %.6f\n",
+                atomic_load_explicit(&pace_delay_us, memory_order_relaxed) / 1e6);
+  if (adaptive_max)                                                                                            // Adaptive limiter inputs
+  {                                                                                                            // Start of if block
+    stream_printf(w, "# HELP webserver_adaptive_latency_seconds Mean time to first byte seen by the adaptive limiter.\n"
+                     "# TYPE webserver_adaptive_latency_seconds gauge\n");
+    stream_printf(w, "webserver_adaptive_latency_seconds{window=\"last\"} %.6f\n",
+                  (double)atomic_load_explicit(&adaptive_rtt_us, memory_order_relaxed) / 1e6);
+    stream_printf(w, "webserver_adaptive_latency_seconds{window=\"baseline\"} %.6f\n",
+                  (double)atomic_load_explicit(&adaptive_baseline_us, memory_order_relaxed) / 1e6);
+  } // End of if block
+
+  stream_printf(w, "# HELP webserver_request_duration_seconds Time from the parsed request head to the last byte sent.\n"
+                   "# TYPE webserver_request_duration_seconds histogram\n");
+  for (int c = 0; c < STAT_CLASSES; c++)                                                                       // One histogram per response class
+  {                                                                                                            // Start of for loop body
+    unsigned long long sum_us;                                                                                 // Latency sum for the class
+    stats_sum_range(ST_LAT_SUM + c, 1, &sum_us);                                                               // Aggregate it
+    stats_sum_range(ST_HIST + c * STAT_HIST_BUCKETS, STAT_HIST_BUCKETS, v);                                    // and the class's buckets
+    unsigned long long cum = 0;                                                                                // Cumulative count
+    for (int b = 0; b < STAT_HIST_BUCKETS; b++)                                                                // Walk the buckets
+    {                                                                                                          // Start of for loop body
+      cum += v[b];                                                                                             // Accumulate
+      if (b % 8 == 7 && b < STAT_HIST_BUCKETS - 1)                                                             // At the end of each power-of-two group
+        stream_printf(w, "webserver_request_duration_seconds_bucket{class=\"%dxx\",le=\"%.9g\"} %llu\n",       // emit a cumulative bucket
+                      c + 1, (double)(stats_bucket_upper(b) + 1) / 1e6, cum);
+    } // End of for loop body
+    stream_printf(w, "webserver_request_duration_seconds_bucket{class=\"%dxx\",le=\"+Inf\"} %llu\n", c + 1, cum);
+    stream_printf(w, "webserver_request_duration_seconds_sum{class=\"%dxx\"} %.6f\n", c + 1, (double)sum_us / 1e6);
+    stream_printf(w, "webserver_request_duration_seconds_count{class=\"%dxx\"} %llu\n", c + 1, cum);
+  } // End of for loop body
+} // End of prom_render function body
+
+/* Sampling profiler (admin port: GET /debug/profile?seconds=N&hz=H)
+   A CLOCK_PROCESS_CPUTIME_ID timer raises SIGPROF in whichever thread is burning CPU; the handler records that
+   thread's return addresses with backtrace() into a preallocated sample table (no locks, no allocation: the
+   table is claimed with one atomic add). When the window closes the stacks are symbolized from the executable's
+   own ELF symbol table (static functions included, so no -rdynamic or perf is needed) and aggregated into
+   folded-stack lines "root;caller;leaf count", ready for flamegraph.pl or speedscope. Frames outside the
+   executable show as "file+0xoffset" (also used for a stripped server binary; resolve with addr2line) */
+#define PROF_MAX_DEPTH 48       // Deepest stack recorded per sample
+#define PROF_MAX_SAMPLES 65536  // Upper bound on samples per profile
+#define PROF_SKIP_FRAMES 2      // Frames of the signal handler itself (handler, signal trampoline)
+#define PROF_MAX_MAPS 64        // Executable mappings remembered for naming frames outside the executable
+
+typedef struct                      // Defines one stack sample
+{                                   // Start of prof_sample_t structure definition
+  int depth;                        // Number of valid return addresses
+  void *pc[PROF_MAX_DEPTH];         // Return addresses, innermost first
+} prof_sample_t;                    // End of prof_sample_t structure definition
+
+typedef struct            // Defines one executable mapping from /proc/self/maps
+{                         // Start of prof_map_t structure definition
+  uintptr_t start, end;   // Address range
+  uintptr_t offset;       // File offset of start
+  char name[64];          // File name (without directories)
+} prof_map_t;             // End of prof_map_t structure definition
+
+typedef struct            // Defines one function of the executable's symbol table
+{                         // Start of prof_sym_t structure definition
+  uintptr_t start, end;   // Run-time address range
+  const char *name;       // Symbol name (points into the mapped file)
+} prof_sym_t;             // End of prof_sym_t structure definition
+
+static struct                      // Defines the profiler state
+{                                  // Start of profiler structure definition
+  atomic_int busy;                 // 1 while a profile is being taken (one at a time)
+  prof_sample_t *samples;          // Sample table
+  size_t cap;                      // Its capacity
+  atomic_size_t claimed;           // Samples claimed by handlers (may exceed cap: those are dropped)
+  atomic_size_t written;           // Samples completely written
+  prof_sym_t *syms;                // Executable's functions, sorted by address (loaded once)
+  size_t nsyms;                    // Number of functions
+  prof_map_t maps[PROF_MAX_MAPS];  // Executable mappings of the process (for frames outside the executable)
+  int nmaps;                       // Number of mappings
+} prof;                            // End of profiler structure definition
+
+/* SIGPROF handler: async-signal-safe (backtrace is primed before the timer starts) */
+static void prof_handler(int sig, siginfo_t *si, void *uc)                      // Defines the SIGPROF handler
+{                                                                               // Start of prof_handler function body
+  (void)sig;                                                                    // Unused
+  (void)si;                                                                     // Unused
+  (void)uc;                                                                     // Unused
+  int saved = errno;                                                            // Preserve the interrupted code's errno
+  size_t i = atomic_fetch_add_explicit(&prof.claimed, 1, memory_order_relaxed); // Claim a sample slot
+  if (i < prof.cap)                                                             // If the table has room
+  {                                                                             // Start of if block
+    prof.samples[i].depth = backtrace(prof.samples[i].pc, PROF_MAX_DEPTH);      // record the stack
+    atomic_fetch_add_explicit(&prof.written, 1, memory_order_release);          // and publish it
+  } // End of if block
+  errno = saved; // Restore errno
+} // End of prof_handler function body
+
+static int prof_sym_cmp(const void *a, const void *b)                               // Defines a comparator for symbols by address
+{                                                                                   // Start of prof_sym_cmp function body
+  uintptr_t x = ((const prof_sym_t *)a)->start, y = ((const prof_sym_t *)b)->start; // Get the addresses
+  return x < y ? -1 : x > y;                                                        // Order by address
+} // End of prof_sym_cmp function body
+
+/* Remember the process's executable mappings (code of the server and its shared libraries) */
+static void prof_load_maps(void)                                                            // Defines a function to read /proc/self/maps
+{                                                                                           // Start of prof_load_maps function body
+  FILE *f = fopen("/proc/self/maps", "r");                                                  // Open the mapping list
+  char line[PATH_MAX + 128];                                                                // Declare a buffer for one line
+  prof.nmaps = 0;                                                                           // Start over (libraries may have changed)
+  while (f && prof.nmaps < PROF_MAX_MAPS && fgets(line, sizeof(line), f))                   // Read each mapping
+  {                                                                                         // Start of while loop body
+    unsigned long lo, hi, off;                                                              // Declare the range and offset
+    char perms[8], path[PATH_MAX];                                                          // Declare buffers for the flags and path
+    path[0] = '\0';                                                                         // Anonymous mappings have no path
+    if (sscanf(line, "%lx-%lx %7s %lx %*s %*s %4095s", &lo, &hi, perms, &off, path) < 4 || perms[2] != 'x') // Keep code only
+      continue;                                                                             // Skip everything else
+    prof_map_t *m = &prof.maps[prof.nmaps++];                                               // Take a slot
+    const char *base = strrchr(path, '/');                                                  // Use the file name only
+    m->start = lo;                                                                          // Range
+    m->end = hi;                                                                            // (end exclusive)
+    m->offset = off;                                                                        // File offset
+    snprintf(m->name, sizeof(m->name), "%s", base ? base + 1 : path[0] ? path : "[anon]");  // Name
+  } // End of while loop body
+  if (f)                                                                                    // If the list was opened
+    fclose(f);                                                                              // close it
+} // End of prof_load_maps function body
+
+/* Load the function symbols of /proc/self/exe (once; the file stays mapped for the names) */
+static void prof_load_symbols(void)                                                         // Defines a function to load the symbol table
+{                                                                                           // Start of prof_load_symbols function body
+  prof_load_maps();                                                                         // Refresh the mappings every run
+  if (prof.syms)                                                                            // If the symbols are already loaded
+    return;                                                                                 // there is nothing more to do
+  int fd = open("/proc/self/exe", O_RDONLY);                                                // Open our own executable
+  struct stat st;                                                                           // Declare a stat structure for its size
+  if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Elf64_Ehdr))            // If it cannot be read
+  {                                                                                         // Start of if block
+    if (fd >= 0)                                                                            // If it was opened
+      close(fd);                                                                            // close it
+    return;                                                                                 // and do without names
+  } // End of if block
+  const unsigned char *img = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0); // Map it
+  close(fd);                                                                                // The mapping stays valid
+  if (img == MAP_FAILED)                                                                    // If mapping fails
+    return;                                                                                 // do without names
+  const Elf64_Ehdr *eh = (const Elf64_Ehdr *)img;                                           // ELF header
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64 ||   // Only 64-bit ELF
+      eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf64_Shdr) > (size_t)st.st_size)          // with sane section headers
+    return;                                                                                 // is understood
+  const Elf64_Shdr *sh = (const Elf64_Shdr *)(img + eh->e_shoff);                           // Section headers
+  const Elf64_Shdr *symtab = NULL;                                                          // Chosen symbol table
+  for (int i = 0; i < eh->e_shnum; i++)                                                     // Prefer the full table
+    if (sh[i].sh_type == SHT_SYMTAB || (sh[i].sh_type == SHT_DYNSYM && !symtab))            // over the dynamic one
+      symtab = &sh[i];                                                                      // Remember it
+  if (!symtab || symtab->sh_link >= eh->e_shnum)                                            // If there is none (stripped)
+    return;                                                                                 // do without names
+  const Elf64_Shdr *strtab = &sh[symtab->sh_link];                                          // Its string table
+  const Elf64_Sym *sym = (const Elf64_Sym *)(img + symtab->sh_offset);                      // The symbols
+  size_t n = symtab->sh_size / sizeof(Elf64_Sym);                                           // How many there are
+  prof_sym_t *out = (prof_sym_t *)malloc((n ? n : 1) * sizeof(prof_sym_t));                 // Allocate the table
+  size_t k = 0;                                                                             // Functions kept
+  uintptr_t bias = 0;                                                                       // Load bias (non-zero for PIE executables)
+  if (!out)                                                                                 // If allocation fails
+    return;                                                                                 // do without names
+  for (size_t i = 0; i < n; i++)                                                            // Find a function we know the address of
+    if (ELF64_ST_TYPE(sym[i].st_info) == STT_FUNC && sym[i].st_name < strtab->sh_size &&
+        !strcmp((const char *)(img + strtab->sh_offset + sym[i].st_name), "prof_handler"))  // (the signal handler)
+      bias = (uintptr_t)prof_handler - (uintptr_t)sym[i].st_value;                          // to compute the bias
+  for (size_t i = 0; i < n; i++)                                                            // Keep defined functions
+  {                                                                                         // Start of for loop body
+    if (ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC || !sym[i].st_value || sym[i].st_name >= strtab->sh_size)
+      continue;                                                                             // Skip everything else
+    out[k].start = bias + (uintptr_t)sym[i].st_value;                                       // Run-time start
+    out[k].end = out[k].start + (sym[i].st_size ? (uintptr_t)sym[i].st_size : 1);           // and end
+    out[k].name = (const char *)(img + strtab->sh_offset + sym[i].st_name);                 // Name
+    k++;                                                                                    // Keep it
+  } // End of for loop body
+  qsort(out, k, sizeof(prof_sym_t), prof_sym_cmp);                                          // Sort for binary search
+  prof.nsyms = k;                                                                           // Publish the table
+  prof.syms = out;                                                                          // (the admin thread is the only user)
+} // End of prof_load_symbols function body
+
+/* Append the name of the function containing pc (a return address unless leaf) to a folded stack */
+static void prof_frame_name(uintptr_t pc, char *out, size_t out_sz)                       // Defines a function to symbolize a frame
+{                                                                                         // Start of prof_frame_name function body
+  size_t lo = 0, hi = prof.nsyms;                                                         // Binary search bounds
+  while (lo < hi)                                                                         // Find the last symbol starting at or before pc
+  {                                                                                       // Start of while loop body
+    size_t mid = (lo + hi) / 2;                                                           // Midpoint
+    if (prof.syms[mid].start <= pc)                                                       // If it starts at or before pc
+      lo = mid + 1;                                                                       // look right
+    else                                                                                  // Otherwise
+      hi = mid;                                                                           // look left
+  } // End of while loop body
+  if (lo > 0 && pc < prof.syms[lo - 1].end)                                               // If pc is inside that function
+  {                                                                                       // Start of if block
+    snprintf(out, out_sz, "%s", prof.syms[lo - 1].name);                                  // use its name
+    return;                                                                               // Done
+  } // End of if block
+  for (int i = 0; i < prof.nmaps; i++)                                                    // Otherwise find the containing mapping
+  {                                                                                       // Start of for loop body
+    const prof_map_t *m = &prof.maps[i];                                                  // Get the mapping
+    if (pc >= m->start && pc < m->end)                                                    // If it holds the address
+    {                                                                                     // Start of if block
+      snprintf(out, out_sz, "%s+0x%lx", m->name, (unsigned long)(pc - m->start + m->offset)); // name the file offset
+      return;                                                                             // Done
+    } // End of if block
+  } // End of for loop body
+  snprintf(out, out_sz, "0x%lx", (unsigned long)pc); // Unknown address, shown raw
+} // End of prof_frame_name function body
+
+static int prof_str_cmp(const void *a, const void *b)           // Defines a comparator for folded stacks
+{                                                               // Start of prof_str_cmp function body
+  return strcmp(*(char *const *)a, *(char *const *)b);          // Order lexically so duplicates are adjacent
+} // End of prof_str_cmp function body
+
+/* A profiling request handed from the admin thread to its profiling thread */
+typedef struct   // Defines a profiling job
+{                // Start of prof_job_t structure definition
+  sock_t c;      // Admin connection to answer
+  int secs;      // Sampling window in seconds
+  int hz;        // Sampling frequency (per second of process CPU time)
+} prof_job_t;    // End of prof_job_t structure definition
+
+/* Run one profile and stream the folded stacks to the client. Runs on its own thread so the admin listener
+   keeps answering scrapes; prof.busy (set by the caller) keeps profiles from overlapping */
+static void *prof_thread(void *arg)                                                             // Defines the entry point of a profiling run
+{                                                                                               // Start of prof_thread function body
+  prof_job_t *job = (prof_job_t *)arg;                                                          // The job
+  static stream_writer_t w;                                                                     // Output buffer (one profile at a time)
+  w.s = job->c;                                                                                 // Point the writer at the socket
+  w.len = 0;                                                                                    // with an empty buffer
+  w.err = 0;                                                                                    // and no error
+  sigset_t block;                                                                               // This thread only sleeps:
+  sigemptyset(&block);                                                                          // keep SIGPROF away from it
+  sigaddset(&block, SIGPROF);                                                                   // so every sample lands on
+  pthread_sigmask(SIG_BLOCK, &block, NULL);                                                     // a thread doing real work
+
+  prof_load_symbols();                                                                          // Names for the frames
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);                                                    // CPU time can accrue on every core
+  size_t cap = (size_t)job->secs * (size_t)job->hz * (size_t)(ncpu > 0 ? ncpu : 1);             // Most samples the window can produce
+  prof.cap = cap < PROF_MAX_SAMPLES ? cap : PROF_MAX_SAMPLES;                                   // bounded
+  prof.samples = (prof_sample_t *)malloc(prof.cap * sizeof(prof_sample_t));                     // Allocate the table
+  void *prime[2];                                                                               // backtrace() loads the unwinder on first use,
+  backtrace(prime, 2);                                                                          // which must not happen inside the handler
+  atomic_store(&prof.claimed, 0);                                                               // Reset the counters
+  atomic_store(&prof.written, 0);                                                               // for this run
+
+  timer_t tid;                                                                                  // Declare the timer ID
+  struct sigaction sa;                                                                          // Declare the handler registration
+  memset(&sa, 0, sizeof(sa));                                                                   // Zero it
+  sa.sa_sigaction = prof_handler;                                                               // Our handler
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;                                                        // Restart interrupted system calls
+  sigemptyset(&sa.sa_mask);                                                                     // Block nothing extra
+  struct sigevent sev;                                                                          // Declare the timer notification
+  memset(&sev, 0, sizeof(sev));                                                                 // Zero it
+  sev.sigev_notify = SIGEV_SIGNAL;                                                              // Deliver a signal
+  sev.sigev_signo = SIGPROF;                                                                    // namely SIGPROF
+  long period_ns = 1000000000L / job->hz;                                                       // Sampling period
+  struct itimerspec its = {{period_ns / 1000000000L, period_ns % 1000000000L},                  // Repeating
+                           {period_ns / 1000000000L, period_ns % 1000000000L}};                 // from the first period
+  if (!prof.samples || sigaction(SIGPROF, &sa, NULL) != 0 ||                                    // Install the handler
+      timer_create(CLOCK_PROCESS_CPUTIME_ID, &sev, &tid) != 0)                                  // and a process CPU-time timer
+  {                                                                                             // Start of if block
+    send_error(job->c, 500, "Internal Server Error", "Cannot start the profiling timer.");      // Report the failure
+    goto done;                                                                                  // and clean up
+  } // End of if block
+  timer_settime(tid, 0, &its, NULL);                                                            // Start sampling
+  struct timespec ts = {job->secs, 0};                                                          // Sampling window
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR)                                            // Sleep through it
+    ;                                                                                           // (resuming if interrupted)
+  timer_delete(tid);                                                                            // Stop sampling
+  signal(SIGPROF, SIG_IGN);                                                                     // Signals still in flight must not kill us
+  size_t n = atomic_load(&prof.claimed);                                                        // Samples taken
+  size_t dropped = n > prof.cap ? n - prof.cap : 0;                                             // Samples that found the table full
+  n -= dropped;                                                                                 // Samples stored
+  for (int i = 0; i < 100 && atomic_load_explicit(&prof.written, memory_order_acquire) < n; i++) // Let running handlers finish
+  {                                                                                             // Start of for loop body
+    struct timespec pause = {0, 1000000L};                                                      // Wait a millisecond
+    nanosleep(&pause, NULL);                                                                    // at a time
+  } // End of for loop body
+
+  char **stacks = (char **)calloc(n ? n : 1, sizeof(char *));                                   // One folded string per sample
+  size_t nstacks = 0;                                                                           // Strings built
+  for (size_t i = 0; stacks && i < n; i++)                                                      // Fold each sample
+  {                                                                                             // Start of for loop body
+    const prof_sample_t *smp = &prof.samples[i];                                                // Get the sample
+    char *str = (char *)malloc(PROF_MAX_DEPTH * 64);                                            // Buffer for its folded form
+    size_t len = 0;                                                                             // Its length
+    if (!str)                                                                                   // If allocation fails
+      break;                                                                                    // stop folding
+    str[0] = '\0';                                                                              // Start empty
+    for (int f = smp->depth - 1; f >= PROF_SKIP_FRAMES; f--)                                    // Outermost frame first
+    {                                                                                           // Start of for loop body
+      char name[SMALL_BUF];                                                                     // Declare a buffer for the frame name
+      uintptr_t pc = (uintptr_t)smp->pc[f];                                                     // Return address (exact pc for the leaf)
+      prof_frame_name(f > PROF_SKIP_FRAMES ? pc - 1 : pc, name, sizeof(name));                  // Look inside the call instruction
+      for (char *q = name; *q; q++)                                                             // Folded format reserves ';' and ' '
+        if (*q == ';' || *q == ' ')                                                             // in frame names
+          *q = '_';                                                                             // so replace them
+      len += (size_t)snprintf(str + len, PROF_MAX_DEPTH * 64 - len, "%s%s", len ? ";" : "", name); // Append the frame
+      if (len >= PROF_MAX_DEPTH * 64)                                                           // If the buffer is full
+        break;                                                                                  // stop (the stack is truncated)
+    } // End of for loop body
+    stacks[nstacks++] = str;                                                                    // Keep the folded stack
+  } // End of for loop body
+  if (stacks)                                                                                   // Sort so identical stacks are adjacent
+    qsort(stacks, nstacks, sizeof(char *), prof_str_cmp);                                       // (aggregation is one pass)
+
+  stream_printf(&w, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; charset=utf-8\r\nCache-Control: no-store\r\n"
+                    "X-Profile-Samples: %zu\r\nX-Profile-Dropped: %zu\r\nConnection: close\r\n\r\n",
+                nstacks, dropped);                                                              // Headers (the body ends at close)
+  for (size_t i = 0; i < nstacks;)                                                              // Emit each distinct stack once
+  {                                                                                             // Start of for loop body
+    size_t j = i + 1;                                                                           // Find the end of the run
+    while (j < nstacks && strcmp(stacks[i], stacks[j]) == 0)                                    // of identical stacks
+      j++;                                                                                      // (sorted, so they are adjacent)
+    if (strlen(stacks[i]) < BIG_BUF - 32)                                                       // Stacks that fit one write
+      stream_printf(&w, "%s %zu\n", stacks[i][0] ? stacks[i] : "[unknown]", j - i);             // with their count
+    i = j;                                                                                      // Move to the next run
+  } // End of for loop body
+  stream_flush(&w);                                                                             // Send the rest
+  for (size_t i = 0; i < nstacks; i++)                                                          // Free the strings
+    free(stacks[i]);                                                                            // one by one
+  free(stacks);                                                                                 // and the array
+
+done:                                            // Cleanup
+  free(prof.samples);                            // Free the sample table
+  prof.samples = NULL;                           // It is gone
+  prof.cap = 0;                                  // and holds nothing
+  CLOSESOCK(job->c);                             // Close the admin connection
+  free(job);                                     // Free the job
+  atomic_store(&prof.busy, 0);                   // Allow the next profile
+  return NULL;                                   // Return NULL as the thread result
+} // End of prof_thread function body
+
+/* Admin listener (admin_port=): answers Prometheus scrapes on its own thread, one connection at a time,
+   so scrapes never compete with the public accept loop or the worker threads
+   GET /debug/profile?seconds=N&hz=H hands the connection to a profiling thread (see prof_thread) */
+static void *admin_thread(void *arg)                                                          // Defines the entry point of the admin thread
+{                                                                                             // Start of admin_thread function body
+  sock_t ls = (sock_t)(intptr_t)arg;                                                          // The admin listening socket
+  static stream_writer_t w;                                                                   // Output buffer (only this thread uses it)
+  for (;;)                                                                                    // Loop forever
+  {                                                                                           // Start of for loop body
+    sock_t c = accept(ls, NULL, NULL);                                                        // Wait for a scraper
+    if (c == INVALID_SOCKET)                                                                  // If accept fails
+      continue;                                                                               // try again
+    struct timeval tv = {5, 0};                                                               // A stalled scraper must not wedge the thread
+    setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(tv));                          // Bound reads
+    setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, (char *)&tv, sizeof(tv));                          // and writes
+    char method[16], path[PATH_MAX], version[16];                                             // Declare buffers for the request line
+    request_headers_t hdrs;                                                                   // Declare a structure for the headers (unused)
+    if (read_http_request(c, method, sizeof(method), path, sizeof(path), version, sizeof(version), &hdrs) == 0) // Read the request
+    {                                                                                         // Start of if block
+      if (strcmp(method, "GET") != 0 && strcmp(method, "HEAD") != 0)                          // Only GET and HEAD
+        send_error(c, 405, "Method Not Allowed", "Only GET and HEAD are supported.");         // are allowed
+      else if (!strcmp(path, "/debug/profile") || !strncmp(path, "/debug/profile?", 15))      // A profiling request
+      {                                                                                       // Start of else if block
+        const char *q;                                                                        // Declare a pointer for parameters
+        int secs = (q = strstr(path, "seconds=")) ? atoi(q + 8) : 10;                         // Window (default 10 s)
+        int hz = (q = strstr(path, "hz=")) ? atoi(q + 3) : 99;                                // Frequency (default 99 Hz)
+        prof_job_t *job = (prof_job_t *)malloc(sizeof(prof_job_t));                           // Allocate the job
+        pthread_t ptid;                                                                       // Declare the profiling thread ID
+        int expected = 0;                                                                     // No profile may be running
+        if (secs < 1 || secs > 60 || hz < 1 || hz > 1000)                                     // If the parameters are out of range
+          send_error(c, 400, "Bad Request", "Use seconds=1..60 and hz=1..1000.");             // refuse them
+        else if (!job || !atomic_compare_exchange_strong(&prof.busy, &expected, 1))           // If a profile is already running
+          send_error(c, 409, "Conflict", "A profile is already being taken.");                // refuse to overlap it
+        else                                                                                  // Otherwise
+        {                                                                                     // Start of else block
+          job->c = c;                                                                         // hand over the connection
+          job->secs = secs;                                                                   // the window
+          job->hz = hz;                                                                       // and the frequency
+          struct timeval ptv = {secs + 5, 0};                                                 // The reply comes after the window
+          setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, (char *)&ptv, sizeof(ptv));                  // so allow for it
+          if (pthread_create(&ptid, NULL, prof_thread, job) == 0)                             // Start the profiling thread
+          {                                                                                   // Start of if block
+            pthread_detach(ptid);                                                             // which owns the connection now
+            continue;                                                                         // Serve the next admin client
+          } // End of if block
+          atomic_store(&prof.busy, 0);                                                        // The profile never started
+          send_error(c, 500, "Internal Server Error", "Cannot start the profiler.");          // Report it
+        } // End of else block
+        free(job);                                                                            // The job was not handed over
+      } // End of else if block
+      else if (strcmp(path, "/metrics") != 0 && strncmp(path, "/metrics?", 9) != 0)           // Only /metrics
+        send_error(c, 404, "Not Found", "Metrics are served at /metrics.");                   // exists
+      else                                                                                    // A scrape
+      {                                                                                       // Start of else block
+        w.s = c;                                                                              // Point the writer at the socket
+        w.len = 0;                                                                            // with an empty buffer
+        w.err = 0;                                                                            // and no error
+        stream_printf(&w, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                          "Cache-Control: no-store\r\nConnection: close\r\n\r\n");            // Headers (the body ends at close)
+        if (strcmp(method, "HEAD") != 0)                                                      // For GET
+          prom_render(&w);                                                                    // stream the metrics
+        stream_flush(&w);                                                                     // Send the rest
+      } // End of else block
+    } // End of if block
+    CLOSESOCK(c); // Close the connection
+  } // End of for loop body
+  return NULL; // Never reached
+} // End of admin_thread function body
+
+/* Shared-memory stats segment (stats_shm=<name>)
+   A publisher thread copies the live counters into a POSIX shared-memory segment every SHM_STATS_INTERVAL_MS.
+   Readers such as the web_stat viewer map it read-only, so watching a saturated server costs it nothing and
+   works even when it can no longer answer HTTP. Each record is guarded by its own seqlock: the publisher (the
+   only writer) makes 'seq' odd, updates the record, then makes it even again; a reader retries whenever it saw
+   an odd value or the value changed while it was copying. The layout is duplicated in web_stat.c: any change
+   here must bump SHM_STATS_VERSION */
+#define SHM_STATS_MAGIC 0x54535357u // "WSST" in little-endian byte order
+#define SHM_STATS_VERSION 1         // Layout version of the segment
+#define SHM_STATS_INTERVAL_MS 100   // How often the publisher refreshes the segment
+
+typedef struct              // Defines the per-worker record of the stats segment
+{                           // Start of shm_worker_t structure definition
+  _Atomic uint32_t seq;     // Seqlock sequence (odd while the record is being written)
+  uint32_t phase;           // WORKER_IDLE, WORKER_READING or WORKER_SENDING
+  uint64_t requests;        // Requests served by this slot's threads
+  uint64_t connections;     // Connections handled by this slot's threads
+  uint64_t bytes;           // Bytes sent by this slot's threads
+} shm_worker_t;             // End of shm_worker_t structure definition
+
+typedef struct                   // Defines the header of the stats segment
+{                                // Start of shm_stats_header_t structure definition
+  uint32_t magic;                // SHM_STATS_MAGIC, written last once the segment is initialized
+  uint32_t version;              // SHM_STATS_VERSION
+  uint32_t header_size;          // sizeof(shm_stats_header_t); worker records start at this offset
+  uint32_t worker_size;          // sizeof(shm_worker_t)
+  uint32_t n_workers;            // Number of worker records
+  uint32_t interval_ms;          // Publishing interval
+  int64_t pid;                   // Server process ID
+  int64_t started;               // Server start time (Unix seconds)
+  _Alignas(64) _Atomic uint32_t seq; // Seqlock sequence of the fields below
+  uint32_t reserved;             // Padding, always zero
+  uint64_t updated_ns;           // Wall-clock time of the last update (Unix nanoseconds)
+  uint64_t conns_active;         // Connections currently being served
+  uint64_t conns_total;          // Connections accepted
+  uint64_t queue_depth;          // Connections still waiting for their request head
+  uint64_t requests;             // Requests served
+  uint64_t bytes;                // Bytes sent
+  uint64_t requests_per_sec;     // Request rate over the last interval
+  uint64_t bytes_per_sec;        // Send rate over the last interval
+  uint64_t gz_hits, gz_misses;   // gzip cache outcomes
+  uint64_t log_dropped;          // Access log records dropped
+} shm_stats_header_t;            // End of shm_stats_header_t structure definition
+
+static shm_stats_header_t *shm_stats; // The mapped segment (NULL when disabled)
+
+/* Create and map the stats segment. Returns 0 on success */
+static int shm_stats_open(const char *name)                                               // Defines a function to create the stats segment
+{                                                                                         // Start of shm_stats_open function body
+  size_t size = sizeof(shm_stats_header_t) + MAX_WORKER_SLOTS * sizeof(shm_worker_t);     // Total segment size
+  shm_unlink(name);                                                                       // Never reuse a stale segment (its layout may differ)
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);                               // Create it, readable by viewers
+  if (fd < 0)                                                                             // If creation fails
+    return -1;                                                                            // return an error
+  void *p = MAP_FAILED;                                                                   // The mapping
+  if (ftruncate(fd, (off_t)size) == 0)                                                    // Size the segment (zero-filled)
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);                      // and map it
+  close(fd);                                                                              // The mapping keeps the segment alive
+  if (p == MAP_FAILED)                                                                    // If sizing or mapping fails
+  {                                                                                       // Start of if block
+    shm_unlink(name);                                                                     // remove the segment
+    return -1;                                                                            // and return an error
+  } // End of if block
+  shm_stats_header_t *h = (shm_stats_header_t *)p;                                        // Fill in the header
+  h->version = SHM_STATS_VERSION;                                                         // Layout version
+  h->header_size = sizeof(shm_stats_header_t);                                            // Where worker records start
+  h->worker_size = sizeof(shm_worker_t);                                                  // Size of each record
+  h->n_workers = MAX_WORKER_SLOTS;                                                        // Number of records
+  h->interval_ms = SHM_STATS_INTERVAL_MS;                                                 // Publishing interval
+  h->pid = (int64_t)getpid();                                                             // Our process ID
+  h->started = (int64_t)stats_started;                                                    // Start time
+  atomic_thread_fence(memory_order_release);                                              // The header is complete
+  h->magic = SHM_STATS_MAGIC;                                                             // before readers can recognize it
+  shm_stats = h;                                                                          // Enable publishing
+  return 0;                                                                               // Return 0 to indicate success
+} // End of shm_stats_open function body
+
+/* Seqlock writer side: open and close a record update */
+static void seq_write_begin(_Atomic uint32_t *seq)                                                            // Defines a function to start a seqlock write
+{                                                                                                             // Start of seq_write_begin function body
+  atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_relaxed);     // Odd: update in progress
+  atomic_thread_fence(memory_order_release);                                                                  // Keep the data writes after it
+} // End of seq_write_begin function body
+
+static void seq_write_end(_Atomic uint32_t *seq)                                                              // Defines a function to finish a seqlock write
+{                                                                                                             // Start of seq_write_end function body
+  atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_release);     // Even again: publish the data writes
+} // End of seq_write_end function body
+
+/* Publisher thread: refreshes the segment from the worker slots every SHM_STATS_INTERVAL_MS */
+static void *shm_stats_thread(void *arg)                                                      // Defines the entry point of the publisher thread
+{                                                                                             // Start of shm_stats_thread function body
+  (void)arg;                                                                                  // The thread takes no argument
+  shm_stats_header_t *h = shm_stats;                                                          // The segment
+  shm_worker_t *wk = (shm_worker_t *)((char *)h + h->header_size);                            // Its worker records
+  unsigned long long prev_req = 0, prev_bytes = 0;                                            // Totals at the previous update
+  long long prev_ns = mono_ns();                                                              // and when they were taken
+  for (;;)                                                                                    // Loop forever
+  {                                                                                           // Start of for loop body
+    struct timespec ts = {0, SHM_STATS_INTERVAL_MS * 1000000L};                               // Wait for the next interval
+    nanosleep(&ts, NULL);                                                                     // before publishing again
+    unsigned long long g[ST_METHOD];                                                          // Shared counters of slot-less threads
+    for (int i = 0; i < ST_METHOD; i++)                                                       // Start the totals from them
+      g[i] = atomic_load_explicit(&stats_shared[i], memory_order_relaxed);                    // (requests, connections, bytes, gzip)
+    unsigned long long active = (unsigned long long)atomic_load_explicit(&stats_unslotted, memory_order_relaxed); // Live connections
+    unsigned long long queued = 0;                                                            // Connections waiting for a request head
+    for (int s = 0; s < MAX_WORKER_SLOTS; s++)                                                // Publish every slot
+    {                                                                                         // Start of for loop body
+      worker_slot_t *ws = &worker_slots[s];                                                   // Get the slot
+      uint32_t phase = atomic_load_explicit(&ws->in_use, memory_order_relaxed)                // An owned slot
+                           ? (uint32_t)atomic_load_explicit(&ws->phase, memory_order_relaxed) // reports its phase
+                           : WORKER_IDLE;                                                     // a free one is idle
+      unsigned long long req = atomic_load_explicit(&ws->stats[ST_REQUESTS], memory_order_relaxed);    // Requests
+      unsigned long long conns = atomic_load_explicit(&ws->stats[ST_CONNECTIONS], memory_order_relaxed); // Connections
+      unsigned long long bytes = atomic_load_explicit(&ws->stats[ST_BYTES], memory_order_relaxed);       // Bytes
+      active += phase != WORKER_IDLE;                                                         // Count live connections
+      queued += phase == WORKER_READING;                                                      // and queued ones
+      g[ST_REQUESTS] += req;                                                                  // Add to the totals
+      g[ST_CONNECTIONS] += conns;                                                             // (connections)
+      g[ST_BYTES] += bytes;                                                                   // (bytes)
+      g[ST_GZ_HITS] += atomic_load_explicit(&ws->stats[ST_GZ_HITS], memory_order_relaxed);    // (gzip hits)
+      g[ST_GZ_MISSES] += atomic_load_explicit(&ws->stats[ST_GZ_MISSES], memory_order_relaxed); // (gzip misses)
+      if (wk[s].phase == phase && wk[s].requests == req && wk[s].connections == conns)        // If nothing changed
+        continue;                                                                             // leave the record alone
+      seq_write_begin(&wk[s].seq);                                                            // Update the record
+      wk[s].phase = phase;                                                                    // phase
+      wk[s].requests = req;                                                                   // requests
+      wk[s].connections = conns;                                                              // connections
+      wk[s].bytes = bytes;                                                                    // bytes
+      seq_write_end(&wk[s].seq);                                                              // Publish it
+    } // End of for loop body
+
+    long long now = mono_ns();                                                                // Time the rates
+    double secs = (double)(now - prev_ns) / 1e9;                                              // over the elapsed interval
+    struct timespec wall;                                                                     // Wall-clock time of the update
+    clock_gettime(CLOCK_REALTIME, &wall);                                                     // Read it
+    seq_write_begin(&h->seq);                                                                 // Update the global record
+    h->updated_ns = (uint64_t)wall.tv_sec * 1000000000ULL + (uint64_t)wall.tv_nsec;           // Timestamp
+    h->conns_active = active;                                                                 // Live connections
+    h->conns_total = g[ST_CONNECTIONS];                                                       // Total connections
+    h->queue_depth = queued;                                                                  // Queued connections
+    h->requests = g[ST_REQUESTS];                                                             // Requests
+    h->bytes = g[ST_BYTES];                                                                   // Bytes
+    h->requests_per_sec = secs > 0 ? (uint64_t)((double)(g[ST_REQUESTS] - prev_req) / secs) : 0; // Request rate
+    h->bytes_per_sec = secs > 0 ? (uint64_t)((double)(g[ST_BYTES] - prev_bytes) / secs) : 0;     // Send rate
+    h->gz_hits = g[ST_GZ_HITS];                                                               // gzip hits
+    h->gz_misses = g[ST_GZ_MISSES];                                                           // gzip misses
+    h->log_dropped = atomic_load_explicit(&log_dropped, memory_order_relaxed);                // Dropped log records
+    seq_write_end(&h->seq);                                                                   // Publish it
+    prev_req = g[ST_REQUESTS];                                                                // Remember the totals
+    prev_bytes = g[ST_BYTES];                                                                 // for the next rates
+    prev_ns = now;                                                                            // and when they were taken
+  } // End of for loop body
+  return NULL; // Never reached
+} // End of shm_stats_thread function body
+
 /* Handle one client connection: parse request, map path, serve file or directory listing */
 static void handle_client(client_ctx_t *ctx)                                                                     // Defines the main function to handle a client connection
 {                                                                                                                // Start of handle_client function body
-  char method[16], path[PATH_MAX], version[16];                                                                  // Declare buffers for the request components
-  if (read_http_request(ctx->client, method, sizeof(method), path, sizeof(path), version, sizeof(version)) != 0) // Read and parse the HTTP request
-  {                                                                                                              // Start of if block
+  char method[16], path[PATH_MAX], version[16];                                                                         // Declare buffers for the request components
+  request_headers_t hdrs;                                                                                               // Declare a structure for the request headers
+  if (read_http_request(ctx->client, method, sizeof(method), path, sizeof(path), version, sizeof(version), &hdrs) != 0) // Read and parse the HTTP request
+  {                                                                                                                     // Start of if block
     // Cannot parse request; close silently
     return; // If parsing fails, simply close the connection
   } // End of if block
 
-  // Log request line
-  char addrstr[NI_MAXHOST];                                                                                    // Declare a buffer for the client's address string
-  addrstr[0] = 0;                                                                                              // Initialize the buffer
-  getnameinfo((struct sockaddr *)&ctx->addr, ctx->addrlen, addrstr, sizeof(addrstr), NULL, 0, NI_NUMERICHOST); // Get the client's IP address
-  printf("[%s] \"%s %s %s\"\n", addrstr, method, path, version);                                               // Print the request line to the console
+  // Start the access log record (written by client_thread once the response is done)
+  if (current_slot)                                                            // Tell observers the request head is in
+    atomic_store_explicit(&current_slot->phase, WORKER_SENDING, memory_order_relaxed);
+  timer_sending();                                                             // From now on the response must make progress
+  trace_mark(PH_RECV);                                                         // The request head is in
+  req_log.active = 1;                                                          // A request was parsed
+  req_log.start_ns = req_log.trace_last;                                       // Durations are measured from here
+  WS_PROBE3(request__parsed, ctx->id, method, path);                           // Fire the request-parsed probe
+  req_log.wall = time(NULL);                                                   // Remember when the request arrived
+  snprintf(req_log.method, sizeof(req_log.method), "%s", method);              // Copy the method
+  snprintf(req_log.path, sizeof(req_log.path), "%s", path);                    // Copy the request target
+  snprintf(req_log.version, sizeof(req_log.version), "%s", version);           // Copy the version
+  snprintf(req_log.referer, sizeof(req_log.referer), "%s", hdrs.referer);      // Copy the Referer
+  snprintf(req_log.user_agent, sizeof(req_log.user_agent), "%s", hdrs.user_agent); // Copy the User-Agent
+  replay_record_request(&hdrs);                                                // Record it for replay, if enabled
+  if (!admission_acquire())                                                    // If too many requests are in flight
+  {                                                                            // Start of if block
+    send_overload(ctx->client);                                                // shed this one cheaply
+    return;                                                                    // Close the connection
+  } // End of if block
 
   // Only support GET and HEAD
   int is_head = 0;                                                                          // Initialize a flag for the HEAD method
@@ -692,6 +4376,14 @@ static void handle_client(client_ctx_t *ctx)
     return;                                                                                 // Close the connection
   } // End of else block
 
+  // Built-in metrics endpoint (served from memory, never from the document root)
+  size_t splen = strlen(ctx->cfg->stats_path);                                               // Length of the reserved path
+  if (splen && !strncmp(path, ctx->cfg->stats_path, splen) && (!path[splen] || path[splen] == '?')) // If it was requested
+  {                                                                                          // Start of if block
+    send_stats(ctx->client, is_head);                                                        // send the metrics
+    return;                                                                                  // Close the connection
+  } // End of if block
+
   // Require path starts with '/'
   if (path[0] != '/')                                                     // If the path does not start with a slash
   {                                                                       // Start of if block
@@ -702,6 +4394,8 @@ static void handle_client(client_ctx_t *ctx)
   // Map URL to filesystem path
   char fs_path[PATH_MAX];                                                               // Declare a buffer for the filesystem path
   int map_rc = map_url_to_fs(ctx->cfg, path, fs_path, sizeof(fs_path));                 // Map the URL path to a filesystem path
+  trace_mark(PH_MAP);                                                                   // Close the mapping phase
+  WS_PROBE3(path__mapped, ctx->id, fs_path, map_rc);                                    // Fire the path-mapped probe
   if (map_rc == -2)                                                                     // If the file is not found
   {                                                                                     // Start of if block
     send_error(ctx->client, 404, "Not Found", "The requested resource was not found."); // send a 404 error
@@ -718,35 +4412,101 @@ static void handle_client(client_ctx_t *ctx)
   if (path_stat_isdir(fs_path, &isdir, NULL) == 0 && isdir) // Check if the path is a directory
   {                                                         // Start of if block
     char idx[PATH_MAX];                                     // Declare a buffer for the index.html path
-    snprintf(idx, sizeof(idx), "%s/index.html", fs_path);   // Construct the path to index.html in that directory
-    if (path_stat_isdir(idx, NULL, NULL) == 0)              // Check if index.html exists and is a file
+    int fits = (size_t)snprintf(idx, sizeof(idx), "%s/index.html", fs_path) < sizeof(idx); // Construct the path to index.html in that directory
+    if (fits && path_stat_isdir(idx, NULL, NULL) == 0)      // Check if index.html exists and is a file (a truncated path never counts)
     {                                                       // Start of if block
       // It's a file; serve it
-      send_file(ctx->client, idx, is_head); // Serve the index.html file
+      send_file(ctx->client, ctx->cfg, idx, is_head, &hdrs); // Serve the index.html file
     } // End of if block
     else // If index.html does not exist
     {    // Start of else block
       // Directory listing
-      send_dir_listing(ctx->client, path, fs_path); // generate and send a directory listing
+      send_dir_listing(ctx->client, path, fs_path, &hdrs); // generate and send a directory listing
     } // End of else block
     return; // Close the connection
   } // End of if block
 
   // Serve as file
-  send_file(ctx->client, fs_path, is_head); // If the path is a file, serve it
+  send_file(ctx->client, ctx->cfg, fs_path, is_head, &hdrs); // If the path is a file, serve it
 } // End of handle_client function body
 
 /* Thread entry point wrapper. Detaches/cleans up after serving the client */
 static void *client_thread(void *arg)      // Defines the entry point for a new client thread
 {                                          // Start of client_thread function body
   client_ctx_t *ctx = (client_ctx_t *)arg; // Cast the argument to a client context pointer
+  current_slot = worker_slot_claim();      // Claim a worker slot (log ring, counters) for this thread
+  if (current_slot)                        // If a slot was free
+    atomic_store_explicit(&current_slot->phase, WORKER_READING, memory_order_relaxed); // note we are waiting for the request
+  else                                     // If every slot is taken
+    atomic_fetch_add_explicit(&stats_unslotted, 1, memory_order_relaxed); // count the connection as live anyway
+  stats_add(ST_CONNECTIONS, 1);            // Count the connection
+  memset(&req_log, 0, sizeof(req_log));    // Start a fresh access log record
+  req_log.trace_last = mono_ns();          // The receive phase starts now
+  req_log.conn_id = ctx->id;               // Tag the record for the tracing probes
+  timer_arm(&ctx->timer, ctx->client);     // Start the header deadline
   handle_client(ctx);                      // Handle the client connection
+  if (req_log.active)                      // If a request was parsed
+  {                                        // Start of if block
+    trace_mark(PH_SEND);                   // Charge any unmarked tail to the send phase
+    req_log.end_ns = req_log.trace_last;   // note when the response finished
+    admission_release();                   // let the next request in
+    WS_PROBE4(response__end, ctx->id, req_log.status, req_log.bytes, (req_log.end_ns - req_log.start_ns) / 1000); // fire the response-end probe
+    stats_record_request();                // count it in the metrics
+    access_log_request(ctx);               // and log it
+    slow_log_request(ctx);                 // (in detail, if it was slow)
+  } // End of if block
+  timer_disarm();                          // Stop the deadline before the socket number can be reused
+  rate_release(ctx);                       // The address has one connection fewer
   CLOSESOCK(ctx->client);                  // Close the client socket
   free(ctx);                               // Free the client context structure
+  if (!current_slot)                       // If the connection was served without a slot
+    atomic_fetch_sub_explicit(&stats_unslotted, 1, memory_order_relaxed); // it is no longer live
+  atomic_fetch_sub_explicit(&admit_conns, 1, memory_order_relaxed); // One connection fewer is open
+  worker_slot_release(current_slot);       // Hand the worker slot back
+  current_slot = NULL;                     // The thread no longer owns it
   return NULL;                             // Return NULL as the thread result
 } // End of client_thread function body
 
-/* Parse a simple key=value config file. Updates cfg for keys 'root' and 'port' */
+/* Parse and compile a cache= rule value: "<pattern> <max-age> [immutable]"
+   pattern is a URL path prefix (starting with '/') or "*.ext". Returns 0 on success, -1 if malformed */
+static int parse_cache_rule(const char *val, cache_rule_t *r)                          // Defines a function to parse a caching policy rule
+{                                                                                      // Start of parse_cache_rule function body
+  char pattern[SMALL_BUF], flag[32];                                                   // Buffers for the pattern and the optional flag
+  long max_age = 0;                                                                    // The freshness lifetime
+  flag[0] = '\0';                                                                      // The flag is optional
+  int n = sscanf(val, "%255s %ld %31s", pattern, &max_age, flag);                      // Split the value into its fields
+  if (n < 2 || max_age < 0 || (n == 3 && strcasecmp(flag, "immutable") != 0))          // If fields are missing or unknown
+    return -1;                                                                         // the rule is malformed
+  memset(r, 0, sizeof(*r));                                                            // Start from an empty rule
+  if (pattern[0] == '*' && pattern[1] == '.' && pattern[2])                            // If the pattern is an extension
+  {                                                                                    // Start of if block
+    r->is_ext = 1;                                                                     // mark it as such
+    strcpy(r->pattern, pattern + 1);                                                   // and keep ".ext"
+  } // End of if block
+  else if (pattern[0] == '/') // If the pattern is a path prefix
+    strcpy(r->pattern, pattern); // keep it as is
+  else                          // Anything else
+    return -1;                  // is malformed
+  r->max_age = max_age; // Store the lifetime
+  if (max_age == 0)     // A zero lifetime means "always revalidate"
+    snprintf(r->header, sizeof(r->header), "Cache-Control: no-cache\r\n"); // so compile a no-cache header
+  else                  // Otherwise
+    snprintf(r->header, sizeof(r->header), "Cache-Control: public, max-age=%ld%s\r\n", // compile the max-age header
+             max_age, n == 3 ? ", immutable" : "");                                     // with the immutable flag if requested
+  return 0; // Return 0 to indicate success
+} // End of parse_cache_rule function body
+
+/* Interpret a boolean config value: "on", "yes", "true" or a non-zero number enable, anything else disables */
+static int parse_bool(const char *val)                                       // Defines a function to parse a boolean setting
+{                                                                            // Start of parse_bool function body
+  return strcasecmp(val, "on") == 0 || strcasecmp(val, "yes") == 0 ||        // Accept the usual spellings
+         strcasecmp(val, "true") == 0 || atoi(val) != 0;                     // and numbers
+} // End of parse_bool function body
+
+/* Parse a simple key=value config file. Updates cfg for keys 'root', 'port', 'etag', 'cache', 'gzip_*', 'access_log', 'log_format', 'stats_path', 'stats_shm', 'admin_port',
+   'server_timing', 'log_phases', 'slow_log', 'slow_ms', 'replay_trace', 'shadow', 'shadow_sample', 'max_connections',
+   'max_inflight', 'overload', 'retry_after', 'listen_backlog', 'adaptive_limit', 'header_timeout', 'send_timeout',
+   'rate_limit', 'rate_burst', 'max_conns_per_ip', 'pace_rate', 'pace_total' and 'pace_threshold' */
 static int parse_config_file(const char *path, server_config_t *cfg) // Defines a function to parse a configuration file
 {                                                                    // Start of parse_config_file function body
   FILE *f = fopen(path, "r");                                        // Open the configuration file for reading
@@ -773,6 +4533,102 @@ static int parse_config_file(const char *path, server_config_t *cfg) // Defines
     {                                      // Start of else if block
       cfg->port = atoi(val);               // convert the value to an integer and set the port configuration
     } // End of else if block
+    else if (strcasecmp(key, "etag") == 0)                              // If the key is "etag"
+    {                                                                   // Start of else if block
+      cfg->etag_mode = strcasecmp(val, "content") == 0 ? ETAG_CONTENT : ETAG_INODE; // select content-hash or inode-based ETags
+    } // End of else if block
+    else if (strcasecmp(key, "access_log") == 0)                     // If the key is "access_log"
+    {                                                                // Start of else if block
+      strncpy(cfg->access_log, val, sizeof(cfg->access_log) - 1);    // copy the log file path
+      cfg->access_log[sizeof(cfg->access_log) - 1] = 0;              // Ensure it's null-terminated
+    } // End of else if block
+    else if (strcasecmp(key, "stats_path") == 0)                     // If the key is "stats_path"
+    {                                                                // Start of else if block
+      strncpy(cfg->stats_path, val, sizeof(cfg->stats_path) - 1);    // copy the reserved path (empty disables the endpoint)
+      cfg->stats_path[sizeof(cfg->stats_path) - 1] = 0;              // Ensure it's null-terminated
+    } // End of else if block
+    else if (strcasecmp(key, "log_format") == 0)                        // If the key is "log_format"
+    {                                                                   // Start of else if block
+      if (strcasecmp(val, "json") == 0)                                 // JSON lines
+        cfg->log_format = LOG_FORMAT_JSON;                              // select JSON
+      else if (strcasecmp(val, "binary") == 0)                          // Binary records
+        cfg->log_format = LOG_FORMAT_BINARY;                            // select binary
+      else                                                              // Anything else
+        cfg->log_format = LOG_FORMAT_COMBINED;                          // selects the combined format
+    } // End of else if block
+    else if (strcasecmp(key, "stats_shm") == 0)                      // If the key is "stats_shm"
+    {                                                                // Start of else if block
+      strncpy(cfg->stats_shm, val, sizeof(cfg->stats_shm) - 1);      // copy the segment name
+      cfg->stats_shm[sizeof(cfg->stats_shm) - 1] = 0;                // Ensure it's null-terminated
+    } // End of else if block
+    else if (strcasecmp(key, "slow_log") == 0)                       // If the key is "slow_log"
+    {                                                                // Start of else if block
+      strncpy(cfg->slow_log, val, sizeof(cfg->slow_log) - 1);        // copy the slow log file path
+      cfg->slow_log[sizeof(cfg->slow_log) - 1] = 0;                  // Ensure it's null-terminated
+    } // End of else if block
+    else if (strcasecmp(key, "replay_trace") == 0)                   // If the key is "replay_trace"
+    {                                                                // Start of else if block
+      strncpy(cfg->replay_trace, val, sizeof(cfg->replay_trace) - 1); // copy the replay trace file path
+      cfg->replay_trace[sizeof(cfg->replay_trace) - 1] = 0;          // Ensure it's null-terminated
+    } // End of else if block
+    else if (strcasecmp(key, "shadow") == 0)                         // If the key is "shadow"
+    {                                                                // Start of else if block
+      strncpy(cfg->shadow, val, sizeof(cfg->shadow) - 1);            // copy the shadow target
+      cfg->shadow[sizeof(cfg->shadow) - 1] = 0;                      // Ensure it's null-terminated
+    } // End of else if block
+    else if (strcasecmp(key, "shadow_sample") == 0)  // If the key is "shadow_sample"
+      cfg->shadow_sample = atof(val);                 // set the fraction of GETs mirrored
+    else if (strcasecmp(key, "max_connections") == 0) // If the key is "max_connections"
+      cfg->max_connections = atoi(val);               // set the open connection limit
+    else if (strcasecmp(key, "max_inflight") == 0)   // If the key is "max_inflight"
+      cfg->max_inflight = atoi(val);                  // set the in-flight request limit
+    else if (strcasecmp(key, "overload") == 0)       // If the key is "overload"
+      cfg->overload_pause = strcasecmp(val, "pause") == 0; // pause accepting, or reject (anything else)
+    else if (strcasecmp(key, "retry_after") == 0)    // If the key is "retry_after"
+      cfg->retry_after = atoi(val);                   // set the Retry-After of overload responses
+    else if (strcasecmp(key, "listen_backlog") == 0) // If the key is "listen_backlog"
+      cfg->listen_backlog = atoi(val);                // set the accept queue length
+    else if (strcasecmp(key, "adaptive_limit") == 0) // If the key is "adaptive_limit"
+      cfg->adaptive_limit = parse_bool(val);          // enable or disable the adaptive in-flight limit
+    else if (strcasecmp(key, "header_timeout") == 0) // If the key is "header_timeout"
+      cfg->header_timeout = atoi(val);                // set the request head deadline
+    else if (strcasecmp(key, "send_timeout") == 0)   // If the key is "send_timeout"
+      cfg->send_timeout = atoi(val);                  // set the send progress deadline
+    else if (strcasecmp(key, "rate_limit") == 0)     // If the key is "rate_limit"
+      cfg->rate_limit = atoi(val);                    // set the per-address request rate
+    else if (strcasecmp(key, "rate_burst") == 0)     // If the key is "rate_burst"
+      cfg->rate_burst = atoi(val);                    // set the per-address burst
+    else if (strcasecmp(key, "max_conns_per_ip") == 0) // If the key is "max_conns_per_ip"
+      cfg->max_conns_per_ip = atoi(val);              // set the per-address connection limit
+    else if (strcasecmp(key, "pace_rate") == 0)      // If the key is "pace_rate"
+      cfg->pace_rate = atoi(val);                     // set the per-transfer pacing cap
+    else if (strcasecmp(key, "pace_total") == 0)     // If the key is "pace_total"
+      cfg->pace_total = atoi(val);                    // set the global pacing cap
+    else if (strcasecmp(key, "pace_threshold") == 0) // If the key is "pace_threshold"
+      cfg->pace_threshold = atoi(val);                // set the size above which bodies are paced
+    else if (strcasecmp(key, "slow_ms") == 0)        // If the key is "slow_ms"
+      cfg->slow_ms = atoi(val);                       // set the slow request threshold
+    else if (strcasecmp(key, "server_timing") == 0)  // If the key is "server_timing"
+      cfg->server_timing = parse_bool(val);           // enable or disable the Server-Timing header
+    else if (strcasecmp(key, "log_phases") == 0)     // If the key is "log_phases"
+      cfg->log_phases = parse_bool(val);              // enable or disable the phase fields in the access log
+    else if (strcasecmp(key, "admin_port") == 0) // If the key is "admin_port"
+      cfg->admin_port = atoi(val);                // set the Prometheus admin port
+    else if (strcasecmp(key, "gzip_cache") == 0) // If the key is "gzip_cache"
+      cfg->gzip_cache_mb = atoi(val);             // set the compression cache budget (MiB)
+    else if (strcasecmp(key, "gzip_workers") == 0) // If the key is "gzip_workers"
+      cfg->gzip_workers = atoi(val);              // set the number of compressor threads
+    else if (strcasecmp(key, "gzip_min_hits") == 0) // If the key is "gzip_min_hits"
+      cfg->gzip_min_hits = atoi(val);             // set the popularity threshold
+    else if (strcasecmp(key, "cache") == 0)                                             // If the key is "cache"
+    {                                                                                   // Start of else if block
+      if (cfg->n_cache_rules >= MAX_CACHE_RULES)                                        // If the rule table is full
+        fprintf(stderr, "Too many cache rules, ignoring: %s\n", val);                   // report and skip the rule
+      else if (parse_cache_rule(val, &cfg->cache_rules[cfg->n_cache_rules]) != 0)       // If the rule is malformed
+        fprintf(stderr, "Invalid cache rule, ignoring: %s\n", val);                     // report and skip it
+      else                                                                              // Otherwise
+        cfg->n_cache_rules++;                                                           // keep the compiled rule
+    } // End of else if block
   } // End of while loop body
   fclose(f); // Close the configuration file
   return 0;  // Return 0 to indicate success
@@ -811,10 +4667,10 @@ static int parse_args(int argc, char **argv, server_config_t *cfg, char *cfgfile
   return 0; // Return 0 to indicate success
 } // End of parse_args function body
 
-/* Create, bind, and listen on a TCP socket for the specified port on all interfaces
-   Returns the listening socket or INVALID_SOCKET on error */
-static sock_t create_listen_socket(int port) // Defines a function to create and prepare a listening socket
-{                                            // Start of create_listen_socket function body
+/* Create, bind, and listen on a TCP socket for the specified port on all interfaces, with an accept queue of
+   'backlog' connections (the kernel caps it at net.core.somaxconn). Returns the listening socket or INVALID_SOCKET on error */
+static sock_t create_listen_socket(int port, int backlog) // Defines a function to create and prepare a listening socket
+{                                                         // Start of create_listen_socket function body
   sock_t s = INVALID_SOCKET;                 // Initialize the socket descriptor to an invalid value
 
   // Prepare hints for getaddrinfo to support both IPv4 and IPv6
@@ -849,7 +4705,7 @@ static sock_t create_listen_socket(int port) // Defines a function to create and
 
     if (bind(s, rp->ai_addr, (int)rp->ai_addrlen) == 0) // Bind the socket to the address
     {                                                   // Start of if block
-      if (listen(s, 128) == 0)                          // Start listening for connections
+      if (listen(s, backlog) == 0)                      // Start listening for connections
       {                                                 // Start of if block
         break;                                          // If successful, exit the loop
       } // End of if block
@@ -892,6 +4748,16 @@ int main(int argc, char **argv)              // The main entry point of the prog
   memset(&cfg, 0, sizeof(cfg)); // Zero out the configuration structure
   // Defaults
   cfg.port = 8080;                     // Set the default port
+  cfg.gzip_workers = 2;                // Default number of compressor threads
+  cfg.gzip_min_hits = 2;               // Default popularity threshold for compression
+  cfg.slow_ms = 1000;                  // Default slow request threshold
+  cfg.pace_threshold = 1024;           // Default size above which bodies are paced (KiB)
+  cfg.shadow_sample = 1;               // Mirror every GET once a shadow target is set
+  cfg.retry_after = 1;                 // Default Retry-After of overload responses
+  cfg.listen_backlog = 128;            // Default accept queue length
+  cfg.header_timeout = 20;             // Default request head deadline (seconds)
+  cfg.send_timeout = 60;               // Default send progress deadline (seconds)
+  strcpy(cfg.stats_path, "/__stats");  // Default metrics endpoint path
 #ifdef _WIN32                          // If compiling on Windows
   _getcwd(cfg.root, sizeof(cfg.root)); // get the current working directory
 #else                                  // If not compiling on Windows
@@ -936,7 +4802,132 @@ int main(int argc, char **argv)              // The main entry point of the prog
   printf("Serving root: %s\n", cfg.root_real); // Print the serving root
   printf("Listening on port: %d\n", cfg.port); // Print the listening port
 
-  sock_t ls = create_listen_socket(cfg.port);                                    // Create the listening socket
+  if (cfg.access_log[0] && strcmp(cfg.access_log, "-") != 0)                   // If the access log goes to a file
+  {                                                                              // Start of if block
+    access_log_fd = open(cfg.access_log, O_WRONLY | O_CREAT | O_APPEND, 0644);   // open it for appending
+    if (access_log_fd < 0)                                                       // If it cannot be opened
+    {                                                                            // Start of if block
+      fprintf(stderr, "Cannot open access log %s: %s\n", cfg.access_log, strerror(errno)); // print an error
+      return 1;                                                                  // Exit with an error code
+    } // End of if block
+  } // End of if block
+  stats_started = time(NULL);                                        // Uptime is reported from here
+  trace_header = cfg.server_timing;                                  // Publish the tracing options
+  trace_log = cfg.log_phases;                                        // for the request threads
+  if (cfg.slow_log[0])                                                         // If the slow request log is enabled
+  {                                                                            // Start of if block
+    slow_log_fd = open(cfg.slow_log, O_WRONLY | O_CREAT | O_APPEND, 0644);     // open it for appending
+    if (slow_log_fd < 0)                                                       // If it cannot be opened
+    {                                                                          // Start of if block
+      fprintf(stderr, "Cannot open slow log %s: %s\n", cfg.slow_log, strerror(errno)); // print an error
+      return 1;                                                                // Exit with an error code
+    } // End of if block
+    slow_log_ns = (long long)(cfg.slow_ms > 0 ? cfg.slow_ms : 0) * 1000000LL;  // Threshold in nanoseconds
+  } // End of if block
+  if (cfg.replay_trace[0])                                                     // If requests are being recorded
+  {                                                                            // Start of if block
+    replay_fd = open(cfg.replay_trace, O_WRONLY | O_CREAT | O_APPEND, 0644);   // open the trace for appending
+    replay_file_header_t fh = {REPLAY_MAGIC, REPLAY_VERSION, sizeof(replay_record_t)}; // File header
+    if (replay_fd < 0 ||                                                       // If it cannot be opened
+        (lseek(replay_fd, 0, SEEK_END) == 0 && write_all(replay_fd, (const char *)&fh, sizeof(fh)) != 0)) // or a new file cannot be started
+    {                                                                          // Start of if block
+      fprintf(stderr, "Cannot open replay trace %s: %s\n", cfg.replay_trace, strerror(errno)); // print an error
+      return 1;                                                                // Exit with an error code
+    } // End of if block
+  } // End of if block
+  if (cfg.shadow[0] && cfg.shadow_sample > 0)                                 // If traffic is mirrored
+  {                                                                            // Start of if block
+    pthread_t shtid;                                                           // declare the sender thread ID
+    if (shadow_resolve(cfg.shadow) != 0 || pthread_create(&shtid, NULL, shadow_thread, NULL) != 0) // Resolve the target and start the sender
+    {                                                                          // Start of if block
+      fprintf(stderr, "Cannot mirror traffic to %s\n", cfg.shadow);           // print an error
+      return 1;                                                                // Exit with an error code
+    } // End of if block
+    pthread_detach(shtid); // Detach the thread; it runs for the life of the process
+    shadow_sample = cfg.shadow_sample < 1 ? cfg.shadow_sample : 1;             // Start sampling (at most every GET)
+    printf("Mirroring %g%% of GET requests to %s\n", shadow_sample * 100, cfg.shadow); // Say so
+  } // End of if block
+  fflush(stdout);                                                    // Flush the startup messages before the log writer shares stdout
+  pthread_t ltid;                                                    // Declare the log writer thread ID
+  if (pthread_create(&ltid, NULL, access_log_thread, NULL) != 0)     // Start the background access log writer
+  {                                                                  // Start of if block
+    fprintf(stderr, "Failed to start access log thread\n");          // If it cannot start, print an error
+    return 1;                                                        // Exit with an error code
+  } // End of if block
+  pthread_detach(ltid); // Detach the thread; it runs for the life of the process
+
+  file_cache_init();                                                  // Prepare the shared file info cache
+  if (cfg.etag_mode == ETAG_CONTENT)                                  // If content-hash ETags are enabled
+  {                                                                   // Start of if block
+    pthread_t htid;                                                   // declare the hashing thread ID
+    if (pthread_create(&htid, NULL, hash_service_thread, NULL) != 0)  // start the background hashing thread
+    {                                                                 // Start of if block
+      fprintf(stderr, "Failed to start hashing thread\n");            // If it cannot start, print an error
+      return 1;                                                       // Exit with an error code
+    } // End of if block
+    pthread_detach(htid); // Detach the thread; it runs for the life of the process
+  } // End of if block
+  if (cfg.gzip_cache_mb > 0)                                            // If the background gzip cache is enabled
+  {                                                                     // Start of if block
+    gzip_init();                                                        // build the CRC table
+    gz_cache.budget = (size_t)cfg.gzip_cache_mb << 20;                  // set the memory budget
+    gz_cache.min_hits = cfg.gzip_min_hits > 0 ? (unsigned)cfg.gzip_min_hits : 1; // and the popularity threshold
+    for (int i = 0; i < (cfg.gzip_workers > 0 ? cfg.gzip_workers : 1); i++) // Start the compressor pool
+    {                                                                   // Start of for loop body
+      pthread_t gtid;                                                   // declare the thread ID
+      if (pthread_create(&gtid, NULL, gz_worker_thread, NULL) != 0)     // start a compressor thread
+      {                                                                 // Start of if block
+        fprintf(stderr, "Failed to start compressor thread\n");         // If it cannot start, print an error
+        return 1;                                                       // Exit with an error code
+      } // End of if block
+      pthread_detach(gtid); // Detach the thread; it runs for the life of the process
+    } // End of for loop body
+  } // End of if block
+
+  if (cfg.stats_shm[0])                                                          // If the stats segment is enabled
+  {                                                                              // Start of if block
+    pthread_t stid;                                                              // declare the publisher thread ID
+    if (shm_stats_open(cfg.stats_shm) != 0 ||                                    // If the segment cannot be created
+        pthread_create(&stid, NULL, shm_stats_thread, NULL) != 0)                // or the publisher cannot start
+    {                                                                            // Start of if block
+      fprintf(stderr, "Failed to publish stats segment %s: %s\n", cfg.stats_shm, strerror(errno)); // print an error
+      return 1;                                                                  // Exit with an error code
+    } // End of if block
+    pthread_detach(stid); // Detach the thread; it runs for the life of the process
+  } // End of if block
+
+  if (cfg.admin_port > 0 && cfg.admin_port <= 65535)                             // If the admin listener is enabled
+  {                                                                              // Start of if block
+    sock_t als = create_listen_socket(cfg.admin_port, 128);                           // create its socket
+    pthread_t atid;                                                              // declare the admin thread ID
+    if (als == INVALID_SOCKET ||                                                 // If the port cannot be bound
+        pthread_create(&atid, NULL, admin_thread, (void *)(intptr_t)als) != 0)   // or the thread cannot start
+    {                                                                            // Start of if block
+      fprintf(stderr, "Failed to start admin listener on port %d\n", cfg.admin_port); // print an error
+      return 1;                                                                  // Exit with an error code
+    } // End of if block
+    pthread_detach(atid); // Detach the thread; it runs for the life of the process
+  } // End of if block
+
+  admission_init(&cfg);                                                          // Prepare the overload response and limits
+  rate_init(&cfg);                                                               // and the per-address limits
+  pace_init(&cfg);                                                               // and the bandwidth caps
+  if (timer_wheel_start(&cfg) != 0)                                              // Start enforcing the connection timeouts
+  {                                                                              // Start of if block
+    fprintf(stderr, "Failed to start timer wheel thread\n");                     // If it cannot start, print an error
+    return 1;                                                                    // Exit with an error code
+  } // End of if block
+  if (cfg.adaptive_limit)                                                        // If the limit adapts to latency
+  {                                                                              // Start of if block
+    pthread_t adtid;                                                             // declare the limiter thread ID
+    if (pthread_create(&adtid, NULL, adaptive_thread, NULL) != 0)                // start the limiter
+    {                                                                            // Start of if block
+      fprintf(stderr, "Failed to start adaptive limiter thread\n");             // If it cannot start, print an error
+      return 1;                                                                  // Exit with an error code
+    } // End of if block
+    pthread_detach(adtid); // Detach the thread; it runs for the life of the process
+  } // End of if block
+  sock_t ls = create_listen_socket(cfg.port, cfg.listen_backlog > 0 ? cfg.listen_backlog : 128); // Create the listening socket
   if (ls == INVALID_SOCKET)                                                      // If creation fails
   {                                                                              // Start of if block
     fprintf(stderr, "Failed to create listening socket on port %d\n", cfg.port); // print an error
@@ -946,8 +4937,16 @@ int main(int argc, char **argv)              // The main entry point of the prog
     return 1;                                                                    // Exit with an error code
   } // End of if block
 
+  listen_sock = ls;                                                      // Publish it for the accept queue metric
+  unsigned long long conn_seq = 0;                                       // Connection counter (numbers connections for the probes)
   for (;;)                                                               // Loop indefinitely to accept client connections
   {                                                                      // Start of for loop body
+    while (admit_pause && admit_max_conns &&                             // When pausing at the connection limit,
+           atomic_load_explicit(&admit_conns, memory_order_relaxed) >= admit_max_conns) // wait for a connection to close
+    {                                                                    // Start of while loop body
+      struct timespec ts = {0, 1000000L};                                // (polling every millisecond keeps the
+      nanosleep(&ts, NULL);                                              // close path free of any signalling)
+    } // End of while loop body
     client_ctx_t *ctx = (client_ctx_t *)calloc(1, sizeof(client_ctx_t)); // Allocate memory for a new client context
     if (!ctx)                                                            // If allocation fails
     {                                                                    // Start of if block
@@ -962,7 +4961,22 @@ int main(int argc, char **argv)              // The main entry point of the prog
       free(ctx);                                                            // free the context
       continue;                                                             // Continue to the next iteration
     } // End of if block
+    if (admit_max_conns && atomic_load_explicit(&admit_conns, memory_order_relaxed) >= admit_max_conns) // Over the connection limit
+    {                                                                       // Start of if block
+      shed_connection(ctx->client);                                         // turn it away
+      free(ctx);                                                            // free the context
+      continue;                                                             // Continue to the next iteration
+    } // End of if block
+    if (rate_admit(ctx) != 0)                                               // Over its address's rate or connection limit
+    {                                                                       // Start of if block
+      reject_connection(ctx->client, rate_response, rate_response_len);     // answer with a 429
+      free(ctx);                                                            // free the context
+      continue;                                                             // Continue to the next iteration
+    } // End of if block
+    atomic_fetch_add_explicit(&admit_conns, 1, memory_order_relaxed);       // One more connection is open
     ctx->cfg = &cfg; // Set the configuration pointer in the context
+    ctx->id = ++conn_seq;                         // Number the connection
+    WS_PROBE2(accept, ctx->id, ctx->client);      // Fire the accept probe
 
     // Spawn thread to handle client
 #ifdef _WIN32                                                            // If compiling on Windows
@@ -970,6 +4984,8 @@ int main(int argc, char **argv)              // The main entry point of the prog
     if (th == 0)                                                         // If thread creation fails
     {                                                                    // Start of if block
       fprintf(stderr, "Failed to create thread\n");                      // print an error
+      atomic_fetch_sub_explicit(&admit_conns, 1, memory_order_relaxed);   // The connection is not served
+      rate_release(ctx);                                                 // (nor counted against its address)
       CLOSESOCK(ctx->client);                                            // Close the client socket
       free(ctx);                                                         // Free the context
       continue;                                                          // Continue to the next iteration
@@ -980,7 +4996,9 @@ int main(int argc, char **argv)              // The main entry point of the prog
     if (pthread_create(&tid, NULL, client_thread, ctx) != 0) // create a new thread
     {                                                        // Start of if block
       fprintf(stderr, "Failed to create thread\n");          // If thread creation fails, print an error
-      CLOSESOCK(ctx->client);                                // Close the client socket
+      atomic_fetch_sub_explicit(&admit_conns, 1, memory_order_relaxed); // The connection is not served
+      rate_release(ctx);                                     // (nor counted against its address)
+      shed_connection(ctx->client);                          // Shed it rather than just hanging up
       free(ctx);                                             // Free the context
       continue;                                              // Continue to the next iteration
     } // End of if block
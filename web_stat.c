@@ -0,0 +1,228 @@
+#define _DEFAULT_SOURCE // Expose non-standard functions like clock_gettime and nanosleep
+/*
+  web_stat: live statistics viewer for web_server (companion to web_server.c)
+
+  Reads the shared-memory stats segment that web_server publishes when started with stats_shm=<name>.
+  The segment is mapped read-only and never written, so watching the server costs it nothing and works even
+  when it is too busy to answer HTTP (in the spirit of varnishstat).
+
+  Build:  cc -std=c11 -Wall -Wextra -O2 -o web_stat web_stat.c   (add -lrt on glibc older than 2.17)
+
+  Usage:
+    web_stat [-n <name>] [-i <ms>] [-w <rows>] [-1]
+      -n   Segment name (default /web_server; must match stats_shm= in the server config)
+      -i   Refresh interval in milliseconds (default 1000)
+      -w   Number of busiest workers to list (default 20)
+      -1   Print one snapshot and exit (no screen clearing)
+*/
+
+#include <sys/mman.h>  // Provides mmap for mapping the segment
+#include <sys/stat.h>  // Provides fstat for sizing the segment
+#include <fcntl.h>     // Provides open flags
+#include <unistd.h>    // Provides close
+#include <stdint.h>    // Provides fixed-width integer types
+#include <stdatomic.h> // Provides atomics for the seqlock counters
+#include <stdio.h>     // Provides printf
+#include <stdlib.h>    // Provides atoi, malloc and qsort
+#include <string.h>    // Provides strcmp and memcpy
+#include <time.h>      // Provides nanosleep and time
+
+/* Segment layout: must match shm_worker_t / shm_stats_header_t in web_server.c */
+#define SHM_STATS_MAGIC 0x54535357u // "WSST" in little-endian byte order
+#define SHM_STATS_VERSION 1         // Layout version this viewer understands
+
+#define WORKER_IDLE 0    // Worker phase: no connection
+#define WORKER_READING 1 // Worker phase: waiting for the request head
+#define WORKER_SENDING 2 // Worker phase: producing the response
+
+typedef struct          // Defines the per-worker record of the stats segment
+{                       // Start of shm_worker_t structure definition
+  _Atomic uint32_t seq; // Seqlock sequence (odd while the server is writing the record)
+  uint32_t phase;       // WORKER_IDLE, WORKER_READING or WORKER_SENDING
+  uint64_t requests;    // Requests served
+  uint64_t connections; // Connections handled
+  uint64_t bytes;       // Bytes sent
+} shm_worker_t;         // End of shm_worker_t structure definition
+
+typedef struct                       // Defines the header of the stats segment
+{                                    // Start of shm_stats_header_t structure definition
+  uint32_t magic;                    // SHM_STATS_MAGIC once the server has initialized the segment
+  uint32_t version;                  // SHM_STATS_VERSION
+  uint32_t header_size;              // Offset of the worker records
+  uint32_t worker_size;              // Size of each worker record
+  uint32_t n_workers;                // Number of worker records
+  uint32_t interval_ms;              // Server publishing interval
+  int64_t pid;                       // Server process ID
+  int64_t started;                   // Server start time (Unix seconds)
+  _Alignas(64) _Atomic uint32_t seq; // Seqlock sequence of the fields below
+  uint32_t reserved;                 // Padding
+  uint64_t updated_ns;               // Wall-clock time of the last update (Unix nanoseconds)
+  uint64_t conns_active;             // Connections currently being served
+  uint64_t conns_total;              // Connections accepted
+  uint64_t queue_depth;              // Connections still waiting for their request head
+  uint64_t requests;                 // Requests served
+  uint64_t bytes;                    // Bytes sent
+  uint64_t requests_per_sec;         // Request rate over the server's last interval
+  uint64_t bytes_per_sec;            // Send rate over the server's last interval
+  uint64_t gz_hits, gz_misses;       // gzip cache outcomes
+  uint64_t log_dropped;              // Access log records dropped
+} shm_stats_header_t;                // End of shm_stats_header_t structure definition
+
+/* Global fields of the header, copied out under the seqlock */
+typedef struct           // Defines a consistent copy of the global counters
+{                        // Start of globals_t structure definition
+  uint64_t updated_ns, conns_active, conns_total, queue_depth, requests, bytes;
+  uint64_t requests_per_sec, bytes_per_sec, gz_hits, gz_misses, log_dropped;
+} globals_t;             // End of globals_t structure definition
+
+/* Seqlock reader: copy len bytes from src while seq is stable and even. Never blocks the writer */
+static void seq_read(_Atomic uint32_t *seq, void *dst, const void *src, size_t len) // Defines a function to read a seqlock-guarded record
+{                                                                                   // Start of seq_read function body
+  for (;;)                                                                          // Retry until a clean copy is made
+  {                                                                                 // Start of for loop body
+    uint32_t s1 = atomic_load_explicit(seq, memory_order_acquire);                  // Sequence before the copy
+    if (s1 & 1)                                                                     // If a write is in progress
+      continue;                                                                     // try again
+    memcpy(dst, src, len);                                                          // Copy the record
+    atomic_thread_fence(memory_order_acquire);                                      // Finish the copy before rechecking
+    if (atomic_load_explicit(seq, memory_order_relaxed) == s1)                      // If nothing changed meanwhile
+      return;                                                                       // the copy is consistent
+  } // End of for loop body
+} // End of seq_read function body
+
+/* Format a byte count or rate with a binary unit suffix */
+static const char *human(double v, char *out, size_t out_sz)    // Defines a function to format a size
+{                                                               // Start of human function body
+  static const char *const units[] = {"B", "KiB", "MiB", "GiB", "TiB"}; // Unit suffixes
+  int u = 0;                                                    // Start with bytes
+  while (v >= 1024 && u < 4)                                    // Scale down while large
+  {                                                             // Start of while loop body
+    v /= 1024;                                                  // by one unit
+    u++;                                                        // and move to the next suffix
+  } // End of while loop body
+  snprintf(out, out_sz, u ? "%.1f %s" : "%.0f %s", v, units[u]); // Format the value
+  return out;                                                   // Return the output for convenience
+} // End of human function body
+
+/* One worker row of the display */
+typedef struct       // Defines a structure for a worker row
+{                    // Start of worker_row_t structure definition
+  int slot;          // Slot number
+  shm_worker_t w;    // Consistent copy of the record
+  uint64_t delta;    // Requests since the previous refresh
+} worker_row_t;      // End of worker_row_t structure definition
+
+/* qsort comparator: busiest workers first, then active before idle */
+static int row_cmp(const void *a, const void *b)                      // Defines a function to order worker rows
+{                                                                     // Start of row_cmp function body
+  const worker_row_t *x = (const worker_row_t *)a, *y = (const worker_row_t *)b; // Cast the rows
+  if (x->delta != y->delta)                                           // More recent requests
+    return x->delta < y->delta ? 1 : -1;                              // sort first
+  if (x->w.phase != y->w.phase)                                       // Then busy workers
+    return x->w.phase < y->w.phase ? 1 : -1;                          // before idle ones
+  return x->slot - y->slot;                                           // Then by slot number
+} // End of row_cmp function body
+
+int main(int argc, char **argv)                                                   // The main entry point of the program
+{                                                                                 // Start of main function body
+  const char *name = "/web_server";                                               // Default segment name
+  int interval_ms = 1000, rows = 20, once = 0;                                    // Default options
+  for (int i = 1; i < argc; i++)                                                  // Parse the command line
+  {                                                                               // Start of for loop body
+    if (!strcmp(argv[i], "-n") && i + 1 < argc)                                   // Segment name
+      name = argv[++i];                                                           // set it
+    else if (!strcmp(argv[i], "-i") && i + 1 < argc)                              // Refresh interval
+      interval_ms = atoi(argv[++i]);                                              // set it
+    else if (!strcmp(argv[i], "-w") && i + 1 < argc)                              // Worker rows
+      rows = atoi(argv[++i]);                                                     // set it
+    else if (!strcmp(argv[i], "-1"))                                              // One-shot mode
+      once = 1;                                                                   // set it
+    else                                                                          // Anything else
+    {                                                                             // Start of else block
+      fprintf(stderr, "Usage: %s [-n <name>] [-i <ms>] [-w <rows>] [-1]\n", argv[0]); // print usage
+      return 1;                                                                   // Exit with an error code
+    } // End of else block
+  } // End of for loop body
+  if (interval_ms <= 0)                                                           // Keep the interval sane
+    interval_ms = 1000;                                                           // by falling back to the default
+
+  int fd = shm_open(name, O_RDONLY, 0);                                           // Open the segment read-only
+  struct stat st;                                                                 // Declare a stat structure for its size
+  if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(shm_stats_header_t)) // If it is missing or too small
+  {                                                                               // Start of if block
+    fprintf(stderr, "Cannot open stats segment %s (is the server running with stats_shm=%s?)\n", name, name);
+    return 1;                                                                     // Exit with an error code
+  } // End of if block
+  void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);         // Map it read-only
+  close(fd);                                                                      // The mapping stays valid
+  if (p == MAP_FAILED)                                                            // If mapping fails
+  {                                                                               // Start of if block
+    perror("mmap");                                                               // print an error
+    return 1;                                                                     // Exit with an error code
+  } // End of if block
+  shm_stats_header_t *h = (shm_stats_header_t *)p;                                // The header
+  if (h->magic != SHM_STATS_MAGIC || h->version != SHM_STATS_VERSION ||           // Check the segment identifies itself
+      h->worker_size != sizeof(shm_worker_t) ||                                   // and has the layout we expect
+      (size_t)h->header_size + (size_t)h->n_workers * h->worker_size > (size_t)st.st_size)
+  {                                                                               // Start of if block
+    fprintf(stderr, "Stats segment %s has an unknown layout (version %u)\n", name, h->version);
+    return 1;                                                                     // Exit with an error code
+  } // End of if block
+  shm_worker_t *wk = (shm_worker_t *)((char *)p + h->header_size);                // The worker records
+  uint32_t n = h->n_workers;                                                      // How many there are
+  worker_row_t *cur = (worker_row_t *)calloc(n, sizeof(worker_row_t));            // Current rows
+  uint64_t *prev = (uint64_t *)calloc(n, sizeof(uint64_t));                       // Request totals at the previous refresh
+  if (!cur || !prev)                                                              // If allocation fails
+    return 1;                                                                     // Exit with an error code
+
+  for (int first = 1;; first = 0)                                                 // Refresh until interrupted
+  {                                                                               // Start of for loop body
+    globals_t g;                                                                  // Consistent copy of the globals
+    seq_read(&h->seq, &g, &h->updated_ns, sizeof(g));                             // Read them under the seqlock
+    int busy = 0;                                                                 // Workers with a connection
+    for (uint32_t i = 0; i < n; i++)                                              // Read every worker record
+    {                                                                             // Start of for loop body
+      cur[i].slot = (int)i;                                                       // Slot number
+      seq_read(&wk[i].seq, &cur[i].w, &wk[i], sizeof(shm_worker_t));              // Consistent copy
+      cur[i].delta = first ? 0 : cur[i].w.requests - prev[i];                     // Requests since the last refresh
+      prev[i] = cur[i].w.requests;                                                // Remember the total
+      busy += cur[i].w.phase != WORKER_IDLE;                                      // Count busy workers
+    } // End of for loop body
+    qsort(cur, n, sizeof(worker_row_t), row_cmp);                                 // Busiest first
+
+    char b1[32], b2[32];                                                          // Buffers for formatted sizes
+    time_t now = time(NULL);                                                      // Current time
+    double age = (double)now - (double)(g.updated_ns / 1000000000ULL);            // Seconds since the last server update
+    if (!once)                                                                    // In live mode
+      printf("\033[H\033[2J");                                                    // clear the screen
+    printf("web_server pid %lld  uptime %llds  updated %.0fs ago%s\n",
+           (long long)h->pid, (long long)(now - h->started), age,
+           age > 5 ? "  (STALE: server not publishing)" : "");
+    printf("connections  active %-8llu queued %-8llu total %llu\n",
+           (unsigned long long)g.conns_active, (unsigned long long)g.queue_depth, (unsigned long long)g.conns_total);
+    printf("requests     %-8llu /s      total %llu\n",
+           (unsigned long long)g.requests_per_sec, (unsigned long long)g.requests);
+    printf("bytes        %-10s/s    total %s\n",
+           human((double)g.bytes_per_sec, b1, sizeof(b1)), human((double)g.bytes, b2, sizeof(b2)));
+    printf("gzip cache   hits %-8llu misses %llu\n", (unsigned long long)g.gz_hits, (unsigned long long)g.gz_misses);
+    printf("access log   dropped %llu\n\n", (unsigned long long)g.log_dropped);
+    printf("%-6s %-8s %10s %12s %12s %12s\n", "SLOT", "PHASE", "REQ/INT", "REQUESTS", "CONNS", "BYTES");
+    for (int i = 0; i < rows && i < (int)n; i++)                                  // List the busiest workers
+    {                                                                             // Start of for loop body
+      const worker_row_t *r = &cur[i];                                            // Get the row
+      if (!r->delta && r->w.phase == WORKER_IDLE && !r->w.requests)               // Stop at never-used slots
+        break;                                                                    // (the rest are the same)
+      static const char *const phases[] = {"idle", "reading", "sending"};         // Phase names
+      printf("%-6d %-8s %10llu %12llu %12llu %12s\n", r->slot, phases[r->w.phase < 3 ? r->w.phase : 0],
+             (unsigned long long)r->delta, (unsigned long long)r->w.requests,
+             (unsigned long long)r->w.connections, human((double)r->w.bytes, b1, sizeof(b1)));
+    } // End of for loop body
+    printf("(%d busy of %u workers)\n", busy, n);                                 // Summary line
+    fflush(stdout);                                                               // Show the frame
+    if (once)                                                                     // In one-shot mode
+      break;                                                                      // stop here
+    struct timespec ts = {interval_ms / 1000, (interval_ms % 1000) * 1000000L};   // Wait for the next refresh
+    nanosleep(&ts, NULL);                                                         // before reading again
+  } // End of for loop body
+  return 0; // Exit successfully
+} // End of main function body